@@ -1,55 +1,175 @@
+#include "src/cache.h"
 #include "src/chunk.h"
-#include "src/compiler/compiler.h"
+#include "src/debug.h"
+#include "src/file.h"
+#include "src/jit.h"
+#include "src/module.h"
+#include "src/pool.h"
+#include "src/profiler.h"
+#include "src/trace.h"
 #include "src/vm.h"
 
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
-#include <sstream>
+#include <vector>
 
-std::string readFile(std::string path) {
-  const std::ifstream t("C:/projects/TripleS/definitions/test.sss");
-  std::stringstream buffer;
-  buffer << t.rdbuf();
-  return buffer.str();
+static int exitCode(const InterpretResult result) {
+  if (result == INTERPRET_COMPILE_ERROR) return 65;
+  if (result == INTERPRET_RUNTIME_ERROR) return 70;
+  return 0;
 }
 
-int main(const int argc, const char *argv[]) {
-
-  // if (argc != 2) {
-  //   std::cout << "Usage: clox [path]" << std::endl;
-  //   return 64;
-  // }
+// Reuses the precompiled bytecode next to the script unless it was built from a different source. Without
+// `useCache` the script is compiled and nothing is written.
+static std::shared_ptr<const Module> loadModule(const std::string &path, const MappedFile &file,
+                                                const bool useCache) {
+  const auto *source = reinterpret_cast<const char *>(file.data());
+  if (!useCache) return Module::compile(source, file.size());
 
-  const std::string source = readFile("");
-  Chunk chunk;
+  const std::string cachePath = Cache::pathFor(path);
+  const uint64_t sourceHash = Cache::hashSource(source, file.size());
+  std::shared_ptr<const Module> module = Module::load(cachePath, sourceHash);
+  if (module != nullptr) return module;
 
-  Compiler compiler(source, chunk);
-  compiler.compile();
+  module = Module::compile(source, file.size());
+  if (module != nullptr) Cache::save(cachePath, sourceHash, module->chunk());
+  return module;
+}
 
-  VM vm(chunk);
-  vm.interpret();
+static bool readCount(const char *text, const uint64_t max, uint64_t *count) {
+  char *end;
+  const unsigned long long value = std::strtoull(text, &end, 10);
+  if (end == text || *end != '\0' || value < 1 || value > max) return false;
+  *count = value;
+  return true;
+}
 
-  // chunk.write(OP_CONSTANT, 123);
-  // chunk.write(chunk.addConstant(1.2), 123);
-  //
-  // chunk.write(OP_CONSTANT, 123);
-  // chunk.write(chunk.addConstant(3.4), 123);
-  //
-  // chunk.write(OP_ADD, 123); // 1.2 + 3.4 = 4.6
-  //
-  // chunk.write(OP_CONSTANT, 123);
-  // chunk.write(chunk.addConstant(5.6), 123);
-  //
-  // chunk.write(OP_DIVIDE, 123); // 4.6 / 5.6 = 0.82142857142
-  //
-  // chunk.write(OP_NEGATE, 123); // -1
+int main(const int argc, const char *argv[]) {
+  // `--engine register` runs the script on the register engine instead of the stack VM. `--no-jit` keeps the
+  // stack VM from compiling hot scripts to machine code. `--print-code` disassembles the chunk before it runs
+  // and `--trace` prints every instruction as it runs, or every nth with `--trace-every n`; both write to
+  // stderr, so the script's own output stays apart. `--profile` prints where the script spent its time to
+  // stderr once it has run (see profiler.h), and `--profile-stacks path` writes the sampled call stacks there
+  // for a flamegraph. `--max-instructions` and `--max-heap` (bytes) stop a script that goes past them with a
+  // runtime error. `--perf-map` lists JIT-compiled code in /tmp/perf-<pid>.map so perf can name it.
+  // `--no-cache` compiles the script without reading or writing its `.sssc` file.
   //
-  // chunk.write(OP_RETURN, 123);
+  // Several scripts, or `--workers n`, run on a pool of worker threads (see pool.h), each script in an
+  // isolate of its own; their output is printed in the order given.
+  Engine engine = ENGINE_STACK;
+  IsolateOptions options;
+  bool printCode = false;
+  bool useCache = true;
+  uint64_t traceEvery = 0;
+  bool profile = false;
+  std::string stacksPath;
+  uint64_t workers = 0;
+  int arg = 1;
+  for (; arg < argc - 1; arg++) {
+    const std::string option = argv[arg];
+    if (option == "--engine") {
+      const std::string name = argv[++arg];
+      if (name == "register") {
+        engine = ENGINE_REGISTER;
+      } else if (name != "stack") {
+        std::cerr << "Unknown engine \"" << name << "\"." << std::endl;
+        return 64;
+      }
+    } else if (option == "--no-jit") {
+      options.jit = false;
+    } else if (option == "--no-cache") {
+      useCache = false;
+    } else if (option == "--perf-map") {
+#ifdef TRIPLES_JIT
+      if (!Jit::enablePerfMap()) std::cerr << "Could not open the perf map file." << std::endl;
+#endif
+    } else if (option == "--print-code") {
+      printCode = true;
+    } else if (option == "--trace") {
+      traceEvery = 1;
+    } else if (option == "--profile") {
+      profile = true;
+    } else if (option == "--profile-stacks") {
+      profile = true;
+      stacksPath = argv[++arg];
+    } else if (option == "--trace-every" || option == "--workers" || option == "--max-instructions" ||
+               option == "--max-heap") {
+      uint64_t count;
+      if (!readCount(argv[++arg], option == "--trace-every" ? UINT32_MAX : UINT64_MAX, &count)) {
+        std::cerr << "Invalid value \"" << argv[arg] << "\" for " << option << "." << std::endl;
+        return 64;
+      }
+      if (option == "--trace-every") traceEvery = count;
+      if (option == "--workers") workers = count;
+      if (option == "--max-instructions") options.maxInstructions = count;
+      if (option == "--max-heap") options.heap.maxHeapSize = static_cast<size_t>(count);
+    } else {
+      break;
+    }
+  }
+
+  const bool pooled = argc - arg > 1 || workers > 0;
+  if (arg >= argc || (pooled && (traceEvery > 0 || profile)) || (traceEvery > 0 && profile)) {
+    std::cout << "Usage: TripleS [--engine stack|register] [--no-jit] [--no-cache] [--perf-map]"
+                 " [--print-code] [--trace | --trace-every n | --profile] [--profile-stacks path]"
+                 " [--max-instructions n] [--max-heap bytes] path"
+              << std::endl
+              << "       TripleS [options except tracing and profiling] [--workers n] path..." << std::endl;
+    return 64;
+  }
+
+  std::vector<std::shared_ptr<const Module>> modules;
+  for (int i = arg; i < argc; i++) {
+    const std::string path = argv[i];
+    // The script is compiled straight from the mapped file, which is no longer needed afterwards.
+    const MappedFile source(path);
+    if (!source.isOpen()) {
+      std::cerr << "Could not open file \"" << path << "\"." << std::endl;
+      return 74;
+    }
+    modules.push_back(loadModule(path, source, useCache));
+    if (modules.back() == nullptr) return 65;
+    if (printCode) Debug(modules.back()->chunk(), std::cerr).disassembleChunk(path);
+  }
+
+  if (pooled) {
+    IsolatePool pool(static_cast<size_t>(workers), options);
+    std::vector<std::future<Evaluation>> evaluations;
+    for (const std::shared_ptr<const Module> &module : modules) {
+      evaluations.push_back(pool.submit(module, engine));
+    }
+
+    int status = 0;
+    for (std::future<Evaluation> &future : evaluations) {
+      const Evaluation evaluation = future.get();
+      std::cout << evaluation.output;
+      std::cerr << evaluation.errors;
+      if (status == 0) status = exitCode(evaluation.result);
+    }
+    return status;
+  }
 
-  // VM vm(&chunk);
-  // vm.interpret();
+  Heap heap(options.heap);
+  VM vm(modules[0], heap, options.stack);
+  vm.enableJit(options.jit);
+  vm.setInstructionLimit(options.maxInstructions);
+  StreamTrace trace(std::cerr);
+  if (traceEvery > 0) vm.setTrace(&trace, static_cast<uint32_t>(traceEvery));
+  Profiler profiler;
+  if (profile) vm.setTrace(&profiler);
+  const InterpretResult result = vm.interpret(engine);
 
-  // auto debug = Debug(&chunk);
-  // const std::string value = "test value";
-  // debug.disassembleChunk(&value);
+  if (profile) {
+    profiler.report(std::cerr);
+    if (!stacksPath.empty()) {
+      std::ofstream stacks(stacksPath);
+      profiler.writeCollapsed(stacks);
+      if (!stacks) {
+        std::cerr << "Could not write \"" << stacksPath << "\"." << std::endl;
+        return 74;
+      }
+    }
+  }
+  return exitCode(result);
 }
@@ -0,0 +1,241 @@
+#include "../vm.h"
+#include "builtins.h"
+#include "kernels.h"
+
+#include <cmath>
+#include <string>
+
+bool resolveIndex(const Value index, const uint32_t count, uint32_t *resolved) {
+  if (!isNumber(index)) return false;
+
+  double number = asNumber(index);
+  if (number != std::floor(number)) return false;
+  if (number < 0) number += count;
+  if (number < 0 || number >= count) return false;
+
+  *resolved = static_cast<uint32_t>(number);
+  return true;
+}
+
+bool expectArguments(VM &vm, const char *name, const int argCount, const int expected) {
+  if (argCount == expected) return true;
+
+  vm.runtimeError(std::string(name) + "() expects " + std::to_string(expected) + " argument(s) but got " +
+                  std::to_string(argCount) + ".");
+  return false;
+}
+
+static bool indexArgument(VM &vm, const ObjArray *array, const Value index, uint32_t *resolved) {
+  if (resolveIndex(index, array->count, resolved)) return true;
+
+  vm.runtimeError("Array index out of range.");
+  return false;
+}
+
+static bool push(VM &vm, Value *args, const int argCount) {
+  if (!expectArguments(vm, "push", argCount, 1)) return false;
+
+  Heap &heap = vm.getHeap();
+  ObjArray *array = asArray(args[0]);
+  const size_t before = Heap::storageOf(array);
+  array->append(args[1]);
+  heap.storageGrew(array, before);
+  heap.writeBarrier(array, args[1]);
+  args[0] = NULL_VAL;
+  return vm.makeRoomForStorage();
+}
+
+static bool pop(VM &vm, Value *args, const int argCount) {
+  if (!expectArguments(vm, "pop", argCount, 0)) return false;
+
+  ObjArray *array = asArray(args[0]);
+  if (array->count == 0) {
+    vm.runtimeError("Cannot pop from an empty array.");
+    return false;
+  }
+
+  args[0] = array->values[--array->count];
+  return true;
+}
+
+static bool length(VM &vm, Value *args, const int argCount) {
+  if (!expectArguments(vm, "length", argCount, 0)) return false;
+
+  args[0] = numberValue(asArray(args[0])->count);
+  return true;
+}
+
+static bool get(VM &vm, Value *args, const int argCount) {
+  if (!expectArguments(vm, "get", argCount, 1)) return false;
+
+  const ObjArray *array = asArray(args[0]);
+  uint32_t index;
+  if (!indexArgument(vm, array, args[1], &index)) return false;
+
+  args[0] = array->values[index];
+  return true;
+}
+
+static bool set(VM &vm, Value *args, const int argCount) {
+  if (!expectArguments(vm, "set", argCount, 2)) return false;
+
+  ObjArray *array = asArray(args[0]);
+  uint32_t index;
+  if (!indexArgument(vm, array, args[1], &index)) return false;
+
+  array->store(index, args[2]);
+  vm.getHeap().writeBarrier(array, args[2]);
+  args[0] = NULL_VAL;
+  return true;
+}
+
+static int64_t findValue(const ObjArray *array, const Value value) {
+  if (array->packed) {
+    if (!isNumber(value)) return -1;
+    return indexOfNumber(array->values, array->count, asNumber(value));
+  }
+
+  for (uint32_t i = 0; i < array->count; i++) {
+    if (valuesEqual(array->values[i], value)) return i;
+  }
+  return -1;
+}
+
+static bool indexOf(VM &vm, Value *args, const int argCount) {
+  if (!expectArguments(vm, "indexOf", argCount, 1)) return false;
+
+  args[0] = numberValue(static_cast<double>(findValue(asArray(args[0]), args[1])));
+  return true;
+}
+
+static bool contains(VM &vm, Value *args, const int argCount) {
+  if (!expectArguments(vm, "contains", argCount, 1)) return false;
+
+  args[0] = boolValue(findValue(asArray(args[0]), args[1]) != -1);
+  return true;
+}
+
+static bool clear(VM &vm, Value *args, const int argCount) {
+  if (!expectArguments(vm, "clear", argCount, 0)) return false;
+
+  ObjArray *array = asArray(args[0]);
+  array->count = 0;
+  array->packed = true;
+  args[0] = NULL_VAL;
+  return true;
+}
+
+static bool fill(VM &vm, Value *args, const int argCount) {
+  if (!expectArguments(vm, "fill", argCount, 1)) return false;
+
+  ObjArray *array = asArray(args[0]);
+  const Value value = args[1];
+  if (isNumber(value)) {
+    fillNumbers(array->values, array->count, asNumber(value));
+    array->packed = true;
+  } else {
+    for (uint32_t i = 0; i < array->count; i++) array->values[i] = value;
+    array->packed = array->count == 0;
+    vm.getHeap().writeBarrier(array, value);
+  }
+  args[0] = NULL_VAL;
+  return true;
+}
+
+// An unpacked array can still hold only numbers, e.g. after its last string was overwritten.
+static bool allNumbers(const ObjArray *array) {
+  if (array->packed) return true;
+
+  for (uint32_t i = 0; i < array->count; i++) {
+    if (!isNumber(array->values[i])) return false;
+  }
+  return true;
+}
+
+static bool sum(VM &vm, Value *args, const int argCount) {
+  if (!expectArguments(vm, "sum", argCount, 0)) return false;
+
+  const ObjArray *array = asArray(args[0]);
+  if (!allNumbers(array)) {
+    vm.runtimeError("sum() requires an array of numbers.");
+    return false;
+  }
+
+  args[0] = numberValue(sumNumbers(array->values, array->count));
+  return true;
+}
+
+static bool mapArithmetic(VM &vm, Value *args, const int argCount, const char *name, const KernelOp op) {
+  if (!expectArguments(vm, name, argCount, 1)) return false;
+
+  const ObjArray *source = asArray(args[0]);
+  if (!allNumbers(source)) {
+    vm.runtimeError(std::string(name) + "() requires an array of numbers.");
+    return false;
+  }
+
+  const Value operand = args[1];
+  if (isArray(operand)) {
+    if (!allNumbers(asArray(operand)) || asArray(operand)->count != source->count) {
+      vm.runtimeError(std::string(name) + "() expects a number or a numeric array of the same length.");
+      return false;
+    }
+  } else if (!isNumber(operand)) {
+    vm.runtimeError(std::string(name) + "() expects a number or a numeric array of the same length.");
+    return false;
+  }
+
+  ObjArray *result = vm.getHeap().allocateArray(source->count);
+  if (result == nullptr) {
+    vm.runtimeError("Out of memory.");
+    return false;
+  }
+
+  // The allocation may have moved the receiver and operand; reload them from the stack.
+  source = asArray(args[0]);
+  if (isArray(args[1])) {
+    applyPairwise(op, result->values, source->values, asArray(args[1])->values, source->count);
+  } else {
+    applyScalar(op, result->values, source->values, source->count, asNumber(args[1]));
+  }
+  result->count = source->count;
+  args[0] = objValue(result);
+  return true;
+}
+
+static bool mapAdd(VM &vm, Value *args, const int argCount) {
+  return mapArithmetic(vm, args, argCount, "mapAdd", KERNEL_ADD);
+}
+
+static bool mapSubtract(VM &vm, Value *args, const int argCount) {
+  return mapArithmetic(vm, args, argCount, "mapSubtract", KERNEL_SUBTRACT);
+}
+
+static bool mapMultiply(VM &vm, Value *args, const int argCount) {
+  return mapArithmetic(vm, args, argCount, "mapMultiply", KERNEL_MULTIPLY);
+}
+
+static bool mapDivide(VM &vm, Value *args, const int argCount) {
+  return mapArithmetic(vm, args, argCount, "mapDivide", KERNEL_DIVIDE);
+}
+
+const NativeMethodEntry arrayMethods[] = {
+    {"push", push},
+    {"add", push},
+    {"pop", pop},
+    {"length", length},
+    {"size", length},
+    {"get", get},
+    {"set", set},
+    {"indexOf", indexOf},
+    {"contains", contains},
+    {"clear", clear},
+    {"fill", fill},
+    {"sum", sum},
+    {"mapAdd", mapAdd},
+    {"mapSubtract", mapSubtract},
+    {"mapMultiply", mapMultiply},
+    {"mapDivide", mapDivide},
+};
+
+const size_t arrayMethodCount = sizeof(arrayMethods) / sizeof(arrayMethods[0]);
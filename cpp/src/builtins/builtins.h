@@ -0,0 +1,41 @@
+#ifndef BUILTINS_H
+#define BUILTINS_H
+#include "../object.h"
+#include "../value.h"
+
+#include <cstddef>
+#include <cstdint>
+
+class VM;
+
+// Native methods of the built-in types. args[0] is the receiver and args[1..argCount] are the arguments,
+// all still on the VM stack, so they stay rooted (and are updated) if the native allocates. A native stores
+// its result in args[0] and returns false after reporting a runtime error through the VM.
+typedef bool (*NativeMethod)(VM &vm, Value *args, int argCount);
+
+typedef struct {
+  const char *name;
+  NativeMethod method;
+} NativeMethodEntry;
+
+// Native functions bound to globals of the same name use the same signature, with the callee in args[0].
+extern const NativeMethodEntry globalFunctions[];
+extern const size_t globalFunctionCount;
+extern const NativeMethodEntry arrayMethods[];
+extern const size_t arrayMethodCount;
+extern const NativeMethodEntry stringMethods[];
+extern const size_t stringMethodCount;
+
+// Resolves a possibly negative index against `count`. Returns false if it is not an integer in range.
+bool resolveIndex(Value index, uint32_t count, uint32_t *resolved);
+
+bool expectArguments(VM &vm, const char *name, int argCount, int expected);
+
+// Replaces *left with the concatenation of the strings *left and *right. Both must be rooted slots, e.g. on
+// the VM stack, as the result may be allocated.
+bool concatenateStrings(VM &vm, Value *left, const Value *right);
+// Replaces the string in the rooted slot *string with `length` of its characters starting at `start`. The
+// range must be in bounds.
+bool sliceString(VM &vm, Value *string, uint32_t start, uint32_t length);
+
+#endif // BUILTINS_H
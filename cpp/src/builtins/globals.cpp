@@ -0,0 +1,27 @@
+#include "../vm.h"
+#include "builtins.h"
+
+#include <chrono>
+
+// Seconds on a monotonic clock, for measuring how long something took.
+static bool clock(VM &vm, Value *args, const int argCount) {
+  if (!expectArguments(vm, "clock", argCount, 0)) return false;
+
+  const auto elapsed = std::chrono::steady_clock::now().time_since_epoch();
+  args[0] = numberValue(std::chrono::duration<double>(elapsed).count());
+  return true;
+}
+
+// Returns a fiber that finishes with the next line of standard input, without its line break, or with null
+// once the input has ended. `await readLine()` waits for it without blocking other fibers.
+static bool readLine(VM &vm, Value *args, const int argCount) {
+  if (!expectArguments(vm, "readLine", argCount, 0)) return false;
+  return vm.startReadLine(&args[0]);
+}
+
+const NativeMethodEntry globalFunctions[] = {
+    {"clock", clock},
+    {"readLine", readLine},
+};
+
+const size_t globalFunctionCount = sizeof(globalFunctions) / sizeof(globalFunctions[0]);
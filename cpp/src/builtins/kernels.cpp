@@ -0,0 +1,158 @@
+#include "kernels.h"
+
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define KERNEL_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define KERNEL_SSE2
+#endif
+
+// Scalar element access goes through memcpy so reading the Value buffer as doubles stays well defined.
+static double load(const Value *values, const size_t index) {
+  double number;
+  std::memcpy(&number, &values[index], sizeof(double));
+  return number;
+}
+
+static void store(Value *values, const size_t index, const double number) {
+  std::memcpy(&values[index], &number, sizeof(double));
+}
+
+static double apply(const KernelOp op, const double a, const double b) {
+  switch (op) {
+    case KERNEL_ADD:
+      return a + b;
+    case KERNEL_SUBTRACT:
+      return a - b;
+    case KERNEL_MULTIPLY:
+      return a * b;
+    case KERNEL_DIVIDE:
+      return a / b;
+  }
+  return 0;
+}
+
+#if defined(KERNEL_AVX2)
+#define KERNEL_WIDTH 4
+typedef __m256d Vector;
+static Vector loadVector(const Value *values) { return _mm256_loadu_pd(reinterpret_cast<const double *>(values)); }
+static void storeVector(Value *values, const Vector vector) {
+  _mm256_storeu_pd(reinterpret_cast<double *>(values), vector);
+}
+static Vector splat(const double number) { return _mm256_set1_pd(number); }
+static Vector zero() { return _mm256_setzero_pd(); }
+static Vector add(const Vector a, const Vector b) { return _mm256_add_pd(a, b); }
+static Vector subtract(const Vector a, const Vector b) { return _mm256_sub_pd(a, b); }
+static Vector multiply(const Vector a, const Vector b) { return _mm256_mul_pd(a, b); }
+static Vector divide(const Vector a, const Vector b) { return _mm256_div_pd(a, b); }
+static int equalMask(const Vector a, const Vector b) { return _mm256_movemask_pd(_mm256_cmp_pd(a, b, _CMP_EQ_OQ)); }
+static double horizontalSum(const Vector vector) {
+  double lanes[KERNEL_WIDTH];
+  _mm256_storeu_pd(lanes, vector);
+  return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+#elif defined(KERNEL_SSE2)
+#define KERNEL_WIDTH 2
+typedef __m128d Vector;
+static Vector loadVector(const Value *values) { return _mm_loadu_pd(reinterpret_cast<const double *>(values)); }
+static void storeVector(Value *values, const Vector vector) {
+  _mm_storeu_pd(reinterpret_cast<double *>(values), vector);
+}
+static Vector splat(const double number) { return _mm_set1_pd(number); }
+static Vector zero() { return _mm_setzero_pd(); }
+static Vector add(const Vector a, const Vector b) { return _mm_add_pd(a, b); }
+static Vector subtract(const Vector a, const Vector b) { return _mm_sub_pd(a, b); }
+static Vector multiply(const Vector a, const Vector b) { return _mm_mul_pd(a, b); }
+static Vector divide(const Vector a, const Vector b) { return _mm_div_pd(a, b); }
+static int equalMask(const Vector a, const Vector b) { return _mm_movemask_pd(_mm_cmpeq_pd(a, b)); }
+static double horizontalSum(const Vector vector) {
+  double lanes[KERNEL_WIDTH];
+  _mm_storeu_pd(lanes, vector);
+  return lanes[0] + lanes[1];
+}
+#endif
+
+#ifdef KERNEL_WIDTH
+static Vector applyVector(const KernelOp op, const Vector a, const Vector b) {
+  switch (op) {
+    case KERNEL_ADD:
+      return add(a, b);
+    case KERNEL_SUBTRACT:
+      return subtract(a, b);
+    case KERNEL_MULTIPLY:
+      return multiply(a, b);
+    case KERNEL_DIVIDE:
+      return divide(a, b);
+  }
+  return a;
+}
+#endif
+
+double sumNumbers(const Value *values, const size_t count) {
+  size_t i = 0;
+  double sum = 0;
+#ifdef KERNEL_WIDTH
+  // Two independent accumulators hide the latency of the vector adds.
+  Vector first = zero();
+  Vector second = zero();
+  for (; i + 2 * KERNEL_WIDTH <= count; i += 2 * KERNEL_WIDTH) {
+    first = add(first, loadVector(values + i));
+    second = add(second, loadVector(values + i + KERNEL_WIDTH));
+  }
+  sum = horizontalSum(add(first, second));
+#endif
+  for (; i < count; i++) sum += load(values, i);
+  return sum;
+}
+
+int64_t indexOfNumber(const Value *values, const size_t count, const double number) {
+  size_t i = 0;
+#ifdef KERNEL_WIDTH
+  const Vector needle = splat(number);
+  for (; i + KERNEL_WIDTH <= count; i += KERNEL_WIDTH) {
+    const int mask = equalMask(loadVector(values + i), needle);
+    if (mask != 0) {
+      for (int lane = 0; lane < KERNEL_WIDTH; lane++) {
+        if (mask & (1 << lane)) return static_cast<int64_t>(i + lane);
+      }
+    }
+  }
+#endif
+  for (; i < count; i++) {
+    if (load(values, i) == number) return static_cast<int64_t>(i);
+  }
+  return -1;
+}
+
+void fillNumbers(Value *values, const size_t count, const double number) {
+  size_t i = 0;
+#ifdef KERNEL_WIDTH
+  const Vector vector = splat(number);
+  for (; i + KERNEL_WIDTH <= count; i += KERNEL_WIDTH) storeVector(values + i, vector);
+#endif
+  for (; i < count; i++) store(values, i, number);
+}
+
+void applyScalar(const KernelOp op, Value *out, const Value *in, const size_t count, const double operand) {
+  size_t i = 0;
+#ifdef KERNEL_WIDTH
+  const Vector vector = splat(operand);
+  for (; i + KERNEL_WIDTH <= count; i += KERNEL_WIDTH) {
+    storeVector(out + i, applyVector(op, loadVector(in + i), vector));
+  }
+#endif
+  for (; i < count; i++) store(out, i, apply(op, load(in, i), operand));
+}
+
+void applyPairwise(const KernelOp op, Value *out, const Value *a, const Value *b, const size_t count) {
+  size_t i = 0;
+#ifdef KERNEL_WIDTH
+  for (; i + KERNEL_WIDTH <= count; i += KERNEL_WIDTH) {
+    storeVector(out + i, applyVector(op, loadVector(a + i), loadVector(b + i)));
+  }
+#endif
+  for (; i < count; i++) store(out, i, apply(op, load(a, i), load(b, i)));
+}
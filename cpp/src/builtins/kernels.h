@@ -0,0 +1,24 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+#include "../value.h"
+
+#include <cstddef>
+#include <cstdint>
+
+// Bulk numeric kernels for packed arrays. Every element of the input buffers must be a number, which makes
+// them plain double buffers. AVX2 is used when the build targets it, SSE2 otherwise on x86, and a scalar loop
+// everywhere else.
+
+typedef enum { KERNEL_ADD, KERNEL_SUBTRACT, KERNEL_MULTIPLY, KERNEL_DIVIDE } KernelOp;
+
+// Pairwise-vectorised sum; the association order differs from a left-to-right loop.
+double sumNumbers(const Value *values, size_t count);
+// Index of the first element equal to `number`, or -1.
+int64_t indexOfNumber(const Value *values, size_t count, double number);
+void fillNumbers(Value *values, size_t count, double number);
+// out[i] = in[i] op operand
+void applyScalar(KernelOp op, Value *out, const Value *in, size_t count, double operand);
+// out[i] = a[i] op b[i]
+void applyPairwise(KernelOp op, Value *out, const Value *a, const Value *b, size_t count);
+
+#endif // KERNELS_H
@@ -0,0 +1,140 @@
+#include "../vm.h"
+#include "builtins.h"
+
+#include <cmath>
+#include <cstring>
+#include <string>
+
+bool concatenateStrings(VM &vm, Value *left, const Value *right) {
+  const uint64_t length = static_cast<uint64_t>(asString(*left)->length) + asString(*right)->length;
+  if (length > UINT32_MAX) {
+    vm.runtimeError("String is too long.");
+    return false;
+  }
+
+  if (asString(*right)->length == 0) return true;
+  if (asString(*left)->length == 0) {
+    *left = *right;
+    return true;
+  }
+
+  Heap &heap = vm.getHeap();
+  if (length < ROPE_MIN_LENGTH) {
+    ObjString *result = heap.allocateString(length);
+    if (result == nullptr) {
+      vm.runtimeError("Out of memory.");
+      return false;
+    }
+
+    // The allocation may have moved both operands; reload them.
+    const ObjString *a = asString(*left);
+    const ObjString *b = asString(*right);
+    std::memcpy(result->inlineChars(), a->chars(), a->length);
+    std::memcpy(result->inlineChars() + a->length, b->chars(), b->length);
+    result->hash = hashString(result->chars(), length);
+    *left = objValue(result);
+    return true;
+  }
+
+  ObjRope *rope = heap.allocateRope(length);
+  if (rope == nullptr) {
+    vm.runtimeError("Out of memory.");
+    return false;
+  }
+
+  rope->left = asString(*left);
+  rope->right = asString(*right);
+  heap.writeBarrier(rope, *left);
+  heap.writeBarrier(rope, *right);
+  *left = objValue(rope);
+  return true;
+}
+
+bool sliceString(VM &vm, Value *string, const uint32_t start, const uint32_t length) {
+  if (start == 0 && length == asString(*string)->length) return true;
+
+  // Flatten first; it never allocates on the heap, so the characters stay put until the copy below.
+  asString(*string)->chars();
+  ObjString *result = vm.getHeap().allocateString(length);
+  if (result == nullptr) {
+    vm.runtimeError("Out of memory.");
+    return false;
+  }
+
+  // The allocation may have moved the source; reload it.
+  const char *chars = asString(*string)->chars() + start;
+  std::memcpy(result->inlineChars(), chars, length);
+  result->hash = hashString(chars, length);
+  *string = objValue(result);
+  return true;
+}
+
+static bool length(VM &vm, Value *args, const int argCount) {
+  if (!expectArguments(vm, "length", argCount, 0)) return false;
+
+  args[0] = numberValue(asString(args[0])->length);
+  return true;
+}
+
+// Appends every argument to the receiver, left to right.
+static bool concatenateArguments(VM &vm, Value *args, const int argCount, const char *name) {
+  for (int i = 1; i <= argCount; i++) {
+    if (!isString(args[i])) {
+      vm.runtimeError(std::string(name) + "() expects string arguments.");
+      return false;
+    }
+  }
+
+  for (int i = 1; i <= argCount; i++) {
+    if (!concatenateStrings(vm, &args[0], &args[i])) return false;
+  }
+  return true;
+}
+
+static bool concat(VM &vm, Value *args, const int argCount) {
+  return concatenateArguments(vm, args, argCount, "concat");
+}
+
+static bool concatenate(VM &vm, Value *args, const int argCount) {
+  return concatenateArguments(vm, args, argCount, "concatenate");
+}
+
+static bool join(VM &vm, Value *args, const int argCount) {
+  return concatenateArguments(vm, args, argCount, "join");
+}
+
+static bool isInteger(const Value value) {
+  return isNumber(value) && asNumber(value) == std::floor(asNumber(value));
+}
+
+// slice(start, length): `start` may be negative to count from the end.
+static bool slice(VM &vm, Value *args, const int argCount) {
+  if (!expectArguments(vm, "slice", argCount, 2)) return false;
+
+  if (!isInteger(args[1]) || !isInteger(args[2]) || asNumber(args[2]) < 0) {
+    vm.runtimeError("slice() expects an integer start and a non-negative integer length.");
+    return false;
+  }
+
+  const double count = asString(args[0])->length;
+  double start = asNumber(args[1]);
+  if (start < 0) start += count;
+  const double sliceLength = asNumber(args[2]);
+  if (start < 0 || start + sliceLength > count) {
+    vm.runtimeError("String index out of range.");
+    return false;
+  }
+
+  return sliceString(vm, &args[0], static_cast<uint32_t>(start), static_cast<uint32_t>(sliceLength));
+}
+
+const NativeMethodEntry stringMethods[] = {
+    {"length", length},
+    {"size", length},
+    {"concat", concat},
+    {"concatenate", concatenate},
+    {"join", join},
+    {"slice", slice},
+};
+
+const size_t stringMethodCount = sizeof(stringMethods) / sizeof(stringMethods[0]);
@@ -0,0 +1,323 @@
+#include "cache.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#ifdef _WIN32
+#include <process.h>
+#define processId _getpid
+#else
+#include <unistd.h>
+#define processId getpid
+#endif
+
+// Numbers the temporary files of saves in this process, which may run on several threads.
+static std::atomic<unsigned long> temporaryCount(0);
+
+// Reads a length-prefixed string, or nullptr for the length UINT32_MAX.
+static bool readString(const uint8_t *&cursor, const uint8_t *end, Heap &heap, ObjString *&string) {
+  if (cursor + sizeof(uint32_t) > end) return false;
+  uint32_t length;
+  std::memcpy(&length, cursor, sizeof(uint32_t));
+  cursor += sizeof(uint32_t);
+  if (length == UINT32_MAX) {
+    string = nullptr;
+    return true;
+  }
+  if (length > static_cast<size_t>(end - cursor)) return false;
+  string = heap.intern(reinterpret_cast<const char *>(cursor), length);
+  cursor += length;
+  return true;
+}
+
+static void writeString(std::string &out, const ObjString *string) {
+  const uint32_t length = string == nullptr ? UINT32_MAX : string->length;
+  out.append(reinterpret_cast<const char *>(&length), sizeof(uint32_t));
+  if (string != nullptr) out.append(string->chars(), string->length);
+}
+
+static bool readConstant(const uint8_t *&cursor, const uint8_t *end, Heap &heap, Value &value) {
+  if (cursor + 1 > end) return false;
+  const uint8_t tag = *cursor++;
+
+  if (tag == CACHE_CONSTANT_VALUE) {
+    if (cursor + sizeof(Value) > end) return false;
+    std::memcpy(&value, cursor, sizeof(Value));
+    cursor += sizeof(Value);
+    // Only numbers, booleans and null are written raw. Any other bits, such as an object pointer or
+    // undefined, mean the file is corrupt.
+    return isNumber(value) || isBool(value) || isNull(value);
+  }
+
+  if (tag == CACHE_CONSTANT_STRING) {
+    ObjString *string;
+    if (!readString(cursor, end, heap, string) || string == nullptr) return false;
+    value = objValue(string);
+    return true;
+  }
+
+  if (tag == CACHE_CONSTANT_FUNCTION) {
+    if (cursor + sizeof(uint32_t) + 2 > end) return false;
+    uint32_t entry;
+    std::memcpy(&entry, cursor, sizeof(uint32_t));
+    cursor += sizeof(uint32_t);
+    const uint8_t arity = *cursor++;
+    const uint8_t upvalueCount = *cursor++;
+    ObjString *name;
+    if (!readString(cursor, end, heap, name)) return false;
+    // The verifier checks the entry against the code.
+    ObjFunction *function = heap.allocateFunction(entry, arity, upvalueCount, name);
+    if (function == nullptr) return false;
+    value = objValue(function);
+    return true;
+  }
+
+  return false;
+}
+
+static bool writeConstant(std::string &out, const Value value) {
+  if (isString(value)) {
+    out.push_back(static_cast<char>(CACHE_CONSTANT_STRING));
+    writeString(out, asString(value));
+    return true;
+  }
+
+  if (isFunction(value)) {
+    const ObjFunction *function = asFunction(value);
+    out.push_back(static_cast<char>(CACHE_CONSTANT_FUNCTION));
+    out.append(reinterpret_cast<const char *>(&function->entry), sizeof(uint32_t));
+    out.push_back(static_cast<char>(function->arity));
+    out.push_back(static_cast<char>(function->upvalueCount));
+    writeString(out, function->name);
+    return true;
+  }
+
+  // Other heap objects have no serialised form yet.
+  if (isObj(value)) return false;
+
+  out.push_back(static_cast<char>(CACHE_CONSTANT_VALUE));
+  out.append(reinterpret_cast<const char *>(&value), sizeof(Value));
+  return true;
+}
+
+// Counts the instructions that own an inline cache, walking the code one instruction at a time. False if the
+// code does not decode, which leaves it to the verifier to reject.
+static bool countCacheSites(const Chunk &chunk, uint32_t &sites) {
+  const uint8_t *code = chunk.code();
+  const size_t count = chunk.count();
+  sites = 0;
+  for (unsigned int offset = 0; offset < count;) {
+    unsigned int operandBytes = 0;
+    switch (static_cast<OpCode>(code[offset])) {
+      case OP_NULL:
+      case OP_TRUE:
+      case OP_FALSE:
+      case OP_POP:
+      case OP_GET_INDEX:
+      case OP_SET_INDEX:
+      case OP_SLICE:
+      case OP_EQUAL:
+      case OP_GREATER:
+      case OP_LESS:
+      case OP_ADD:
+      case OP_SUBTRACT:
+      case OP_MULTIPLY:
+      case OP_DIVIDE:
+      case OP_NOT:
+      case OP_NEGATE:
+      case OP_PRINT:
+      case OP_AWAIT:
+      case OP_RETURN_VALUE:
+      case OP_RETURN:
+        break;
+      case OP_CONSTANT:
+      case OP_GET_LOCAL:
+      case OP_SET_LOCAL:
+      case OP_GET_GLOBAL:
+      case OP_DEFINE_GLOBAL:
+      case OP_SET_GLOBAL:
+      case OP_MAP:
+      case OP_ARRAY:
+      case OP_ADD_CONST:
+      case OP_SUBTRACT_CONST:
+      case OP_MULTIPLY_CONST:
+      case OP_DIVIDE_CONST:
+      case OP_LESS_CONST:
+      case OP_GREATER_CONST:
+      case OP_SET_LOCAL_POP:
+      case OP_GET_UPVALUE:
+      case OP_GET_BOXED_LOCAL:
+      case OP_SET_BOXED_LOCAL:
+      case OP_SET_BOXED_LOCAL_POP:
+      case OP_GET_BOXED_UPVALUE:
+      case OP_SET_BOXED_UPVALUE:
+      case OP_CALL:
+      case OP_TAIL_CALL:
+      case OP_SPAWN:
+        operandBytes = 1;
+        break;
+      case OP_JUMP:
+      case OP_JUMP_IF_FALSE:
+      case OP_LOOP:
+        operandBytes = 2;
+        break;
+      case OP_CONSTANT_LONG:
+      case OP_GET_GLOBAL_LONG:
+      case OP_DEFINE_GLOBAL_LONG:
+      case OP_SET_GLOBAL_LONG:
+      case OP_MAP_LONG:
+      case OP_ARRAY_LONG:
+        operandBytes = 3;
+        break;
+      case OP_GET_PROPERTY:
+      case OP_SET_PROPERTY:
+        operandBytes = 4;
+        sites++;
+        break;
+      case OP_INVOKE:
+        operandBytes = 5;
+        sites++;
+        break;
+      case OP_GET_PROPERTY_LONG:
+      case OP_SET_PROPERTY_LONG:
+        operandBytes = 6;
+        sites++;
+        break;
+      case OP_INVOKE_LONG:
+        operandBytes = 7;
+        sites++;
+        break;
+      case OP_CLOSURE:
+      case OP_CLOSURE_LONG:
+        {
+          const bool isShort = code[offset] == OP_CLOSURE;
+          operandBytes = isShort ? 1 : 3;
+          if (offset + 1 + operandBytes > count) return false;
+          const uint32_t constant = isShort ? code[offset + 1] : chunk.readLong(offset + 1);
+          if (constant >= chunk.constants.size() || !isFunction(chunk.constants[constant])) return false;
+          // One (isLocal, index) pair per upvalue.
+          operandBytes += 2 * asFunction(chunk.constants[constant])->upvalueCount;
+          break;
+        }
+      default:
+        return false;
+    }
+    offset += 1 + operandBytes;
+  }
+  return true;
+}
+
+uint64_t Cache::hashSource(const char *source, const size_t length) {
+  // FNV-1a, 64 bit.
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < length; i++) {
+    hash ^= static_cast<uint8_t>(source[i]);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+std::string Cache::pathFor(const std::string &sourcePath) {
+  const size_t dot = sourcePath.find_last_of('.');
+  const size_t slash = sourcePath.find_last_of("/\\");
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+    return sourcePath + CACHE_EXTENSION;
+  }
+  return sourcePath.substr(0, dot) + CACHE_EXTENSION;
+}
+
+bool Cache::load(const std::string &path, const uint64_t sourceHash, Chunk &chunk, Heap &heap) {
+  const auto image = std::make_shared<const MappedFile>(path);
+  if (!image->isOpen() || image->size() < sizeof(CacheHeader)) return false;
+
+  CacheHeader header;
+  std::memcpy(&header, image->data(), sizeof(CacheHeader));
+  if (std::memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) != 0) return false;
+  if (header.version != CACHE_VERSION || header.sourceHash != sourceHash) return false;
+
+  const size_t linesSize = static_cast<size_t>(header.lineCount) * sizeof(LineStart);
+  if (image->size() != sizeof(CacheHeader) + linesSize + header.constantsSize + header.codeCount) return false;
+
+  const uint8_t *cursor = image->data() + sizeof(CacheHeader);
+
+  Chunk loaded;
+  loaded.lines.resize(header.lineCount);
+  std::memcpy(loaded.lines.data(), cursor, linesSize);
+  cursor += linesSize;
+
+  // Every constant and global name takes at least CACHE_CONSTANT_MIN bytes, which bounds the counts by the
+  // section, and so by the file, before anything is sized by them.
+  const uint64_t constantCount = static_cast<uint64_t>(header.constantCount) + header.globalCount;
+  if (constantCount * CACHE_CONSTANT_MIN > header.constantsSize) return false;
+
+  const uint8_t *constantsEnd = cursor + header.constantsSize;
+  loaded.constants.resize(header.constantCount);
+  for (Value &constant : loaded.constants) {
+    if (!readConstant(cursor, constantsEnd, heap, constant)) return false;
+  }
+  loaded.globalNames.resize(header.globalCount);
+  for (Value &name : loaded.globalNames) {
+    if (!readConstant(cursor, constantsEnd, heap, name) || !isString(name)) return false;
+  }
+  if (cursor != constantsEnd) return false;
+
+  loaded.adopt(image, cursor, header.codeCount);
+  // VMs allocate the inline caches before verifying the code, so the count must not exceed what the code
+  // can index.
+  uint32_t sites;
+  if (!countCacheSites(loaded, sites) || header.cacheCount > sites) return false;
+  loaded.cacheCount = header.cacheCount;
+  chunk = loaded;
+  return true;
+}
+
+bool Cache::save(const std::string &path, const uint64_t sourceHash, const Chunk &chunk) {
+  std::string constants;
+  for (const Value &constant : chunk.constants) {
+    if (!writeConstant(constants, constant)) return false;
+  }
+  for (const Value &name : chunk.globalNames) {
+    if (!writeConstant(constants, name)) return false;
+  }
+
+  CacheHeader header;
+  std::memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+  header.version = CACHE_VERSION;
+  header.sourceHash = sourceHash;
+  header.codeCount = static_cast<uint32_t>(chunk.count());
+  header.constantCount = static_cast<uint32_t>(chunk.constants.size());
+  header.lineCount = static_cast<uint32_t>(chunk.lines.size());
+  header.constantsSize = static_cast<uint32_t>(constants.size());
+  header.globalCount = static_cast<uint32_t>(chunk.globalNames.size());
+  header.cacheCount = chunk.cacheCount;
+
+  // Write to a temporary file first so a concurrent reader never maps a half-written cache. Its name is
+  // unique to this save, so concurrent runs of the same script each write their own and the last rename wins.
+  const std::string temporary = path + "." + std::to_string(processId()) + "." +
+                                std::to_string(temporaryCount.fetch_add(1)) + ".tmp";
+  {
+    std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+    if (!file) return false;
+
+    file.write(reinterpret_cast<const char *>(&header), sizeof(CacheHeader));
+    file.write(reinterpret_cast<const char *>(chunk.lines.data()),
+               static_cast<std::streamsize>(chunk.lines.size() * sizeof(LineStart)));
+    file.write(constants.data(), static_cast<std::streamsize>(constants.size()));
+    file.write(reinterpret_cast<const char *>(chunk.code()), static_cast<std::streamsize>(chunk.count()));
+    if (!file) {
+      file.close();
+      std::remove(temporary.c_str());
+      return false;
+    }
+  }
+
+  // On POSIX systems rename replaces an existing cache atomically. Windows refuses to replace it.
+#ifdef _WIN32
+  std::remove(path.c_str());
+#endif
+  if (std::rename(temporary.c_str(), path.c_str()) == 0) return true;
+  std::remove(temporary.c_str());
+  return false;
+}
@@ -0,0 +1,60 @@
+#ifndef CACHE_H
+#define CACHE_H
+#include "chunk.h"
+#include "heap.h"
+
+#include <cstdint>
+#include <string>
+
+// Precompiled bytecode files (`.sssc`).
+//
+// Layout, all integers little-endian:
+//   CacheHeader
+//   LineStart[lineCount]
+//   constants then global names, constantsSize bytes in total; each is a CacheConstant tag followed by either
+//   the raw 8-byte Value or, for strings, a uint32_t length and the characters, or for functions a uint32_t
+//   entry, uint8_t arity, uint8_t upvalue count and the name encoded like a string (length UINT32_MAX for
+//   none)
+//   uint8_t[codeCount]
+//
+// The code section is last so it can be executed straight from the mapped file without alignment concerns.
+// Bump CACHE_VERSION whenever the opcode numbering or the constant encoding changes.
+#define CACHE_MAGIC "SSSC"
+#define CACHE_VERSION 12
+#define CACHE_EXTENSION ".sssc"
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint64_t sourceHash;
+  uint32_t codeCount;
+  uint32_t constantCount;
+  uint32_t lineCount;
+  uint32_t constantsSize;
+  uint32_t globalCount;
+  // Inline caches are not stored, only how many the code indexes; they start out empty.
+  uint32_t cacheCount;
+} CacheHeader;
+
+typedef enum : uint8_t {
+  CACHE_CONSTANT_VALUE,
+  CACHE_CONSTANT_STRING,
+  CACHE_CONSTANT_FUNCTION,
+} CacheConstant;
+
+// The smallest encoded constant: a tag and the length of a string.
+#define CACHE_CONSTANT_MIN (1 + sizeof(uint32_t))
+
+class Cache {
+public:
+  static uint64_t hashSource(const char *source, size_t length);
+  static std::string pathFor(const std::string &sourcePath);
+
+  // Returns false when the file is missing, malformed, from another format version or compiled from a
+  // different source, in which case the caller should recompile.
+  // String and function constants are allocated in `heap`.
+  static bool load(const std::string &path, uint64_t sourceHash, Chunk &chunk, Heap &heap);
+  static bool save(const std::string &path, uint64_t sourceHash, const Chunk &chunk);
+};
+
+#endif // CACHE_H
@@ -1,13 +1,71 @@
 #include "chunk.h"
 
-void Chunk::write(const unsigned long long chunk, const unsigned int line) {
-    this->bytes.push_back(chunk);
-    this->lines.push_back(line);
+#include <algorithm>
+#include <stdexcept>
+
+const uint8_t *Chunk::code() const {
+  if (this->mappedCode != nullptr) return this->mappedCode;
+  return this->bytes.data();
+}
+
+size_t Chunk::count() const {
+  if (this->mappedCode != nullptr) return this->mappedCount;
+  return this->bytes.size();
+}
+
+uint8_t Chunk::at(const unsigned int offset) const {
+  if (offset >= this->count()) throw std::out_of_range("Chunk offset out of range.");
+  return this->code()[offset];
+}
+
+void Chunk::adopt(const std::shared_ptr<const MappedFile> &image, const uint8_t *code, const size_t count) {
+  this->bytes.clear();
+  this->image = image;
+  this->mappedCode = code;
+  this->mappedCount = count;
+}
+
+void Chunk::write(const uint8_t byte, const unsigned int line) {
+  this->bytes.push_back(byte);
+
+  if (!this->lines.empty() && this->lines.back().line == line) return;
+  this->lines.push_back({static_cast<unsigned int>(this->bytes.size() - 1), line});
 }
 
-unsigned long long Chunk::addConstant(const Value constant) {
+void Chunk::writeLong(const uint32_t operand, const unsigned int line) {
+  this->write(static_cast<uint8_t>(operand & 0xFF), line);
+  this->write(static_cast<uint8_t>((operand >> 8) & 0xFF), line);
+  this->write(static_cast<uint8_t>((operand >> 16) & 0xFF), line);
+}
+
+uint32_t Chunk::addConstant(const Value constant) {
   this->constants.push_back(constant);
-  return this->constants.size() - 1;
+  return static_cast<uint32_t>(this->constants.size() - 1);
+}
+
+uint32_t Chunk::addCache() { return this->cacheCount++; }
+
+uint32_t Chunk::readLong(const unsigned int offset) const {
+  const uint8_t *code = this->code();
+  return static_cast<uint32_t>(code[offset]) | static_cast<uint32_t>(code[offset + 1]) << 8 |
+         static_cast<uint32_t>(code[offset + 2]) << 16;
+}
+
+uint16_t Chunk::readShort(const unsigned int offset) const {
+  const uint8_t *code = this->code();
+  return static_cast<uint16_t>(code[offset] | code[offset + 1] << 8);
+}
+
+unsigned int Chunk::getLine(const unsigned int offset) const {
+  if (this->lines.empty()) return 0;
+
+  // First run starting after the offset; the run before it contains the offset.
+  const auto next = std::upper_bound(this->lines.begin(), this->lines.end(), offset,
+                                     [](const unsigned int value, const LineStart &start) {
+                                       return value < start.offset;
+                                     });
+  if (next == this->lines.begin()) return this->lines.front().line;
+  return (next - 1)->line;
 }
 
 void Chunk::free() {
@@ -15,4 +73,9 @@ void Chunk::free() {
   this->bytes.clear();
   this->constants.clear();
   this->lines.clear();
-}
\ No newline at end of file
+  this->globalNames.clear();
+  this->cacheCount = 0;
+  this->image.reset();
+  this->mappedCode = nullptr;
+  this->mappedCount = 0;
+}
@@ -1,31 +1,166 @@
 #ifndef CHUNK_H
 #define CHUNK_H
+#include "file.h"
 #include "value.h"
 
+#include <cstdint>
+#include <memory>
 #include <vector>
 
-typedef enum {
+// Opcodes are one byte wide. Operands follow inline in the byte stream: short forms take a single byte and
+// `_LONG` forms take a 24-bit little-endian operand. Jumps take a 16-bit little-endian offset. Property
+// accesses and method calls end in a 24-bit index into the running VM's inline caches.
+typedef enum : uint8_t {
   OP_CONSTANT,
+  OP_CONSTANT_LONG,
+  OP_NULL,
+  OP_TRUE,
+  OP_FALSE,
+  OP_POP,
+  OP_GET_LOCAL,
+  OP_SET_LOCAL,
+  OP_GET_GLOBAL,
+  OP_GET_GLOBAL_LONG,
+  OP_DEFINE_GLOBAL,
+  OP_DEFINE_GLOBAL_LONG,
+  OP_SET_GLOBAL,
+  OP_SET_GLOBAL_LONG,
+  OP_MAP,
+  OP_MAP_LONG,
+  OP_ARRAY,
+  OP_ARRAY_LONG,
+  OP_GET_INDEX,
+  OP_SET_INDEX,
+  OP_SLICE,
+  OP_EQUAL,
+  OP_GREATER,
+  OP_LESS,
   OP_ADD,
   OP_SUBTRACT,
   OP_MULTIPLY,
   OP_DIVIDE,
+  OP_NOT,
   OP_NEGATE,
+  OP_INVOKE,
+  OP_INVOKE_LONG,
+  OP_GET_PROPERTY,
+  OP_GET_PROPERTY_LONG,
+  OP_SET_PROPERTY,
+  OP_SET_PROPERTY_LONG,
+  OP_PRINT,
+  OP_JUMP,
+  OP_JUMP_IF_FALSE,
+  OP_LOOP,
+  // Superinstructions picked from opcode n-gram counts (tools/ngrams.cpp). The `_CONST` forms fold a short
+  // OP_CONSTANT holding a number into the arithmetic or comparison after it; OP_SET_LOCAL_POP is an
+  // assignment statement.
+  OP_ADD_CONST,
+  OP_SUBTRACT_CONST,
+  OP_MULTIPLY_CONST,
+  OP_DIVIDE_CONST,
+  OP_LESS_CONST,
+  OP_GREATER_CONST,
+  OP_SET_LOCAL_POP,
+  // Functions. OP_CLOSURE names a function constant and is followed by one (isLocal, index) byte pair per
+  // upvalue, copying either a local slot of the current frame (isLocal 1) or one of its own upvalues (0).
+  // With isLocal 2 the slot is first boxed in place unless it already holds a box, and the box is copied.
+  // The `_BOXED` forms access a local or upvalue that may hold a box through it (see ObjBox). Calls take the
+  // argument count, the callee sitting below the arguments. A tail call replaces the current frame.
+  OP_CLOSURE,
+  OP_CLOSURE_LONG,
+  OP_GET_UPVALUE,
+  OP_GET_BOXED_LOCAL,
+  OP_SET_BOXED_LOCAL,
+  OP_SET_BOXED_LOCAL_POP,
+  OP_GET_BOXED_UPVALUE,
+  OP_SET_BOXED_UPVALUE,
+  OP_CALL,
+  OP_TAIL_CALL,
+  // Fibers. OP_SPAWN takes the argument count like OP_CALL but runs the call on a fiber of its own and pushes
+  // the fiber. OP_AWAIT suspends the running fiber until the value on top of the stack, a fiber or a number
+  // of milliseconds, is ready and replaces it with the fiber's result or null.
+  OP_SPAWN,
+  OP_AWAIT,
+  // Returns the value on top of the stack from a function; OP_RETURN ends the script.
+  OP_RETURN_VALUE,
   OP_RETURN,
 } OpCode;
 
+#define UINT24_MAX 0xFFFFFF
+
 template <typename T = unsigned long long> using Array = std::vector<T>;
 
+// One entry per run of bytes emitted from the same source line. Entries are sorted by offset, so the line
+// for any byte is found with a binary search and never touched by the VM on the hot path.
+typedef struct {
+  unsigned int offset;
+  unsigned int line;
+} LineStart;
+
+// Receiver layouts an inline cache remembers before it stops learning new ones.
+#define INLINE_CACHE_WAYS 4
+
+// One receiver layout seen at a site. For property accesses `key` is the map's shape (see shape.h) and
+// `index` the property's entry in the map's table; for method calls `key` is the receiver's ObjType and
+// `index` the method's index in its native method list.
+typedef struct {
+  uint32_t key;
+  uint32_t index;
+  // Shape of the map after a property store, which differs from `key` if the store added the property.
+  uint32_t transition;
+} CacheEntry;
+
+// Per-site cache of a property access or method call. Caches are runtime state each VM keeps next to the code
+// rather than patched into it, so cached bytecode can run straight from its read-only mapping and VMs can
+// share it.
+typedef struct {
+  CacheEntry entries[INLINE_CACHE_WAYS];
+  uint32_t count;
+
+  const CacheEntry *find(const uint32_t key) const {
+    for (uint32_t i = 0; i < this->count; i++) {
+      if (this->entries[i].key == key) return &this->entries[i];
+    }
+    return nullptr;
+  }
+
+  // Once every way is taken the site is megamorphic and further layouts go uncached.
+  void add(const uint32_t key, const uint32_t index, const uint32_t transition) {
+    if (this->count < INLINE_CACHE_WAYS) this->entries[this->count++] = {key, index, transition};
+  }
+} InlineCache;
+
 class Chunk {
 public:
-  Array<unsigned long long> bytes;
+  Array<uint8_t> bytes;
   Array<Value> constants;
-  Array<unsigned int> lines;
+  Array<LineStart> lines;
+  // Interned name of every global slot, indexed by the slot operand of the global opcodes.
+  Array<Value> globalNames;
+  // Inline caches the cache operands of property accesses and method calls index.
+  uint32_t cacheCount = 0;
+
+  const uint8_t *code() const;
+  size_t count() const;
+  uint8_t at(unsigned int offset) const;
+  void adopt(const std::shared_ptr<const MappedFile> &image, const uint8_t *code, size_t count);
 
-  void write(unsigned long long chunk, unsigned int line);
-  unsigned long long addConstant(Value constant);
+  void write(uint8_t byte, unsigned int line);
+  void writeLong(uint32_t operand, unsigned int line);
+  uint32_t addConstant(Value constant);
+  uint32_t addCache();
+
+  uint32_t readLong(unsigned int offset) const;
+  uint16_t readShort(unsigned int offset) const;
+  unsigned int getLine(unsigned int offset) const;
 
   void free();
+
+private:
+  // Set when the code lives in a read-only cache file instead of `bytes`; `image` keeps the pages mapped.
+  std::shared_ptr<const MappedFile> image;
+  const uint8_t *mappedCode = nullptr;
+  size_t mappedCount = 0;
 };
 
 #endif // CHUNK_H
@@ -1,22 +1,28 @@
 #include "compiler.h"
 
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 
-Compiler::Compiler(const std::string &source, Chunk &chunk)
-    : source(source), scanner(source), parser(), compilingChunk(&chunk)
-#ifdef DEBUG_PRINT_CODE
-      ,
-      debug(chunk)
-#endif
-{
+// Numbers longer than this are parsed from a copy on the heap.
+#define NUMBER_BUFFER_SIZE 64
+
+Compiler::Compiler(const char *source, const size_t length, Chunk &chunk, Heap &heap)
+    : scanner(source, length), parser(), compilingChunk(&chunk), heap(heap) {
+  this->globals.init();
 }
 
+Compiler::Compiler(const std::string &source, Chunk &chunk, Heap &heap)
+    : Compiler(source.data(), source.length(), chunk, heap) {}
+
+Compiler::~Compiler() { this->globals.free(); }
+
 bool Compiler::compile() {
   this->advance();
 
-  this->expression();
-
-  this->consume(TokenType::TOKEN_EOF, "Expect end of expression.");
+  while (!this->match(TokenType::TOKEN_EOF)) {
+    this->declaration();
+  }
 
   this->endCompiler();
   return !this->parser.hadError;
@@ -24,6 +30,281 @@ bool Compiler::compile() {
 
 void Compiler::expression() { this->parsePrecedence(Precedence::PRECEDENCE_ASSIGNMENT); }
 
+void Compiler::declaration() {
+  if (this->match(TokenType::TOKEN_FUNCTION)) {
+    this->funDeclaration();
+  } else if (this->match(TokenType::TOKEN_VAR)) {
+    this->varDeclaration();
+  } else {
+    this->statement();
+  }
+
+  if (this->parser.panicMode) this->synchronize();
+}
+
+void Compiler::varDeclaration() {
+  const uint32_t global = this->parseVariable("Expect variable name.");
+
+  if (this->match(TokenType::TOKEN_EQUAL)) {
+    this->expression();
+  } else {
+    this->emitByte(OpCode::OP_NULL);
+  }
+  this->consume(TokenType::TOKEN_SEMICOLON, "Expect ';' after variable declaration.");
+
+  this->defineVariable(global);
+}
+
+void Compiler::funDeclaration() {
+  const uint32_t global = this->parseVariable("Expect function name.");
+  const Token name = this->parser.previous;
+  this->consume(TokenType::TOKEN_LEFT_PAREN, "Expect '(' after function name.");
+  this->function(name, false, true);
+  this->defineVariable(global);
+}
+
+// Compiles a function and leaves a closure of it on the stack. With parameters, their '(' has just been
+// consumed; without, so has an arrow function's '->'. The body is emitted in place, with the code around it
+// jumping over it.
+void Compiler::function(const Token &name, const bool isArrow, const bool hasParameters) {
+  FunctionState state = {this->current, {}, {}, 0};
+  // An arrow function has no name to call itself by.
+  Token callee = name;
+  if (isArrow) callee.length = 0;
+  state.locals.push_back({callee, 0, false, false, false, {}, {}});
+
+  const unsigned int skip = this->emitJump(OpCode::OP_JUMP);
+  const auto entry = static_cast<uint32_t>(this->currentChunk()->count());
+  this->current = &state;
+  this->beginScope();
+
+  int arity = 0;
+  if (hasParameters && !this->check(TokenType::TOKEN_RIGHT_PAREN)) {
+    do {
+      if (arity == UINT8_MAX) this->errorAtCurrent("Can't have more than 255 parameters.");
+      arity++;
+      this->consume(TokenType::TOKEN_IDENTIFIER, "Expect parameter name.");
+      this->declareVariable();
+      this->markInitialized();
+    } while (this->match(TokenType::TOKEN_COMMA));
+  }
+  if (hasParameters) this->consume(TokenType::TOKEN_RIGHT_PAREN, "Expect ')' after parameters.");
+
+  if (isArrow) {
+    if (hasParameters) this->consume(TokenType::TOKEN_ARROW, "Expect '->' after parameters.");
+    this->functionBody(true);
+  } else {
+    this->consume(TokenType::TOKEN_LEFT_BRACE, "Expect '{' before function body.");
+    this->functionBody(false);
+  }
+
+  // Returning drops the whole frame, so the body's locals are never popped one by one.
+  this->current = state.enclosing;
+  this->patchJump(skip);
+
+  ObjString *functionName = isArrow ? nullptr : this->identifierName(name);
+  const auto upvalueCount = static_cast<uint8_t>(state.upvalues.size());
+  ObjFunction *function =
+      this->heap.allocateFunction(entry, static_cast<uint8_t>(arity), upvalueCount, functionName);
+  this->emitOperand(OpCode::OP_CLOSURE, OpCode::OP_CLOSURE_LONG, this->makeConstant(objValue(function)));
+  for (const Upvalue &upvalue : state.upvalues) {
+    uint8_t isLocal = 0;
+    if (upvalue.isLocal) {
+      Local &captured = this->current->locals[upvalue.index];
+      const auto offset = static_cast<unsigned int>(this->currentChunk()->count());
+      if (!captured.boxed) captured.captures.push_back(offset);
+      isLocal = captured.boxed ? 2 : 1;
+    }
+    this->emitBytes(isLocal, upvalue.index);
+  }
+}
+
+// A block, or for arrow functions also a single expression whose value is returned. Either way control never
+// runs off the end: a block without a return statement returns null.
+void Compiler::functionBody(const bool isArrow) {
+  if (isArrow && !this->match(TokenType::TOKEN_LEFT_BRACE)) {
+    this->expression();
+    this->emitReturnValue();
+    return;
+  }
+
+  this->block();
+  this->emitBytes(OpCode::OP_NULL, OpCode::OP_RETURN_VALUE);
+}
+
+void Compiler::statement() {
+  if (this->match(TokenType::TOKEN_PRINT)) {
+    this->printStatement();
+  } else if (this->match(TokenType::TOKEN_RETURN)) {
+    this->returnStatement();
+  } else if (this->match(TokenType::TOKEN_IF)) {
+    this->ifStatement();
+  } else if (this->match(TokenType::TOKEN_WHILE)) {
+    this->whileStatement();
+  } else if (this->match(TokenType::TOKEN_FOR)) {
+    this->forStatement();
+  } else if (this->match(TokenType::TOKEN_LEFT_BRACE)) {
+    this->beginScope();
+    this->block();
+    this->endScope();
+  } else {
+    this->expressionStatement();
+  }
+}
+
+void Compiler::printStatement() {
+  this->expression();
+  this->consume(TokenType::TOKEN_SEMICOLON, "Expect ';' after value.");
+  this->emitByte(OpCode::OP_PRINT);
+}
+
+void Compiler::returnStatement() {
+  if (this->current->enclosing == nullptr) this->error("Can't return from top-level code.");
+
+  if (this->match(TokenType::TOKEN_SEMICOLON)) {
+    this->emitBytes(OpCode::OP_NULL, OpCode::OP_RETURN_VALUE);
+    return;
+  }
+
+  this->expression();
+  this->consume(TokenType::TOKEN_SEMICOLON, "Expect ';' after return value.");
+  this->emitReturnValue();
+}
+
+void Compiler::expressionStatement() {
+  this->expression();
+  this->consume(TokenType::TOKEN_SEMICOLON, "Expect ';' after expression.");
+  if (this->canFuse(OpCode::OP_SET_LOCAL)) {
+    this->currentChunk()->bytes[this->fusable] = OpCode::OP_SET_LOCAL_POP;
+    this->fusable = -1;
+    return;
+  }
+  if (this->canFuse(OpCode::OP_SET_BOXED_LOCAL)) {
+    this->currentChunk()->bytes[this->fusable] = OpCode::OP_SET_BOXED_LOCAL_POP;
+    this->fusable = -1;
+    return;
+  }
+  this->emitByte(OpCode::OP_POP);
+}
+
+void Compiler::ifStatement() {
+  this->consume(TokenType::TOKEN_LEFT_PAREN, "Expect '(' after 'if'.");
+  this->expression();
+  this->consume(TokenType::TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+
+  const unsigned int thenJump = this->emitJump(OpCode::OP_JUMP_IF_FALSE);
+  this->emitByte(OpCode::OP_POP);
+  this->statement();
+
+  const unsigned int elseJump = this->emitJump(OpCode::OP_JUMP);
+  this->patchJump(thenJump);
+  this->emitByte(OpCode::OP_POP);
+
+  if (this->match(TokenType::TOKEN_ELSE)) this->statement();
+  this->patchJump(elseJump);
+}
+
+void Compiler::whileStatement() {
+  const unsigned int loopStart = static_cast<unsigned int>(this->currentChunk()->count());
+  this->consume(TokenType::TOKEN_LEFT_PAREN, "Expect '(' after 'while'.");
+  this->expression();
+  this->consume(TokenType::TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+
+  const unsigned int exitJump = this->emitJump(OpCode::OP_JUMP_IF_FALSE);
+  this->emitByte(OpCode::OP_POP);
+  this->statement();
+  this->emitLoop(loopStart);
+
+  this->patchJump(exitJump);
+  this->emitByte(OpCode::OP_POP);
+}
+
+void Compiler::forStatement() {
+  this->beginScope();
+  this->consume(TokenType::TOKEN_LEFT_PAREN, "Expect '(' after 'for'.");
+  if (this->match(TokenType::TOKEN_SEMICOLON)) {
+    // No initializer.
+  } else if (this->match(TokenType::TOKEN_VAR)) {
+    this->varDeclaration();
+  } else {
+    this->expressionStatement();
+  }
+
+  unsigned int loopStart = static_cast<unsigned int>(this->currentChunk()->count());
+  int exitJump = -1;
+  if (!this->match(TokenType::TOKEN_SEMICOLON)) {
+    this->expression();
+    this->consume(TokenType::TOKEN_SEMICOLON, "Expect ';' after loop condition.");
+
+    // Jump out of the loop if the condition is false.
+    exitJump = static_cast<int>(this->emitJump(OpCode::OP_JUMP_IF_FALSE));
+    this->emitByte(OpCode::OP_POP);
+  }
+
+  if (!this->match(TokenType::TOKEN_RIGHT_PAREN)) {
+    const unsigned int bodyJump = this->emitJump(OpCode::OP_JUMP);
+    const unsigned int incrementStart = static_cast<unsigned int>(this->currentChunk()->count());
+    this->expression();
+    this->emitByte(OpCode::OP_POP);
+    this->consume(TokenType::TOKEN_RIGHT_PAREN, "Expect ')' after for clauses.");
+
+    this->emitLoop(loopStart);
+    loopStart = incrementStart;
+    this->patchJump(bodyJump);
+  }
+
+  this->statement();
+  this->emitLoop(loopStart);
+
+  if (exitJump != -1) {
+    this->patchJump(static_cast<unsigned int>(exitJump));
+    this->emitByte(OpCode::OP_POP);
+  }
+
+  this->endScope();
+}
+
+void Compiler::block() {
+  while (!this->check(TokenType::TOKEN_RIGHT_BRACE) && !this->check(TokenType::TOKEN_EOF)) {
+    this->declaration();
+  }
+
+  this->consume(TokenType::TOKEN_RIGHT_BRACE, "Expect '}' after block.");
+}
+
+void Compiler::beginScope() { this->current->scopeDepth++; }
+
+void Compiler::endScope() {
+  this->current->scopeDepth--;
+
+  while (!this->current->locals.empty() && this->current->locals.back().depth > this->current->scopeDepth) {
+    this->emitByte(OpCode::OP_POP);
+    this->current->locals.pop_back();
+  }
+}
+
+void Compiler::synchronize() {
+  this->parser.panicMode = false;
+
+  while (this->parser.current.type != TokenType::TOKEN_EOF) {
+    if (this->parser.previous.type == TokenType::TOKEN_SEMICOLON) return;
+    switch (this->parser.current.type) {
+      case TokenType::TOKEN_CLASS:
+      case TokenType::TOKEN_FUNCTION:
+      case TokenType::TOKEN_VAR:
+      case TokenType::TOKEN_FOR:
+      case TokenType::TOKEN_IF:
+      case TokenType::TOKEN_WHILE:
+      case TokenType::TOKEN_PRINT:
+      case TokenType::TOKEN_RETURN:
+        return;
+      default:; // Do nothing.
+    }
+
+    this->advance();
+  }
+}
+
 void Compiler::advance() {
   parser.previous = parser.current;
 
@@ -31,7 +312,7 @@ void Compiler::advance() {
     this->parser.current = this->scanner.scanToken();
     if (this->parser.current.type != TokenType::TOKEN_ERROR) break;
 
-    this->errorAtCurrent(this->parser.current.lexeme);
+    this->errorAtCurrent(std::string(this->parser.current.start, this->parser.current.length));
   }
 }
 
@@ -44,39 +325,331 @@ void Compiler::consume(const TokenType type, const std::string &message) {
   this->errorAtCurrent(message);
 }
 
-void Compiler::emitByte(const unsigned long long byte) {
-  this->currentChunk()->write(byte, this->parser.previous.line);
+bool Compiler::check(const TokenType type) const { return this->parser.current.type == type; }
+
+bool Compiler::match(const TokenType type) {
+  if (!this->check(type)) return false;
+  this->advance();
+  return true;
 }
 
-void Compiler::emitBytes(const unsigned long long byte1, const unsigned long long byte2) {
+void Compiler::emitByte(const uint8_t byte) { this->currentChunk()->write(byte, this->parser.previous.line); }
+
+void Compiler::emitBytes(const uint8_t byte1, const uint8_t byte2) {
   this->emitByte(byte1);
   this->emitByte(byte2);
 }
 
+void Compiler::emitLong(const uint32_t operand) {
+  this->currentChunk()->writeLong(operand, this->parser.previous.line);
+}
+
+void Compiler::emitOperand(const OpCode shortOp, const OpCode longOp, const uint32_t operand) {
+  if (operand <= UINT8_MAX) {
+    this->emitBytes(shortOp, static_cast<uint8_t>(operand));
+    return;
+  }
+
+  this->emitByte(longOp);
+  this->emitLong(operand);
+}
+
+// Gives the instruction just emitted an inline cache of its own.
+void Compiler::emitCache() {
+  if (this->currentChunk()->cacheCount > UINT24_MAX) {
+    this->error("Too many property accesses and method calls in one chunk.");
+    return;
+  }
+
+  this->emitLong(this->currentChunk()->addCache());
+}
+
 void Compiler::emitReturn() { this->emitByte(OpCode::OP_RETURN); }
 
-unsigned long long Compiler::makeConstant(const double value) {
-  const unsigned long long constant = this->currentChunk()->addConstant(value);
-  if (constant > ULONG_LONG_MAX) {
-    this->errorAtCurrent("Too many constants in one chunk.");
+// Returns the value just computed. If a call computed it, that call becomes a tail call replacing the frame
+// instead, and the OP_RETURN_VALUE after it is only reached by jumps that skipped the call, as in `a or f()`.
+void Compiler::emitReturnValue() {
+  const size_t count = this->currentChunk()->count();
+  if (this->lastCall >= 0 && static_cast<size_t>(this->lastCall) + 2 == count) {
+    this->currentChunk()->bytes[this->lastCall] = OpCode::OP_TAIL_CALL;
+  }
+  this->emitByte(OpCode::OP_RETURN_VALUE);
+}
+
+unsigned int Compiler::emitJump(const OpCode instruction) {
+  this->emitByte(instruction);
+  this->emitByte(0xff);
+  this->emitByte(0xff);
+  return static_cast<unsigned int>(this->currentChunk()->count() - 2);
+}
+
+void Compiler::patchJump(const unsigned int offset) {
+  // -2 to adjust for the bytecode for the jump offset itself.
+  const size_t jump = this->currentChunk()->count() - offset - 2;
+  if (jump > UINT16_MAX) this->error("Too much code to jump over.");
+  this->jumpTarget = this->currentChunk()->count();
+
+  this->currentChunk()->bytes[offset] = static_cast<uint8_t>(jump & 0xff);
+  this->currentChunk()->bytes[offset + 1] = static_cast<uint8_t>((jump >> 8) & 0xff);
+}
+
+void Compiler::emitLoop(const unsigned int loopStart) {
+  this->emitByte(OpCode::OP_LOOP);
+
+  const size_t offset = this->currentChunk()->count() - loopStart + 2;
+  if (offset > UINT16_MAX) this->error("Loop body too large.");
+
+  this->emitByte(static_cast<uint8_t>(offset & 0xff));
+  this->emitByte(static_cast<uint8_t>((offset >> 8) & 0xff));
+}
+
+uint32_t Compiler::makeConstant(const Value value) {
+  if (this->currentChunk()->constants.size() > UINT24_MAX) {
+    this->error("Too many constants in one chunk.");
     return 0;
   }
 
-  return constant;
+  return this->currentChunk()->addConstant(value);
 }
 
-void Compiler::emitConstant(const double value) {
-  const unsigned long long constant = this->makeConstant(value);
-  this->emitBytes(OpCode::OP_CONSTANT, constant);
+void Compiler::emitConstant(const Value value) {
+  const uint32_t constant = this->makeConstant(value);
+  this->emitOperand(OpCode::OP_CONSTANT, OpCode::OP_CONSTANT_LONG, constant);
+  if (isNumber(value) && constant <= UINT8_MAX) {
+    this->fusable = static_cast<long>(this->currentChunk()->count() - 2);
+  }
 }
 
-void Compiler::endCompiler() {
-#ifdef DEBUG_PRINT_CODE
-  if (!this->parser.hadError) {
-    this->debug.chunk = *this->currentChunk();
-    this->debug.disassembleChunk("COMPILER");
+// True if the last instruction is `first` with a one-byte operand and nothing jumps in between it and the
+// instruction about to be emitted. Loop starts always begin a statement or expression, so only forward jumps
+// can split a pair.
+bool Compiler::canFuse(const OpCode first) {
+  const size_t count = this->currentChunk()->count();
+  return this->fusable >= 0 && static_cast<size_t>(this->fusable) + 2 == count && this->jumpTarget != count &&
+         this->currentChunk()->bytes[this->fusable] == first;
+}
+
+// Emits a binary operator, folding a number constant pushed right before it into `withConstant`.
+void Compiler::emitFused(const OpCode instruction, const OpCode withConstant) {
+  if (this->canFuse(OpCode::OP_CONSTANT)) {
+    this->currentChunk()->bytes[this->fusable] = withConstant;
+    this->fusable = -1;
+    return;
+  }
+  this->emitByte(instruction);
+}
+
+ObjString *Compiler::identifierName(const Token &name) {
+  return this->heap.intern(name.start, static_cast<size_t>(name.length));
+}
+
+bool Compiler::identifiersEqual(const Token &a, const Token &b) {
+  return a.length == b.length && std::memcmp(a.start, b.start, static_cast<size_t>(a.length)) == 0;
+}
+
+uint32_t Compiler::globalSlot(ObjString *name) {
+  Value slotValue;
+  if (this->globals.get(objValue(name), &slotValue)) return static_cast<uint32_t>(asNumber(slotValue));
+
+  Chunk *chunk = this->currentChunk();
+  if (chunk->globalNames.size() > UINT24_MAX) {
+    this->error("Too many global variables.");
+    return 0;
+  }
+
+  const auto slot = static_cast<uint32_t>(chunk->globalNames.size());
+  chunk->globalNames.push_back(objValue(name));
+  this->globals.set(objValue(name), numberValue(slot));
+  return slot;
+}
+
+int Compiler::resolveLocal(FunctionState *state, const Token &name) {
+  for (int i = static_cast<int>(state->locals.size()) - 1; i >= 0; i--) {
+    const Local &local = state->locals[i];
+    if (identifiersEqual(local.name, name)) {
+      if (local.depth == -1) {
+        this->error("Can't read local variable in its own initializer.");
+      }
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+// Finds `name` among the locals of the functions enclosing `state`, capturing it into each function in
+// between, or returns -1 if it is a global.
+int Compiler::resolveUpvalue(FunctionState *state, const Token &name) {
+  if (state->enclosing == nullptr) return -1;
+
+  const int local = this->resolveLocal(state->enclosing, name);
+  if (local != -1) {
+    Local &captured = state->enclosing->locals[local];
+    captured.captured = true;
+    this->boxShared(captured);
+    return this->addUpvalue(state, static_cast<uint8_t>(local), true);
+  }
+
+  const int upvalue = this->resolveUpvalue(state->enclosing, name);
+  if (upvalue != -1) return this->addUpvalue(state, static_cast<uint8_t>(upvalue), false);
+
+  return -1;
+}
+
+int Compiler::addUpvalue(FunctionState *state, const uint8_t index, const bool isLocal) {
+  for (size_t i = 0; i < state->upvalues.size(); i++) {
+    const Upvalue &upvalue = state->upvalues[i];
+    if (upvalue.index == index && upvalue.isLocal == isLocal) return static_cast<int>(i);
+  }
+
+  if (state->upvalues.size() > UINT8_MAX) {
+    this->error("Too many closure variables in function.");
+    return 0;
   }
-#endif
+
+  state->upvalues.push_back({index, isLocal});
+  return static_cast<int>(state->upvalues.size() - 1);
+}
+
+// The local of an enclosing function that upvalue `upvalue` of `state` captures.
+Local &Compiler::upvalueLocal(FunctionState *state, const int upvalue) {
+  const Upvalue &captured = state->upvalues[static_cast<size_t>(upvalue)];
+  if (captured.isLocal) return state->enclosing->locals[captured.index];
+  return upvalueLocal(state->enclosing, captured.index);
+}
+
+// Boxes `local` once it is both captured and assigned, rewriting the accesses and captures emitted so far.
+// Those that run before the first capture find no box in the slot yet and use the value there directly.
+void Compiler::boxShared(Local &local) {
+  if (local.boxed || !local.captured || !local.assigned) return;
+
+  local.boxed = true;
+  Chunk *chunk = this->currentChunk();
+  for (const unsigned int offset : local.accesses) {
+    switch (chunk->bytes[offset]) {
+      case OpCode::OP_GET_LOCAL:
+        chunk->bytes[offset] = OpCode::OP_GET_BOXED_LOCAL;
+        break;
+      case OpCode::OP_SET_LOCAL:
+        chunk->bytes[offset] = OpCode::OP_SET_BOXED_LOCAL;
+        break;
+      case OpCode::OP_SET_LOCAL_POP:
+        chunk->bytes[offset] = OpCode::OP_SET_BOXED_LOCAL_POP;
+        break;
+      case OpCode::OP_GET_UPVALUE:
+        chunk->bytes[offset] = OpCode::OP_GET_BOXED_UPVALUE;
+        break;
+      default:
+        break;
+    }
+  }
+  for (const unsigned int offset : local.captures) chunk->bytes[offset] = 2;
+  local.accesses.clear();
+  local.captures.clear();
+}
+
+// Records an access of `local` about to be emitted while the local may still be boxed, and returns whether
+// it already is.
+bool Compiler::trackAccess(Local &local) {
+  if (!local.boxed) local.accesses.push_back(static_cast<unsigned int>(this->currentChunk()->count()));
+  return local.boxed;
+}
+
+void Compiler::addLocal(const Token &name) {
+  if (this->current->locals.size() > UINT8_MAX) {
+    this->error("Too many local variables in function.");
+    return;
+  }
+
+  this->current->locals.push_back({name, -1, false, false, false, {}, {}});
+}
+
+void Compiler::declareVariable() {
+  if (this->current->scopeDepth == 0) return;
+
+  const Token &name = this->parser.previous;
+  for (int i = static_cast<int>(this->current->locals.size()) - 1; i >= 0; i--) {
+    const Local &local = this->current->locals[i];
+    if (local.depth != -1 && local.depth < this->current->scopeDepth) break;
+
+    if (identifiersEqual(local.name, name)) {
+      this->error("Already a variable with this name in this scope.");
+    }
+  }
+
+  this->addLocal(name);
+}
+
+uint32_t Compiler::parseVariable(const std::string &errorMessage) {
+  this->consume(TokenType::TOKEN_IDENTIFIER, errorMessage);
+
+  this->declareVariable();
+  if (this->current->scopeDepth > 0) return 0;
+
+  return this->globalSlot(this->identifierName(this->parser.previous));
+}
+
+void Compiler::markInitialized() { this->current->locals.back().depth = this->current->scopeDepth; }
+
+void Compiler::defineVariable(const uint32_t global) {
+  if (this->current->scopeDepth > 0) {
+    this->markInitialized();
+    return;
+  }
+
+  this->emitOperand(OpCode::OP_DEFINE_GLOBAL, OpCode::OP_DEFINE_GLOBAL_LONG, global);
+}
+
+void Compiler::namedVariable(const Token &name, const bool canAssign) {
+  const int local = this->resolveLocal(this->current, name);
+  if (local != -1) {
+    if (canAssign && this->match(TokenType::TOKEN_EQUAL)) {
+      if (local == 0 && this->current->enclosing != nullptr) {
+        this->error("Can't assign to a function inside its own body.");
+      }
+      // Marked before the value is compiled, so a closure in it captures the variable by reference too.
+      this->current->locals[local].assigned = true;
+      this->boxShared(this->current->locals[local]);
+      this->expression();
+      const bool boxed = this->trackAccess(this->current->locals[local]);
+      this->emitBytes(boxed ? OpCode::OP_SET_BOXED_LOCAL : OpCode::OP_SET_LOCAL, static_cast<uint8_t>(local));
+      this->fusable = static_cast<long>(this->currentChunk()->count() - 2);
+    } else {
+      const bool boxed = this->trackAccess(this->current->locals[local]);
+      this->emitBytes(boxed ? OpCode::OP_GET_BOXED_LOCAL : OpCode::OP_GET_LOCAL, static_cast<uint8_t>(local));
+    }
+    return;
+  }
+
+  const int upvalue = this->resolveUpvalue(this->current, name);
+  if (upvalue != -1) {
+    // Assigning the variable boxes it, so the enclosing function and its other closures see the new value.
+    if (canAssign && this->match(TokenType::TOKEN_EQUAL)) {
+      Local &assigned = upvalueLocal(this->current, upvalue);
+      // Only the callee local has depth 0: the script's variables at that depth are globals.
+      if (assigned.depth == 0) this->error("Can't assign to a function inside its own body.");
+      assigned.assigned = true;
+      this->boxShared(assigned);
+      this->expression();
+      this->emitBytes(OpCode::OP_SET_BOXED_UPVALUE, static_cast<uint8_t>(upvalue));
+      return;
+    }
+    const bool boxed = this->trackAccess(upvalueLocal(this->current, upvalue));
+    const OpCode get = boxed ? OpCode::OP_GET_BOXED_UPVALUE : OpCode::OP_GET_UPVALUE;
+    this->emitBytes(get, static_cast<uint8_t>(upvalue));
+    return;
+  }
+
+  const uint32_t global = this->globalSlot(this->identifierName(name));
+  if (canAssign && this->match(TokenType::TOKEN_EQUAL)) {
+    this->expression();
+    this->emitOperand(OpCode::OP_SET_GLOBAL, OpCode::OP_SET_GLOBAL_LONG, global);
+  } else {
+    this->emitOperand(OpCode::OP_GET_GLOBAL, OpCode::OP_GET_GLOBAL_LONG, global);
+  }
+}
+
+void Compiler::endCompiler() {
   this->emitReturn();
 }
 
@@ -87,17 +660,74 @@ void Compiler::binary() {
   this->parsePrecedence(static_cast<Precedence>(rule.precedence + 1));
 
   switch (operatorType) {
+    case TokenType::TOKEN_BANG_EQUAL:
+      this->emitBytes(OpCode::OP_EQUAL, OpCode::OP_NOT);
+      break;
+    case TokenType::TOKEN_EQUAL_EQUAL:
+      this->emitByte(OpCode::OP_EQUAL);
+      break;
+    case TokenType::TOKEN_GREATER:
+      this->emitFused(OpCode::OP_GREATER, OpCode::OP_GREATER_CONST);
+      break;
+    case TokenType::TOKEN_GREATER_EQUAL:
+      this->emitFused(OpCode::OP_LESS, OpCode::OP_LESS_CONST);
+      this->emitByte(OpCode::OP_NOT);
+      break;
+    case TokenType::TOKEN_LESS:
+      this->emitFused(OpCode::OP_LESS, OpCode::OP_LESS_CONST);
+      break;
+    case TokenType::TOKEN_LESS_EQUAL:
+      this->emitFused(OpCode::OP_GREATER, OpCode::OP_GREATER_CONST);
+      this->emitByte(OpCode::OP_NOT);
+      break;
     case TokenType::TOKEN_PLUS:
-      this->emitByte(OpCode::OP_ADD);
+      this->emitFused(OpCode::OP_ADD, OpCode::OP_ADD_CONST);
       break;
     case TokenType::TOKEN_MINUS:
-      this->emitByte(OpCode::OP_SUBTRACT);
+      this->emitFused(OpCode::OP_SUBTRACT, OpCode::OP_SUBTRACT_CONST);
       break;
     case TokenType::TOKEN_STAR:
-      this->emitByte(OpCode::OP_MULTIPLY);
+      this->emitFused(OpCode::OP_MULTIPLY, OpCode::OP_MULTIPLY_CONST);
       break;
     case TokenType::TOKEN_SLASH:
-      this->emitByte(OpCode::OP_DIVIDE);
+      this->emitFused(OpCode::OP_DIVIDE, OpCode::OP_DIVIDE_CONST);
+      break;
+    default:
+      // Unreachable, hopefully!
+      return;
+  }
+}
+
+void Compiler::andOperator() {
+  const unsigned int endJump = this->emitJump(OpCode::OP_JUMP_IF_FALSE);
+
+  this->emitByte(OpCode::OP_POP);
+  this->parsePrecedence(Precedence::PRECEDENCE_AND);
+
+  this->patchJump(endJump);
+}
+
+void Compiler::orOperator() {
+  const unsigned int elseJump = this->emitJump(OpCode::OP_JUMP_IF_FALSE);
+  const unsigned int endJump = this->emitJump(OpCode::OP_JUMP);
+
+  this->patchJump(elseJump);
+  this->emitByte(OpCode::OP_POP);
+
+  this->parsePrecedence(Precedence::PRECEDENCE_OR);
+  this->patchJump(endJump);
+}
+
+void Compiler::literal() {
+  switch (this->parser.previous.type) {
+    case TokenType::TOKEN_FALSE:
+      this->emitByte(OpCode::OP_FALSE);
+      break;
+    case TokenType::TOKEN_NULL:
+      this->emitByte(OpCode::OP_NULL);
+      break;
+    case TokenType::TOKEN_TRUE:
+      this->emitByte(OpCode::OP_TRUE);
       break;
     default:
       // Unreachable, hopefully!
@@ -106,21 +736,230 @@ void Compiler::binary() {
 }
 
 void Compiler::grouping() {
+  if (this->isArrowFunction()) {
+    this->function(this->parser.previous, true, true);
+    return;
+  }
+
   this->expression();
   this->consume(TokenType::TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
 }
 
+// True if the '(' just consumed opens the parameters of an arrow function, that is if it is followed by a
+// list of names, a ')' and a '->'. Looks ahead without consuming anything.
+bool Compiler::isArrowFunction() {
+  const ScannerPosition position = this->scanner.position();
+  Token token = this->parser.current;
+  while (token.type == TokenType::TOKEN_IDENTIFIER) {
+    token = this->scanner.scanToken();
+    if (token.type != TokenType::TOKEN_COMMA) break;
+    token = this->scanner.scanToken();
+  }
+  const bool isArrow = token.type == TokenType::TOKEN_RIGHT_PAREN &&
+                       this->scanner.scanToken().type == TokenType::TOKEN_ARROW;
+  this->scanner.rewind(position);
+  return isArrow;
+}
+
+// `-> body`, an arrow function without parameters or their parentheses.
+void Compiler::arrowFunction() {
+  this->function(this->parser.previous, true, false);
+}
+
+void Compiler::call() {
+  const uint8_t argCount = this->argumentList();
+  this->emitBytes(OpCode::OP_CALL, argCount);
+  this->lastCall = static_cast<long>(this->currentChunk()->count() - 2);
+}
+
 void Compiler::number() {
-  const double value = std::stod(this->parser.previous.lexeme);
-  this->emitConstant(value);
+  // The lexeme is not null-terminated, and strtod would read on past it, for one into an exponent the
+  // language does not have.
+  const Token &token = this->parser.previous;
+  const auto length = static_cast<size_t>(token.length);
+  char buffer[NUMBER_BUFFER_SIZE];
+  std::string copy;
+  const char *digits = buffer;
+  if (length < NUMBER_BUFFER_SIZE) {
+    std::memcpy(buffer, token.start, length);
+    buffer[length] = '\0';
+  } else {
+    copy.assign(token.start, length);
+    digits = copy.c_str();
+  }
+  this->emitConstant(numberValue(std::strtod(digits, nullptr)));
+}
+
+void Compiler::string() {
+  const char *lexeme = this->parser.previous.start;
+  const auto length = static_cast<size_t>(this->parser.previous.length);
+
+  // Strip the quotes. Most strings have no escape sequences and are interned straight from the source.
+  if (std::memchr(lexeme + 1, '\\', length - 2) == nullptr) {
+    this->emitConstant(objValue(this->heap.intern(lexeme + 1, length - 2)));
+    return;
+  }
+
+  std::string value;
+  value.reserve(length - 2);
+  for (size_t i = 1; i < length - 1; i++) {
+    if (lexeme[i] != '\\' || i + 1 >= length - 1) {
+      value.push_back(lexeme[i]);
+      continue;
+    }
+
+    switch (lexeme[++i]) {
+      case 'b':
+        value.push_back('\b');
+        break;
+      case 'f':
+        value.push_back('\f');
+        break;
+      case 'n':
+        value.push_back('\n');
+        break;
+      case 'r':
+        value.push_back('\r');
+        break;
+      case 't':
+        value.push_back('\t');
+        break;
+      case 'v':
+        value.push_back('\v');
+        break;
+      case '0':
+        value.push_back('\0');
+        break;
+      default:
+        value.push_back(lexeme[i]);
+        break;
+    }
+  }
+
+  this->emitConstant(objValue(this->heap.intern(value.data(), value.length())));
+}
+
+void Compiler::map() {
+  uint32_t count = 0;
+  if (!this->check(TokenType::TOKEN_RIGHT_BRACE)) {
+    do {
+      // Allow a trailing comma.
+      if (this->check(TokenType::TOKEN_RIGHT_BRACE)) break;
+
+      if (this->match(TokenType::TOKEN_IDENTIFIER)) {
+        this->emitConstant(objValue(this->identifierName(this->parser.previous)));
+      } else if (this->match(TokenType::TOKEN_STRING)) {
+        this->string();
+      } else if (this->match(TokenType::TOKEN_NUMBER)) {
+        this->number();
+      } else {
+        this->errorAtCurrent("Expect map key.");
+        return;
+      }
+
+      this->consume(TokenType::TOKEN_COLON, "Expect ':' after map key.");
+      this->expression();
+      count++;
+    } while (this->match(TokenType::TOKEN_COMMA));
+  }
+
+  this->consume(TokenType::TOKEN_RIGHT_BRACE, "Expect '}' after map entries.");
+  this->emitOperand(OpCode::OP_MAP, OpCode::OP_MAP_LONG, count);
 }
 
+void Compiler::array() {
+  uint32_t count = 0;
+  if (!this->check(TokenType::TOKEN_RIGHT_BRACKET)) {
+    do {
+      // Allow a trailing comma.
+      if (this->check(TokenType::TOKEN_RIGHT_BRACKET)) break;
+
+      this->expression();
+      count++;
+    } while (this->match(TokenType::TOKEN_COMMA));
+  }
+
+  this->consume(TokenType::TOKEN_RIGHT_BRACKET, "Expect ']' after array elements.");
+  this->emitOperand(OpCode::OP_ARRAY, OpCode::OP_ARRAY_LONG, count);
+}
+
+uint8_t Compiler::argumentList() {
+  int argCount = 0;
+  if (!this->check(TokenType::TOKEN_RIGHT_PAREN)) {
+    do {
+      this->expression();
+      if (argCount == UINT8_MAX) {
+        this->error("Can't have more than 255 arguments.");
+      }
+      argCount++;
+    } while (this->match(TokenType::TOKEN_COMMA));
+  }
+
+  this->consume(TokenType::TOKEN_RIGHT_PAREN, "Expect ')' after arguments.");
+  return static_cast<uint8_t>(argCount);
+}
+
+void Compiler::dot(const bool canAssign) {
+  this->consume(TokenType::TOKEN_IDENTIFIER, "Expect property name after '.'.");
+  const uint32_t name = this->makeConstant(objValue(this->identifierName(this->parser.previous)));
+
+  if (this->match(TokenType::TOKEN_LEFT_PAREN)) {
+    const uint8_t argCount = this->argumentList();
+    this->emitOperand(OpCode::OP_INVOKE, OpCode::OP_INVOKE_LONG, name);
+    this->emitByte(argCount);
+  } else if (canAssign && this->match(TokenType::TOKEN_EQUAL)) {
+    this->expression();
+    this->emitOperand(OpCode::OP_SET_PROPERTY, OpCode::OP_SET_PROPERTY_LONG, name);
+  } else {
+    this->emitOperand(OpCode::OP_GET_PROPERTY, OpCode::OP_GET_PROPERTY_LONG, name);
+  }
+  this->emitCache();
+}
+
+void Compiler::index(const bool canAssign) {
+  // `[start:end]` slices; either bound may be omitted.
+  if (this->match(TokenType::TOKEN_COLON)) {
+    this->emitByte(OpCode::OP_NULL);
+    this->slice();
+    return;
+  }
+
+  this->expression();
+  if (this->match(TokenType::TOKEN_COLON)) {
+    this->slice();
+    return;
+  }
+  this->consume(TokenType::TOKEN_RIGHT_BRACKET, "Expect ']' after index.");
+
+  if (canAssign && this->match(TokenType::TOKEN_EQUAL)) {
+    this->expression();
+    this->emitByte(OpCode::OP_SET_INDEX);
+  } else {
+    this->emitByte(OpCode::OP_GET_INDEX);
+  }
+}
+
+void Compiler::slice() {
+  if (this->check(TokenType::TOKEN_RIGHT_BRACKET)) {
+    this->emitByte(OpCode::OP_NULL);
+  } else {
+    this->expression();
+  }
+  this->consume(TokenType::TOKEN_RIGHT_BRACKET, "Expect ']' after slice.");
+  this->emitByte(OpCode::OP_SLICE);
+}
+
+void Compiler::variable(const bool canAssign) { this->namedVariable(this->parser.previous, canAssign); }
+
 void Compiler::unary() {
   const TokenType operatorType = this->parser.previous.type;
 
   this->parsePrecedence(Precedence::PRECEDENCE_UNARY);
 
   switch (operatorType) {
+    case TokenType::TOKEN_BANG:
+      this->emitByte(OpCode::OP_NOT);
+      break;
     case TokenType::TOKEN_MINUS:
       this->emitByte(OpCode::OP_NEGATE);
       break;
@@ -130,78 +969,114 @@ void Compiler::unary() {
   }
 }
 
+// `spawn f(args)` makes the call right after it run on a fiber of its own.
+void Compiler::spawn() {
+  this->parsePrecedence(Precedence::PRECEDENCE_CALL);
+
+  const size_t count = this->currentChunk()->count();
+  if (this->lastCall < 0 || static_cast<size_t>(this->lastCall) + 2 != count) {
+    this->error("Expect a function call after 'spawn'.");
+    return;
+  }
+  this->currentChunk()->bytes[this->lastCall] = OpCode::OP_SPAWN;
+  // Returning a fiber is not a tail call.
+  this->lastCall = -1;
+}
+
+void Compiler::await() {
+  this->parsePrecedence(Precedence::PRECEDENCE_UNARY);
+  this->emitByte(OpCode::OP_AWAIT);
+}
+
 void Compiler::parsePrecedence(const Precedence precedence) {
   this->advance();
 
   const ParseFn prefixRule = this->getRule(this->parser.previous.type).prefix;
   if (prefixRule == nullptr) {
-    this->errorAtCurrent("Expect expression.");
+    this->error("Expect expression.");
     return;
   }
 
-  prefixRule();
+  const bool canAssign = precedence <= Precedence::PRECEDENCE_ASSIGNMENT;
+  prefixRule(canAssign);
 
   while (precedence <= this->getRule(this->parser.current.type).precedence) {
     this->advance();
     const ParseFn infixRule = this->getRule(this->parser.previous.type).infix;
-    infixRule();
+    infixRule(canAssign);
+  }
+
+  if (canAssign && this->match(TokenType::TOKEN_EQUAL)) {
+    this->error("Invalid assignment target.");
   }
 }
 
 ParseRule Compiler::getRule(const TokenType type) {
   switch (type) {
     case TOKEN_LEFT_PAREN:
-      return {[this]() { this->grouping(); }, nullptr, Precedence::PRECEDENCE_NONE};
+      return {[this](bool) { this->grouping(); }, [this](bool) { this->call(); },
+              Precedence::PRECEDENCE_CALL};
     case TOKEN_RIGHT_PAREN:
       return {nullptr, nullptr, Precedence::PRECEDENCE_NONE};
     case TOKEN_LEFT_BRACE:
-      return {nullptr, nullptr, Precedence::PRECEDENCE_NONE};
+      return {[this](bool) { this->map(); }, nullptr, Precedence::PRECEDENCE_NONE};
     case TOKEN_RIGHT_BRACE:
       return {nullptr, nullptr, Precedence::PRECEDENCE_NONE};
+    case TOKEN_LEFT_BRACKET:
+      return {[this](bool) { this->array(); }, [this](const bool canAssign) { this->index(canAssign); },
+              Precedence::PRECEDENCE_CALL};
+    case TOKEN_RIGHT_BRACKET:
+      return {nullptr, nullptr, Precedence::PRECEDENCE_NONE};
+    case TOKEN_COLON:
+      return {nullptr, nullptr, Precedence::PRECEDENCE_NONE};
     case TOKEN_COMMA:
       return {nullptr, nullptr, Precedence::PRECEDENCE_NONE};
     case TOKEN_DOT:
-      return {nullptr, nullptr, Precedence::PRECEDENCE_NONE};
+      return {nullptr, [this](const bool canAssign) { this->dot(canAssign); }, Precedence::PRECEDENCE_CALL};
     case TOKEN_MINUS:
-      return {[this]() { this->unary(); }, [this]() { this->binary(); }, Precedence::PRECEDENCE_TERM};
+      return {[this](bool) { this->unary(); }, [this](bool) { this->binary(); }, Precedence::PRECEDENCE_TERM};
     case TOKEN_PLUS:
-      return {nullptr, [this]() { this->binary(); }, Precedence::PRECEDENCE_TERM};
+      return {nullptr, [this](bool) { this->binary(); }, Precedence::PRECEDENCE_TERM};
     case TOKEN_SEMICOLON:
       return {nullptr, nullptr, Precedence::PRECEDENCE_NONE};
     case TOKEN_SLASH:
-      return {nullptr, [this]() { this->binary(); }, Precedence::PRECEDENCE_FACTOR};
+      return {nullptr, [this](bool) { this->binary(); }, Precedence::PRECEDENCE_FACTOR};
     case TOKEN_STAR:
-      return {nullptr, [this]() { this->binary(); }, Precedence::PRECEDENCE_FACTOR};
+      return {nullptr, [this](bool) { this->binary(); }, Precedence::PRECEDENCE_FACTOR};
+    case TOKEN_ARROW:
+      return {[this](bool) { this->arrowFunction(); }, nullptr, Precedence::PRECEDENCE_NONE};
     case TOKEN_BANG:
-      return {nullptr, nullptr, Precedence::PRECEDENCE_NONE};
+      return {[this](bool) { this->unary(); }, nullptr, Precedence::PRECEDENCE_NONE};
     case TOKEN_BANG_EQUAL:
-      return {nullptr, nullptr, Precedence::PRECEDENCE_NONE};
+      return {nullptr, [this](bool) { this->binary(); }, Precedence::PRECEDENCE_EQUALITY};
     case TOKEN_EQUAL:
       return {nullptr, nullptr, Precedence::PRECEDENCE_NONE};
     case TOKEN_EQUAL_EQUAL:
-      return {nullptr, nullptr, Precedence::PRECEDENCE_NONE};
+      return {nullptr, [this](bool) { this->binary(); }, Precedence::PRECEDENCE_EQUALITY};
     case TOKEN_GREATER:
-      return {nullptr, nullptr, Precedence::PRECEDENCE_NONE};
+      return {nullptr, [this](bool) { this->binary(); }, Precedence::PRECEDENCE_COMPARISON};
     case TOKEN_GREATER_EQUAL:
-      return {nullptr, nullptr, Precedence::PRECEDENCE_NONE};
+      return {nullptr, [this](bool) { this->binary(); }, Precedence::PRECEDENCE_COMPARISON};
     case TOKEN_LESS:
-      return {nullptr, nullptr, Precedence::PRECEDENCE_NONE};
+      return {nullptr, [this](bool) { this->binary(); }, Precedence::PRECEDENCE_COMPARISON};
     case TOKEN_LESS_EQUAL:
-      return {nullptr, nullptr, Precedence::PRECEDENCE_NONE};
+      return {nullptr, [this](bool) { this->binary(); }, Precedence::PRECEDENCE_COMPARISON};
     case TOKEN_IDENTIFIER:
-      return {nullptr, nullptr, Precedence::PRECEDENCE_NONE};
+      return {[this](const bool canAssign) { this->variable(canAssign); }, nullptr, Precedence::PRECEDENCE_NONE};
     case TOKEN_STRING:
-      return {nullptr, nullptr, Precedence::PRECEDENCE_NONE};
+      return {[this](bool) { this->string(); }, nullptr, Precedence::PRECEDENCE_NONE};
     case TOKEN_NUMBER:
-      return {[this]() { this->number(); }, nullptr, Precedence::PRECEDENCE_NONE};
+      return {[this](bool) { this->number(); }, nullptr, Precedence::PRECEDENCE_NONE};
     case TOKEN_AND:
-      return {nullptr, nullptr, Precedence::PRECEDENCE_NONE};
+      return {nullptr, [this](bool) { this->andOperator(); }, Precedence::PRECEDENCE_AND};
+    case TOKEN_AWAIT:
+      return {[this](bool) { this->await(); }, nullptr, Precedence::PRECEDENCE_NONE};
     case TOKEN_CLASS:
       return {nullptr, nullptr, Precedence::PRECEDENCE_NONE};
     case TOKEN_ELSE:
       return {nullptr, nullptr, Precedence::PRECEDENCE_NONE};
     case TOKEN_FALSE:
-      return {nullptr, nullptr, Precedence::PRECEDENCE_NONE};
+      return {[this](bool) { this->literal(); }, nullptr, Precedence::PRECEDENCE_NONE};
     case TOKEN_FOR:
       return {nullptr, nullptr, Precedence::PRECEDENCE_NONE};
     case TOKEN_FUNCTION:
@@ -209,19 +1084,21 @@ ParseRule Compiler::getRule(const TokenType type) {
     case TOKEN_IF:
       return {nullptr, nullptr, Precedence::PRECEDENCE_NONE};
     case TOKEN_NULL:
-      return {nullptr, nullptr, Precedence::PRECEDENCE_NONE};
+      return {[this](bool) { this->literal(); }, nullptr, Precedence::PRECEDENCE_NONE};
     case TOKEN_OR:
-      return {nullptr, nullptr, Precedence::PRECEDENCE_NONE};
+      return {nullptr, [this](bool) { this->orOperator(); }, Precedence::PRECEDENCE_OR};
     case TOKEN_PRINT:
       return {nullptr, nullptr, Precedence::PRECEDENCE_NONE};
     case TOKEN_RETURN:
       return {nullptr, nullptr, Precedence::PRECEDENCE_NONE};
+    case TOKEN_SPAWN:
+      return {[this](bool) { this->spawn(); }, nullptr, Precedence::PRECEDENCE_NONE};
     case TOKEN_SUPER:
       return {nullptr, nullptr, Precedence::PRECEDENCE_NONE};
     case TOKEN_THIS:
       return {nullptr, nullptr, Precedence::PRECEDENCE_NONE};
     case TOKEN_TRUE:
-      return {nullptr, nullptr, Precedence::PRECEDENCE_NONE};
+      return {[this](bool) { this->literal(); }, nullptr, Precedence::PRECEDENCE_NONE};
     case TOKEN_VAR:
       return {nullptr, nullptr, Precedence::PRECEDENCE_NONE};
     case TOKEN_WHILE:
@@ -235,7 +1112,9 @@ ParseRule Compiler::getRule(const TokenType type) {
   }
 }
 
-void Compiler::errorAtCurrent(const std::string &message) { this->errorAt(this->parser.previous, message); }
+void Compiler::error(const std::string &message) { this->errorAt(this->parser.previous, message); }
+
+void Compiler::errorAtCurrent(const std::string &message) { this->errorAt(this->parser.current, message); }
 
 void Compiler::errorAt(const Token &token, const std::string &message) {
   if (this->parser.panicMode) return;
@@ -246,7 +1125,9 @@ void Compiler::errorAt(const Token &token, const std::string &message) {
     std::cerr << " at end";
   } else if (token.type == TokenType::TOKEN_ERROR) {
   } else {
-    std::cerr << " at '" << token.lexeme << "'";
+    std::cerr << " at '";
+    std::cerr.write(token.start, token.length);
+    std::cerr << "'";
   }
 
   std::cerr << ": " << message << std::endl;
@@ -2,8 +2,8 @@
 #define COMPILER_H
 
 
-#include "../debug.h"
 #include "../chunk.h"
+#include "../heap.h"
 #include "scanner.h"
 #include "token.h"
 
@@ -24,7 +24,7 @@ typedef enum {
   PRECEDENCE_PRIMARY
 } Precedence;
 
-typedef std::function<void()> ParseFn;
+typedef std::function<void(bool canAssign)> ParseFn;
 
 typedef struct {
   ParseFn prefix;
@@ -39,39 +39,143 @@ typedef struct {
   bool panicMode;
 } Parser;
 
-#endif // COMPILER_H
+// A local variable lives in the stack slot matching its index. `depth` is -1 until its initializer is done.
+// Closures copy the locals they capture. A local that is both captured and assigned after its declaration is
+// `boxed` instead, so the closures share it: once it is, the code that accesses it so far is rewritten to go
+// through the box, and later code is compiled that way directly.
+typedef struct {
+  Token name;
+  int depth;
+  bool captured;
+  bool assigned;
+  bool boxed;
+  // Until the local is boxed: offsets of the instructions that access it, including upvalue reads in nested
+  // functions, and of the isLocal byte of every upvalue pair that captures it.
+  Array<unsigned int> accesses;
+  Array<unsigned int> captures;
+} Local;
+
+// A variable a function captures: a local slot of the enclosing function, or one of its upvalues.
+typedef struct {
+  uint8_t index;
+  bool isLocal;
+} Upvalue;
+
+// Locals and upvalues of the function being compiled. The script is the outermost function; in every other
+// one local 0 is the callee, named after the function so its body can call itself.
+typedef struct FunctionState {
+  struct FunctionState *enclosing;
+  Array<Local> locals;
+  Array<Upvalue> upvalues;
+  int scopeDepth;
+} FunctionState;
+
+// Compiles source it does not copy; it must outlive the compiler (see Scanner).
 class Compiler {
 public:
-  explicit Compiler(const std::string &source, Chunk &chunk);
+  Compiler(const char *source, size_t length, Chunk &chunk, Heap &heap);
+  Compiler(const std::string &source, Chunk &chunk, Heap &heap);
+  ~Compiler();
   bool compile();
 
 private:
-  std::string source;
   Scanner scanner;
   Parser parser = {.hadError = false, .panicMode = false};
   Chunk *compilingChunk;
-#ifdef DEBUG_PRINT_CODE
-  Debug debug;
-#endif
+  Heap &heap;
+  FunctionState script = {nullptr, {}, {}, 0};
+  FunctionState *current = &this->script;
+  // Global slot of each interned global name, resolved at compile time.
+  Table globals;
+  // Offset of the last emitted instruction while it can still be fused with the next one, or -1. Only a
+  // short OP_CONSTANT of a number or an OP_SET_LOCAL qualifies.
+  long fusable = -1;
+  // Where the most recently patched forward jump lands. No instruction is fused across it.
+  size_t jumpTarget = 0;
+  // Offset of the last OP_CALL emitted, or -1; returning its result right away makes it a tail call.
+  long lastCall = -1;
 
   void expression();
+  void declaration();
+  void varDeclaration();
+  void funDeclaration();
+  void function(const Token &name, bool isArrow, bool hasParameters);
+  void functionBody(bool isArrow);
+  void statement();
+  void printStatement();
+  void returnStatement();
+  void expressionStatement();
+  void ifStatement();
+  void whileStatement();
+  void forStatement();
+  void block();
+  void beginScope();
+  void endScope();
+  void synchronize();
 
   void advance();
   void consume(TokenType type, const std::string &message);
-  void emitByte(unsigned long long byte);
-  void emitBytes(unsigned long long byte1, unsigned long long byte2);
+  bool check(TokenType type) const;
+  bool match(TokenType type);
+  void emitByte(uint8_t byte);
+  void emitBytes(uint8_t byte1, uint8_t byte2);
+  void emitLong(uint32_t operand);
+  void emitOperand(OpCode shortOp, OpCode longOp, uint32_t operand);
+  void emitCache();
   void emitReturn();
-  unsigned long long makeConstant(double value);
-  void emitConstant(double value);
+  void emitReturnValue();
+  unsigned int emitJump(OpCode instruction);
+  void patchJump(unsigned int offset);
+  void emitLoop(unsigned int loopStart);
+  uint32_t makeConstant(Value value);
+  void emitConstant(Value value);
+  bool canFuse(OpCode first);
+  void emitFused(OpCode instruction, OpCode withConstant);
+
+  ObjString *identifierName(const Token &name);
+  uint32_t globalSlot(ObjString *name);
+  static bool identifiersEqual(const Token &a, const Token &b);
+  int resolveLocal(FunctionState *state, const Token &name);
+  int resolveUpvalue(FunctionState *state, const Token &name);
+  int addUpvalue(FunctionState *state, uint8_t index, bool isLocal);
+  static Local &upvalueLocal(FunctionState *state, int upvalue);
+  void boxShared(Local &local);
+  bool trackAccess(Local &local);
+  void addLocal(const Token &name);
+  void declareVariable();
+  uint32_t parseVariable(const std::string &errorMessage);
+  void markInitialized();
+  void defineVariable(uint32_t global);
+  void namedVariable(const Token &name, bool canAssign);
+
   void endCompiler();
   void binary();
+  void andOperator();
+  void orOperator();
+  void literal();
   void grouping();
+  bool isArrowFunction();
+  void arrowFunction();
+  void call();
   void number();
+  void string();
+  void map();
+  void array();
+  uint8_t argumentList();
+  void dot(bool canAssign);
+  void index(bool canAssign);
+  void slice();
+  void variable(bool canAssign);
   void unary();
+  void spawn();
+  void await();
   void parsePrecedence(Precedence precedence);
   ParseRule getRule(TokenType type);
 
+  void error(const std::string &message);
   void errorAtCurrent(const std::string &message);
   void errorAt(const Token &token, const std::string &message);
   Chunk *currentChunk();
 };
+
+#endif // COMPILER_H
@@ -1,9 +1,225 @@
 #include "scanner.h"
 
-#include <iostream>
-Scanner::Scanner(const std::string &source) : source(source) {}
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SCAN_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SCAN_SSE2
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// The skip functions below classify a block of source characters per step, a byte per lane, and finish the
+// last block's worth one character at a time, so they never read past the end of the source. Comparisons are
+// on signed bytes: characters above 0x7F are negative and fall outside every range tested.
+#if defined(SCAN_AVX2)
+#define SCAN_WIDTH 32
+#define SCAN_ALL 0xFFFFFFFFu
+typedef __m256i Block;
+static Block loadBlock(const char *characters) {
+  return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(characters));
+}
+static Block splat(const char c) { return _mm256_set1_epi8(c); }
+static Block equal(const Block a, const Block b) { return _mm256_cmpeq_epi8(a, b); }
+static Block greater(const Block a, const Block b) { return _mm256_cmpgt_epi8(a, b); }
+static Block either(const Block a, const Block b) { return _mm256_or_si256(a, b); }
+static Block both(const Block a, const Block b) { return _mm256_and_si256(a, b); }
+static uint32_t lanes(const Block block) { return static_cast<uint32_t>(_mm256_movemask_epi8(block)); }
+#elif defined(SCAN_SSE2)
+#define SCAN_WIDTH 16
+#define SCAN_ALL 0xFFFFu
+typedef __m128i Block;
+static Block loadBlock(const char *characters) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i *>(characters));
+}
+static Block splat(const char c) { return _mm_set1_epi8(c); }
+static Block equal(const Block a, const Block b) { return _mm_cmpeq_epi8(a, b); }
+static Block greater(const Block a, const Block b) { return _mm_cmpgt_epi8(a, b); }
+static Block either(const Block a, const Block b) { return _mm_or_si128(a, b); }
+static Block both(const Block a, const Block b) { return _mm_and_si128(a, b); }
+static uint32_t lanes(const Block block) { return static_cast<uint32_t>(_mm_movemask_epi8(block)); }
+#endif
+
+// Most runs of whitespace, identifiers and numbers are a few characters long, too short for a block to pay
+// for itself, so the skip functions take this many characters one at a time before switching to blocks.
+#define SCAN_SHORT 8
+
+#ifdef SCAN_WIDTH
+// Lanes holding a character from `low` to `high`.
+static Block inRange(const Block block, const char low, const char high) {
+  const Block above = greater(block, splat(static_cast<char>(low - 1)));
+  return both(above, greater(splat(static_cast<char>(high + 1)), block));
+}
+
+static int lowestBit(const uint32_t mask) {
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return static_cast<int>(index);
+#else
+  return __builtin_ctz(mask);
+#endif
+}
+
+// Newlines are few, so clearing their bits one at a time is cheap.
+static int countBits(uint32_t mask) {
+  int count = 0;
+  for (; mask != 0; mask &= mask - 1) count++;
+  return count;
+}
+
+// Bits below the lowest set bit of `stops`.
+static uint32_t before(const uint32_t stops) { return (stops & (0u - stops)) - 1; }
+#endif
+
+// Moves past whitespace, counting the newlines passed.
+void Scanner::skipBlanks() {
+  const char *source = this->source;
+  int current = this->current;
+  for (const int end = std::min(current + SCAN_SHORT, this->length); current < end; current++) {
+    if (!isBlank(source[current])) {
+      this->current = current;
+      return;
+    }
+    if (source[current] == '\n') this->line++;
+  }
+#ifdef SCAN_WIDTH
+  for (; current + SCAN_WIDTH <= this->length; current += SCAN_WIDTH) {
+    const Block block = loadBlock(source + current);
+    const Block newline = equal(block, splat('\n'));
+    const Block blank = either(either(equal(block, splat(' ')), equal(block, splat('\t'))),
+                               either(equal(block, splat('\r')), newline));
+    const uint32_t stops = ~lanes(blank) & SCAN_ALL;
+    if (stops != 0) {
+      this->line += countBits(lanes(newline) & before(stops));
+      this->current = current + lowestBit(stops);
+      return;
+    }
+    this->line += countBits(lanes(newline));
+  }
+#endif
+  for (; current < this->length && isBlank(source[current]); current++) {
+    if (source[current] == '\n') this->line++;
+  }
+  this->current = current;
+}
+
+// Moves to the newline ending the current line, or the end of the source.
+void Scanner::skipToLineEnd() {
+  const char *source = this->source;
+  int current = this->current;
+#ifdef SCAN_WIDTH
+  for (; current + SCAN_WIDTH <= this->length; current += SCAN_WIDTH) {
+    const uint32_t stops = lanes(equal(loadBlock(source + current), splat('\n')));
+    if (stops != 0) {
+      this->current = current + lowestBit(stops);
+      return;
+    }
+  }
+#endif
+  while (current < this->length && source[current] != '\n') current++;
+  this->current = current;
+}
+
+// Moves to the next `quote` or backslash, or the end of the source, counting the newlines passed.
+void Scanner::skipToStringStop(const char quote) {
+  const char *source = this->source;
+  int current = this->current;
+  for (const int end = std::min(current + SCAN_SHORT, this->length); current < end; current++) {
+    if (source[current] == quote || source[current] == '\\') {
+      this->current = current;
+      return;
+    }
+    if (source[current] == '\n') this->line++;
+  }
+#ifdef SCAN_WIDTH
+  for (; current + SCAN_WIDTH <= this->length; current += SCAN_WIDTH) {
+    const Block block = loadBlock(source + current);
+    const uint32_t newlines = lanes(equal(block, splat('\n')));
+    const uint32_t stops = lanes(either(equal(block, splat(quote)), equal(block, splat('\\'))));
+    if (stops != 0) {
+      this->line += countBits(newlines & before(stops));
+      this->current = current + lowestBit(stops);
+      return;
+    }
+    this->line += countBits(newlines);
+  }
+#endif
+  for (; current < this->length && source[current] != quote && source[current] != '\\'; current++) {
+    if (source[current] == '\n') this->line++;
+  }
+  this->current = current;
+}
+
+// Moves past the characters that can continue an identifier.
+void Scanner::skipWord() {
+  const char *source = this->source;
+  int current = this->current;
+  for (const int end = std::min(current + SCAN_SHORT, this->length); current < end; current++) {
+    if (!isAlpha(source[current]) && !isDigit(source[current])) {
+      this->current = current;
+      return;
+    }
+  }
+#ifdef SCAN_WIDTH
+  for (; current + SCAN_WIDTH <= this->length; current += SCAN_WIDTH) {
+    const Block block = loadBlock(source + current);
+    // Setting bit 5 folds upper case onto lower case and moves nothing else into a to z.
+    const Block word = either(either(inRange(either(block, splat(0x20)), 'a', 'z'), inRange(block, '0', '9')),
+                              equal(block, splat('_')));
+    const uint32_t stops = ~lanes(word) & SCAN_ALL;
+    if (stops != 0) {
+      this->current = current + lowestBit(stops);
+      return;
+    }
+  }
+#endif
+  while (current < this->length && (isAlpha(source[current]) || isDigit(source[current]))) current++;
+  this->current = current;
+}
+
+// Moves past digits.
+void Scanner::skipDigits() {
+  const char *source = this->source;
+  int current = this->current;
+  for (const int end = std::min(current + SCAN_SHORT, this->length); current < end; current++) {
+    if (!isDigit(source[current])) {
+      this->current = current;
+      return;
+    }
+  }
+#ifdef SCAN_WIDTH
+  for (; current + SCAN_WIDTH <= this->length; current += SCAN_WIDTH) {
+    const uint32_t stops = ~lanes(inRange(loadBlock(source + current), '0', '9')) & SCAN_ALL;
+    if (stops != 0) {
+      this->current = current + lowestBit(stops);
+      return;
+    }
+  }
+#endif
+  while (current < this->length && isDigit(source[current])) current++;
+  this->current = current;
+}
+
+Scanner::Scanner(const char *source, const size_t length)
+    : source(source), length(length > SCANNER_MAX_LENGTH ? 0 : static_cast<int>(length)),
+      tooLarge(length > SCANNER_MAX_LENGTH) {}
+
+Scanner::Scanner(const std::string &source) : Scanner(source.data(), source.length()) {}
 
 Token Scanner::scanToken() {
+  if (this->tooLarge) {
+    this->tooLarge = false;
+    return this->errorToken("Source is too large.");
+  }
+
   this->skipWhitespace();
   this->start = this->current;
 
@@ -19,12 +235,18 @@ Token Scanner::scanToken() {
       return this->makeToken(TokenType::TOKEN_LEFT_BRACE);
     case '}':
       return this->makeToken(TokenType::TOKEN_RIGHT_BRACE);
+    case '[':
+      return this->makeToken(TokenType::TOKEN_LEFT_BRACKET);
+    case ']':
+      return this->makeToken(TokenType::TOKEN_RIGHT_BRACKET);
+    case ':':
+      return this->makeToken(TokenType::TOKEN_COLON);
     case ',':
       return this->makeToken(TokenType::TOKEN_COMMA);
     case '.':
       return this->makeToken(TokenType::TOKEN_DOT);
     case '-':
-      return this->makeToken(TokenType::TOKEN_MINUS);
+      return this->makeToken(this->match('>') ? TokenType::TOKEN_ARROW : TokenType::TOKEN_MINUS);
     case '+':
       return this->makeToken(TokenType::TOKEN_PLUS);
     case ';':
@@ -55,63 +277,48 @@ Token Scanner::scanToken() {
   return this->errorToken("Unexpected character.");
 }
 
+ScannerPosition Scanner::position() const { return {this->current, this->line}; }
+
+void Scanner::rewind(const ScannerPosition position) {
+  this->current = position.current;
+  this->line = position.line;
+}
+
 void Scanner::skipWhitespace() {
   for (;;) {
-    const char c = this->peek();
-    switch (c) {
-      case ' ':
-      case '\r':
-      case '\t':
-        this->advance();
-        break;
-      case '\n':
-        this->line++;
-        this->advance();
-        break;
-      case '/':
-        if (this->peekNext() == '/') {
-          // A comment goes until the end of the line.
-          while (peek() != '\n' && !isAtEnd()) this->advance();
-        } else {
-          return;
-        }
-        break;
-      default:
-        return;
-    }
+    this->skipBlanks();
+    if (this->peek() != '/' || this->peekNext() != '/') return;
+
+    // A comment goes until the end of the line.
+    this->skipToLineEnd();
   }
 }
 
 Token Scanner::string() {
   const char quote = this->peekPrevious();
-  while (this->peek() != quote && !this->isAtEnd()) {
-    if (this->peek() == '\n') this->line++;
-    if (this->peek() == '\\' && this->peekNext() == quote) {
-      this->advance();
-    }
+  for (;;) {
+    this->skipToStringStop(quote);
+    if (this->isAtEnd()) return this->errorToken("Unterminated string.");
+    if (this->peek() == quote) break;
+
+    // A backslash. It keeps a quote after it from ending the string.
+    if (this->peekNext() == quote) this->advance();
     this->advance();
   }
 
-  if (this->isAtEnd()) return this->errorToken("Unterminated string.");
-
   // The closing quote.
   this->advance();
   return this->makeToken(TokenType::TOKEN_STRING);
 }
 
 Token Scanner::number() {
-  while (this->isDigit(this->peek())) {
-    this->advance();
-  }
+  this->skipDigits();
 
   // Look for a fractional part.
   if (this->peek() == '.' && this->isDigit(this->peekNext())) {
     // Consume the ".".
     this->advance();
-
-    while (this->isDigit(this->peek())) {
-      this->advance();
-    }
+    this->skipDigits();
   }
 
   return this->makeToken(TokenType::TOKEN_NUMBER);
@@ -120,44 +327,70 @@ Token Scanner::number() {
 bool Scanner::isDigit(const char c) { return c >= '0' && c <= '9'; }
 
 Token Scanner::identifier() {
-  while (this->isAlpha(this->peek()) || this->isDigit(this->peek())) {
-    this->advance();
-  }
+  this->skipWord();
 
   return this->makeToken(this->identifierType());
 }
 
-TokenType Scanner::identifierType() {
-  const std::string keyword = this->source.substr(this->start, this->current - this->start);
-  if (keyword.compare("true") == 0) return TokenType::TOKEN_TRUE;
-  if (keyword.compare("false") == 0) return TokenType::TOKEN_FALSE;
-
-  if (keyword.compare("and") == 0) return TokenType::TOKEN_AND;
-  if (keyword.compare("or") == 0) return TokenType::TOKEN_OR;
-
-  if (keyword.compare("var") == 0) return TokenType::TOKEN_VAR;
-
-  if (keyword.compare("function") == 0) return TokenType::TOKEN_FUNCTION;
-  if (keyword.compare("return") == 0) return TokenType::TOKEN_RETURN;
-
-  if (keyword.compare("class") == 0) return TokenType::TOKEN_CLASS;
-  if (keyword.compare("super") == 0) return TokenType::TOKEN_SUPER;
-  if (keyword.compare("this") == 0) return TokenType::TOKEN_THIS;
-
-  if (keyword.compare("if") == 0) return TokenType::TOKEN_IF;
-  if (keyword.compare("else") == 0) return TokenType::TOKEN_ELSE;
-
-  if (keyword.compare("while") == 0) return TokenType::TOKEN_WHILE;
-  if (keyword.compare("for") == 0) return TokenType::TOKEN_FOR;
+// Keywords are told apart by their first letter and length before any comparison.
+TokenType Scanner::identifierType() const {
+  const int length = this->current - this->start;
+  switch (this->source[this->start]) {
+    case 'a':
+      if (length == 3) return this->checkKeyword("and", TokenType::TOKEN_AND);
+      return this->checkKeyword("await", TokenType::TOKEN_AWAIT);
+    case 'c':
+      return this->checkKeyword("class", TokenType::TOKEN_CLASS);
+    case 'e':
+      return this->checkKeyword("else", TokenType::TOKEN_ELSE);
+    case 'f':
+      if (length == 3) return this->checkKeyword("for", TokenType::TOKEN_FOR);
+      if (length == 5) return this->checkKeyword("false", TokenType::TOKEN_FALSE);
+      return this->checkKeyword("function", TokenType::TOKEN_FUNCTION);
+    case 'i':
+      return this->checkKeyword("if", TokenType::TOKEN_IF);
+    case 'n':
+      return this->checkKeyword("null", TokenType::TOKEN_NULL);
+    case 'o':
+      return this->checkKeyword("or", TokenType::TOKEN_OR);
+    case 'p':
+      return this->checkKeyword("print", TokenType::TOKEN_PRINT);
+    case 'r':
+      return this->checkKeyword("return", TokenType::TOKEN_RETURN);
+    case 's':
+      if (length > 1 && this->source[this->start + 1] == 'p') {
+        return this->checkKeyword("spawn", TokenType::TOKEN_SPAWN);
+      }
+      return this->checkKeyword("super", TokenType::TOKEN_SUPER);
+    case 't':
+      if (length > 1 && this->source[this->start + 1] == 'h') {
+        return this->checkKeyword("this", TokenType::TOKEN_THIS);
+      }
+      return this->checkKeyword("true", TokenType::TOKEN_TRUE);
+    case 'v':
+      return this->checkKeyword("var", TokenType::TOKEN_VAR);
+    case 'w':
+      return this->checkKeyword("while", TokenType::TOKEN_WHILE);
+    default:
+      return TokenType::TOKEN_IDENTIFIER;
+  }
+}
 
-  if (keyword.compare("print") == 0) return TokenType::TOKEN_PRINT;
-  if (keyword.compare("null") == 0) return TokenType::TOKEN_NULL;
+// `type` if the identifier just scanned is `keyword`, otherwise TOKEN_IDENTIFIER.
+TokenType Scanner::checkKeyword(const char *keyword, const TokenType type) const {
+  const size_t length = std::strlen(keyword);
+  if (static_cast<size_t>(this->current - this->start) == length &&
+      std::memcmp(this->source + this->start, keyword, length) == 0) {
+    return type;
+  }
   return TokenType::TOKEN_IDENTIFIER;
 }
 
+bool Scanner::isBlank(const char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+
 bool Scanner::isAlpha(const char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_'; }
 
-bool Scanner::isAtEnd() const { return this->current >= this->source.length(); }
+bool Scanner::isAtEnd() const { return this->current >= this->length; }
 
 char Scanner::advance() { return this->source[this->current++]; }
 
@@ -168,10 +401,14 @@ bool Scanner::match(const char c) {
   return true;
 }
 
-char Scanner::peek() const { return this->source[this->current]; }
+// Past the end of the source both read a null character, which nothing in it ends with.
+char Scanner::peek() const {
+  if (this->isAtEnd()) return '\0';
+  return this->source[this->current];
+}
 
 char Scanner::peekNext() const {
-  if (this->isAtEnd()) return '\0';
+  if (this->current + 1 >= this->length) return '\0';
   return this->source[this->current + 1];
 }
 
@@ -180,19 +417,17 @@ char Scanner::peekPrevious() const { return this->source[this->current - 1]; }
 Token Scanner::makeToken(const TokenType type) const {
   Token token;
   token.type = type;
-  token.start = this->start;
+  token.start = this->source + this->start;
   token.length = this->current - this->start;
-  token.lexeme = this->source.substr(token.start, token.length);
   token.line = this->line;
   return token;
 }
 
-Token Scanner::errorToken(const std::string &message) const {
+Token Scanner::errorToken(const char *message) const {
   Token token;
   token.type = TokenType::TOKEN_ERROR;
-  token.start = 0;
-  token.length = message.length();
-  token.lexeme = message;
+  token.start = message;
+  token.length = static_cast<int>(std::strlen(message));
   token.line = this->line;
   return token;
 }
\ No newline at end of file
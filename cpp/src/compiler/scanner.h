@@ -2,20 +2,46 @@
 #define SCANNER_H
 #include "token.h"
 
+#include <climits>
+#include <cstddef>
 #include <string>
 
+// Positions in the source are ints, with room left to look a block of characters past any of them. A longer
+// source scans as a single error token.
+#define SCANNER_MAX_LENGTH (INT_MAX - 64)
+
+// Where scanning has got to. The parser saves it to look ahead and rewinds to scan the same tokens again.
+typedef struct {
+  int current;
+  int line;
+} ScannerPosition;
+
+// Scans source it does not own and never copies, such as a memory-mapped file; it must outlive the scanner
+// and the tokens, which point into it. The source need not end in a null character.
 class Scanner {
 public:
+  Scanner(const char *source, size_t length);
   explicit Scanner(const std::string &source);
   Token scanToken();
+  ScannerPosition position() const;
+  void rewind(ScannerPosition position);
 
 private:
-  std::string source;
+  const char *source;
+  int length;
+  // Set for a source over SCANNER_MAX_LENGTH until its error token has been scanned.
+  bool tooLarge;
   int start = 0;
   int current = 0;
   int line = 1;
 
   void skipWhitespace();
+  void skipBlanks();
+  void skipToLineEnd();
+  void skipToStringStop(char quote);
+  void skipWord();
+  void skipDigits();
+  static bool isBlank(char c);
 
   Token string();
 
@@ -23,7 +49,8 @@ private:
   static bool isDigit(char c);
 
   Token identifier();
-  TokenType identifierType();
+  TokenType identifierType() const;
+  TokenType checkKeyword(const char *keyword, TokenType type) const;
   static bool isAlpha(char c);
 
   bool isAtEnd() const;
@@ -34,7 +61,7 @@ private:
   bool match(char c);
 
   Token makeToken(TokenType type) const;
-  Token errorToken(const std::string &message) const;
+  Token errorToken(const char *message) const;
 };
 
 #endif // SCANNER_H
@@ -1,6 +1,5 @@
 #ifndef TOKEN_H
 #define TOKEN_H
-#include <string>
 
 typedef enum {
   // Single-character tokens.
@@ -8,6 +7,9 @@ typedef enum {
   TOKEN_RIGHT_PAREN,
   TOKEN_LEFT_BRACE,
   TOKEN_RIGHT_BRACE,
+  TOKEN_LEFT_BRACKET,
+  TOKEN_RIGHT_BRACKET,
+  TOKEN_COLON,
   TOKEN_COMMA,
   TOKEN_DOT,
   TOKEN_MINUS,
@@ -17,6 +19,7 @@ typedef enum {
   TOKEN_STAR,
 
   // One or two character tokens.
+  TOKEN_ARROW,
   TOKEN_BANG,
   TOKEN_BANG_EQUAL,
   TOKEN_EQUAL,
@@ -33,6 +36,7 @@ typedef enum {
 
   // Keywords.
   TOKEN_AND,
+  TOKEN_AWAIT,
   TOKEN_CLASS,
   TOKEN_ELSE,
   TOKEN_FALSE,
@@ -43,6 +47,7 @@ typedef enum {
   TOKEN_OR,
   TOKEN_PRINT,
   TOKEN_RETURN,
+  TOKEN_SPAWN,
   TOKEN_SUPER,
   TOKEN_THIS,
   TOKEN_TRUE,
@@ -53,10 +58,11 @@ typedef enum {
   TOKEN_EOF
 } TokenType;
 
+// A view of a lexeme in the source being scanned, which outlives its tokens, so scanning allocates nothing.
+// An error token's lexeme is its message instead.
 typedef struct {
   TokenType type;
-  std::string lexeme;
-  int start;
+  const char *start;
   int length;
   int line;
 } Token;
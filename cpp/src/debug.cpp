@@ -1,43 +1,90 @@
 #include "debug.h"
+#include "object.h"
 #include "value.h"
 
 #include <iomanip>
 #include <iostream>
 
-Debug::Debug(const Chunk &chunk) : chunk(chunk) {}
+Debug::Debug(const Chunk &chunk, std::ostream &out) : chunk(chunk), out(out) {}
 
-void Debug::disassembleChunk(const std::string &name) {
-  std::cout << "== " << name << " ==" << std::endl;
+void Debug::disassembleChunk(const std::string &name) const {
+  this->out << "== " << name << " ==" << std::endl;
 
-  for (int offset = 0; offset < this->chunk.bytes.size();) {
+  for (unsigned int offset = 0; offset < this->chunk.count();) {
     offset = this->disassembleInstruction(offset);
   }
 }
-int Debug::disassembleInstruction(const unsigned int offset) {
-  std::cout << std::setw(4) << std::setfill('0') << offset;
+int Debug::disassembleInstruction(const unsigned int offset) const {
+  this->out << std::setw(4) << std::setfill('0') << offset;
 
-  std::cout << "\t";
+  this->out << "\t";
 
   auto printLineNumber = [this, offset]() {
-    const int currentLine = this->chunk.lines.at(offset);
+    const unsigned int currentLine = this->chunk.getLine(offset);
     if (offset > 0) {
-      const int previousLine = this->chunk.lines.at(offset - 1);
+      const unsigned int previousLine = this->chunk.getLine(offset - 1);
       if (currentLine == previousLine) {
-        std::cout << "   | ";
+        this->out << "   | ";
         return;
       }
     }
 
-    std::cout << std::setw(4) << std::setfill('0') << currentLine;
+    this->out << std::setw(4) << std::setfill('0') << currentLine;
   };
   printLineNumber();
 
-  std::cout << "\t";
+  this->out << "\t";
 
-  const auto instruction = this->chunk.bytes.at(offset);
+  const auto instruction = this->chunk.at(offset);
   switch (instruction) {
     case OpCode::OP_CONSTANT:
       return this->constantInstruction("OP_CONSTANT", offset);
+    case OpCode::OP_CONSTANT_LONG:
+      return this->constantLongInstruction("OP_CONSTANT_LONG", offset);
+    case OpCode::OP_NULL:
+      return this->simpleInstruction("OP_NULL", offset);
+    case OpCode::OP_TRUE:
+      return this->simpleInstruction("OP_TRUE", offset);
+    case OpCode::OP_FALSE:
+      return this->simpleInstruction("OP_FALSE", offset);
+    case OpCode::OP_POP:
+      return this->simpleInstruction("OP_POP", offset);
+    case OpCode::OP_GET_LOCAL:
+      return this->byteInstruction("OP_GET_LOCAL", offset);
+    case OpCode::OP_SET_LOCAL:
+      return this->byteInstruction("OP_SET_LOCAL", offset);
+    case OpCode::OP_GET_GLOBAL:
+      return this->globalInstruction("OP_GET_GLOBAL", offset, false);
+    case OpCode::OP_GET_GLOBAL_LONG:
+      return this->globalInstruction("OP_GET_GLOBAL_LONG", offset, true);
+    case OpCode::OP_DEFINE_GLOBAL:
+      return this->globalInstruction("OP_DEFINE_GLOBAL", offset, false);
+    case OpCode::OP_DEFINE_GLOBAL_LONG:
+      return this->globalInstruction("OP_DEFINE_GLOBAL_LONG", offset, true);
+    case OpCode::OP_SET_GLOBAL:
+      return this->globalInstruction("OP_SET_GLOBAL", offset, false);
+    case OpCode::OP_SET_GLOBAL_LONG:
+      return this->globalInstruction("OP_SET_GLOBAL_LONG", offset, true);
+    case OpCode::OP_MAP:
+      return this->byteInstruction("OP_MAP", offset);
+    case OpCode::OP_MAP_LONG:
+      return this->longInstruction("OP_MAP_LONG", offset);
+    case OpCode::OP_ARRAY:
+      return this->byteInstruction("OP_ARRAY", offset);
+    case OpCode::OP_ARRAY_LONG:
+      return this->longInstruction("OP_ARRAY_LONG", offset);
+    case OpCode::OP_GET_INDEX:
+      return this->simpleInstruction("OP_GET_INDEX", offset);
+    case OpCode::OP_SET_INDEX:
+      return this->simpleInstruction("OP_SET_INDEX", offset);
+    case OpCode::OP_SLICE:
+      return this->simpleInstruction("OP_SLICE", offset);
+    case OpCode::OP_EQUAL:
+      return this->simpleInstruction("OP_EQUAL", offset);
+    case OpCode::OP_GREATER:
+      return this->simpleInstruction("OP_GREATER", offset);
+    case OpCode::OP_LESS:
+      return this->simpleInstruction("OP_LESS", offset);
     case OpCode::OP_ADD:
       return this->simpleInstruction("OP_ADD", offset);
     case OpCode::OP_SUBTRACT:
@@ -46,27 +93,290 @@ int Debug::disassembleInstruction(const unsigned int offset) {
       return this->simpleInstruction("OP_MULTIPLY", offset);
     case OpCode::OP_DIVIDE:
       return this->simpleInstruction("OP_DIVIDE", offset);
+    case OpCode::OP_NOT:
+      return this->simpleInstruction("OP_NOT", offset);
     case OpCode::OP_NEGATE:
       return this->simpleInstruction("OP_NEGATE", offset);
+    case OpCode::OP_INVOKE:
+      return this->invokeInstruction("OP_INVOKE", offset, false);
+    case OpCode::OP_INVOKE_LONG:
+      return this->invokeInstruction("OP_INVOKE_LONG", offset, true);
+    case OpCode::OP_GET_PROPERTY:
+      return this->propertyInstruction("OP_GET_PROPERTY", offset, false);
+    case OpCode::OP_GET_PROPERTY_LONG:
+      return this->propertyInstruction("OP_GET_PROPERTY_LONG", offset, true);
+    case OpCode::OP_SET_PROPERTY:
+      return this->propertyInstruction("OP_SET_PROPERTY", offset, false);
+    case OpCode::OP_SET_PROPERTY_LONG:
+      return this->propertyInstruction("OP_SET_PROPERTY_LONG", offset, true);
+    case OpCode::OP_PRINT:
+      return this->simpleInstruction("OP_PRINT", offset);
+    case OpCode::OP_JUMP:
+      return this->jumpInstruction("OP_JUMP", 1, offset);
+    case OpCode::OP_JUMP_IF_FALSE:
+      return this->jumpInstruction("OP_JUMP_IF_FALSE", 1, offset);
+    case OpCode::OP_LOOP:
+      return this->jumpInstruction("OP_LOOP", -1, offset);
+    case OpCode::OP_ADD_CONST:
+      return this->constantInstruction("OP_ADD_CONST", offset);
+    case OpCode::OP_SUBTRACT_CONST:
+      return this->constantInstruction("OP_SUBTRACT_CONST", offset);
+    case OpCode::OP_MULTIPLY_CONST:
+      return this->constantInstruction("OP_MULTIPLY_CONST", offset);
+    case OpCode::OP_DIVIDE_CONST:
+      return this->constantInstruction("OP_DIVIDE_CONST", offset);
+    case OpCode::OP_LESS_CONST:
+      return this->constantInstruction("OP_LESS_CONST", offset);
+    case OpCode::OP_GREATER_CONST:
+      return this->constantInstruction("OP_GREATER_CONST", offset);
+    case OpCode::OP_SET_LOCAL_POP:
+      return this->byteInstruction("OP_SET_LOCAL_POP", offset);
+    case OpCode::OP_CLOSURE:
+      return this->closureInstruction("OP_CLOSURE", offset, false);
+    case OpCode::OP_CLOSURE_LONG:
+      return this->closureInstruction("OP_CLOSURE_LONG", offset, true);
+    case OpCode::OP_GET_UPVALUE:
+      return this->byteInstruction("OP_GET_UPVALUE", offset);
+    case OpCode::OP_GET_BOXED_LOCAL:
+      return this->byteInstruction("OP_GET_BOXED_LOCAL", offset);
+    case OpCode::OP_SET_BOXED_LOCAL:
+      return this->byteInstruction("OP_SET_BOXED_LOCAL", offset);
+    case OpCode::OP_SET_BOXED_LOCAL_POP:
+      return this->byteInstruction("OP_SET_BOXED_LOCAL_POP", offset);
+    case OpCode::OP_GET_BOXED_UPVALUE:
+      return this->byteInstruction("OP_GET_BOXED_UPVALUE", offset);
+    case OpCode::OP_SET_BOXED_UPVALUE:
+      return this->byteInstruction("OP_SET_BOXED_UPVALUE", offset);
+    case OpCode::OP_CALL:
+      return this->byteInstruction("OP_CALL", offset);
+    case OpCode::OP_TAIL_CALL:
+      return this->byteInstruction("OP_TAIL_CALL", offset);
+    case OpCode::OP_SPAWN:
+      return this->byteInstruction("OP_SPAWN", offset);
+    case OpCode::OP_AWAIT:
+      return this->simpleInstruction("OP_AWAIT", offset);
+    case OpCode::OP_RETURN_VALUE:
+      return this->simpleInstruction("OP_RETURN_VALUE", offset);
     case OpCode::OP_RETURN:
       return this->simpleInstruction("OP_RETURN", offset);
     default:
-      std::cout << "Unknown opcode " << instruction << std::endl;
+      this->out << "Unknown opcode " << static_cast<int>(instruction) << std::endl;
       return offset + 1;
   }
 }
 
-int Debug::simpleInstruction(const std::string &name, const int offset) {
-  std::cout << name << std::endl;
+int Debug::simpleInstruction(const std::string &name, const int offset) const {
+  this->out << name << std::endl;
   return offset + 1;
 }
 
 int Debug::constantInstruction(const std::string &name, const int offset) const {
-  const auto constant = this->chunk.bytes.at(offset + 1);
-  std::cout << name;
-  std::cout << "\t";
+  const auto constant = this->chunk.at(offset + 1);
+  this->out << name;
+  this->out << "\t";
 
-  printValue(this->chunk.constants.at(constant));
-  std::cout << std::endl;
+  printValue(this->chunk.constants.at(constant), this->out);
+  this->out << std::endl;
   return offset + 2;
-}
\ No newline at end of file
+}
+
+int Debug::constantLongInstruction(const std::string &name, const int offset) const {
+  const uint32_t constant = this->chunk.readLong(offset + 1);
+  this->out << name;
+  this->out << "\t";
+
+  printValue(this->chunk.constants.at(constant), this->out);
+  this->out << std::endl;
+  return offset + 4;
+}
+
+int Debug::byteInstruction(const std::string &name, const int offset) const {
+  const uint8_t slot = this->chunk.at(offset + 1);
+  this->out << name << "\t" << static_cast<int>(slot) << std::endl;
+  return offset + 2;
+}
+
+int Debug::longInstruction(const std::string &name, const int offset) const {
+  this->out << name << "\t" << this->chunk.readLong(offset + 1) << std::endl;
+  return offset + 4;
+}
+
+int Debug::globalInstruction(const std::string &name, const int offset, const bool isLong) const {
+  const uint32_t slot = isLong ? this->chunk.readLong(offset + 1) : this->chunk.at(offset + 1);
+  this->out << name << "\t" << slot << "\t";
+  printValue(this->chunk.globalNames.at(slot), this->out);
+  this->out << std::endl;
+  return offset + (isLong ? 4 : 2);
+}
+
+int Debug::invokeInstruction(const std::string &name, const int offset, const bool isLong) const {
+  const uint32_t constant = isLong ? this->chunk.readLong(offset + 1) : this->chunk.at(offset + 1);
+  const int argCountOffset = offset + (isLong ? 4 : 2);
+  const uint8_t argCount = this->chunk.at(argCountOffset);
+  this->out << name << "\t(" << static_cast<int>(argCount) << " args)\t";
+  printValue(this->chunk.constants.at(constant), this->out);
+  this->out << "\tcache " << this->chunk.readLong(argCountOffset + 1) << std::endl;
+  return argCountOffset + 4;
+}
+
+int Debug::propertyInstruction(const std::string &name, const int offset, const bool isLong) const {
+  const uint32_t constant = isLong ? this->chunk.readLong(offset + 1) : this->chunk.at(offset + 1);
+  const int cacheOffset = offset + (isLong ? 4 : 2);
+  this->out << name << "\t";
+  printValue(this->chunk.constants.at(constant), this->out);
+  this->out << "\tcache " << this->chunk.readLong(cacheOffset) << std::endl;
+  return cacheOffset + 3;
+}
+
+int Debug::closureInstruction(const std::string &name, const int offset, const bool isLong) const {
+  const uint32_t constant = isLong ? this->chunk.readLong(offset + 1) : this->chunk.at(offset + 1);
+  const ObjFunction *function = asFunction(this->chunk.constants.at(constant));
+  this->out << name << "\t";
+  printValue(this->chunk.constants.at(constant), this->out);
+  this->out << "\tentry " << function->entry << std::endl;
+
+  int next = offset + (isLong ? 4 : 2);
+  for (uint32_t i = 0; i < function->upvalueCount; i++) {
+    const uint8_t isLocal = this->chunk.at(next);
+    const uint8_t index = this->chunk.at(next + 1);
+    this->out << std::setw(4) << std::setfill('0') << next << "\t   | \t\t";
+    const char *kind = isLocal == 0 ? "upvalue " : isLocal == 1 ? "local " : "boxed local ";
+    this->out << kind << static_cast<int>(index) << std::endl;
+    next += 2;
+  }
+  return next;
+}
+
+int Debug::jumpInstruction(const std::string &name, const int sign, const int offset) const {
+  const uint16_t jump = this->chunk.readShort(offset + 1);
+  this->out << name << "\t" << offset << " -> " << offset + 3 + sign * jump << std::endl;
+  return offset + 3;
+}
+
+const char *opcodeName(const uint8_t opcode) {
+  switch (static_cast<OpCode>(opcode)) {
+    case OpCode::OP_CONSTANT:
+      return "OP_CONSTANT";
+    case OpCode::OP_CONSTANT_LONG:
+      return "OP_CONSTANT_LONG";
+    case OpCode::OP_NULL:
+      return "OP_NULL";
+    case OpCode::OP_TRUE:
+      return "OP_TRUE";
+    case OpCode::OP_FALSE:
+      return "OP_FALSE";
+    case OpCode::OP_POP:
+      return "OP_POP";
+    case OpCode::OP_GET_LOCAL:
+      return "OP_GET_LOCAL";
+    case OpCode::OP_SET_LOCAL:
+      return "OP_SET_LOCAL";
+    case OpCode::OP_GET_GLOBAL:
+      return "OP_GET_GLOBAL";
+    case OpCode::OP_GET_GLOBAL_LONG:
+      return "OP_GET_GLOBAL_LONG";
+    case OpCode::OP_DEFINE_GLOBAL:
+      return "OP_DEFINE_GLOBAL";
+    case OpCode::OP_DEFINE_GLOBAL_LONG:
+      return "OP_DEFINE_GLOBAL_LONG";
+    case OpCode::OP_SET_GLOBAL:
+      return "OP_SET_GLOBAL";
+    case OpCode::OP_SET_GLOBAL_LONG:
+      return "OP_SET_GLOBAL_LONG";
+    case OpCode::OP_MAP:
+      return "OP_MAP";
+    case OpCode::OP_MAP_LONG:
+      return "OP_MAP_LONG";
+    case OpCode::OP_ARRAY:
+      return "OP_ARRAY";
+    case OpCode::OP_ARRAY_LONG:
+      return "OP_ARRAY_LONG";
+    case OpCode::OP_GET_INDEX:
+      return "OP_GET_INDEX";
+    case OpCode::OP_SET_INDEX:
+      return "OP_SET_INDEX";
+    case OpCode::OP_SLICE:
+      return "OP_SLICE";
+    case OpCode::OP_EQUAL:
+      return "OP_EQUAL";
+    case OpCode::OP_GREATER:
+      return "OP_GREATER";
+    case OpCode::OP_LESS:
+      return "OP_LESS";
+    case OpCode::OP_ADD:
+      return "OP_ADD";
+    case OpCode::OP_SUBTRACT:
+      return "OP_SUBTRACT";
+    case OpCode::OP_MULTIPLY:
+      return "OP_MULTIPLY";
+    case OpCode::OP_DIVIDE:
+      return "OP_DIVIDE";
+    case OpCode::OP_NOT:
+      return "OP_NOT";
+    case OpCode::OP_NEGATE:
+      return "OP_NEGATE";
+    case OpCode::OP_INVOKE:
+      return "OP_INVOKE";
+    case OpCode::OP_INVOKE_LONG:
+      return "OP_INVOKE_LONG";
+    case OpCode::OP_GET_PROPERTY:
+      return "OP_GET_PROPERTY";
+    case OpCode::OP_GET_PROPERTY_LONG:
+      return "OP_GET_PROPERTY_LONG";
+    case OpCode::OP_SET_PROPERTY:
+      return "OP_SET_PROPERTY";
+    case OpCode::OP_SET_PROPERTY_LONG:
+      return "OP_SET_PROPERTY_LONG";
+    case OpCode::OP_PRINT:
+      return "OP_PRINT";
+    case OpCode::OP_JUMP:
+      return "OP_JUMP";
+    case OpCode::OP_JUMP_IF_FALSE:
+      return "OP_JUMP_IF_FALSE";
+    case OpCode::OP_LOOP:
+      return "OP_LOOP";
+    case OpCode::OP_ADD_CONST:
+      return "OP_ADD_CONST";
+    case OpCode::OP_SUBTRACT_CONST:
+      return "OP_SUBTRACT_CONST";
+    case OpCode::OP_MULTIPLY_CONST:
+      return "OP_MULTIPLY_CONST";
+    case OpCode::OP_DIVIDE_CONST:
+      return "OP_DIVIDE_CONST";
+    case OpCode::OP_LESS_CONST:
+      return "OP_LESS_CONST";
+    case OpCode::OP_GREATER_CONST:
+      return "OP_GREATER_CONST";
+    case OpCode::OP_SET_LOCAL_POP:
+      return "OP_SET_LOCAL_POP";
+    case OpCode::OP_CLOSURE:
+      return "OP_CLOSURE";
+    case OpCode::OP_CLOSURE_LONG:
+      return "OP_CLOSURE_LONG";
+    case OpCode::OP_GET_UPVALUE:
+      return "OP_GET_UPVALUE";
+    case OpCode::OP_GET_BOXED_LOCAL:
+      return "OP_GET_BOXED_LOCAL";
+    case OpCode::OP_SET_BOXED_LOCAL:
+      return "OP_SET_BOXED_LOCAL";
+    case OpCode::OP_SET_BOXED_LOCAL_POP:
+      return "OP_SET_BOXED_LOCAL_POP";
+    case OpCode::OP_GET_BOXED_UPVALUE:
+      return "OP_GET_BOXED_UPVALUE";
+    case OpCode::OP_SET_BOXED_UPVALUE:
+      return "OP_SET_BOXED_UPVALUE";
+    case OpCode::OP_CALL:
+      return "OP_CALL";
+    case OpCode::OP_TAIL_CALL:
+      return "OP_TAIL_CALL";
+    case OpCode::OP_SPAWN:
+      return "OP_SPAWN";
+    case OpCode::OP_AWAIT:
+      return "OP_AWAIT";
+    case OpCode::OP_RETURN_VALUE:
+      return "OP_RETURN_VALUE";
+    case OpCode::OP_RETURN:
+      return "OP_RETURN";
+  }
+  return nullptr;
+}
@@ -1,24 +1,35 @@
 #ifndef DEBUG_H
 #define DEBUG_H
 
-#define DEBUG_PRINT_CODE
-#define DEBUG_TRACE_EXECUTION
-
 #include "chunk.h"
 
+#include <iosfwd>
 #include <string>
 
+// Disassembles `chunk` to `out`. Both must outlive it.
 class Debug {
 public:
-  Chunk chunk;
-
-  explicit Debug(const Chunk &chunk);
-  void disassembleChunk(const std::string &name);
-  int disassembleInstruction(unsigned int offset);
+  Debug(const Chunk &chunk, std::ostream &out);
+  void disassembleChunk(const std::string &name) const;
+  int disassembleInstruction(unsigned int offset) const;
 
 private:
-  int simpleInstruction(const std::string &name, int offset);
+  const Chunk &chunk;
+  std::ostream &out;
+
+  int simpleInstruction(const std::string &name, int offset) const;
   int constantInstruction(const std::string &name, int offset) const;
+  int constantLongInstruction(const std::string &name, int offset) const;
+  int byteInstruction(const std::string &name, int offset) const;
+  int longInstruction(const std::string &name, int offset) const;
+  int globalInstruction(const std::string &name, int offset, bool isLong) const;
+  int invokeInstruction(const std::string &name, int offset, bool isLong) const;
+  int propertyInstruction(const std::string &name, int offset, bool isLong) const;
+  int closureInstruction(const std::string &name, int offset, bool isLong) const;
+  int jumpInstruction(const std::string &name, int sign, int offset) const;
 };
 
+// Name of an opcode as the disassembler prints it, or nullptr if the byte is not an opcode.
+const char *opcodeName(uint8_t opcode);
+
 #endif // DEBUG_H
\ No newline at end of file
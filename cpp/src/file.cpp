@@ -0,0 +1,82 @@
+#include "file.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define TRIPLES_HAS_MMAP
+#else
+#include <fstream>
+#include <sstream>
+#endif
+
+MappedFile::MappedFile(const std::string &path) {
+#ifdef TRIPLES_HAS_MMAP
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return;
+
+  struct stat info {};
+  if (fstat(fd, &info) != 0) {
+    close(fd);
+    return;
+  }
+
+  if (!S_ISREG(info.st_mode)) {
+    char chunk[65536];
+    ssize_t count;
+    while ((count = read(fd, chunk, sizeof(chunk))) != 0) {
+      if (count < 0 && errno == EINTR) continue;
+      if (count < 0) {
+        close(fd);
+        return;
+      }
+      this->buffer.append(chunk, static_cast<size_t>(count));
+    }
+    close(fd);
+    this->bytes = reinterpret_cast<const uint8_t *>(this->buffer.data());
+    this->length = this->buffer.size();
+    return;
+  }
+
+  this->length = static_cast<size_t>(info.st_size);
+  if (this->length == 0) {
+    // mmap rejects empty mappings; an empty file is still a valid, open file.
+    this->bytes = reinterpret_cast<const uint8_t *>(this->buffer.data());
+    close(fd);
+    return;
+  }
+
+  void *address = mmap(nullptr, this->length, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (address == MAP_FAILED) {
+    this->length = 0;
+    return;
+  }
+
+  this->bytes = static_cast<const uint8_t *>(address);
+  this->mapped = true;
+#else
+  const std::ifstream file(path, std::ios::binary);
+  if (!file) return;
+
+  std::stringstream contents;
+  contents << file.rdbuf();
+  this->buffer = contents.str();
+  this->bytes = reinterpret_cast<const uint8_t *>(this->buffer.data());
+  this->length = this->buffer.size();
+#endif
+}
+
+MappedFile::~MappedFile() {
+#ifdef TRIPLES_HAS_MMAP
+  if (this->mapped) munmap(const_cast<uint8_t *>(this->bytes), this->length);
+#endif
+}
+
+bool MappedFile::isOpen() const { return this->bytes != nullptr; }
+
+const uint8_t *MappedFile::data() const { return this->bytes; }
+
+size_t MappedFile::size() const { return this->length; }
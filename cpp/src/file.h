@@ -0,0 +1,29 @@
+#ifndef FILE_H
+#define FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Read-only view of a whole file. On POSIX systems a regular file is memory-mapped so callers can work
+// directly on the page cache; pipes and other files, and every file elsewhere, are read into an owned buffer.
+class MappedFile {
+public:
+  explicit MappedFile(const std::string &path);
+  ~MappedFile();
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  bool isOpen() const;
+  const uint8_t *data() const;
+  size_t size() const;
+
+private:
+  const uint8_t *bytes = nullptr;
+  size_t length = 0;
+  bool mapped = false;
+  std::string buffer;
+};
+
+#endif // FILE_H
@@ -0,0 +1,509 @@
+#include "heap.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+// Every allocation is rounded up so objects in the nursery stay pointer-aligned.
+static size_t alignSize(const size_t size) { return (size + 7) & ~static_cast<size_t>(7); }
+
+Heap::Heap(const HeapLimits &limits) : heapLimits(limits), nextMajor(limits.initialThreshold) {
+  const size_t nurserySize = this->heapLimits.nurserySize;
+  this->nursery = nurserySize == 0 ? nullptr : static_cast<uint8_t *>(::operator new(nurserySize));
+  this->nurseryTop = this->nursery;
+  this->nurseryEnd = this->nursery + nurserySize;
+  this->strings.init();
+}
+
+Heap::~Heap() {
+  this->clear();
+  ::operator delete(this->nursery);
+}
+
+void Heap::setRoots(RootSet *roots) { this->roots = roots; }
+
+void Heap::clear() {
+  Obj *object = this->objects;
+  while (object != nullptr) {
+    Obj *next = object->next;
+    this->freeObject(object);
+    object = next;
+  }
+  this->objects = nullptr;
+  this->oldSize = 0;
+  this->youngStorage = 0;
+  this->nextMajor = this->heapLimits.initialThreshold;
+  for (Obj *young : this->youngWithStorage) {
+    this->freeStorage(young);
+  }
+  this->youngWithStorage.clear();
+  this->nurseryTop = this->nursery;
+  this->rememberedSet.clear();
+  this->strings.free();
+}
+
+ObjString *Heap::allocateString(const size_t length) {
+  auto *string = static_cast<ObjString *>(this->allocate(OBJ_STRING, sizeof(ObjString) + length + 1));
+  if (string == nullptr) return nullptr;
+
+  string->length = static_cast<uint32_t>(length);
+  string->hash = 0;
+  string->inlineChars()[length] = '\0';
+  return string;
+}
+
+ObjString *Heap::copyString(const char *chars, const size_t length) {
+  ObjString *string = this->allocateString(length);
+  if (string == nullptr) return nullptr;
+
+  std::memcpy(string->inlineChars(), chars, length);
+  string->hash = hashString(chars, length);
+  return string;
+}
+
+ObjString *Heap::intern(const char *chars, const size_t length) {
+  const uint32_t hash = hashString(chars, length);
+
+  ObjString *interned = this->strings.findString(chars, length, hash);
+  if (interned != nullptr) return interned;
+
+  auto *string = static_cast<ObjString *>(this->allocate(OBJ_STRING, sizeof(ObjString) + length + 1, true));
+  if (string == nullptr) return nullptr;
+
+  string->length = static_cast<uint32_t>(length);
+  string->hash = hash;
+  std::memcpy(string->inlineChars(), chars, length);
+  string->inlineChars()[length] = '\0';
+  this->strings.set(objValue(string), NULL_VAL);
+  return string;
+}
+
+ObjRope *Heap::allocateRope(const size_t length) {
+  // A rope that could never be flattened under the cap fails now rather than when its characters are read.
+  if (!this->withinLimit(length + 1)) return nullptr;
+  auto *rope = static_cast<ObjRope *>(this->allocate(OBJ_ROPE, sizeof(ObjRope)));
+  if (rope == nullptr) return nullptr;
+
+  rope->length = static_cast<uint32_t>(length);
+  rope->hash = 0;
+  rope->left = nullptr;
+  rope->right = nullptr;
+  rope->flat = nullptr;
+  rope->heap = this;
+  // Flattening gives the rope out-of-line storage later on.
+  if (rope->young) this->youngWithStorage.push_back(rope);
+  return rope;
+}
+
+ObjMap *Heap::allocateMap() {
+  auto *map = static_cast<ObjMap *>(this->allocate(OBJ_MAP, sizeof(ObjMap)));
+  if (map == nullptr) return nullptr;
+
+  map->table.init();
+  map->shape = SHAPE_EMPTY;
+  if (map->young) this->youngWithStorage.push_back(map);
+  return map;
+}
+
+ObjArray *Heap::allocateArray(const uint32_t capacity) {
+  // Collect for the elements first, while the array does not need rooting yet.
+  if (!this->makeRoomForStorage(static_cast<size_t>(capacity) * sizeof(Value))) return nullptr;
+  auto *array = static_cast<ObjArray *>(this->allocate(OBJ_ARRAY, sizeof(ObjArray)));
+  if (array == nullptr) return nullptr;
+
+  array->init();
+  array->reserve(capacity);
+  this->storageGrew(array, 0);
+  if (array->young) this->youngWithStorage.push_back(array);
+  return array;
+}
+
+ObjFunction *Heap::allocateFunction(const uint32_t entry, const uint8_t arity, const uint8_t upvalueCount,
+                                    ObjString *name) {
+  auto *function = static_cast<ObjFunction *>(this->allocate(OBJ_FUNCTION, sizeof(ObjFunction), true));
+  if (function == nullptr) return nullptr;
+
+  function->entry = entry;
+  function->arity = arity;
+  function->upvalueCount = upvalueCount;
+  function->name = name;
+  return function;
+}
+
+ObjClosure *Heap::allocateClosure(ObjFunction *function) {
+  const size_t size = sizeof(ObjClosure) + function->upvalueCount * sizeof(Value);
+  auto *closure = static_cast<ObjClosure *>(this->allocate(OBJ_CLOSURE, size));
+  if (closure == nullptr) return nullptr;
+
+  closure->function = function;
+  closure->upvalueCount = function->upvalueCount;
+  for (uint32_t i = 0; i < closure->upvalueCount; i++) closure->upvalues()[i] = NULL_VAL;
+  return closure;
+}
+
+ObjNative *Heap::allocateNative(const uint32_t index) {
+  auto *native = static_cast<ObjNative *>(this->allocate(OBJ_NATIVE, sizeof(ObjNative)));
+  if (native == nullptr) return nullptr;
+
+  native->index = index;
+  return native;
+}
+
+ObjFiber *Heap::allocateFiber() {
+  auto *fiber = static_cast<ObjFiber *>(this->allocate(OBJ_FIBER, sizeof(ObjFiber)));
+  if (fiber == nullptr) return nullptr;
+
+  fiber->task = nullptr;
+  fiber->result = NULL_VAL;
+  return fiber;
+}
+
+ObjBox *Heap::allocateBox() {
+  auto *box = static_cast<ObjBox *>(this->allocate(OBJ_BOX, sizeof(ObjBox)));
+  if (box == nullptr) return nullptr;
+
+  box->value = NULL_VAL;
+  return box;
+}
+
+void Heap::writeBarrier(Obj *owner, const Value value) {
+  if (owner->young || owner->remembered) return;
+  if (!isObj(value) || !asObj(value)->young) return;
+
+  owner->remembered = true;
+  this->rememberedSet.push_back(owner);
+}
+
+void Heap::visit(Value &value) {
+  if (!isObj(value)) return;
+
+  Obj *object = asObj(value);
+  this->visit(object);
+  value = objValue(object);
+}
+
+void Heap::visit(Obj *&object) {
+  if (object == nullptr) return;
+
+  if (this->phase == PHASE_MINOR) {
+    if (object->young) object = this->promote(object);
+    return;
+  }
+
+  if (this->phase == PHASE_MAJOR) this->markObject(object);
+}
+
+size_t Heap::storageOf(const Obj *object) {
+  switch (object->type) {
+    case OBJ_ROPE:
+      {
+        const auto *rope = static_cast<const ObjRope *>(object);
+        return rope->flat == nullptr ? 0 : rope->length + 1;
+      }
+    case OBJ_MAP:
+      {
+        const Table &table = static_cast<const ObjMap *>(object)->table;
+        return table.capacity * (sizeof(uint8_t) + sizeof(uint32_t)) + table.entryCapacity * sizeof(Entry);
+      }
+    case OBJ_ARRAY:
+      return static_cast<const ObjArray *>(object)->capacity * sizeof(Value);
+    case OBJ_STRING:
+    case OBJ_FUNCTION:
+    case OBJ_CLOSURE:
+    case OBJ_NATIVE:
+    case OBJ_FIBER:
+    case OBJ_BOX:
+      break;
+  }
+  return 0;
+}
+
+void Heap::storageGrew(const Obj *object, const size_t before) {
+  const size_t grown = storageOf(object) - before;
+  this->storageSize += grown;
+  this->youngStorage += grown;
+}
+
+bool Heap::makeRoomForStorage(const size_t bytes) {
+  if (this->youngStorage + bytes > this->heapLimits.nurserySize && this->roots != nullptr &&
+      this->phase == PHASE_IDLE) {
+    this->minorCollection();
+    if (this->oldSize + this->storageSize > this->nextMajor) this->majorCollection();
+  }
+  return this->withinLimit(bytes);
+}
+
+void Heap::collectGarbage() {
+  if (this->roots == nullptr || this->phase != PHASE_IDLE) return;
+
+  this->minorCollection();
+  this->majorCollection();
+}
+
+void Heap::freeze() {
+  for (Obj *object = this->objects; object != nullptr; object = object->next) object->marked = true;
+}
+
+size_t Heap::youngBytes() const { return static_cast<size_t>(this->nurseryTop - this->nursery); }
+
+size_t Heap::oldBytes() const { return this->oldSize; }
+
+size_t Heap::storageBytes() const { return this->storageSize; }
+
+const HeapStats &Heap::stats() const { return this->heapStats; }
+
+const HeapLimits &Heap::limits() const { return this->heapLimits; }
+
+Obj *Heap::allocate(const ObjType type, size_t size, const bool tenured) {
+  size = alignSize(size);
+
+  Obj *object = nullptr;
+  const bool fitsNursery = size <= this->heapLimits.nurserySize / 4;
+  if (!tenured && this->roots != nullptr && fitsNursery && this->phase == PHASE_IDLE) {
+    if (this->nurseryTop + size > this->nurseryEnd || this->youngStorage > this->heapLimits.nurserySize) {
+      const size_t limit = this->heapLimits.maxHeapSize;
+      this->minorCollection();
+      const size_t heapSize = this->oldSize + this->storageSize;
+      if (heapSize > this->nextMajor || (limit != 0 && heapSize > limit)) this->majorCollection();
+      // Promotion cannot fail, so survivors that pushed old space past the cap fail this allocation instead.
+      if (limit != 0 && this->oldSize + this->storageSize > limit) return nullptr;
+    }
+
+    object = reinterpret_cast<Obj *>(this->nurseryTop);
+    this->nurseryTop += size;
+    object->young = true;
+    object->next = nullptr;
+  } else {
+    object = this->allocateOld(size);
+    if (object == nullptr) return nullptr;
+    object->young = false;
+  }
+
+  object->type = type;
+  object->marked = false;
+  object->remembered = false;
+  object->size = static_cast<uint32_t>(size);
+  return object;
+}
+
+// Whether `bytes` more fit under maxHeapSize, after a full collection if they do not at first.
+bool Heap::withinLimit(const size_t bytes) {
+  const size_t limit = this->heapLimits.maxHeapSize;
+  if (limit == 0 || this->phase != PHASE_IDLE) return true;
+  if (this->oldSize + this->storageSize + bytes > limit && this->roots != nullptr) {
+    this->minorCollection();
+    this->majorCollection();
+  }
+  return this->oldSize + this->storageSize + bytes <= limit;
+}
+
+Obj *Heap::allocateOld(const size_t size) {
+  if (!this->withinLimit(size)) return nullptr;
+
+  auto *object = static_cast<Obj *>(::operator new(size));
+  object->next = this->objects;
+  this->objects = object;
+  this->oldSize += size;
+  return object;
+}
+
+Obj *Heap::promote(Obj *object) {
+  // Already copied by an earlier reference; `next` holds the forwarding address.
+  if (object->next != nullptr) return object->next;
+
+  auto *copy = static_cast<Obj *>(::operator new(object->size));
+  std::memcpy(copy, object, object->size);
+  copy->young = false;
+  copy->marked = false;
+  copy->remembered = false;
+  copy->next = this->objects;
+  this->objects = copy;
+  this->oldSize += copy->size;
+  this->heapStats.promotedBytes += copy->size;
+
+  object->next = copy;
+  this->grayStack.push_back(copy);
+  return copy;
+}
+
+void Heap::markObject(Obj *object) {
+  if (object->marked) return;
+
+  object->marked = true;
+  this->grayStack.push_back(object);
+}
+
+void Heap::blackenObject(Obj *object) {
+  switch (object->type) {
+    case OBJ_STRING:
+      break;
+    case OBJ_ROPE:
+      {
+        // A flattened rope has dropped its children.
+        auto *rope = static_cast<ObjRope *>(object);
+        Obj *left = rope->left;
+        Obj *right = rope->right;
+        this->visit(left);
+        this->visit(right);
+        rope->left = static_cast<ObjString *>(left);
+        rope->right = static_cast<ObjString *>(right);
+        break;
+      }
+    case OBJ_MAP:
+      {
+        Table &table = static_cast<ObjMap *>(object)->table;
+        for (Entry *entry = table.begin(); entry != table.end(); entry++) {
+          this->visit(entry->key);
+          this->visit(entry->value);
+        }
+        break;
+      }
+    case OBJ_ARRAY:
+      {
+        // Packed arrays hold only numbers and have nothing to trace.
+        auto *array = static_cast<ObjArray *>(object);
+        if (array->packed) break;
+        for (uint32_t i = 0; i < array->count; i++) this->visit(array->values[i]);
+        break;
+      }
+    case OBJ_FUNCTION:
+      {
+        auto *function = static_cast<ObjFunction *>(object);
+        Obj *name = function->name;
+        this->visit(name);
+        function->name = static_cast<ObjString *>(name);
+        break;
+      }
+    case OBJ_CLOSURE:
+      {
+        // Functions are old and never move, but a major collection has to mark them.
+        auto *closure = static_cast<ObjClosure *>(object);
+        Obj *function = closure->function;
+        this->visit(function);
+        closure->function = static_cast<ObjFunction *>(function);
+        for (uint32_t i = 0; i < closure->upvalueCount; i++) this->visit(closure->upvalues()[i]);
+        break;
+      }
+    case OBJ_NATIVE:
+      break;
+    case OBJ_FIBER:
+      // An unfinished fiber's stack is a root of the scheduler that runs it.
+      this->visit(static_cast<ObjFiber *>(object)->result);
+      break;
+    case OBJ_BOX:
+      this->visit(static_cast<ObjBox *>(object)->value);
+      break;
+  }
+}
+
+void Heap::traceGray() {
+  while (!this->grayStack.empty()) {
+    Obj *object = this->grayStack.back();
+    this->grayStack.pop_back();
+    this->blackenObject(object);
+  }
+}
+
+void Heap::minorCollection() {
+  if (this->roots == nullptr) return;
+
+  this->phase = PHASE_MINOR;
+  const size_t promotedBefore = this->heapStats.promotedBytes;
+
+  this->roots->visitRoots(*this);
+  for (Obj *object : this->rememberedSet) {
+    object->remembered = false;
+    this->blackenObject(object);
+  }
+  this->rememberedSet.clear();
+  this->traceGray();
+
+  // Promoted objects took their storage with them; release the storage of the ones left behind.
+  for (Obj *young : this->youngWithStorage) {
+    if (young->next == nullptr) this->freeStorage(young);
+  }
+  this->youngWithStorage.clear();
+  this->youngStorage = 0;
+
+  this->heapStats.freedBytes += this->youngBytes() - (this->heapStats.promotedBytes - promotedBefore);
+  this->nurseryTop = this->nursery;
+  this->heapStats.minorCollections++;
+  this->phase = PHASE_IDLE;
+}
+
+void Heap::majorCollection() {
+  if (this->roots == nullptr) return;
+
+  this->phase = PHASE_MAJOR;
+
+  this->roots->visitRoots(*this);
+  this->traceGray();
+  this->removeWhiteStrings();
+  this->sweep();
+
+  const size_t live = this->oldSize + this->storageSize;
+  this->nextMajor = static_cast<size_t>(static_cast<double>(live) * this->heapLimits.growthFactor);
+  if (this->nextMajor < this->heapLimits.initialThreshold) this->nextMajor = this->heapLimits.initialThreshold;
+  this->heapStats.majorCollections++;
+  this->phase = PHASE_IDLE;
+}
+
+void Heap::removeWhiteStrings() {
+  for (const Entry *entry = this->strings.begin(); entry != this->strings.end(); entry++) {
+    if (!isUndefined(entry->key) && !asObj(entry->key)->marked) this->strings.remove(entry->key);
+  }
+}
+
+void Heap::sweep() {
+  Obj *previous = nullptr;
+  Obj *object = this->objects;
+  while (object != nullptr) {
+    if (object->marked) {
+      object->marked = false;
+      previous = object;
+      object = object->next;
+      continue;
+    }
+
+    Obj *unreached = object;
+    object = object->next;
+    if (previous != nullptr) {
+      previous->next = object;
+    } else {
+      this->objects = object;
+    }
+
+    this->oldSize -= unreached->size;
+    this->heapStats.freedBytes += unreached->size;
+    this->freeObject(unreached);
+  }
+}
+
+void Heap::freeStorage(Obj *object) {
+  this->storageSize -= storageOf(object);
+  switch (object->type) {
+    case OBJ_STRING:
+      break;
+    case OBJ_ROPE:
+      std::free(static_cast<ObjRope *>(object)->flat);
+      static_cast<ObjRope *>(object)->flat = nullptr;
+      break;
+    case OBJ_MAP:
+      static_cast<ObjMap *>(object)->table.free();
+      break;
+    case OBJ_ARRAY:
+      static_cast<ObjArray *>(object)->release();
+      break;
+    case OBJ_FUNCTION:
+    case OBJ_CLOSURE:
+    case OBJ_NATIVE:
+    case OBJ_FIBER:
+    case OBJ_BOX:
+      break;
+  }
+}
+
+void Heap::freeObject(Obj *object) {
+  this->freeStorage(object);
+  ::operator delete(object);
+}
@@ -0,0 +1,155 @@
+#ifndef HEAP_H
+#define HEAP_H
+#include "object.h"
+#include "value.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class Heap;
+
+typedef struct {
+  // Bytes reserved for the bump-pointer nursery that holds young objects. A heap with no nursery allocates
+  // every object in old space.
+  size_t nurserySize = 1024 * 1024;
+  // Size of old space and out-of-line storage together that triggers the first major collection.
+  size_t initialThreshold = 4 * 1024 * 1024;
+  // After a major collection the next threshold is the size that survived it times this factor.
+  double growthFactor = 2.0;
+  // Hard cap in bytes on old space and out-of-line storage together, 0 for no limit. Allocations and storage
+  // that would exceed it, or that find the survivors of a collection already past it, fail.
+  size_t maxHeapSize = 0;
+} HeapLimits;
+
+typedef struct {
+  size_t minorCollections = 0;
+  size_t majorCollections = 0;
+  size_t promotedBytes = 0;
+  size_t freedBytes = 0;
+} HeapStats;
+
+// Implemented by whoever owns GC roots (the VM). The heap calls visitRoots() at the start of every
+// collection and the owner hands each root slot to Heap::visit(), which may rewrite it in place.
+class RootSet {
+public:
+  virtual ~RootSet() = default;
+  virtual void visitRoots(Heap &heap) = 0;
+};
+
+// Generational object heap.
+//
+// New objects are bump-allocated in a fixed-size nursery. When it fills up, a minor collection copies every
+// young object reachable from the roots or from the remembered set into old space and resets the nursery in
+// one step, so short-lived objects cost nothing to free. Old space is a list of individually allocated
+// objects collected by mark-sweep once it outgrows its threshold. Objects too large for the nursery, and
+// everything allocated while no roots are registered (e.g. compiler constants), go straight to old space.
+class Heap {
+public:
+  explicit Heap(const HeapLimits &limits = HeapLimits());
+  ~Heap();
+
+  Heap(const Heap &) = delete;
+  Heap &operator=(const Heap &) = delete;
+
+  void setRoots(RootSet *roots);
+  // Frees every object at once, leaving the heap as good as new for the next owner of roots. Nothing may
+  // reference its objects any more.
+  void clear();
+
+  // Returns a string with uninitialised characters; the caller fills them and sets the hash. May collect.
+  ObjString *allocateString(size_t length);
+  ObjString *copyString(const char *chars, size_t length);
+  // Returns the unique old-space string with these characters, creating it on first use. Interned strings
+  // never move, so compile-time tables can key on their address.
+  ObjString *intern(const char *chars, size_t length);
+  // Returns a rope of `length` characters with no children yet; the caller links them in.
+  ObjRope *allocateRope(size_t length);
+  ObjMap *allocateMap();
+  ObjArray *allocateArray(uint32_t capacity);
+  // Functions are made by the compiler and live in old space like its other constants.
+  ObjFunction *allocateFunction(uint32_t entry, uint8_t arity, uint8_t upvalueCount, ObjString *name);
+  // Returns a closure whose upvalues are all null; the caller fills them in.
+  ObjClosure *allocateClosure(ObjFunction *function);
+  ObjNative *allocateNative(uint32_t index);
+  // Returns an unfinished fiber without a task; the caller attaches one.
+  ObjFiber *allocateFiber();
+  // Returns a box holding null; the caller fills it in.
+  ObjBox *allocateBox();
+
+  // Must be called after storing `value` into a field of `owner`, so old-to-young pointers are found by the
+  // next minor collection.
+  void writeBarrier(Obj *owner, Value value);
+
+  // Root and field visitors used during a collection. They promote or mark the referenced object and update
+  // the slot with its new address.
+  void visit(Value &value);
+  void visit(Obj *&object);
+
+  // Out-of-line storage (array elements, map tables and the buffers of flattened ropes) counts toward the
+  // heap's size, so growing it makes collections due just as allocating does. Returns what `object` owns.
+  static size_t storageOf(const Obj *object);
+  // Records that the storage of `object` grew from `before` bytes. Never collects; the next allocation or
+  // makeRoomForStorage() does once a collection is due.
+  void storageGrew(const Obj *object, size_t before);
+  // Collects if `bytes` more storage make a collection due, and returns whether they fit under maxHeapSize.
+  // May collect.
+  bool makeRoomForStorage(size_t bytes);
+
+  void collectGarbage();
+  // Marks every object for good, so the collectors of other heaps holding references to them neither trace
+  // nor write to them (see Module). Only for heaps that never had roots, which keeps every object in old
+  // space; nothing may be allocated or collected afterwards.
+  void freeze();
+
+  size_t youngBytes() const;
+  size_t oldBytes() const;
+  size_t storageBytes() const;
+  const HeapStats &stats() const;
+  const HeapLimits &limits() const;
+
+private:
+  typedef enum { PHASE_IDLE, PHASE_MINOR, PHASE_MAJOR } Phase;
+
+  HeapLimits heapLimits;
+  HeapStats heapStats;
+  RootSet *roots = nullptr;
+  Phase phase = PHASE_IDLE;
+
+  uint8_t *nursery;
+  uint8_t *nurseryTop;
+  uint8_t *nurseryEnd;
+
+  Obj *objects = nullptr;
+  size_t oldSize = 0;
+  size_t nextMajor;
+  // Out-of-line storage of young and old objects, and how much of it was added since the last minor
+  // collection; a nursery's worth makes the next one due.
+  size_t storageSize = 0;
+  size_t youngStorage = 0;
+
+  std::vector<Obj *> rememberedSet;
+  std::vector<Obj *> grayStack;
+  // Nursery objects that own out-of-line storage; whichever are not promoted are released after a minor
+  // collection.
+  std::vector<Obj *> youngWithStorage;
+  // Intern table. Weak: entries whose string is unreachable are dropped before each sweep.
+  Table strings;
+
+  Obj *allocate(ObjType type, size_t size, bool tenured = false);
+  bool withinLimit(size_t bytes);
+  Obj *allocateOld(size_t size);
+  Obj *promote(Obj *object);
+  void markObject(Obj *object);
+  void blackenObject(Obj *object);
+  void traceGray();
+
+  void minorCollection();
+  void majorCollection();
+  void removeWhiteStrings();
+  void sweep();
+  void freeStorage(Obj *object);
+  void freeObject(Obj *object);
+};
+
+#endif // HEAP_H
@@ -0,0 +1,24 @@
+#include "isolate.h"
+
+#include <sstream>
+
+Isolate::Isolate(const IsolateOptions &options) : options(options), heap(options.heap) {}
+
+Evaluation Isolate::evaluate(const std::shared_ptr<const Module> &module, const Engine engine) {
+  std::ostringstream output;
+  std::ostringstream errors;
+  Evaluation evaluation;
+  {
+    VM vm(module, this->heap, this->options.stack);
+    vm.setOutput(output, errors);
+    vm.enableJit(this->options.jit);
+    vm.setInstructionLimit(this->options.maxInstructions);
+    evaluation.result = vm.interpret(engine);
+  }
+  // Whatever the VM left behind may point into `module`, which need not outlive this call.
+  this->heap.clear();
+
+  evaluation.output = output.str();
+  evaluation.errors = errors.str();
+  return evaluation;
+}
@@ -0,0 +1,48 @@
+#ifndef ISOLATE_H
+#define ISOLATE_H
+#include "heap.h"
+#include "module.h"
+#include "stack.h"
+#include "vm.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+typedef struct {
+  // HeapLimits::maxHeapSize caps the memory of an evaluation; allocations past it fail with a runtime error.
+  HeapLimits heap;
+  StackLimits stack;
+  // Instructions an evaluation may run before it is stopped with a runtime error, 0 for no limit.
+  uint64_t maxInstructions = 0;
+  // Whether the stack engine may compile hot scripts (see VM::enableJit).
+  bool jit = true;
+} IsolateOptions;
+
+typedef struct {
+  InterpretResult result;
+  // Everything the script printed, and the error report if it failed.
+  std::string output;
+  std::string errors;
+} Evaluation;
+
+// An independent instance of the language for embedders: a heap of its own and the limits its evaluations
+// run under. Each evaluation gets a fresh VM, so scripts never see each other's globals, and the heap is
+// cleared after every evaluation but keeps its memory for the next one. Isolates share nothing but the
+// frozen modules they run, so different threads may use different isolates at once; one isolate runs one
+// evaluation at a time.
+class Isolate {
+public:
+  explicit Isolate(const IsolateOptions &options = IsolateOptions());
+
+  Isolate(const Isolate &) = delete;
+  Isolate &operator=(const Isolate &) = delete;
+
+  Evaluation evaluate(const std::shared_ptr<const Module> &module, Engine engine = ENGINE_STACK);
+
+private:
+  IsolateOptions options;
+  Heap heap;
+};
+
+#endif // ISOLATE_H
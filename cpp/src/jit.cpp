@@ -0,0 +1,588 @@
+#include "jit.h"
+#include "object.h"
+
+#ifdef TRIPLES_JIT
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <initializer_list>
+#include <mutex>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Compiled code keeps its state in callee-saved registers, so helper calls leave it alone:
+//   rbx  stack top, one past the topmost value, as in run()
+//   r12  first slot of the frame
+//   r13  the JitFrame
+//   r14  the chunk's constants
+//   r15  QNAN, to test values for numbers
+// rax, rcx and rdx are scratch; xmm0 and xmm1 hold the operands of floating-point instructions.
+namespace {
+
+// Builds machine code in a growable buffer. 32-bit jumps are emitted with a zero displacement and patched
+// once their target is known.
+class Assembler {
+public:
+  std::vector<uint8_t> code;
+
+  size_t position() const { return this->code.size(); }
+
+  void emit(const std::initializer_list<uint8_t> bytes) { this->code.insert(this->code.end(), bytes); }
+
+  void emit32(const uint32_t value) {
+    for (int shift = 0; shift < 32; shift += 8) this->code.push_back(static_cast<uint8_t>(value >> shift));
+  }
+
+  void emit64(const uint64_t value) {
+    for (int shift = 0; shift < 64; shift += 8) this->code.push_back(static_cast<uint8_t>(value >> shift));
+  }
+
+  // Emits a jump opcode with a placeholder displacement and returns where the displacement is.
+  size_t jump(const std::initializer_list<uint8_t> opcode) {
+    this->emit(opcode);
+    const size_t at = this->position();
+    this->emit32(0);
+    return at;
+  }
+
+  void patch(const size_t at, const size_t target) {
+    const int64_t distance = static_cast<int64_t>(target) - static_cast<int64_t>(at + 4);
+    const auto displacement = static_cast<int32_t>(distance);
+    std::memcpy(&this->code[at], &displacement, sizeof(displacement));
+  }
+};
+
+// Register numbers as they appear in ModRM fields.
+typedef enum : uint8_t { RAX = 0, RCX = 1, RDX = 2 } Register;
+
+// Where a template continues when its fast path does not apply: the helper runs the instruction and compiled
+// code resumes after the template.
+typedef struct {
+  std::vector<size_t> jumps;
+  uint32_t offset;
+  size_t resume;
+} SlowPath;
+
+class TemplateCompiler {
+public:
+  TemplateCompiler(const Chunk &chunk, const Verifier &verifier, Value *globals, const InlineCache *caches,
+                   const JitHelper helper)
+      : chunk(chunk), verifier(verifier), globals(globals), caches(caches), helper(helper) {}
+
+  bool compile(std::vector<uint32_t> &entries, std::string &error);
+
+  std::vector<uint8_t> &code() { return this->assembler.code; }
+
+private:
+  const Chunk &chunk;
+  const Verifier &verifier;
+  Value *globals;
+  const InlineCache *caches;
+  JitHelper helper;
+  Assembler assembler;
+  // Bytecode jumps, to be pointed at the template of their target.
+  std::vector<std::pair<size_t, unsigned int>> jumps;
+  // Jumps to the shared exits.
+  std::vector<size_t> errorJumps;
+  std::vector<size_t> returnJumps;
+  std::vector<SlowPath> slowPaths;
+
+  void compileInstruction(unsigned int offset);
+
+  void loadTop(Register reg, uint8_t depth);
+  void storeTop(Register reg, uint8_t depth);
+  void push();
+  void pop();
+  void loadConstant(Register reg, uint64_t value);
+  void slowPathIf(std::initializer_list<uint8_t> jump);
+  void checkNumber(Register reg);
+  void checkNumbers();
+  void moveToXmm();
+  void arithmetic(uint8_t opcode);
+  void compare(bool greater);
+  void makeBool();
+  void jumpIfFalsey(unsigned int target);
+  void global(uint32_t slot);
+  void cachedEntry(Register receiver, uint32_t cache, bool isStore);
+  void callHelper(uint32_t offset);
+};
+
+void TemplateCompiler::loadTop(const Register reg, const uint8_t depth) {
+  this->assembler.emit({0x48, 0x8B, static_cast<uint8_t>(0x43 | reg << 3), static_cast<uint8_t>(-8 * depth)});
+}
+
+void TemplateCompiler::storeTop(const Register reg, const uint8_t depth) {
+  this->assembler.emit({0x48, 0x89, static_cast<uint8_t>(0x43 | reg << 3), static_cast<uint8_t>(-8 * depth)});
+}
+
+// Pushes rax.
+void TemplateCompiler::push() {
+  this->assembler.emit({0x48, 0x89, 0x03});       // mov [rbx], rax
+  this->assembler.emit({0x48, 0x83, 0xC3, 0x08}); // add rbx, 8
+}
+
+void TemplateCompiler::pop() {
+  this->assembler.emit({0x48, 0x83, 0xEB, 0x08}); // sub rbx, 8
+}
+
+void TemplateCompiler::loadConstant(const Register reg, const uint64_t value) {
+  this->assembler.emit({0x48, static_cast<uint8_t>(0xB8 | reg)}); // mov reg, imm64
+  this->assembler.emit64(value);
+}
+
+// Leaves the fast path of the current instruction if the condition of `jump` holds.
+void TemplateCompiler::slowPathIf(const std::initializer_list<uint8_t> jump) {
+  this->slowPaths.back().jumps.push_back(this->assembler.jump(jump));
+}
+
+void TemplateCompiler::checkNumber(const Register reg) {
+  this->assembler.emit({0x48, 0x89, static_cast<uint8_t>(0xC2 | reg << 3)}); // mov rdx, reg
+  this->assembler.emit({0x4C, 0x21, 0xFA});                                 // and rdx, r15
+  this->assembler.emit({0x4C, 0x39, 0xFA});                                 // cmp rdx, r15
+  this->slowPathIf({0x0F, 0x84});                                           // je
+}
+
+// Loads the two operands of a binary instruction, the left one into rcx and the right one into rax.
+void TemplateCompiler::checkNumbers() {
+  this->loadTop(RCX, 2);
+  this->loadTop(RAX, 1);
+  this->checkNumber(RCX);
+  this->checkNumber(RAX);
+}
+
+void TemplateCompiler::moveToXmm() {
+  this->assembler.emit({0x66, 0x48, 0x0F, 0x6E, 0xC1}); // movq xmm0, rcx
+  this->assembler.emit({0x66, 0x48, 0x0F, 0x6E, 0xC8}); // movq xmm1, rax
+}
+
+// Applies an SSE2 scalar double instruction to the numbers in rcx and rax, leaving the result in rax.
+void TemplateCompiler::arithmetic(const uint8_t opcode) {
+  this->moveToXmm();
+  this->assembler.emit({0xF2, 0x0F, opcode, 0xC1});     // op xmm0, xmm1
+  this->assembler.emit({0x66, 0x48, 0x0F, 0x7E, 0xC0}); // movq rax, xmm0
+}
+
+// Compares the numbers in rcx and rax, leaving a boolean in rax. seta is false for unordered operands, so NaN
+// compares false as in run().
+void TemplateCompiler::compare(const bool greater) {
+  this->moveToXmm();
+  this->assembler.emit({0x66, 0x0F, 0x2E, static_cast<uint8_t>(greater ? 0xC1 : 0xC8)}); // ucomisd
+  this->assembler.emit({0x0F, 0x97, 0xC0});                                            // seta al
+  this->makeBool();
+}
+
+// Turns al into a boolean value in rax. TRUE_VAL is FALSE_VAL with the lowest bit set.
+void TemplateCompiler::makeBool() {
+  this->assembler.emit({0x0F, 0xB6, 0xC0}); // movzx eax, al
+  this->loadConstant(RCX, FALSE_VAL);
+  this->assembler.emit({0x48, 0x09, 0xC8}); // or rax, rcx
+}
+
+// Jumps to the template of `target` if the top of the stack is null or false.
+void TemplateCompiler::jumpIfFalsey(const unsigned int target) {
+  this->loadTop(RAX, 1);
+  this->loadConstant(RCX, NULL_VAL);
+  this->assembler.emit({0x48, 0x39, 0xC8}); // cmp rax, rcx
+  this->jumps.emplace_back(this->assembler.jump({0x0F, 0x84}), target);
+  this->assembler.emit({0x48, 0xFF, 0xC1}); // inc rcx, making it FALSE_VAL
+  this->assembler.emit({0x48, 0x39, 0xC8}); // cmp rax, rcx
+  this->jumps.emplace_back(this->assembler.jump({0x0F, 0x84}), target);
+}
+
+// Loads a global into rax through its address in rdx. Undefined globals take the slow path, which reports
+// them.
+void TemplateCompiler::global(const uint32_t slot) {
+  this->loadConstant(RDX, reinterpret_cast<uint64_t>(&this->globals[slot]));
+  this->assembler.emit({0x48, 0x8B, 0x02}); // mov rax, [rdx]
+  this->loadConstant(RCX, UNDEFINED_VAL);
+  this->assembler.emit({0x48, 0x39, 0xC8}); // cmp rax, rcx
+  this->slowPathIf({0x0F, 0x84});           // je
+}
+
+// Points rax at the table entry of the property the inline cache `cache` knows for the map in `receiver`,
+// which is read from the stack. Anything but a cached shape takes the slow path, as do stores that add a
+// property.
+void TemplateCompiler::cachedEntry(const Register receiver, const uint32_t cache, const bool isStore) {
+  // Field offsets, taken from a probe as the object structs are not standard-layout.
+  ObjMap probe;
+  const auto field = [&probe](const void *member) {
+    return static_cast<uint32_t>(static_cast<const char *>(member) - reinterpret_cast<const char *>(&probe));
+  };
+  static_assert(offsetof(CacheEntry, key) == 0 && offsetof(CacheEntry, index) == 4 &&
+                    offsetof(CacheEntry, transition) == 8 && sizeof(CacheEntry) == 12,
+                "the property templates hard-code the CacheEntry layout");
+
+  // Unbox the receiver if it is an object, then check that it is a map.
+  if (receiver != RAX) this->assembler.emit({0x48, 0x89, static_cast<uint8_t>(0xC0 | receiver << 3)});
+  this->loadConstant(RCX, QNAN | SIGN_BIT);
+  this->assembler.emit({0x48, 0x89, 0xC2});       // mov rdx, rax
+  this->assembler.emit({0x48, 0x21, 0xCA});       // and rdx, rcx
+  this->assembler.emit({0x48, 0x39, 0xCA});       // cmp rdx, rcx
+  this->slowPathIf({0x0F, 0x85});                 // jne
+  this->assembler.emit({0x48, 0xF7, 0xD1});       // not rcx
+  this->assembler.emit({0x48, 0x21, 0xC8});       // and rax, rcx
+  this->assembler.emit({0x80, 0x38, OBJ_MAP});    // cmp byte [rax + type], OBJ_MAP
+  this->slowPathIf({0x0F, 0x85});                 // jne
+  this->assembler.emit({0x8B, 0x90});             // mov edx, [rax + shape]
+  this->assembler.emit32(field(&probe.shape));
+
+  // Look for the shape among the cache's ways in order, as InlineCache::find() does, leaving the property's
+  // entry index in edx.
+  const InlineCache *site = &this->caches[cache];
+  this->loadConstant(RCX, reinterpret_cast<uint64_t>(site));
+  std::vector<size_t> found;
+  for (uint32_t way = 0; way < INLINE_CACHE_WAYS; way++) {
+    const uint32_t entry = static_cast<uint32_t>(offsetof(InlineCache, entries) + way * sizeof(CacheEntry));
+    this->assembler.emit({0x83, 0xB9}); // cmp dword [rcx + count], way
+    this->assembler.emit32(offsetof(InlineCache, count));
+    this->assembler.emit({static_cast<uint8_t>(way)});
+    this->slowPathIf({0x0F, 0x86}); // jbe
+    this->assembler.emit({0x3B, 0x91}); // cmp edx, [rcx + key]
+    this->assembler.emit32(entry);
+    const size_t next = this->assembler.jump({0x0F, 0x85});
+    if (isStore) {
+      this->assembler.emit({0x3B, 0x91}); // cmp edx, [rcx + transition]
+      this->assembler.emit32(entry + offsetof(CacheEntry, transition));
+      this->slowPathIf({0x0F, 0x85}); // jne
+    }
+    this->assembler.emit({0x8B, 0x91}); // mov edx, [rcx + index]
+    this->assembler.emit32(entry + offsetof(CacheEntry, index));
+    found.push_back(this->assembler.jump({0xE9}));
+    if (way + 1 < INLINE_CACHE_WAYS) {
+      this->assembler.patch(next, this->assembler.position());
+    } else {
+      this->slowPaths.back().jumps.push_back(next);
+    }
+  }
+  for (const size_t jump : found) this->assembler.patch(jump, this->assembler.position());
+
+  this->assembler.emit({0x48, 0x8B, 0x80}); // mov rax, [rax + table.entries]
+  this->assembler.emit32(field(&probe.table.entries));
+  this->assembler.emit({0x48, 0x69, 0xD2}); // imul rdx, rdx, sizeof(Entry)
+  this->assembler.emit32(sizeof(Entry));
+  this->assembler.emit({0x48, 0x01, 0xD0}); // add rax, rdx
+}
+
+// Hands the stack to the helper to run the instruction at `offset`, leaving through the error exit if it
+// fails.
+void TemplateCompiler::callHelper(const uint32_t offset) {
+  this->assembler.emit({0x49, 0x89, 0x5D, 0x00}); // mov [r13 + top], rbx
+  this->assembler.emit({0x4C, 0x89, 0xEF});       // mov rdi, r13
+  this->assembler.emit({0xBE});                   // mov esi, offset
+  this->assembler.emit32(offset);
+  this->loadConstant(RAX, reinterpret_cast<uint64_t>(this->helper));
+  this->assembler.emit({0xFF, 0xD0});             // call rax
+  this->assembler.emit({0x49, 0x8B, 0x5D, 0x00}); // mov rbx, [r13 + top]
+  this->assembler.emit({0x84, 0xC0});             // test al, al
+  this->errorJumps.push_back(this->assembler.jump({0x0F, 0x84}));
+}
+
+void TemplateCompiler::compileInstruction(const unsigned int offset) {
+  const uint8_t instruction = this->chunk.at(offset);
+  const uint8_t byteOperand = offset + 1 < this->chunk.count() ? this->chunk.at(offset + 1) : 0;
+  this->slowPaths.push_back({{}, offset, 0});
+
+  switch (instruction) {
+    case OP_CONSTANT:
+    case OP_CONSTANT_LONG: {
+      const uint32_t index = instruction == OP_CONSTANT ? byteOperand : this->chunk.readLong(offset + 1);
+      this->assembler.emit({0x49, 0x8B, 0x86}); // mov rax, [r14 + disp32]
+      this->assembler.emit32(index * sizeof(Value));
+      this->push();
+      break;
+    }
+    case OP_NULL:
+      this->loadConstant(RAX, NULL_VAL);
+      this->push();
+      break;
+    case OP_TRUE:
+      this->loadConstant(RAX, TRUE_VAL);
+      this->push();
+      break;
+    case OP_FALSE:
+      this->loadConstant(RAX, FALSE_VAL);
+      this->push();
+      break;
+    case OP_POP:
+      this->pop();
+      break;
+    case OP_GET_LOCAL:
+      this->assembler.emit({0x49, 0x8B, 0x84, 0x24}); // mov rax, [r12 + disp32]
+      this->assembler.emit32(byteOperand * sizeof(Value));
+      this->push();
+      break;
+    case OP_SET_LOCAL:
+      this->loadTop(RAX, 1);
+      this->assembler.emit({0x49, 0x89, 0x84, 0x24}); // mov [r12 + disp32], rax
+      this->assembler.emit32(byteOperand * sizeof(Value));
+      break;
+    case OP_SET_LOCAL_POP:
+      this->pop();
+      this->assembler.emit({0x48, 0x8B, 0x03});       // mov rax, [rbx]
+      this->assembler.emit({0x49, 0x89, 0x84, 0x24}); // mov [r12 + disp32], rax
+      this->assembler.emit32(byteOperand * sizeof(Value));
+      break;
+    case OP_GET_GLOBAL:
+    case OP_GET_GLOBAL_LONG:
+      this->global(instruction == OP_GET_GLOBAL ? byteOperand : this->chunk.readLong(offset + 1));
+      this->push();
+      break;
+    case OP_SET_GLOBAL:
+    case OP_SET_GLOBAL_LONG:
+      this->global(instruction == OP_SET_GLOBAL ? byteOperand : this->chunk.readLong(offset + 1));
+      this->loadTop(RAX, 1);
+      this->assembler.emit({0x48, 0x89, 0x02}); // mov [rdx], rax
+      break;
+    case OP_DEFINE_GLOBAL:
+    case OP_DEFINE_GLOBAL_LONG: {
+      const uint32_t slot = instruction == OP_DEFINE_GLOBAL ? byteOperand : this->chunk.readLong(offset + 1);
+      this->pop();
+      this->assembler.emit({0x48, 0x8B, 0x03}); // mov rax, [rbx]
+      this->loadConstant(RDX, reinterpret_cast<uint64_t>(&this->globals[slot]));
+      this->assembler.emit({0x48, 0x89, 0x02}); // mov [rdx], rax
+      break;
+    }
+    // Only numbers are compared inline; everything else may need to look inside objects.
+    case OP_EQUAL:
+      this->checkNumbers();
+      this->moveToXmm();
+      this->assembler.emit({0x66, 0x0F, 0x2E, 0xC1}); // ucomisd xmm0, xmm1
+      this->assembler.emit({0x0F, 0x9B, 0xC1});       // setnp cl, as NaN is unordered
+      this->assembler.emit({0x0F, 0x94, 0xC0});       // sete al
+      this->assembler.emit({0x20, 0xC8});             // and al, cl
+      this->makeBool();
+      this->pop();
+      this->storeTop(RAX, 1);
+      break;
+    case OP_GREATER:
+    case OP_LESS:
+      this->checkNumbers();
+      this->compare(instruction == OP_GREATER);
+      this->pop();
+      this->storeTop(RAX, 1);
+      break;
+    case OP_GREATER_CONST:
+    case OP_LESS_CONST:
+      this->loadTop(RCX, 1);
+      this->checkNumber(RCX);
+      this->loadConstant(RAX, this->chunk.constants[byteOperand]);
+      this->compare(instruction == OP_GREATER_CONST);
+      this->storeTop(RAX, 1);
+      break;
+    // Adding strings is left to the slow path along with every other type error.
+    case OP_ADD:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE: {
+      static const uint8_t operations[] = {0x58, 0x5C, 0x59, 0x5E}; // addsd, subsd, mulsd, divsd
+      this->checkNumbers();
+      this->arithmetic(operations[instruction - OP_ADD]);
+      this->pop();
+      this->storeTop(RAX, 1);
+      break;
+    }
+    case OP_ADD_CONST:
+    case OP_SUBTRACT_CONST:
+    case OP_MULTIPLY_CONST:
+    case OP_DIVIDE_CONST: {
+      static const uint8_t operations[] = {0x58, 0x5C, 0x59, 0x5E};
+      this->loadTop(RCX, 1);
+      this->checkNumber(RCX);
+      this->loadConstant(RAX, this->chunk.constants[byteOperand]);
+      this->arithmetic(operations[instruction - OP_ADD_CONST]);
+      this->storeTop(RAX, 1);
+      break;
+    }
+    case OP_NOT:
+      this->loadTop(RAX, 1);
+      this->loadConstant(RCX, NULL_VAL);
+      this->assembler.emit({0x48, 0x39, 0xC8}); // cmp rax, rcx
+      this->assembler.emit({0x0F, 0x94, 0xC2}); // sete dl
+      this->assembler.emit({0x48, 0xFF, 0xC1}); // inc rcx, making it FALSE_VAL
+      this->assembler.emit({0x48, 0x39, 0xC8}); // cmp rax, rcx
+      this->assembler.emit({0x0F, 0x94, 0xC0}); // sete al
+      this->assembler.emit({0x08, 0xD0});       // or al, dl
+      this->assembler.emit({0x0F, 0xB6, 0xC0}); // movzx eax, al
+      this->assembler.emit({0x48, 0x09, 0xC8}); // or rax, rcx
+      this->storeTop(RAX, 1);
+      break;
+    case OP_NEGATE:
+      this->loadTop(RAX, 1);
+      this->checkNumber(RAX);
+      this->assembler.emit({0x48, 0x0F, 0xBA, 0xF8, 0x3F}); // btc rax, 63
+      this->storeTop(RAX, 1);
+      break;
+    case OP_JUMP:
+      this->jumps.emplace_back(this->assembler.jump({0xE9}), offset + 3 + this->chunk.readShort(offset + 1));
+      break;
+    case OP_JUMP_IF_FALSE:
+      this->jumpIfFalsey(offset + 3 + this->chunk.readShort(offset + 1));
+      break;
+    case OP_LOOP:
+      this->jumps.emplace_back(this->assembler.jump({0xE9}), offset + 3 - this->chunk.readShort(offset + 1));
+      break;
+    case OP_RETURN:
+      this->returnJumps.push_back(this->assembler.jump({0xE9}));
+      break;
+    case OP_GET_PROPERTY:
+    case OP_GET_PROPERTY_LONG:
+      this->loadTop(RAX, 1);
+      this->cachedEntry(RAX, this->chunk.readLong(offset + (instruction == OP_GET_PROPERTY ? 2 : 4)), false);
+      this->assembler.emit({0x48, 0x8B, 0x80}); // mov rax, [rax + value]
+      this->assembler.emit32(offsetof(Entry, value));
+      this->storeTop(RAX, 1);
+      break;
+    // Storing a number needs no write barrier; other values are stored by the slow path.
+    case OP_SET_PROPERTY:
+    case OP_SET_PROPERTY_LONG:
+      this->loadTop(RAX, 1);
+      this->checkNumber(RAX);
+      this->loadTop(RAX, 2);
+      this->cachedEntry(RAX, this->chunk.readLong(offset + (instruction == OP_SET_PROPERTY ? 2 : 4)), true);
+      this->loadTop(RCX, 1);
+      this->assembler.emit({0x48, 0x89, 0x88}); // mov [rax + value], rcx
+      this->assembler.emit32(offsetof(Entry, value));
+      this->pop();
+      this->storeTop(RCX, 1);
+      break;
+    // Literals, indexing, calls and printing allocate or look inside objects.
+    default:
+      this->callHelper(offset);
+      break;
+  }
+
+  this->slowPaths.back().resume = this->assembler.position();
+}
+
+bool TemplateCompiler::compile(std::vector<uint32_t> &entries, std::string &error) {
+  // Entered as bool (*)(JitFrame *frame, const void *entry) from Jit::run(). Six pushes and the sub keep rsp
+  // 16-byte aligned for helper calls.
+  this->assembler.emit({0x55});                   // push rbp
+  this->assembler.emit({0x48, 0x89, 0xE5});       // mov rbp, rsp
+  this->assembler.emit({0x53});                   // push rbx
+  this->assembler.emit({0x41, 0x54});             // push r12
+  this->assembler.emit({0x41, 0x55});             // push r13
+  this->assembler.emit({0x41, 0x56});             // push r14
+  this->assembler.emit({0x41, 0x57});             // push r15
+  this->assembler.emit({0x48, 0x83, 0xEC, 0x08}); // sub rsp, 8
+  this->assembler.emit({0x49, 0x89, 0xFD});       // mov r13, rdi
+  this->assembler.emit({0x49, 0x8B, 0x5D, 0x00}); // mov rbx, [r13 + top]
+  this->assembler.emit({0x4D, 0x8B, 0x65, 0x08}); // mov r12, [r13 + slots]
+  this->assembler.emit({0x4D, 0x8B, 0x75, 0x10}); // mov r14, [r13 + constants]
+  this->assembler.emit({0x49, 0xBF});             // mov r15, QNAN
+  this->assembler.emit64(QNAN);
+  this->assembler.emit({0xFF, 0xE6}); // jmp rsi
+
+  entries.assign(this->chunk.count(), UINT32_MAX);
+  for (unsigned int offset = 0; offset < this->chunk.count(); offset++) {
+    if (this->verifier.depthAt(offset) < 0) continue;
+    // Templates assume a single frame, the script's, that never suspends.
+    const uint8_t instruction = this->chunk.at(offset);
+    if (instruction >= OP_CLOSURE && instruction <= OP_RETURN_VALUE) {
+      error = "Functions and fibers are not compiled.";
+      return false;
+    }
+
+    entries[offset] = static_cast<uint32_t>(this->assembler.position());
+    this->compileInstruction(offset);
+  }
+
+  // Slow paths go after all templates, out of the way of the fast paths.
+  for (const SlowPath &path : this->slowPaths) {
+    if (path.jumps.empty()) continue;
+
+    for (const size_t jump : path.jumps) this->assembler.patch(jump, this->assembler.position());
+    this->callHelper(path.offset);
+    this->assembler.patch(this->assembler.jump({0xE9}), path.resume);
+  }
+
+  for (const auto &jump : this->jumps) {
+    if (jump.second >= entries.size() || entries[jump.second] == UINT32_MAX) {
+      error = "Jump to offset " + std::to_string(jump.second) + " has no compiled target.";
+      return false;
+    }
+    this->assembler.patch(jump.first, entries[jump.second]);
+  }
+
+  for (const size_t jump : this->errorJumps) this->assembler.patch(jump, this->assembler.position());
+  this->assembler.emit({0x31, 0xC0}); // xor eax, eax
+  const size_t exit = this->assembler.jump({0xE9});
+  for (const size_t jump : this->returnJumps) this->assembler.patch(jump, this->assembler.position());
+  this->assembler.emit({0xB8}); // mov eax, 1
+  this->assembler.emit32(1);
+  this->assembler.patch(exit, this->assembler.position());
+
+  this->assembler.emit({0x49, 0x89, 0x5D, 0x00}); // mov [r13 + top], rbx
+  this->assembler.emit({0x48, 0x83, 0xC4, 0x08}); // add rsp, 8
+  this->assembler.emit({0x41, 0x5F});             // pop r15
+  this->assembler.emit({0x41, 0x5E});             // pop r14
+  this->assembler.emit({0x41, 0x5D});             // pop r13
+  this->assembler.emit({0x41, 0x5C});             // pop r12
+  this->assembler.emit({0x5B});                   // pop rbx
+  this->assembler.emit({0x5D});                   // pop rbp
+  this->assembler.emit({0xC3});                   // ret
+  return true;
+}
+
+} // namespace
+
+static_assert(offsetof(JitFrame, top) == 0 && offsetof(JitFrame, slots) == 8 &&
+                  offsetof(JitFrame, constants) == 16,
+              "the prologue and helper calls hard-code JitFrame offsets");
+
+// Open once Jit::enablePerfMap has been called. Jits on every thread append to it.
+static std::mutex perfMapLock;
+static std::ofstream perfMap;
+
+Jit::~Jit() {
+  if (this->memory != nullptr) munmap(this->memory, this->size);
+}
+
+bool Jit::compile(const Chunk &chunk, const Verifier &verifier, Value *globals, const InlineCache *caches,
+                  const JitHelper helper) {
+  TemplateCompiler compiler(chunk, verifier, globals, caches, helper);
+  if (!compiler.compile(this->entries, this->message)) return false;
+
+  const std::vector<uint8_t> &code = compiler.code();
+  const auto pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  const size_t size = (code.size() + pageSize - 1) / pageSize * pageSize;
+  void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) return this->fail("Could not map memory for compiled code.");
+
+  std::memcpy(memory, code.data(), code.size());
+  if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(memory, size);
+    return this->fail("Could not make compiled code executable.");
+  }
+  this->memory = static_cast<uint8_t *>(memory);
+  this->size = size;
+
+  // perf reads symbols for JIT code from this file; a failure to write it only costs the names.
+  const std::lock_guard<std::mutex> lock(perfMapLock);
+  if (perfMap.is_open()) {
+    perfMap << std::hex << reinterpret_cast<uintptr_t>(this->memory) << " " << code.size()
+            << " TripleS::script" << std::endl;
+  }
+  return true;
+}
+
+bool Jit::enablePerfMap() {
+  const std::lock_guard<std::mutex> lock(perfMapLock);
+  if (!perfMap.is_open()) perfMap.open("/tmp/perf-" + std::to_string(getpid()) + ".map", std::ios::app);
+  return perfMap.is_open();
+}
+
+bool Jit::isCompiled() const { return this->memory != nullptr; }
+
+bool Jit::run(JitFrame &frame, const unsigned int offset) const {
+  const auto entry = reinterpret_cast<bool (*)(JitFrame *, const void *)>(this->memory);
+  return entry(&frame, this->memory + this->entries[offset]);
+}
+
+const std::string &Jit::error() const { return this->message; }
+
+bool Jit::fail(const std::string &reason) {
+  this->message = reason;
+  return false;
+}
+#endif
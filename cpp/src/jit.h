@@ -0,0 +1,86 @@
+#ifndef JIT_H
+#define JIT_H
+#include "chunk.h"
+#include "debug.h"
+#include "verifier.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// The baseline JIT emits x86-64 code and is only built for Linux; defining TRIPLES_NO_JIT leaves it out there
+// too. A traced VM keeps every instruction in the interpreter instead (see trace.h).
+#if defined(__x86_64__) && defined(__linux__) && !defined(TRIPLES_NO_JIT)
+#define TRIPLES_JIT
+#endif
+
+#ifdef TRIPLES_JIT
+// Back edges the interpreter takes before it compiles the chunk.
+#ifndef JIT_HOT_LOOP
+#define JIT_HOT_LOOP 1000
+#endif
+
+class VM;
+
+// Shared between the VM and compiled code, which keeps its own copy of the stack top in a register and writes
+// it back here whenever it calls out or returns.
+typedef struct {
+  Value *top;
+  Value *slots;
+  const Value *constants;
+  VM *vm;
+} JitFrame;
+
+// Runs the instruction at `offset` for compiled code, on the stack as compiled code left it. Returns false
+// after reporting a runtime error.
+typedef bool (*JitHelper)(JitFrame *frame, uint32_t offset);
+
+// Baseline template JIT.
+//
+// Every reachable instruction of a chunk is replaced by a fixed machine-code template, so dispatch disappears
+// and operands become immediates. Templates keep the interpreter's stack layout: values stay in the VM's
+// stack slots and only the top pointer lives in a register. That lets any instruction hand the stack to the
+// VM as it is, which templates do whenever a type check fails (adding strings, comparing non-numbers, an
+// undefined global) and for everything that allocates or looks into objects. The helper then runs the
+// instruction exactly as the interpreter would, so the interpreter stays the reference for every result and
+// error; the templates only cover numbers, locals, globals, control flow and property accesses that hit their
+// inline cache.
+//
+// Code is written to anonymous memory that is made executable, and never writable again, once complete. After
+// Jit::enablePerfMap, each compiled chunk is also listed in /tmp/perf-<pid>.map so perf can name its samples.
+class Jit {
+public:
+  Jit() = default;
+  ~Jit();
+
+  Jit(const Jit &) = delete;
+  Jit &operator=(const Jit &) = delete;
+
+  // Compiled code uses `globals` and the inline caches `caches` in place, so neither may move for as long as
+  // it may run.
+  bool compile(const Chunk &chunk, const Verifier &verifier, Value *globals, const InlineCache *caches,
+               JitHelper helper);
+  bool isCompiled() const;
+  // Runs compiled code from the instruction at `offset`, which must be reachable, until the chunk returns.
+  // Returns false after a runtime error.
+  bool run(JitFrame &frame, unsigned int offset) const;
+
+  const std::string &error() const;
+
+  // Lists the code every Jit in the process compiles from now on in /tmp/perf-<pid>.map, which is opened once
+  // and then shared. Returns false if the file cannot be opened.
+  static bool enablePerfMap();
+
+private:
+  uint8_t *memory = nullptr;
+  size_t size = 0;
+  // Code offset of each instruction's template, or UINT32_MAX for bytes that do not start one.
+  std::vector<uint32_t> entries;
+  std::string message;
+
+  bool fail(const std::string &reason);
+};
+#endif
+
+#endif // JIT_H
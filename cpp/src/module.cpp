@@ -0,0 +1,36 @@
+#include "module.h"
+#include "cache.h"
+#include "compiler/compiler.h"
+
+// Objects only go to a nursery while a VM roots the heap, and a module's never is.
+static HeapLimits moduleLimits() {
+  HeapLimits limits;
+  limits.nurserySize = 0;
+  return limits;
+}
+
+Module::Module() : heap(moduleLimits()) {}
+
+std::shared_ptr<const Module> Module::compile(const char *source, const size_t length) {
+  std::unique_ptr<Module> module(new Module());
+  Compiler compiler(source, length, module->code, module->heap);
+  if (!compiler.compile()) return nullptr;
+  return freeze(std::move(module));
+}
+
+std::shared_ptr<const Module> Module::compile(const std::string &source) {
+  return compile(source.data(), source.length());
+}
+
+std::shared_ptr<const Module> Module::load(const std::string &path, const uint64_t sourceHash) {
+  std::unique_ptr<Module> module(new Module());
+  if (!Cache::load(path, sourceHash, module->code, module->heap)) return nullptr;
+  return freeze(std::move(module));
+}
+
+const Chunk &Module::chunk() const { return this->code; }
+
+std::shared_ptr<const Module> Module::freeze(std::unique_ptr<Module> module) {
+  module->heap.freeze();
+  return std::shared_ptr<const Module>(std::move(module));
+}
@@ -0,0 +1,38 @@
+#ifndef MODULE_H
+#define MODULE_H
+#include "chunk.h"
+#include "heap.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Compiled code, immutable once built, that any number of VMs run at the same time without copying it.
+//
+// A module owns its chunk and a private heap holding the chunk's constants and global names. The heap is
+// frozen when the module is complete (see Heap::freeze): VMs allocate in heaps of their own, and their
+// collectors pass over the module's objects without touching them, so VMs on different threads can share a
+// module. Everything a run changes (globals, inline caches, shapes, the stack) belongs to the VM. Modules are
+// handed around as shared pointers, and each VM keeps its module alive.
+class Module {
+public:
+  Module(const Module &) = delete;
+  Module &operator=(const Module &) = delete;
+
+  // Returns nullptr after reporting compile errors. The source is only read while compiling.
+  static std::shared_ptr<const Module> compile(const char *source, size_t length);
+  static std::shared_ptr<const Module> compile(const std::string &source);
+  // Returns the module precompiled in the cache file at `path`, or nullptr if Cache::load rejects it.
+  static std::shared_ptr<const Module> load(const std::string &path, uint64_t sourceHash);
+
+  const Chunk &chunk() const;
+
+private:
+  Heap heap;
+  Chunk code;
+
+  Module();
+  static std::shared_ptr<const Module> freeze(std::unique_ptr<Module> module);
+};
+
+#endif // MODULE_H
@@ -0,0 +1,210 @@
+#include "object.h"
+#include "builtins/builtins.h"
+#include "heap.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+void ObjArray::init() {
+  this->values = nullptr;
+  this->count = 0;
+  this->capacity = 0;
+  this->packed = true;
+}
+
+void ObjArray::reserve(const uint32_t minimum) {
+  if (minimum <= this->capacity) return;
+
+  uint32_t capacity = this->capacity < 8 ? 8 : this->capacity;
+  while (capacity < minimum) capacity *= 2;
+  this->values = static_cast<Value *>(std::realloc(this->values, capacity * sizeof(Value)));
+  this->capacity = capacity;
+}
+
+void ObjArray::append(const Value value) {
+  this->reserve(this->count + 1);
+  this->values[this->count++] = value;
+  if (!isNumber(value)) this->packed = false;
+}
+
+void ObjArray::store(const uint32_t index, const Value value) {
+  this->values[index] = value;
+  if (!isNumber(value)) this->packed = false;
+}
+
+void ObjArray::release() {
+  std::free(this->values);
+  this->init();
+}
+
+uint32_t hashString(const char *chars, const size_t length) {
+  // FNV-1a, 32 bit.
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < length; i++) {
+    hash ^= static_cast<uint8_t>(chars[i]);
+    hash *= 16777619;
+  }
+  return hash;
+}
+
+const char *flattenRope(const ObjString *string) {
+  // Flattening does not change the value of the string, so it is allowed through a const pointer.
+  auto *rope = static_cast<ObjRope *>(const_cast<ObjString *>(string));
+  if (rope->flat != nullptr) return rope->flat;
+
+  char *flat = static_cast<char *>(std::malloc(rope->length + 1));
+  // Walk the tree with an explicit stack: `s = s + piece` loops build ropes as deep as they are long.
+  std::vector<const ObjString *> pending = {rope->right, rope->left};
+  size_t offset = 0;
+  while (!pending.empty()) {
+    const ObjString *piece = pending.back();
+    pending.pop_back();
+
+    if (piece->type == OBJ_ROPE && static_cast<const ObjRope *>(piece)->flat == nullptr) {
+      pending.push_back(static_cast<const ObjRope *>(piece)->right);
+      pending.push_back(static_cast<const ObjRope *>(piece)->left);
+      continue;
+    }
+
+    std::memcpy(flat + offset, piece->chars(), piece->length);
+    offset += piece->length;
+  }
+  flat[rope->length] = '\0';
+
+  rope->flat = flat;
+  rope->hash = hashString(flat, rope->length);
+  rope->left = nullptr;
+  rope->right = nullptr;
+  rope->heap->storageGrew(rope, 0);
+  return flat;
+}
+
+bool stringsEqual(const ObjString *a, const ObjString *b) {
+  if (a == b) return true;
+  if (a->length != b->length || a->hashCode() != b->hashCode()) return false;
+  return std::memcmp(a->chars(), b->chars(), a->length) == 0;
+}
+
+static bool mapsEqual(const ObjMap *a, const ObjMap *b) {
+  if (a->table.count != b->table.count) return false;
+
+  for (const Entry *entry = a->table.begin(); entry != a->table.end(); entry++) {
+    if (isUndefined(entry->key)) continue;
+
+    Value other;
+    if (!b->table.get(entry->key, &other) || !valuesEqual(entry->value, other)) return false;
+  }
+  return true;
+}
+
+static bool arraysEqual(const ObjArray *a, const ObjArray *b) {
+  if (a->count != b->count) return false;
+
+  for (uint32_t i = 0; i < a->count; i++) {
+    if (!valuesEqual(a->values[i], b->values[i])) return false;
+  }
+  return true;
+}
+
+bool objectsEqual(const Value a, const Value b) {
+  // A rope and a flat string with the same characters are equal.
+  if (isString(a) && isString(b)) return stringsEqual(asString(a), asString(b));
+  if (objType(a) != objType(b)) return false;
+
+  switch (objType(a)) {
+    case OBJ_STRING:
+    case OBJ_ROPE:
+      return false;
+    case OBJ_MAP:
+      return mapsEqual(asMap(a), asMap(b));
+    case OBJ_ARRAY:
+      return arraysEqual(asArray(a), asArray(b));
+    case OBJ_FUNCTION:
+    case OBJ_CLOSURE:
+    case OBJ_NATIVE:
+    case OBJ_FIBER:
+    case OBJ_BOX:
+      return false;
+  }
+  return false;
+}
+
+static void printMap(const ObjMap *map, std::ostream &out) {
+  if (map->table.count == 0) {
+    out << "{}";
+    return;
+  }
+
+  out << "{";
+  bool first = true;
+  for (const Entry *entry = map->table.begin(); entry != map->table.end(); entry++) {
+    if (isUndefined(entry->key)) continue;
+
+    if (!first) out << ", ";
+    first = false;
+    printRepresentation(entry->key, out);
+    out << ": ";
+    printRepresentation(entry->value, out);
+  }
+  out << "}";
+}
+
+static void printArray(const ObjArray *array, std::ostream &out) {
+  out << "[";
+  for (uint32_t i = 0; i < array->count; i++) {
+    if (i > 0) out << ", ";
+    printRepresentation(array->values[i], out);
+  }
+  out << "]";
+}
+
+static void printFunction(const ObjFunction *function, std::ostream &out) {
+  if (function->name == nullptr) {
+    out << "<fn>";
+    return;
+  }
+  out << "<fn " << function->name->chars() << ">";
+}
+
+void printObject(const Value value, std::ostream &out) {
+  switch (objType(value)) {
+    case OBJ_STRING:
+    case OBJ_ROPE:
+      out.write(asString(value)->chars(), asString(value)->length);
+      break;
+    case OBJ_MAP:
+      printMap(asMap(value), out);
+      break;
+    case OBJ_ARRAY:
+      printArray(asArray(value), out);
+      break;
+    case OBJ_FUNCTION:
+      printFunction(asFunction(value), out);
+      break;
+    case OBJ_CLOSURE:
+      printFunction(asClosure(value)->function, out);
+      break;
+    case OBJ_NATIVE:
+      out << "<native fn " << globalFunctions[asNative(value)->index].name << ">";
+      break;
+    case OBJ_FIBER:
+      out << "<fiber>";
+      break;
+    case OBJ_BOX:
+      out << "<box>";
+      break;
+  }
+}
+
+void printRepresentation(const Value value, std::ostream &out) {
+  if (isString(value)) {
+    out << "'";
+    printObject(value, out);
+    out << "'";
+    return;
+  }
+
+  printValue(value, out);
+}
@@ -0,0 +1,185 @@
+#ifndef OBJECT_H
+#define OBJECT_H
+#include "table.h"
+#include "value.h"
+
+#include <cstddef>
+#include <cstdint>
+
+typedef enum : uint8_t {
+  OBJ_STRING,
+  OBJ_ROPE,
+  OBJ_MAP,
+  OBJ_ARRAY,
+  OBJ_FUNCTION,
+  OBJ_CLOSURE,
+  OBJ_NATIVE,
+  OBJ_FIBER,
+  OBJ_BOX,
+} ObjType;
+
+// Common header of every heap object. Objects are plain data so the collector can relocate them with memcpy.
+struct Obj {
+  ObjType type;
+  bool marked;
+  // Set while the object lives in the nursery.
+  bool young;
+  // Set while an old object sits in the remembered set.
+  bool remembered;
+  // Allocation size in bytes, including this header.
+  uint32_t size;
+  // Old space: next object in the heap's object list.
+  // Nursery: forwarding address once the object has been promoted, otherwise nullptr.
+  Obj *next;
+};
+
+// Concatenations shorter than this are copied into a flat string; longer ones build a rope.
+#define ROPE_MIN_LENGTH 32
+
+class Heap;
+struct ObjString;
+// Copies a rope's characters into its own buffer on first use and returns them.
+const char *flattenRope(const ObjString *string);
+
+// A string is either flat (OBJ_STRING), with its characters stored inline directly after the header, or a
+// rope (OBJ_ROPE, see ObjRope). Either way chars() is null-terminated.
+struct ObjString : Obj {
+  uint32_t length;
+  // Ropes only know their hash once flattened; read it through hashCode().
+  uint32_t hash;
+
+  const char *chars() const {
+    if (this->type == OBJ_STRING) return reinterpret_cast<const char *>(this + 1);
+    return flattenRope(this);
+  }
+  uint32_t hashCode() const {
+    if (this->type == OBJ_ROPE) this->chars();
+    return this->hash;
+  }
+  // Writable storage of a freshly allocated flat string.
+  char *inlineChars() { return reinterpret_cast<char *>(this + 1); }
+};
+
+// The lazy concatenation left + right. Nothing is copied until the characters are first needed (indexing,
+// slicing, printing, hashing or comparing); then both sides are copied once into an out-of-line buffer,
+// which the heap releases when the rope dies, and the children are dropped. Appending piece by piece
+// therefore costs one small node per piece and a single linear copy at the end.
+struct ObjRope : ObjString {
+  ObjString *left;
+  ObjString *right;
+  // Null until the rope is flattened.
+  char *flat;
+  // The heap the rope lives in, which counts the flat buffer toward its size.
+  Heap *heap;
+};
+
+// Shape of a map that has no keys yet.
+#define SHAPE_EMPTY 0
+// Shape of a map whose layout is not tracked (see shape.h); its properties are only found by hashing.
+#define SHAPE_DICTIONARY UINT32_MAX
+
+// Keys and values live in out-of-line table storage that the heap releases when the map dies.
+struct ObjMap : Obj {
+  Table table;
+  // Hidden class: maps with the same shape hold the same string keys at the same table entries.
+  uint32_t shape;
+};
+
+// Elements live in an out-of-line buffer that the heap releases when the array dies. While every element is
+// a number the array is `packed`: since numbers are stored unboxed, the buffer is then bit-for-bit a
+// contiguous double array that the SIMD kernels in builtins/kernels.h work on directly, and the collector
+// does not need to scan it. Storing any other value clears the flag.
+struct ObjArray : Obj {
+  Value *values;
+  uint32_t count;
+  uint32_t capacity;
+  bool packed;
+
+  void init();
+  void reserve(uint32_t minimum);
+  void append(Value value);
+  void store(uint32_t index, Value value);
+  void release();
+};
+
+// Compiled function. Its body lives in the same chunk as the code around it, starting at `entry`; calls
+// run it in a frame whose slot 0 holds the callee and whose next `arity` slots hold the arguments.
+// Functions are compile-time constants and never change once compiled.
+struct ObjFunction : Obj {
+  uint32_t entry;
+  uint8_t arity;
+  uint8_t upvalueCount;
+  // Interned, or nullptr for an arrow function.
+  ObjString *name;
+};
+
+// A function together with the values it captured. Upvalues are flat: OP_CLOSURE copies each captured value
+// into the closure, stored inline directly after the header, so reading one is a single load and no variable
+// has to outlive its frame. A captured variable that is also assigned is boxed instead (see ObjBox), and the
+// closure copies the box, so it shares the variable with its frame and with other closures.
+struct ObjClosure : Obj {
+  ObjFunction *function;
+  uint32_t upvalueCount;
+
+  Value *upvalues() { return reinterpret_cast<Value *>(this + 1); }
+};
+
+// A built-in function bound to a global of the same name; `index` is its entry in globalFunctions (see
+// builtins/builtins.h).
+struct ObjNative : Obj {
+  uint32_t index;
+};
+
+struct Task;
+
+// Something scripts can `await`: a call started with `spawn`, which runs on a stack of its own, or an I/O
+// request. While it is unfinished the VM's scheduler owns its Task; once it has finished `task` is nullptr
+// and `result` holds the value the call returned or the request produced.
+struct ObjFiber : Obj {
+  Task *task;
+  Value result;
+};
+
+// The cell of a local that is both captured and assigned. The local's slot and every closure that captures it
+// hold the box, and reads and writes of the variable go through it. Boxes are never values of their own.
+struct ObjBox : Obj {
+  Value value;
+};
+
+inline ObjType objType(const Value value) { return asObj(value)->type; }
+inline bool isObjType(const Value value, const ObjType type) { return isObj(value) && objType(value) == type; }
+
+inline bool isString(const Value value) {
+  return isObj(value) && (objType(value) == OBJ_STRING || objType(value) == OBJ_ROPE);
+}
+inline ObjString *asString(const Value value) { return static_cast<ObjString *>(asObj(value)); }
+
+inline bool isMap(const Value value) { return isObjType(value, OBJ_MAP); }
+inline ObjMap *asMap(const Value value) { return static_cast<ObjMap *>(asObj(value)); }
+
+inline bool isArray(const Value value) { return isObjType(value, OBJ_ARRAY); }
+inline ObjArray *asArray(const Value value) { return static_cast<ObjArray *>(asObj(value)); }
+
+inline bool isFunction(const Value value) { return isObjType(value, OBJ_FUNCTION); }
+inline ObjFunction *asFunction(const Value value) { return static_cast<ObjFunction *>(asObj(value)); }
+
+inline bool isClosure(const Value value) { return isObjType(value, OBJ_CLOSURE); }
+inline ObjClosure *asClosure(const Value value) { return static_cast<ObjClosure *>(asObj(value)); }
+
+inline bool isNative(const Value value) { return isObjType(value, OBJ_NATIVE); }
+inline ObjNative *asNative(const Value value) { return static_cast<ObjNative *>(asObj(value)); }
+
+inline bool isFiber(const Value value) { return isObjType(value, OBJ_FIBER); }
+inline ObjFiber *asFiber(const Value value) { return static_cast<ObjFiber *>(asObj(value)); }
+
+inline bool isBox(const Value value) { return isObjType(value, OBJ_BOX); }
+inline ObjBox *asBox(const Value value) { return static_cast<ObjBox *>(asObj(value)); }
+
+uint32_t hashString(const char *chars, size_t length);
+bool stringsEqual(const ObjString *a, const ObjString *b);
+bool objectsEqual(Value a, Value b);
+void printObject(Value value, std::ostream &out);
+// Like printValue, but quotes strings; used for elements of containers.
+void printRepresentation(Value value, std::ostream &out);
+
+#endif // OBJECT_H
@@ -0,0 +1,80 @@
+#include "pool.h"
+
+#include <exception>
+#include <utility>
+
+IsolatePool::IsolatePool(size_t workers, const IsolateOptions &options) : pending(0), nextQueue(0) {
+  if (workers == 0) workers = std::thread::hardware_concurrency();
+  if (workers == 0) workers = 1;
+
+  for (size_t i = 0; i < workers; i++) this->queues.emplace_back(new Queue());
+  for (size_t i = 0; i < workers; i++) this->threads.emplace_back(&IsolatePool::work, this, i, options);
+}
+
+IsolatePool::~IsolatePool() {
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->stopping = true;
+  }
+  this->wake.notify_all();
+  for (std::thread &thread : this->threads) thread.join();
+}
+
+std::future<Evaluation> IsolatePool::submit(std::shared_ptr<const Module> module, const Engine engine) {
+  // Counted before it is queued, so `pending` never drops below the tasks actually queued.
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->pending++;
+  }
+  Queue &queue = *this->queues[this->nextQueue++ % this->queues.size()];
+  std::future<Evaluation> result;
+  {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.tasks.push_back(Task{std::move(module), engine, std::promise<Evaluation>()});
+    result = queue.tasks.back().promise.get_future();
+  }
+  this->wake.notify_one();
+  return result;
+}
+
+size_t IsolatePool::workerCount() const { return this->threads.size(); }
+
+void IsolatePool::work(const size_t worker, const IsolateOptions &options) {
+  Isolate isolate(options);
+  for (;;) {
+    Task task;
+    if (this->take(worker, task)) {
+      try {
+        task.promise.set_value(isolate.evaluate(task.module, task.engine));
+      } catch (...) {
+        task.promise.set_exception(std::current_exception());
+      }
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->wake.wait(lock, [this]() { return this->stopping || this->pending > 0; });
+    if (this->stopping && this->pending == 0) return;
+  }
+}
+
+// Takes the oldest task of the worker's own queue, or else the newest of another one.
+bool IsolatePool::take(const size_t worker, Task &task) {
+  const size_t count = this->queues.size();
+  for (size_t i = 0; i < count; i++) {
+    Queue &queue = *this->queues[(worker + i) % count];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) continue;
+
+    if (i == 0) {
+      task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+    } else {
+      task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+    }
+    this->pending--;
+    return true;
+  }
+  return false;
+}
@@ -0,0 +1,61 @@
+#ifndef POOL_H
+#define POOL_H
+#include "isolate.h"
+#include "module.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads, each owning an isolate, that run submitted modules.
+//
+// Every worker has a queue of its own. Submissions are dealt out to the queues in turn; a worker runs its own
+// queue oldest first, and when that is empty it steals the newest task of another worker, so one slow script
+// never holds up the tasks queued behind it while other workers sit idle. Workers sleep only while every
+// queue is empty.
+class IsolatePool {
+public:
+  // `workers` 0 starts one worker per hardware thread.
+  explicit IsolatePool(size_t workers = 0, const IsolateOptions &options = IsolateOptions());
+  // Runs everything already submitted, then stops the workers.
+  ~IsolatePool();
+
+  IsolatePool(const IsolatePool &) = delete;
+  IsolatePool &operator=(const IsolatePool &) = delete;
+
+  std::future<Evaluation> submit(std::shared_ptr<const Module> module, Engine engine = ENGINE_STACK);
+  size_t workerCount() const;
+
+private:
+  typedef struct {
+    std::shared_ptr<const Module> module;
+    Engine engine;
+    std::promise<Evaluation> promise;
+  } Task;
+
+  typedef struct {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  } Queue;
+
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<std::thread> threads;
+  // Tasks queued and not yet taken, across all queues.
+  std::atomic<size_t> pending;
+  std::atomic<size_t> nextQueue;
+  // Guards sleeping on `wake` against missing a submission.
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool stopping = false;
+
+  void work(size_t worker, const IsolateOptions &options);
+  bool take(size_t worker, Task &task);
+};
+
+#endif // POOL_H
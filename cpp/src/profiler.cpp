@@ -0,0 +1,290 @@
+#include "profiler.h"
+#include "debug.h"
+#include "object.h"
+#include "verifier.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TRIPLES_HAS_RDTSC
+#define PROFILE_TICKS "cycles"
+#else
+#define PROFILE_TICKS "ns"
+#endif
+
+// Callers kept in a sampled call stack besides the script or fiber at its bottom; deeper recursion keeps the
+// innermost.
+#define PROFILE_FRAMES_MAX 64
+// Stand in a sampled call stack for the bottom of a fiber, which lies outside the chunk, and for the frames
+// cut out of a deep one.
+#define PROFILE_FIBER_ROOT UINT32_MAX
+#define PROFILE_ELIDED_FRAMES (UINT32_MAX - 1)
+
+static uint64_t readTicks() {
+#ifdef TRIPLES_HAS_RDTSC
+  return __rdtsc();
+#else
+  const auto elapsed = std::chrono::steady_clock::now().time_since_epoch();
+  return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+#endif
+}
+
+Profiler::Profiler(const uint32_t sampleEvery) : sampleEvery(sampleEvery > 0 ? sampleEvery : 1) {}
+
+void Profiler::start(const Chunk &chunk, const RegisterChunk *) {
+  if (this->chunk == nullptr) {
+    this->chunk = &chunk;
+    // The VM has verified the chunk already; this only recovers which function each instruction is in.
+    Verifier verifier(chunk);
+    verifier.verify();
+    this->owners.resize(chunk.count());
+    for (unsigned int offset = 0; offset < chunk.count(); offset++) {
+      this->owners[offset] = verifier.ownerAt(offset);
+    }
+    this->opcodes.assign(512, Cost{0, 0, 0});
+    this->offsets.assign(chunk.count(), Cost{0, 0, 0});
+    this->pairs.assign(512 * 512, 0);
+  }
+
+  // Pairs and timings never run from one run into the next.
+  this->previous = -1;
+  this->sampling = false;
+  this->untilSample = this->nextInterval();
+}
+
+void Profiler::instruction(const Chunk &chunk, const unsigned int offset, const Value *, const Value *,
+                           const Array<CallFrame> &frames) {
+  const uint64_t now = readTicks();
+  if (this->sampling) this->finishSample(now);
+  const unsigned int opcode = chunk.at(offset);
+  if (!this->record(opcode, offset)) return;
+
+  const uint8_t *code = chunk.code();
+  const size_t count = chunk.count();
+  std::vector<uint32_t> stack;
+  stack.reserve(std::min<size_t>(frames.size(), PROFILE_FRAMES_MAX + 2) + 3);
+  for (size_t frame = 0; frame < frames.size(); frame++) {
+    if (frame > 0 && frames.size() - frame > PROFILE_FRAMES_MAX) {
+      stack.push_back(PROFILE_ELIDED_FRAMES);
+      frame = frames.size() - PROFILE_FRAMES_MAX;
+    }
+    const uint8_t *ip = frames[frame].ip;
+    stack.push_back(ip > code && ip < code + count ? static_cast<uint32_t>(ip - code) : PROFILE_FIBER_ROOT);
+  }
+  stack.push_back(offset);
+  this->startSample(stack, opcode, offset);
+}
+
+void Profiler::registerInstruction(const Chunk &, const RegisterChunk &registers, const size_t pc) {
+  const uint64_t now = readTicks();
+  if (this->sampling) this->finishSample(now);
+  const unsigned int opcode = 256 + registers.code[pc].op;
+  const unsigned int offset = registers.origins[pc].offset;
+  if (!this->record(opcode, offset)) return;
+
+  // The register engine only runs the script itself.
+  std::vector<uint32_t> stack = {offset};
+  this->startSample(stack, opcode, offset);
+}
+
+// Counts an instruction and returns whether to time it.
+bool Profiler::record(const unsigned int opcode, const unsigned int offset) {
+  this->executed++;
+  this->opcodes[opcode].count++;
+  this->offsets[offset].count++;
+  if (this->previous >= 0) this->pairs[static_cast<size_t>(this->previous) * 512 + opcode]++;
+  this->previous = opcode;
+
+  if (--this->untilSample > 0) return false;
+  this->untilSample = this->nextInterval();
+  return true;
+}
+
+void Profiler::startSample(std::vector<uint32_t> &stack, const unsigned int opcode,
+                           const unsigned int offset) {
+  stack.push_back(opcode);
+  this->sampledOpcode = &this->opcodes[opcode];
+  this->sampledOffset = &this->offsets[offset];
+  this->sampledStack = &this->stacks[stack];
+  this->sampling = true;
+  // Read last, so the bookkeeping above is not charged to the instruction.
+  this->sampleStart = readTicks();
+}
+
+void Profiler::finishSample(const uint64_t now) {
+  const uint64_t ticks = now - this->sampleStart;
+  for (Cost *cost : {this->sampledOpcode, this->sampledOffset, this->sampledStack}) {
+    cost->samples++;
+    cost->ticks += ticks;
+  }
+  this->fastestSample = std::min(this->fastestSample, ticks);
+  this->sampling = false;
+}
+
+// A random interval averaging `sampleEvery`, so samples do not keep landing on one instruction of a loop.
+uint64_t Profiler::nextInterval() {
+  this->random ^= this->random << 13;
+  this->random ^= this->random >> 7;
+  this->random ^= this->random << 17;
+  return 1 + this->random % (2 * static_cast<uint64_t>(this->sampleEvery) - 1);
+}
+
+uint64_t Profiler::netTicks(const Cost &cost) const {
+  const uint64_t overhead = this->fastestSample == UINT64_MAX ? 0 : cost.samples * this->fastestSample;
+  return cost.ticks > overhead ? cost.ticks - overhead : 0;
+}
+
+// Time spent on all executions, extrapolated from the timed ones.
+double Profiler::estimatedTicks(const Cost &cost) const {
+  if (cost.samples == 0) return 0;
+  return static_cast<double>(this->netTicks(cost)) * static_cast<double>(cost.count) /
+         static_cast<double>(cost.samples);
+}
+
+std::string Profiler::opcodeLabel(const unsigned int opcode) const {
+  if (opcode >= 256) return std::string("REG_") + registerOpName(static_cast<RegisterOp>(opcode - 256));
+  const char *name = opcodeName(static_cast<uint8_t>(opcode));
+  return name != nullptr ? name : "?";
+}
+
+// `function:line` for an instruction, or for a caller the call it returns from.
+std::string Profiler::frameLabel(const uint32_t offset, const bool leaf) const {
+  if (offset == PROFILE_FIBER_ROOT) return "fiber";
+  if (offset == PROFILE_ELIDED_FRAMES) return "...";
+
+  std::ostringstream label;
+  const long owner = this->owners[offset];
+  if (owner < 0) {
+    label << "script";
+  } else {
+    const ObjString *name = asFunction(this->chunk->constants[static_cast<size_t>(owner)])->name;
+    label << (name != nullptr ? std::string(name->chars(), name->length) : "anonymous");
+  }
+  label << ":" << this->chunk->getLine(leaf || offset == 0 ? offset : offset - 1);
+  return label.str();
+}
+
+static double percent(const double part, const double whole) {
+  return whole > 0 ? 100.0 * part / whole : 0;
+}
+
+static void printCost(std::ostream &out, const uint64_t count, const uint64_t executed, const double ticks,
+                      const double totalTicks, const uint64_t samples, const uint64_t netTicks) {
+  out << std::setw(12) << count << std::setw(8)
+      << percent(static_cast<double>(count), static_cast<double>(executed)) << "%" << std::setw(14)
+      << static_cast<uint64_t>(ticks) << std::setw(8) << percent(ticks, totalTicks) << "%";
+  if (samples > 0) {
+    out << std::setw(10) << static_cast<double>(netTicks) / static_cast<double>(samples);
+  } else {
+    out << std::setw(10) << "-";
+  }
+  out << "  ";
+}
+
+void Profiler::report(std::ostream &out, const size_t rows) const {
+  if (this->chunk == nullptr) return;
+  typedef std::pair<unsigned int, Cost> Row;
+  const auto hottest = [this](const Row &a, const Row &b) {
+    const double aTicks = this->estimatedTicks(a.second);
+    const double bTicks = this->estimatedTicks(b.second);
+    return aTicks > bTicks || (aTicks == bTicks && a.second.count > b.second.count);
+  };
+
+  uint64_t samples = 0;
+  double totalTicks = 0;
+  std::vector<Row> opcodes;
+  for (unsigned int opcode = 0; opcode < this->opcodes.size(); opcode++) {
+    const Cost &cost = this->opcodes[opcode];
+    if (cost.count == 0) continue;
+    samples += cost.samples;
+    totalTicks += this->estimatedTicks(cost);
+    opcodes.emplace_back(opcode, cost);
+  }
+  std::sort(opcodes.begin(), opcodes.end(), hottest);
+
+  out << std::fixed << std::setprecision(1);
+  out << "== Profile ==" << std::endl
+      << this->executed << " instructions, " << samples << " timed (1 in " << this->sampleEvery
+      << " on average), " << (this->fastestSample == UINT64_MAX ? 0 : this->fastestSample)
+      << " " PROFILE_TICKS " per sample subtracted as profiling overhead" << std::endl;
+  const char *header = "       count   share  " PROFILE_TICKS " (est.)   share      each  ";
+
+  out << std::endl << "== Opcodes ==" << std::endl << header << "opcode" << std::endl;
+  for (const Row &row : opcodes) {
+    printCost(out, row.second.count, this->executed, this->estimatedTicks(row.second), totalTicks,
+              row.second.samples, this->netTicks(row.second));
+    out << this->opcodeLabel(row.first) << std::endl;
+  }
+
+  std::map<unsigned int, Cost> lineCosts;
+  std::vector<Row> offsets;
+  for (unsigned int offset = 0; offset < this->offsets.size(); offset++) {
+    const Cost &cost = this->offsets[offset];
+    if (cost.count == 0) continue;
+    Cost &line = lineCosts[this->chunk->getLine(offset)];
+    line.count += cost.count;
+    line.samples += cost.samples;
+    line.ticks += cost.ticks;
+    offsets.emplace_back(offset, cost);
+  }
+  std::vector<Row> lines(lineCosts.begin(), lineCosts.end());
+  std::sort(lines.begin(), lines.end(), hottest);
+  std::sort(offsets.begin(), offsets.end(), hottest);
+
+  out << std::endl << "== Lines ==" << std::endl << header << "line" << std::endl;
+  for (size_t i = 0; i < lines.size() && i < rows; i++) {
+    printCost(out, lines[i].second.count, this->executed, this->estimatedTicks(lines[i].second), totalTicks,
+              lines[i].second.samples, this->netTicks(lines[i].second));
+    out << lines[i].first << std::endl;
+  }
+
+  out << std::endl << "== Instructions ==" << std::endl;
+  out << header << "offset  function:line  opcode" << std::endl;
+  for (size_t i = 0; i < offsets.size() && i < rows; i++) {
+    const unsigned int offset = offsets[i].first;
+    printCost(out, offsets[i].second.count, this->executed, this->estimatedTicks(offsets[i].second),
+              totalTicks, offsets[i].second.samples, this->netTicks(offsets[i].second));
+    out << std::setw(6) << std::setfill('0') << offset << std::setfill(' ') << "  "
+        << this->frameLabel(offset, true) << "  " << this->opcodeLabel(this->chunk->at(offset)) << std::endl;
+  }
+
+  std::vector<std::pair<size_t, uint64_t>> pairs;
+  for (size_t pair = 0; pair < this->pairs.size(); pair++) {
+    if (this->pairs[pair] > 0) pairs.emplace_back(pair, this->pairs[pair]);
+  }
+  std::sort(pairs.begin(), pairs.end(),
+            [](const std::pair<size_t, uint64_t> &a, const std::pair<size_t, uint64_t> &b) {
+              return a.second > b.second;
+            });
+
+  out << std::endl << "== Opcode pairs ==" << std::endl << "       count   share  pair" << std::endl;
+  for (size_t i = 0; i < pairs.size() && i < rows; i++) {
+    out << std::setw(12) << pairs[i].second << std::setw(8)
+        << percent(static_cast<double>(pairs[i].second), static_cast<double>(this->executed)) << "%  "
+        << this->opcodeLabel(static_cast<unsigned int>(pairs[i].first / 512)) << ", "
+        << this->opcodeLabel(static_cast<unsigned int>(pairs[i].first % 512)) << std::endl;
+  }
+}
+
+void Profiler::writeCollapsed(std::ostream &out) const {
+  // Different call sites on the same line collapse into one stack.
+  std::map<std::string, uint64_t> collapsed;
+  for (const auto &entry : this->stacks) {
+    const std::vector<uint32_t> &stack = entry.first;
+    std::string line;
+    for (size_t frame = 0; frame + 1 < stack.size(); frame++) {
+      line += this->frameLabel(stack[frame], frame + 2 == stack.size()) + ";";
+    }
+    line += this->opcodeLabel(stack.back());
+    collapsed[line] += this->netTicks(entry.second);
+  }
+
+  for (const auto &entry : collapsed) {
+    if (entry.second > 0) out << entry.first << " " << entry.second << std::endl;
+  }
+}
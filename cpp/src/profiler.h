@@ -0,0 +1,88 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+#include "chunk.h"
+#include "trace.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <map>
+#include <string>
+#include <vector>
+
+// Instructions between timed samples, on average.
+#define PROFILE_SAMPLE_EVERY 64
+
+// Finds where a script spends its time. Installed with VM::setTrace(&profiler) it sees every instruction,
+// counting executions per opcode, per instruction and, through the chunk's lines, per source line, along with
+// how often each opcode follows another.
+//
+// Timing every instruction would cost far more than the instructions themselves, so the profiler times a
+// sample: at random intervals, `sampleEvery` instructions apart on average, it reads the time stamp counter
+// (a steady clock where there is none) and charges the time until the next instruction starts to the sampled
+// one, together with the call stack it ran in. The smallest time any sample took is what the profiler itself
+// costs per instruction and is subtracted from each. Times are wall time: an instruction that waits, such as
+// an `await` with nothing else to run, is charged for the wait.
+//
+// A profiler takes the runs of one module; their counts add up.
+class Profiler : public TraceSink {
+public:
+  explicit Profiler(uint32_t sampleEvery = PROFILE_SAMPLE_EVERY);
+
+  void start(const Chunk &chunk, const RegisterChunk *registers) override;
+  void instruction(const Chunk &chunk, unsigned int offset, const Value *base, const Value *top,
+                   const Array<CallFrame> &frames) override;
+  void registerInstruction(const Chunk &chunk, const RegisterChunk &registers, size_t pc) override;
+
+  // Writes tables of the opcodes, source lines, instructions and opcode pairs, the last three cut off after
+  // the `rows` hottest.
+  void report(std::ostream &out, size_t rows = 20) const;
+  // Writes the sampled call stacks in the collapsed format flamegraph tools read: one line per stack, the
+  // frames from the script inwards separated by semicolons, each `function:line`, then the opcode that ran
+  // and the time spent there.
+  void writeCollapsed(std::ostream &out) const;
+
+private:
+  typedef struct {
+    uint64_t count;
+    uint64_t samples;
+    uint64_t ticks;
+  } Cost;
+
+  const Chunk *chunk = nullptr;
+  // Constant index of the function each instruction belongs to, by offset, or -1 for the script.
+  std::vector<long> owners;
+
+  // Opcodes are indexed by their byte; register opcodes follow at 256 and up.
+  std::vector<Cost> opcodes;
+  std::vector<Cost> offsets;
+  // Indexed by the previous opcode times 512 plus the opcode that followed it.
+  std::vector<uint64_t> pairs;
+  // Keyed by the offsets the callers return to, outermost first, then the offset and opcode that ran.
+  std::map<std::vector<uint32_t>, Cost> stacks;
+  uint64_t executed = 0;
+  // The opcode that ran last in this run, or -1.
+  long previous = -1;
+
+  uint32_t sampleEvery;
+  uint64_t untilSample = 0;
+  uint64_t random = 0x9e3779b97f4a7c15;
+  // Set while a sample is timed, until the next instruction starts.
+  bool sampling = false;
+  uint64_t sampleStart = 0;
+  Cost *sampledOpcode = nullptr;
+  Cost *sampledOffset = nullptr;
+  Cost *sampledStack = nullptr;
+  uint64_t fastestSample = UINT64_MAX;
+
+  bool record(unsigned int opcode, unsigned int offset);
+  void finishSample(uint64_t now);
+  void startSample(std::vector<uint32_t> &stack, unsigned int opcode, unsigned int offset);
+  double estimatedTicks(const Cost &cost) const;
+  uint64_t nextInterval();
+  uint64_t netTicks(const Cost &cost) const;
+  std::string opcodeLabel(unsigned int opcode) const;
+  std::string frameLabel(uint32_t offset, bool leaf) const;
+};
+
+#endif // PROFILER_H
@@ -0,0 +1,479 @@
+#include "registers.h"
+#include "value.h"
+
+#include <iomanip>
+#include <iostream>
+
+static const char *const registerOpNames[] = {
+    "MOVE", "GET_GLOBAL", "DEFINE_GLOBAL", "SET_GLOBAL", "MAP", "ARRAY", "GET_INDEX", "SET_INDEX", "SLICE",
+    "EQUAL", "GREATER", "LESS", "ADD", "SUBTRACT", "MULTIPLY", "DIVIDE", "NOT", "NEGATE", "INVOKE",
+    "GET_PROPERTY", "SET_PROPERTY", "PRINT", "JUMP", "JUMP_IF_FALSE", "RETURN"};
+static_assert(sizeof(registerOpNames) / sizeof(registerOpNames[0]) == REG_RETURN + 1,
+              "registerOpNames must name every register opcode");
+
+const char *registerOpName(const RegisterOp op) { return registerOpNames[op]; }
+
+void RegisterChunk::disassemble(const Chunk &chunk, std::ostream &out) const {
+  out << "== REGISTERS ==" << std::endl;
+  for (size_t pc = 0; pc < this->code.size(); pc++) this->disassembleInstruction(chunk, pc, out);
+}
+
+void RegisterChunk::disassembleInstruction(const Chunk &chunk, const size_t pc, std::ostream &out) const {
+  const RegisterInstruction &instruction = this->code[pc];
+  out << std::setw(4) << std::setfill('0') << pc << "\t" << std::setw(4) << std::setfill('0')
+            << chunk.getLine(this->origins[pc].offset) << "\t" << registerOpNames[instruction.op] << "\t";
+
+  switch (instruction.op) {
+    case REG_GET_GLOBAL:
+    case REG_DEFINE_GLOBAL:
+    case REG_SET_GLOBAL:
+      this->printRegister(chunk, instruction.a, out);
+      out << ", ";
+      printValue(chunk.globalNames[instruction.wide()], out);
+      break;
+    case REG_MAP:
+    case REG_ARRAY:
+      this->printRegister(chunk, instruction.a, out);
+      out << ", " << instruction.b;
+      break;
+    case REG_SLICE:
+    case REG_PRINT:
+      this->printRegister(chunk, instruction.a, out);
+      break;
+    case REG_INVOKE:
+      this->printRegister(chunk, instruction.a, out);
+      out << ", ";
+      this->printRegister(chunk, instruction.b, out);
+      out << ", " << instruction.c;
+      break;
+    case REG_GET_PROPERTY:
+    case REG_SET_PROPERTY:
+      this->printRegister(chunk, instruction.a, out);
+      out << ", ";
+      this->printRegister(chunk, instruction.b, out);
+      out << ", cache " << instruction.c;
+      break;
+    case REG_MOVE:
+    case REG_NOT:
+    case REG_NEGATE:
+      this->printRegister(chunk, instruction.a, out);
+      out << ", ";
+      this->printRegister(chunk, instruction.b, out);
+      break;
+    case REG_JUMP:
+      out << instruction.wide();
+      break;
+    case REG_JUMP_IF_FALSE:
+      this->printRegister(chunk, instruction.a, out);
+      out << ", " << instruction.wide();
+      break;
+    case REG_RETURN:
+      break;
+    default:
+      this->printRegister(chunk, instruction.a, out);
+      out << ", ";
+      this->printRegister(chunk, instruction.b, out);
+      out << ", ";
+      this->printRegister(chunk, instruction.c, out);
+      break;
+  }
+  out << std::endl;
+}
+
+void RegisterChunk::printRegister(const Chunk &chunk, const uint16_t reg, std::ostream &out) const {
+  if (reg >= this->firstSlot) {
+    out << "r" << reg - this->firstSlot;
+    return;
+  }
+
+  // Constants print as their value.
+  Value constant = FALSE_VAL;
+  if (reg < chunk.constants.size()) {
+    constant = chunk.constants[reg];
+  } else if (reg == this->firstSlot - 3) {
+    constant = NULL_VAL;
+  } else if (reg == this->firstSlot - 2) {
+    constant = TRUE_VAL;
+  }
+  out << "'";
+  printValue(constant, out);
+  out << "'";
+}
+
+RegisterCompiler::RegisterCompiler(const Chunk &chunk, const Verifier &verifier)
+    : chunk(chunk), verifier(verifier) {}
+
+const std::string &RegisterCompiler::error() const { return this->message; }
+
+bool RegisterCompiler::compile(RegisterChunk &target) {
+  this->target = &target;
+  target.code.clear();
+  target.origins.clear();
+
+  // The constants, null, true and false, every stack slot and one spare slot above the deepest (see REG_ADD).
+  const size_t constants = this->chunk.constants.size();
+  const size_t depth = this->verifier.maxStackDepth();
+  if (constants + 3 + depth + 1 > UINT16_MAX + 1) return this->fail("frame needs more than 65536 registers.");
+  target.firstSlot = static_cast<uint16_t>(constants + 3);
+  target.frameSize = static_cast<uint32_t>(constants + 3 + depth + 1);
+
+  const size_t count = this->chunk.count();
+  this->aliases.assign(depth + 1, 0);
+  this->starts.assign(count, -1);
+  this->jumps.clear();
+  this->retargetable = -1;
+
+  bool fallsThrough = false;
+  unsigned int next = 0;
+  for (unsigned int offset = 0; offset < count;) {
+    // Unreachable code is skipped a byte at a time, as it cannot be decoded reliably.
+    const long depthHere = this->verifier.depthAt(offset);
+    if (depthHere < 0) {
+      offset++;
+      continue;
+    }
+
+    this->offset = offset;
+    const bool fellThrough = fallsThrough && next == offset;
+    if (this->verifier.isJumpTarget(offset) || !fellThrough) {
+      if (fellThrough) this->enterTarget(offset);
+      // Every path into here left each value in its own slot.
+      for (long position = 0; position < depthHere; position++) {
+        this->aliases[position] = this->slot(position);
+      }
+      this->retargetable = -1;
+    }
+
+    this->starts[offset] = static_cast<long>(target.code.size());
+    if (!this->lowerInstruction(depthHere, &next, &fallsThrough)) return false;
+    offset = next;
+  }
+
+  for (const auto &jump : this->jumps) {
+    const long start = this->starts[jump.second];
+    if (start < 0) return this->fail("jump into the middle of an instruction.");
+    target.code[jump.first].b = static_cast<uint16_t>(start & 0xffff);
+    target.code[jump.first].c = static_cast<uint16_t>(start >> 16);
+  }
+  return true;
+}
+
+// Register form of a binary stack instruction, with or without a constant operand.
+static RegisterOp binaryOp(const uint8_t instruction) {
+  switch (instruction) {
+    case OP_EQUAL:
+      return REG_EQUAL;
+    case OP_GREATER:
+    case OP_GREATER_CONST:
+      return REG_GREATER;
+    case OP_LESS:
+    case OP_LESS_CONST:
+      return REG_LESS;
+    case OP_SUBTRACT:
+    case OP_SUBTRACT_CONST:
+      return REG_SUBTRACT;
+    case OP_MULTIPLY:
+    case OP_MULTIPLY_CONST:
+      return REG_MULTIPLY;
+    default:
+      return REG_DIVIDE;
+  }
+}
+
+bool RegisterCompiler::lowerInstruction(const long depth, unsigned int *next, bool *fallsThrough) {
+  const uint8_t *code = this->chunk.code();
+  const unsigned int offset = this->offset;
+  const uint16_t nullRegister = static_cast<uint16_t>(this->target->firstSlot - 3);
+  *fallsThrough = true;
+
+  switch (static_cast<OpCode>(code[offset])) {
+    case OP_CONSTANT:
+      this->aliases[depth] = code[offset + 1];
+      *next = offset + 2;
+      return true;
+    case OP_CONSTANT_LONG:
+      this->aliases[depth] = static_cast<uint16_t>(this->chunk.readLong(offset + 1));
+      *next = offset + 4;
+      return true;
+    case OP_NULL:
+      this->aliases[depth] = nullRegister;
+      *next = offset + 1;
+      return true;
+    case OP_TRUE:
+      this->aliases[depth] = static_cast<uint16_t>(nullRegister + 1);
+      *next = offset + 1;
+      return true;
+    case OP_FALSE:
+      this->aliases[depth] = static_cast<uint16_t>(nullRegister + 2);
+      *next = offset + 1;
+      return true;
+    case OP_POP:
+      *next = offset + 1;
+      return true;
+    case OP_GET_LOCAL:
+      this->aliases[depth] = this->aliases[code[offset + 1]];
+      *next = offset + 2;
+      return true;
+    case OP_SET_LOCAL:
+    case OP_SET_LOCAL_POP:
+      this->assignLocal(code[offset + 1], depth);
+      *next = offset + 2;
+      return true;
+    case OP_GET_GLOBAL:
+    case OP_GET_GLOBAL_LONG:
+      {
+        const bool isLong = code[offset] == OP_GET_GLOBAL_LONG;
+        const uint32_t global = isLong ? this->chunk.readLong(offset + 1) : code[offset + 1];
+        this->emitWide(REG_GET_GLOBAL, this->slot(depth), global, static_cast<unsigned int>(depth));
+        this->aliases[depth] = this->slot(depth);
+        this->retargetable = static_cast<long>(this->target->code.size() - 1);
+        *next = offset + (isLong ? 4 : 2);
+        return true;
+      }
+    case OP_DEFINE_GLOBAL:
+    case OP_DEFINE_GLOBAL_LONG:
+    case OP_SET_GLOBAL:
+    case OP_SET_GLOBAL_LONG:
+      {
+        const bool isLong = code[offset] == OP_DEFINE_GLOBAL_LONG || code[offset] == OP_SET_GLOBAL_LONG;
+        const bool define = code[offset] == OP_DEFINE_GLOBAL || code[offset] == OP_DEFINE_GLOBAL_LONG;
+        const uint32_t global = isLong ? this->chunk.readLong(offset + 1) : code[offset + 1];
+        this->emitWide(define ? REG_DEFINE_GLOBAL : REG_SET_GLOBAL, this->aliases[depth - 1], global,
+                       static_cast<unsigned int>(depth));
+        *next = offset + (isLong ? 4 : 2);
+        return true;
+      }
+    case OP_MAP:
+    case OP_MAP_LONG:
+    case OP_ARRAY:
+    case OP_ARRAY_LONG:
+      {
+        const bool isLong = code[offset] == OP_MAP_LONG || code[offset] == OP_ARRAY_LONG;
+        const bool isMap = code[offset] == OP_MAP || code[offset] == OP_MAP_LONG;
+        const uint32_t count = isLong ? this->chunk.readLong(offset + 1) : code[offset + 1];
+        const long first = depth - (isMap ? 2 : 1) * static_cast<long>(count);
+        this->materializeRange(first, depth);
+        this->emit(isMap ? REG_MAP : REG_ARRAY, this->slot(first), static_cast<uint16_t>(count), 0,
+                   static_cast<unsigned int>(depth));
+        this->aliases[first] = this->slot(first);
+        *next = offset + (isLong ? 4 : 2);
+        return true;
+      }
+    case OP_GET_INDEX:
+      this->emitValue(REG_GET_INDEX, depth - 2, this->aliases[depth - 2], this->aliases[depth - 1],
+                      static_cast<unsigned int>(depth));
+      *next = offset + 1;
+      return true;
+    case OP_SET_INDEX:
+      {
+        const uint16_t value = this->aliases[depth - 1];
+        this->emit(REG_SET_INDEX, this->aliases[depth - 3], this->aliases[depth - 2], value,
+                   static_cast<unsigned int>(depth));
+        // The assigned value is the result; it may only be aliased if its register outlives the slot.
+        if (value < this->slot(depth - 3)) {
+          this->aliases[depth - 3] = value;
+        } else {
+          this->emitValue(REG_MOVE, depth - 3, value);
+        }
+        *next = offset + 1;
+        return true;
+      }
+    case OP_SLICE:
+      this->materializeRange(depth - 3, depth);
+      this->emit(REG_SLICE, this->slot(depth - 3), 0, 0, static_cast<unsigned int>(depth));
+      this->aliases[depth - 3] = this->slot(depth - 3);
+      *next = offset + 1;
+      return true;
+    case OP_INVOKE:
+    case OP_INVOKE_LONG:
+      {
+        const bool isLong = code[offset] == OP_INVOKE_LONG;
+        const uint32_t name = isLong ? this->chunk.readLong(offset + 1) : code[offset + 1];
+        const uint8_t argCount = code[offset + (isLong ? 4 : 2)];
+        this->materializeRange(depth - 1 - argCount, depth);
+        this->emit(REG_INVOKE, this->slot(depth - 1 - argCount), static_cast<uint16_t>(name), argCount,
+                   static_cast<unsigned int>(depth));
+        this->aliases[depth - 1 - argCount] = this->slot(depth - 1 - argCount);
+        *next = offset + (isLong ? 8 : 6);
+        return true;
+      }
+    case OP_GET_PROPERTY:
+    case OP_GET_PROPERTY_LONG:
+    case OP_SET_PROPERTY:
+    case OP_SET_PROPERTY_LONG:
+      {
+        const bool isLong = code[offset] == OP_GET_PROPERTY_LONG || code[offset] == OP_SET_PROPERTY_LONG;
+        const uint32_t cache = this->chunk.readLong(offset + (isLong ? 4 : 2));
+        if (cache > UINT16_MAX) return this->fail("more than 65536 inline caches.");
+        *next = offset + (isLong ? 7 : 5);
+
+        if (code[offset] == OP_GET_PROPERTY || code[offset] == OP_GET_PROPERTY_LONG) {
+          this->emitValue(REG_GET_PROPERTY, depth - 1, this->aliases[depth - 1], static_cast<uint16_t>(cache),
+                          static_cast<unsigned int>(depth));
+          return true;
+        }
+
+        const uint16_t value = this->aliases[depth - 1];
+        this->emit(REG_SET_PROPERTY, this->aliases[depth - 2], value, static_cast<uint16_t>(cache),
+                   static_cast<unsigned int>(depth));
+        // As for OP_SET_INDEX, the assigned value is the result.
+        if (value < this->slot(depth - 2)) {
+          this->aliases[depth - 2] = value;
+        } else {
+          this->emitValue(REG_MOVE, depth - 2, value);
+        }
+        return true;
+      }
+    case OP_EQUAL:
+    case OP_GREATER:
+    case OP_LESS:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+      this->emitValue(binaryOp(code[offset]), depth - 2, this->aliases[depth - 2], this->aliases[depth - 1]);
+      *next = offset + 1;
+      return true;
+    case OP_ADD:
+      this->emitValue(REG_ADD, depth - 2, this->aliases[depth - 2], this->aliases[depth - 1],
+                      static_cast<unsigned int>(depth));
+      *next = offset + 1;
+      return true;
+    case OP_ADD_CONST:
+      // The constant gets a slot above the operand if the addition has to fall back to concatenation.
+      this->emitValue(REG_ADD, depth - 1, this->aliases[depth - 1], code[offset + 1],
+                      static_cast<unsigned int>(depth + 1));
+      *next = offset + 2;
+      return true;
+    case OP_SUBTRACT_CONST:
+    case OP_MULTIPLY_CONST:
+    case OP_DIVIDE_CONST:
+    case OP_LESS_CONST:
+    case OP_GREATER_CONST:
+      this->emitValue(binaryOp(code[offset]), depth - 1, this->aliases[depth - 1], code[offset + 1]);
+      *next = offset + 2;
+      return true;
+    case OP_NOT:
+    case OP_NEGATE:
+      this->emitValue(code[offset] == OP_NOT ? REG_NOT : REG_NEGATE, depth - 1, this->aliases[depth - 1]);
+      *next = offset + 1;
+      return true;
+    case OP_PRINT:
+      this->emit(REG_PRINT, this->aliases[depth - 1]);
+      *next = offset + 1;
+      return true;
+    case OP_JUMP:
+      this->emitJump(REG_JUMP, offset + 3 + this->chunk.readShort(offset + 1));
+      *next = offset + 3;
+      *fallsThrough = false;
+      return true;
+    case OP_JUMP_IF_FALSE:
+      this->emitJump(REG_JUMP_IF_FALSE, offset + 3 + this->chunk.readShort(offset + 1), depth - 1);
+      *next = offset + 3;
+      return true;
+    case OP_LOOP:
+      this->emitJump(REG_JUMP, offset + 3 - this->chunk.readShort(offset + 1));
+      *next = offset + 3;
+      *fallsThrough = false;
+      return true;
+    case OP_RETURN:
+      this->emit(REG_RETURN, 0);
+      *next = offset + 1;
+      *fallsThrough = false;
+      return true;
+    // The register frame is the script's; chunks with functions run on the stack engine.
+    case OP_CLOSURE:
+    case OP_CLOSURE_LONG:
+    case OP_GET_UPVALUE:
+    case OP_GET_BOXED_LOCAL:
+    case OP_SET_BOXED_LOCAL:
+    case OP_SET_BOXED_LOCAL_POP:
+    case OP_GET_BOXED_UPVALUE:
+    case OP_SET_BOXED_UPVALUE:
+    case OP_CALL:
+    case OP_TAIL_CALL:
+    case OP_RETURN_VALUE:
+      return this->fail("functions are not lowered.");
+    case OP_SPAWN:
+    case OP_AWAIT:
+      return this->fail("fibers are not lowered.");
+  }
+
+  return this->fail("unknown opcode " + std::to_string(code[offset]) + ".");
+}
+
+uint16_t RegisterCompiler::slot(const long position) const {
+  return static_cast<uint16_t>(this->target->firstSlot + position);
+}
+
+void RegisterCompiler::emit(const RegisterOp op, const uint16_t a, const uint16_t b, const uint16_t c,
+                            const unsigned int top) {
+  this->target->code.push_back({op, a, b, c});
+  this->target->origins.push_back({this->offset, top});
+  this->retargetable = -1;
+}
+
+void RegisterCompiler::emitWide(const RegisterOp op, const uint16_t a, const uint32_t operand,
+                                const unsigned int top) {
+  this->emit(op, a, static_cast<uint16_t>(operand & 0xffff), static_cast<uint16_t>(operand >> 16), top);
+}
+
+// Emits an instruction computing the value of stack slot `position` into the slot's own register.
+void RegisterCompiler::emitValue(const RegisterOp op, const long position, const uint16_t b, const uint16_t c,
+                                 const unsigned int top) {
+  this->emit(op, this->slot(position), b, c, top);
+  this->aliases[position] = this->slot(position);
+  this->retargetable = static_cast<long>(this->target->code.size() - 1);
+}
+
+void RegisterCompiler::materialize(const long position) {
+  if (this->aliases[position] == this->slot(position)) return;
+
+  this->emit(REG_MOVE, this->slot(position), this->aliases[position]);
+  this->aliases[position] = this->slot(position);
+}
+
+void RegisterCompiler::materializeRange(const long from, const long to) {
+  for (long position = from; position < to; position++) this->materialize(position);
+}
+
+// Control flow meets at `target`, so every value moves into its own slot first. A value the target pops
+// straight away is left where it is.
+void RegisterCompiler::enterTarget(const unsigned int target) {
+  long depth = this->verifier.depthAt(target);
+  if (this->chunk.at(target) == OP_POP) depth--;
+  this->materializeRange(0, depth);
+}
+
+void RegisterCompiler::emitJump(const RegisterOp op, const unsigned int target, const long condition) {
+  this->enterTarget(target);
+  this->jumps.emplace_back(this->target->code.size(), target);
+  this->emit(op, condition < 0 ? 0 : this->aliases[condition]);
+}
+
+void RegisterCompiler::assignLocal(const uint8_t local, const long depth) {
+  const uint16_t value = this->aliases[depth - 1];
+  const uint16_t destination = this->slot(local);
+  if (value == destination) return;
+
+  // Values still reading the old contents of the local get their own copy first.
+  for (long position = 0; position < depth - 1; position++) {
+    if (position != local && this->aliases[position] == destination) this->materialize(position);
+  }
+
+  RegisterChunk &target = *this->target;
+  if (value == this->slot(depth - 1) && this->retargetable == static_cast<long>(target.code.size()) - 1 &&
+      target.code.back().a == value) {
+    // The value was just computed into a temporary; compute it into the local instead.
+    target.code.back().a = destination;
+  } else {
+    this->emit(REG_MOVE, destination, value);
+  }
+  this->aliases[local] = destination;
+  this->aliases[depth - 1] = destination;
+  this->retargetable = -1;
+}
+
+bool RegisterCompiler::fail(const std::string &reason) {
+  this->message = "Cannot lower bytecode at offset " + std::to_string(this->offset) + ": " + reason;
+  return false;
+}
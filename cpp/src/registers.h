@@ -0,0 +1,118 @@
+#ifndef REGISTERS_H
+#define REGISTERS_H
+#include "chunk.h"
+#include "verifier.h"
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// Three-address instructions for the register engine (VM::runRegisters). A, B and C name registers of the
+// frame: the chunk's constants come first, then null, true and false, then one register per stack slot, so a
+// local variable is simply the register of its slot. Globals and jump targets span B and C (see wide()).
+typedef enum : uint8_t {
+  REG_MOVE,          // A = B
+  REG_GET_GLOBAL,    // A = globals[BC]
+  REG_DEFINE_GLOBAL, // globals[BC] = A
+  REG_SET_GLOBAL,    // globals[BC] = A, which must already be defined
+  REG_MAP,           // A = map of the B key/value pairs starting at A
+  REG_ARRAY,         // A = array of the B values starting at A
+  REG_GET_INDEX,     // A = B[C]
+  REG_SET_INDEX,     // A[B] = C
+  REG_SLICE,         // A = A[A + 1 : A + 2]
+  REG_EQUAL,         // A = B == C
+  REG_GREATER,       // A = B > C
+  REG_LESS,          // A = B < C
+  REG_ADD,           // A = B + C
+  REG_SUBTRACT,      // A = B - C
+  REG_MULTIPLY,      // A = B * C
+  REG_DIVIDE,        // A = B / C
+  REG_NOT,           // A = !B
+  REG_NEGATE,        // A = -B
+  REG_INVOKE,        // A = A.B(A + 1 ... A + C), B naming the method name constant
+  REG_GET_PROPERTY,  // A = B.name, C being the site's inline cache
+  REG_SET_PROPERTY,  // A.name = B, C being the site's inline cache
+  REG_PRINT,         // print A
+  REG_JUMP,          // continue at instruction BC
+  REG_JUMP_IF_FALSE, // continue at instruction BC if A is falsey
+  REG_RETURN,
+} RegisterOp;
+
+typedef struct {
+  RegisterOp op;
+  uint16_t a;
+  uint16_t b;
+  uint16_t c;
+
+  uint32_t wide() const { return static_cast<uint32_t>(this->b) | static_cast<uint32_t>(this->c) << 16; }
+} RegisterInstruction;
+
+// Where a register instruction came from, for the paths that leave the fast loop: `offset` of the stack
+// instruction (for error lines) and the stack slots in use when it ran there, counting its own operands. The
+// value stack is cut off there while the stack engine's helpers run on those operands.
+typedef struct {
+  unsigned int offset;
+  unsigned int top;
+} RegisterOrigin;
+
+class RegisterChunk {
+public:
+  Array<RegisterInstruction> code;
+  // Parallel to `code`.
+  Array<RegisterOrigin> origins;
+  // Register of stack slot 0; everything below holds constants.
+  uint16_t firstSlot = 0;
+  uint32_t frameSize = 0;
+
+  void disassemble(const Chunk &chunk, std::ostream &out) const;
+  void disassembleInstruction(const Chunk &chunk, size_t pc, std::ostream &out) const;
+
+private:
+  void printRegister(const Chunk &chunk, uint16_t reg, std::ostream &out) const;
+};
+
+// Lowers verified stack bytecode to register code. Each stack slot gets a register, but pushing a constant or
+// a local only records which register already holds the value. A move is emitted only when a value has to
+// be in its own slot: before a jump and at a jump target, for operands that must be consecutive (calls,
+// literals, slices) and before a local it aliases is overwritten. Arithmetic and indexing then read their
+// operands straight from constants and locals, and an assignment retargets the instruction that computed
+// the value, so `i = i + 1` is a single ADD.
+class RegisterCompiler {
+public:
+  RegisterCompiler(const Chunk &chunk, const Verifier &verifier);
+  bool compile(RegisterChunk &target);
+
+  const std::string &error() const;
+
+private:
+  const Chunk &chunk;
+  const Verifier &verifier;
+  RegisterChunk *target = nullptr;
+  // Register currently holding the value of each stack slot.
+  std::vector<uint16_t> aliases;
+  // First register instruction of each stack instruction, or -1.
+  std::vector<long> starts;
+  // Jump instructions to point at the register code of their stack target once it exists.
+  std::vector<std::pair<size_t, unsigned int>> jumps;
+  unsigned int offset = 0;
+  // Index of the last instruction if it only computes a value into a slot register, so it may be retargeted.
+  long retargetable = -1;
+  std::string message;
+
+  bool lowerInstruction(long depth, unsigned int *next, bool *fallsThrough);
+  uint16_t slot(long position) const;
+  void emit(RegisterOp op, uint16_t a, uint16_t b = 0, uint16_t c = 0, unsigned int top = 0);
+  void emitWide(RegisterOp op, uint16_t a, uint32_t operand, unsigned int top = 0);
+  void emitValue(RegisterOp op, long position, uint16_t b, uint16_t c = 0, unsigned int top = 0);
+  void materialize(long position);
+  void materializeRange(long from, long to);
+  void enterTarget(unsigned int target);
+  void emitJump(RegisterOp op, unsigned int target, long condition = -1);
+  void assignLocal(uint8_t local, long depth);
+  bool fail(const std::string &reason);
+};
+
+// Name of a register opcode as the disassembler prints it.
+const char *registerOpName(RegisterOp op);
+
+#endif // REGISTERS_H
@@ -0,0 +1,199 @@
+#include "scheduler.h"
+#include "heap.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#define TRIPLES_HAS_READ
+#endif
+#ifdef __linux__
+#include <sys/epoll.h>
+#define TRIPLES_HAS_EPOLL
+#endif
+
+Scheduler::Scheduler() = default;
+
+Scheduler::~Scheduler() {
+  for (Task *task : this->tasks) delete task;
+#ifdef TRIPLES_HAS_EPOLL
+  if (this->poller >= 0) close(this->poller);
+#endif
+}
+
+Task *Scheduler::add(const TaskKind kind, const Value object, std::unique_ptr<ValueStack> stack) {
+  auto *task = new Task();
+  task->kind = kind;
+  task->object = object;
+  task->stack = std::move(stack);
+  task->ip = nullptr;
+  task->slots = nullptr;
+  task->index = this->tasks.size();
+  this->tasks.push_back(task);
+  return task;
+}
+
+void Scheduler::remove(Task *task) {
+  Task *last = this->tasks.back();
+  this->tasks[task->index] = last;
+  last->index = task->index;
+  this->tasks.pop_back();
+  delete task;
+}
+
+bool Scheduler::empty() const { return this->tasks.empty(); }
+
+void Scheduler::ready(Task *task) { this->readyTasks.push_back(task); }
+
+void Scheduler::sleep(Task *task, const double milliseconds) {
+  // Also catches NaN.
+  if (!(milliseconds > 0)) {
+    this->ready(task);
+    return;
+  }
+
+  // Capped at about thirty years, which keeps the deadline within the clock's range.
+  const std::chrono::duration<double, std::milli> delay(std::min(milliseconds, 1e12));
+  const Clock::time_point deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(delay);
+  this->timers.push({deadline, this->timerSequence++, task});
+}
+
+void Scheduler::readLine(Task *task) { this->readers.push_back(task); }
+
+Task *Scheduler::next(std::ostream &output) {
+  for (;;) {
+    if (!this->timers.empty()) this->expireTimers();
+    if (!this->readyTasks.empty()) {
+      Task *task = this->readyTasks.front();
+      this->readyTasks.pop_front();
+      return task;
+    }
+    if (!this->readers.empty() && (this->hasLine() || this->inputEnded)) {
+      Task *task = this->readers.front();
+      this->readers.pop_front();
+      return task;
+    }
+
+    if (this->timers.empty() && this->readers.empty()) return nullptr;
+    output.flush();
+    if (!this->wait()) return nullptr;
+  }
+}
+
+bool Scheduler::takeLine(std::string &line) {
+  const size_t end = this->input.find('\n');
+  if (end == std::string::npos) {
+    // The input ended without a final line break.
+    if (this->input.empty()) return false;
+    line.swap(this->input);
+    this->input.clear();
+    return true;
+  }
+
+  line.assign(this->input, 0, end);
+  if (!line.empty() && line.back() == '\r') line.pop_back();
+  this->input.erase(0, end + 1);
+  return true;
+}
+
+const std::string &Scheduler::error() const { return this->message; }
+
+void Scheduler::visit(Heap &heap) {
+  for (Task *task : this->tasks) {
+    heap.visit(task->object);
+    if (task->stack != nullptr) task->stack->visit(heap);
+  }
+}
+
+void Scheduler::expireTimers() {
+  const Clock::time_point now = Clock::now();
+  while (!this->timers.empty() && this->timers.top().deadline <= now) {
+    this->ready(this->timers.top().task);
+    this->timers.pop();
+  }
+}
+
+bool Scheduler::hasLine() const { return this->input.find('\n') != std::string::npos; }
+
+// Sleeps until the earliest timer is due or, while reads are pending, input arrives.
+bool Scheduler::wait() {
+  int timeout = -1;
+  if (!this->timers.empty()) {
+    const Clock::duration remaining = this->timers.top().deadline - Clock::now();
+    // Rounded up, so the loop never wakes just before the timer is due.
+    const auto milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(
+        remaining + std::chrono::milliseconds(1) - Clock::duration(1));
+    timeout = static_cast<int>(std::max<long long>(0, std::min<long long>(milliseconds.count(), INT_MAX)));
+  }
+
+  if (this->readers.empty()) {
+    std::this_thread::sleep_until(this->timers.top().deadline);
+    return true;
+  }
+  return this->waitForInput(timeout);
+}
+
+// Reads input once it is ready, or returns after `timeout` milliseconds (-1 for none) without it.
+bool Scheduler::waitForInput(const int timeout) {
+#ifdef TRIPLES_HAS_EPOLL
+  if (this->pollable && !this->watching) {
+    if (this->poller < 0) this->poller = epoll_create1(EPOLL_CLOEXEC);
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = STDIN_FILENO;
+    // epoll refuses regular files, which are always ready anyway, and the read below reports a bad input.
+    if (this->poller >= 0 && epoll_ctl(this->poller, EPOLL_CTL_ADD, STDIN_FILENO, &event) == 0) {
+      this->watching = true;
+    } else {
+      this->pollable = false;
+    }
+  }
+
+  if (this->watching) {
+    epoll_event event{};
+    const int count = epoll_wait(this->poller, &event, 1, timeout);
+    if (count < 0 && errno != EINTR) {
+      this->message = std::string("Cannot wait for input: ") + std::strerror(errno) + ".";
+      return false;
+    }
+    if (count <= 0) return true;
+  }
+#else
+  static_cast<void>(timeout);
+#endif
+  return this->readInput();
+}
+
+// Appends what standard input has, blocking until it has something.
+bool Scheduler::readInput() {
+  char buffer[4096];
+#ifdef TRIPLES_HAS_READ
+  ssize_t count;
+  do {
+    count = read(STDIN_FILENO, buffer, sizeof(buffer));
+  } while (count < 0 && errno == EINTR);
+  if (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+    this->message = std::string("Cannot read input: ") + std::strerror(errno) + ".";
+    return false;
+  }
+  if (count == 0) this->inputEnded = true;
+  if (count > 0) this->input.append(buffer, static_cast<size_t>(count));
+#else
+  if (std::fgets(buffer, sizeof(buffer), stdin) == nullptr) {
+    if (std::ferror(stdin)) {
+      this->message = "Cannot read input.";
+      return false;
+    }
+    this->inputEnded = true;
+    return true;
+  }
+  this->input.append(buffer);
+#endif
+  return true;
+}
@@ -0,0 +1,112 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+#include "chunk.h"
+#include "stack.h"
+#include "value.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <ostream>
+#include <queue>
+#include <string>
+#include <vector>
+
+class Heap;
+
+typedef enum { TASK_FIBER, TASK_READ_LINE } TaskKind;
+
+// Runtime state of something that can be waited for: a fiber, the script itself once fibers are in play, or
+// a pending read. A fiber that is not running keeps its whole execution state here; switching to it swaps
+// that state with the VM's, so the slots never move and the fiber costs no more than its stack segment.
+struct Task {
+  TaskKind kind;
+  // The task's ObjFiber, or null for the script. Rewritten by the collector when the fiber moves.
+  Value object;
+  // Tasks suspended in `await` on this one; each is resumed with its result.
+  Array<Task *> waiters;
+  // Saved state of a fiber. While the fiber runs the VM holds its state, and `stack` and `frames` hold the
+  // empty ones the VM had before. Reads have no stack.
+  std::unique_ptr<ValueStack> stack;
+  Array<CallFrame> frames;
+  const uint8_t *ip;
+  Value *slots;
+  // Position in the scheduler's list of tasks.
+  size_t index;
+};
+
+// The event loop of one VM. Fibers are cooperative: the running one keeps going until it awaits something,
+// and the scheduler then picks the next task that can run, sleeping until the earliest timer is due or input
+// arrives when none can. Input is watched with epoll on Linux; elsewhere, and for inputs epoll cannot watch
+// such as regular files, a pending read blocks the loop until the input has data.
+class Scheduler {
+public:
+  Scheduler();
+  ~Scheduler();
+
+  Scheduler(const Scheduler &) = delete;
+  Scheduler &operator=(const Scheduler &) = delete;
+
+  // Registers a task the scheduler owns until remove() is called on it.
+  Task *add(TaskKind kind, Value object, std::unique_ptr<ValueStack> stack);
+  void remove(Task *task);
+  bool empty() const;
+
+  // Queues a task to run once the running one waits.
+  void ready(Task *task);
+  // Queues a task to run once `milliseconds` have passed.
+  void sleep(Task *task, double milliseconds);
+  // Queues a read to complete with the next line of standard input.
+  void readLine(Task *task);
+
+  // Waits until some task can make progress and returns it: a task to run, or a read whose line takeLine()
+  // then hands out. Returns nullptr once no task ever will, or after an I/O error (see error()). `output` is
+  // flushed before it blocks, so a prompt the script printed shows while it waits.
+  Task *next(std::ostream &output);
+  // The line for the read next() just returned, without its line break. False if the input has ended.
+  bool takeLine(std::string &line);
+  const std::string &error() const;
+
+  void visit(Heap &heap);
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  typedef struct {
+    Clock::time_point deadline;
+    // Breaks ties, so timers due at the same time fire in the order they were set.
+    uint64_t sequence;
+    Task *task;
+  } Timer;
+
+  struct LaterTimer {
+    bool operator()(const Timer &a, const Timer &b) const {
+      return a.deadline > b.deadline || (a.deadline == b.deadline && a.sequence > b.sequence);
+    }
+  };
+
+  Array<Task *> tasks;
+  std::deque<Task *> readyTasks;
+  std::priority_queue<Timer, std::vector<Timer>, LaterTimer> timers;
+  uint64_t timerSequence = 0;
+
+  // Reads waiting for a line, oldest first, and the input read so far but not handed out yet.
+  std::deque<Task *> readers;
+  std::string input;
+  bool inputEnded = false;
+  // epoll instance watching standard input, -1 until a read first waits for it or if it cannot be watched.
+  int poller = -1;
+  bool pollable = true;
+  bool watching = false;
+  std::string message;
+
+  void expireTimers();
+  bool hasLine() const;
+  bool wait();
+  bool waitForInput(int timeout);
+  bool readInput();
+};
+
+#endif // SCHEDULER_H
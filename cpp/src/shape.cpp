@@ -0,0 +1,40 @@
+#include "shape.h"
+#include "heap.h"
+
+ShapeTree::ShapeTree() {
+  Shape root;
+  root.count = 0;
+  root.transitions.init();
+  this->shapes.push_back(root);
+}
+
+ShapeTree::~ShapeTree() {
+  for (Shape &shape : this->shapes) shape.transitions.free();
+}
+
+uint32_t ShapeTree::transition(const uint32_t shape, const Value key) {
+  if (shape == SHAPE_DICTIONARY || !isString(key)) return SHAPE_DICTIONARY;
+
+  Value next;
+  if (this->shapes[shape].transitions.get(key, &next)) return static_cast<uint32_t>(asNumber(next));
+  if (this->shapes[shape].count == SHAPE_MAX_PROPERTIES || this->shapes.size() == SHAPE_MAX_COUNT) {
+    return SHAPE_DICTIONARY;
+  }
+
+  Shape child;
+  child.count = this->shapes[shape].count + 1;
+  child.transitions.init();
+  const auto index = static_cast<uint32_t>(this->shapes.size());
+  this->shapes.push_back(child);
+  this->shapes[shape].transitions.set(key, numberValue(static_cast<double>(index)));
+  return index;
+}
+
+void ShapeTree::visit(Heap &heap) {
+  // Tables hash strings by content, so keys the collector moves stay where they are in them.
+  for (Shape &shape : this->shapes) {
+    for (Entry *entry = shape.transitions.begin(); entry != shape.transitions.end(); entry++) {
+      heap.visit(entry->key);
+    }
+  }
+}
@@ -0,0 +1,51 @@
+#ifndef SHAPE_H
+#define SHAPE_H
+#include "object.h"
+#include "table.h"
+#include "value.h"
+
+#include <cstdint>
+#include <vector>
+
+class Heap;
+
+// Past this many properties a map is treated as a dictionary.
+#define SHAPE_MAX_PROPERTIES 64
+// Cap on the shapes one VM creates, so maps used as dictionaries with ever new keys cannot grow the tree
+// without bound.
+#define SHAPE_MAX_COUNT (64 * 1024)
+
+// Hidden classes of maps.
+//
+// A map's table keeps its entries in insertion order, and maps never lose keys, so the keys a map was given
+// and their order decide which entry holds which property. A shape names such a sequence of string keys: maps
+// start out SHAPE_EMPTY and follow a transition for every key they add, and maps built the same way end up
+// sharing a shape. Knowing the shape of a map and the entry index of a property in that shape, an inline
+// cache reads the property with a single compare instead of hashing its name. Maps given a key that is not a
+// string, or too many keys, drop to SHAPE_DICTIONARY for good.
+//
+// Shapes are numbered by their index in the tree; SHAPE_EMPTY is the root. They hold on to their keys, which
+// the owner must hand to the collector through visit().
+class ShapeTree {
+public:
+  ShapeTree();
+  ~ShapeTree();
+
+  ShapeTree(const ShapeTree &) = delete;
+  ShapeTree &operator=(const ShapeTree &) = delete;
+
+  // Shape reached from `shape` by adding `key`, which must not be a key of `shape` already.
+  uint32_t transition(uint32_t shape, Value key);
+  void visit(Heap &heap);
+
+private:
+  typedef struct {
+    uint32_t count;
+    // Key -> shape it leads to.
+    Table transitions;
+  } Shape;
+
+  std::vector<Shape> shapes;
+};
+
+#endif // SHAPE_H
@@ -0,0 +1,105 @@
+#include "stack.h"
+#include "heap.h"
+
+#include <cstring>
+#include <utility>
+
+static StackSegment *newSegment(const size_t capacity) {
+  auto *segment = new StackSegment;
+  segment->slots = new Value[capacity];
+  segment->capacity = capacity;
+  segment->previous = nullptr;
+  segment->savedTop = nullptr;
+  return segment;
+}
+
+ValueStack::ValueStack(const StackLimits &limits) : stackLimits(limits) {
+  this->segment = newSegment(this->stackLimits.initialSlots);
+  this->top = this->segment->slots;
+  this->limit = this->segment->slots + this->segment->capacity;
+}
+
+ValueStack::~ValueStack() {
+  this->reset();
+  this->freeSegment(this->segment);
+  if (this->spare != nullptr) this->freeSegment(this->spare);
+}
+
+void ValueStack::leave(Value *frameBase) {
+  if (frameBase != this->segment->slots || this->segment->previous == nullptr) {
+    this->top = frameBase;
+    return;
+  }
+
+  // The frame opened this segment; continue below where its carried values used to be.
+  StackSegment *left = this->segment;
+  this->segment = left->previous;
+  this->top = left->savedTop;
+  this->limit = this->segment->slots + this->segment->capacity;
+  this->usedBySegments -= this->segment->capacity;
+
+  if (this->spare != nullptr) this->freeSegment(this->spare);
+  this->spare = left;
+}
+
+void ValueStack::reset() {
+  while (this->segment->previous != nullptr) {
+    StackSegment *previous = this->segment->previous;
+    this->freeSegment(this->segment);
+    this->segment = previous;
+  }
+  this->usedBySegments = 0;
+  this->top = this->segment->slots;
+  this->limit = this->segment->slots + this->segment->capacity;
+}
+
+void ValueStack::swap(ValueStack &other) {
+  std::swap(this->top, other.top);
+  std::swap(this->stackLimits, other.stackLimits);
+  std::swap(this->segment, other.segment);
+  std::swap(this->limit, other.limit);
+  std::swap(this->usedBySegments, other.usedBySegments);
+  std::swap(this->spare, other.spare);
+}
+
+Value *ValueStack::base() const { return this->segment->slots; }
+
+void ValueStack::visit(Heap &heap) {
+  Value *segmentTop = this->top;
+  for (StackSegment *current = this->segment; current != nullptr; current = current->previous) {
+    for (Value *slot = current->slots; slot < segmentTop; slot++) heap.visit(*slot);
+    segmentTop = current->savedTop;
+  }
+}
+
+bool ValueStack::grow(const size_t slots, const size_t carried) {
+  const size_t needed = slots + carried;
+  if (this->stackLimits.segmentSlots == 0) return false;
+
+  size_t capacity = needed > this->stackLimits.segmentSlots ? needed : this->stackLimits.segmentSlots;
+  const size_t used = this->usedBySegments + this->segment->capacity;
+  if (used + needed > this->stackLimits.maxSlots) return false;
+  if (used + capacity > this->stackLimits.maxSlots) capacity = this->stackLimits.maxSlots - used;
+
+  StackSegment *next = this->spare;
+  this->spare = nullptr;
+  if (next == nullptr || next->capacity < needed || used + next->capacity > this->stackLimits.maxSlots) {
+    if (next != nullptr) this->freeSegment(next);
+    next = newSegment(capacity);
+  }
+
+  std::memcpy(next->slots, this->top - carried, carried * sizeof(Value));
+  next->previous = this->segment;
+  next->savedTop = this->top - carried;
+
+  this->usedBySegments += this->segment->capacity;
+  this->segment = next;
+  this->top = next->slots + carried;
+  this->limit = next->slots + next->capacity;
+  return true;
+}
+
+void ValueStack::freeSegment(StackSegment *segment) {
+  delete[] segment->slots;
+  delete segment;
+}
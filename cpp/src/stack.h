@@ -0,0 +1,78 @@
+#ifndef STACK_H
+#define STACK_H
+#include "value.h"
+
+#include <cstddef>
+#include <cstdint>
+
+class Heap;
+
+// What a call saves of its caller: where to continue and the caller's frame. The callee's own frame starts at
+// the callee slot, so arguments are never copied.
+typedef struct {
+  const uint8_t *ip;
+  Value *slots;
+} CallFrame;
+
+typedef struct {
+  // Slots in the first segment, allocated up front.
+  size_t initialSlots = 1024;
+  // Minimum slots in every further segment; 0 keeps the stack to its first segment.
+  size_t segmentSlots = 16 * 1024;
+  // Hard cap on slots across all segments, so the worst-case memory of a VM is known in advance.
+  size_t maxSlots = 1024 * 1024;
+} StackLimits;
+
+// Segment of the value stack. Frames never straddle segments, so every frame is one contiguous run of slots.
+typedef struct StackSegment {
+  Value *slots;
+  size_t capacity;
+  struct StackSegment *previous;
+  // Top of the previous segment when this one was entered.
+  Value *savedTop;
+} StackSegment;
+
+// The VM value stack. Pushing and popping is a plain store or load through `top`: there are no checks on the
+// hot path. Instead a frame is entered with the number of slots it can use at most (the depth found by the
+// verifier), and that is the only place overflow is detected. When the current segment is full, a new one is
+// chained on, up to StackLimits::maxSlots.
+class ValueStack {
+public:
+  Value *top;
+
+  explicit ValueStack(const StackLimits &limits = StackLimits());
+  ~ValueStack();
+
+  ValueStack(const ValueStack &) = delete;
+  ValueStack &operator=(const ValueStack &) = delete;
+
+  // Makes room for `slots` values above `top`, moving the `carried` values just below it (e.g. a callee's
+  // arguments) to a new segment if they do not fit. Returns false if the stack would exceed its limits.
+  bool enter(size_t slots, size_t carried = 0) {
+    if (static_cast<size_t>(this->limit - this->top) >= slots) return true;
+    return this->grow(slots, carried);
+  }
+  // Drops the frame starting at `frameBase`; afterwards `top` is where the frame's carried values were.
+  void leave(Value *frameBase);
+  // Empties the stack and releases every segment but the first.
+  void reset();
+  // Exchanges the contents of two stacks, so a fiber's stack can be run without moving any slot.
+  void swap(ValueStack &other);
+
+  Value *base() const;
+  void visit(Heap &heap);
+
+private:
+  StackLimits stackLimits;
+  StackSegment *segment;
+  Value *limit;
+  size_t usedBySegments = 0;
+  // The most recently left segment, kept to avoid reallocating when a frame at a segment boundary is entered
+  // and left repeatedly.
+  StackSegment *spare = nullptr;
+
+  bool grow(size_t slots, size_t carried);
+  void freeSegment(StackSegment *segment);
+};
+
+#endif // STACK_H
@@ -0,0 +1,246 @@
+#include "table.h"
+#include "object.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TABLE_SSE2
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#define CONTROL_EMPTY 0x80
+#define CONTROL_DELETED 0xFE
+
+// Maximum load, counting deleted slots, is 7/8 of the index.
+#define TABLE_MAX_LOAD(capacity) ((capacity) / 8 * 7)
+
+static uint8_t hashTag(const uint32_t hash) { return static_cast<uint8_t>(hash & 0x7F); }
+
+static uint32_t hashGroup(const uint32_t hash) { return hash >> 7; }
+
+static int lowestBit(const uint32_t mask) {
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return static_cast<int>(index);
+#else
+  return __builtin_ctz(mask);
+#endif
+}
+
+// Bit i is set when control byte i of the group equals `tag`.
+static uint32_t matchTag(const uint8_t *group, const uint8_t tag) {
+#ifdef TABLE_SSE2
+  const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(group));
+  return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(static_cast<char>(tag)))));
+#else
+  uint32_t mask = 0;
+  for (int i = 0; i < TABLE_GROUP_SIZE; i++) {
+    if (group[i] == tag) mask |= 1u << i;
+  }
+  return mask;
+#endif
+}
+
+// Bit i is set when control byte i is EMPTY or DELETED; both have the high bit set, full slots do not.
+static uint32_t matchFree(const uint8_t *group) {
+#ifdef TABLE_SSE2
+  const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(group));
+  return static_cast<uint32_t>(_mm_movemask_epi8(bytes));
+#else
+  uint32_t mask = 0;
+  for (int i = 0; i < TABLE_GROUP_SIZE; i++) {
+    if (group[i] & 0x80) mask |= 1u << i;
+  }
+  return mask;
+#endif
+}
+
+static uint32_t mixBits(uint64_t bits) {
+  bits ^= bits >> 33;
+  bits *= 0xff51afd7ed558ccdULL;
+  bits ^= bits >> 33;
+  bits *= 0xc4ceb9fe1a85ec53ULL;
+  bits ^= bits >> 33;
+  return static_cast<uint32_t>(bits);
+}
+
+bool isHashable(const Value value) { return !isObj(value) || isString(value); }
+
+uint32_t hashValue(const Value value) {
+  if (isString(value)) return asString(value)->hashCode();
+  if (isNumber(value)) {
+    // 0 and -0 are equal keys.
+    const double number = asNumber(value);
+    return mixBits(number == 0 ? 0 : value);
+  }
+  return mixBits(value);
+}
+
+void Table::init() {
+  this->control = nullptr;
+  this->slots = nullptr;
+  this->entries = nullptr;
+  this->capacity = 0;
+  this->entryCount = 0;
+  this->entryCapacity = 0;
+  this->count = 0;
+  this->deleted = 0;
+}
+
+void Table::free() {
+  std::free(this->control);
+  std::free(this->slots);
+  std::free(this->entries);
+  this->init();
+}
+
+// Visits the groups of the probe sequence for `hash`. Groups are stepped triangularly, which reaches every
+// group exactly once when the group count is a power of two.
+template <typename Visit> static void probe(const Table &table, const uint32_t hash, Visit visit) {
+  const uint32_t groupMask = table.capacity / TABLE_GROUP_SIZE - 1;
+  uint32_t group = hashGroup(hash) & groupMask;
+  for (uint32_t step = 1;; step++) {
+    if (visit(group * TABLE_GROUP_SIZE)) return;
+    group = (group + step) & groupMask;
+  }
+}
+
+static int64_t findSlot(const Table &table, const Value key, const uint32_t hash) {
+  if (table.capacity == 0) return -1;
+
+  int64_t found = -1;
+  probe(table, hash, [&](const uint32_t base) {
+    uint32_t matches = matchTag(table.control + base, hashTag(hash));
+    while (matches != 0) {
+      const uint32_t slot = base + lowestBit(matches);
+      const Entry &entry = table.entries[table.slots[slot]];
+      if (entry.hash == hash && valuesEqual(entry.key, key)) {
+        found = slot;
+        return true;
+      }
+      matches &= matches - 1;
+    }
+
+    // An EMPTY slot ends the probe sequence; DELETED ones do not.
+    return matchTag(table.control + base, CONTROL_EMPTY) != 0;
+  });
+  return found;
+}
+
+static void insertSlot(Table &table, const uint32_t hash, const uint32_t entryIndex) {
+  probe(table, hash, [&](const uint32_t base) {
+    const uint32_t free = matchFree(table.control + base);
+    if (free == 0) return false;
+
+    const uint32_t slot = base + lowestBit(free);
+    if (table.control[slot] == CONTROL_DELETED) table.deleted--;
+    table.control[slot] = hashTag(hash);
+    table.slots[slot] = entryIndex;
+    return true;
+  });
+}
+
+static void resize(Table &table, const uint32_t capacity) {
+  // Compact the entries, dropping removed ones while keeping insertion order.
+  uint32_t live = 0;
+  for (uint32_t i = 0; i < table.entryCount; i++) {
+    if (isUndefined(table.entries[i].key)) continue;
+    table.entries[live++] = table.entries[i];
+  }
+  table.entryCount = live;
+
+  if (capacity != table.capacity) {
+    std::free(table.control);
+    std::free(table.slots);
+    table.control = static_cast<uint8_t *>(std::malloc(capacity));
+    table.slots = static_cast<uint32_t *>(std::malloc(capacity * sizeof(uint32_t)));
+    table.capacity = capacity;
+
+    table.entryCapacity = TABLE_MAX_LOAD(capacity);
+    table.entries = static_cast<Entry *>(std::realloc(table.entries, table.entryCapacity * sizeof(Entry)));
+  }
+
+  std::memset(table.control, CONTROL_EMPTY, capacity);
+  table.deleted = 0;
+  for (uint32_t i = 0; i < table.entryCount; i++) {
+    insertSlot(table, table.entries[i].hash, i);
+  }
+}
+
+bool Table::get(const Value key, Value *value) const {
+  const int64_t slot = findSlot(*this, key, hashValue(key));
+  if (slot < 0) return false;
+
+  *value = this->entries[this->slots[slot]].value;
+  return true;
+}
+
+Entry *Table::find(const Value key) const {
+  const int64_t slot = findSlot(*this, key, hashValue(key));
+  if (slot < 0) return nullptr;
+
+  return &this->entries[this->slots[slot]];
+}
+
+bool Table::set(const Value key, const Value value) {
+  const uint32_t hash = hashValue(key);
+  const int64_t slot = findSlot(*this, key, hash);
+  if (slot >= 0) {
+    this->entries[this->slots[slot]].value = value;
+    return false;
+  }
+
+  if (this->entryCount + 1 > this->entryCapacity ||
+      this->count + this->deleted + 1 > TABLE_MAX_LOAD(this->capacity)) {
+    uint32_t capacity = this->capacity < TABLE_GROUP_SIZE ? TABLE_GROUP_SIZE : this->capacity;
+    while (this->count + 1 > TABLE_MAX_LOAD(capacity)) capacity *= 2;
+    resize(*this, capacity);
+  }
+
+  const uint32_t entryIndex = this->entryCount++;
+  this->entries[entryIndex] = {key, value, hash};
+  insertSlot(*this, hash, entryIndex);
+  this->count++;
+  return true;
+}
+
+bool Table::remove(const Value key) {
+  const int64_t slot = findSlot(*this, key, hashValue(key));
+  if (slot < 0) return false;
+
+  this->entries[this->slots[slot]].key = UNDEFINED_VAL;
+  this->entries[this->slots[slot]].value = NULL_VAL;
+  this->control[slot] = CONTROL_DELETED;
+  this->deleted++;
+  this->count--;
+  return true;
+}
+
+ObjString *Table::findString(const char *chars, const size_t length, const uint32_t hash) const {
+  if (this->capacity == 0) return nullptr;
+
+  ObjString *found = nullptr;
+  probe(*this, hash, [&](const uint32_t base) {
+    uint32_t matches = matchTag(this->control + base, hashTag(hash));
+    while (matches != 0) {
+      const Entry &entry = this->entries[this->slots[base + lowestBit(matches)]];
+      if (entry.hash == hash && isString(entry.key)) {
+        ObjString *string = asString(entry.key);
+        if (string->length == length && std::memcmp(string->chars(), chars, length) == 0) {
+          found = string;
+          return true;
+        }
+      }
+      matches &= matches - 1;
+    }
+
+    return matchTag(this->control + base, CONTROL_EMPTY) != 0;
+  });
+  return found;
+}
@@ -0,0 +1,65 @@
+#ifndef TABLE_H
+#define TABLE_H
+#include "value.h"
+
+#include <cstddef>
+#include <cstdint>
+
+struct ObjString;
+
+// Size of a probe group; one SSE2 register of control bytes.
+#define TABLE_GROUP_SIZE 16
+
+typedef struct {
+  Value key;
+  Value value;
+  uint32_t hash;
+} Entry;
+
+// Open-addressing hash table in the style of Swiss tables, keyed by Value.
+//
+// Entries are stored densely in insertion order; the index is a separate array of slots, each paired with a
+// control byte that is either EMPTY, DELETED or the low 7 bits of the key's hash. A lookup loads a group of
+// 16 control bytes at once and compares them against the hash tag with SIMD, so most probes touch a single
+// cache line of metadata and compare at most one or two keys.
+//
+// Keys are hashed by content: strings by their cached hash, numbers by value. The table therefore survives
+// the collector moving key objects. Other objects cannot be keys.
+//
+// The table is plain data so it can live inside heap objects that the collector relocates with memcpy. Call
+// init() before first use and free() to release its storage.
+struct Table {
+  uint8_t *control;
+  uint32_t *slots;
+  Entry *entries;
+  // Number of index slots; zero or a power of two that is a multiple of TABLE_GROUP_SIZE.
+  uint32_t capacity;
+  // Entries in use, including removed ones that are still waiting for compaction.
+  uint32_t entryCount;
+  uint32_t entryCapacity;
+  // Live keys.
+  uint32_t count;
+  // Index slots holding a DELETED marker.
+  uint32_t deleted;
+
+  void init();
+  void free();
+
+  bool get(Value key, Value *value) const;
+  // The live entry for `key`, or nullptr. Only valid until the table is next modified.
+  Entry *find(Value key) const;
+  // Returns true when the key was not present before.
+  bool set(Value key, Value value);
+  bool remove(Value key);
+  // Looks up a string key by its characters, for interning.
+  ObjString *findString(const char *chars, size_t length, uint32_t hash) const;
+
+  // Live entries in insertion order. Removed entries have an undefined key and must be skipped.
+  Entry *begin() const { return this->entries; }
+  Entry *end() const { return this->entries + this->entryCount; }
+};
+
+bool isHashable(Value value);
+uint32_t hashValue(Value value);
+
+#endif // TABLE_H
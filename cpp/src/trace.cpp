@@ -0,0 +1,31 @@
+#include "trace.h"
+#include "debug.h"
+
+#include <iostream>
+
+void TraceSink::start(const Chunk &, const RegisterChunk *) {}
+
+StreamTrace::StreamTrace(std::ostream &out) : out(out) {}
+
+void StreamTrace::start(const Chunk &chunk, const RegisterChunk *registers) {
+  if (registers != nullptr) registers->disassemble(chunk, this->out);
+  this->out << "== VM ==" << std::endl;
+}
+
+void StreamTrace::instruction(const Chunk &chunk, const unsigned int offset, const Value *base,
+                              const Value *top, const Array<CallFrame> &) {
+  if (top > base) {
+    this->out << "\t\t";
+    for (const Value *slot = base; slot < top; slot++) {
+      this->out << "[ ";
+      printValue(*slot, this->out);
+      this->out << " ]";
+    }
+    this->out << std::endl;
+  }
+  Debug(chunk, this->out).disassembleInstruction(offset);
+}
+
+void StreamTrace::registerInstruction(const Chunk &chunk, const RegisterChunk &registers, const size_t pc) {
+  registers.disassembleInstruction(chunk, pc, this->out);
+}
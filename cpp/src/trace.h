@@ -0,0 +1,43 @@
+#ifndef TRACE_H
+#define TRACE_H
+#include "chunk.h"
+#include "registers.h"
+#include "stack.h"
+
+#include <cstddef>
+#include <iosfwd>
+
+// Receives the instructions a VM runs while tracing is on (see VM::setTrace). Each engine is built twice,
+// with and without the calls to the sink, and interpret() picks one, so a VM that is not traced does no work
+// per instruction for it. The JIT never runs while tracing.
+class TraceSink {
+public:
+  virtual ~TraceSink() = default;
+
+  // Called once before the first instruction. `registers` is the lowered code if the register engine runs the
+  // chunk and nullptr on the stack engine.
+  virtual void start(const Chunk &chunk, const RegisterChunk *registers);
+  // Called before the stack engine runs the instruction at `offset`; the current stack segment spans `base`
+  // up to `top`. `frames` are the suspended callers, outermost first, each with the ip to return to.
+  virtual void instruction(const Chunk &chunk, unsigned int offset, const Value *base, const Value *top,
+                           const Array<CallFrame> &frames) = 0;
+  // Called before the register engine runs instruction `pc`.
+  virtual void registerInstruction(const Chunk &chunk, const RegisterChunk &registers, size_t pc) = 0;
+};
+
+// Prints traced instructions to `out` as the disassembler does, each stack-engine instruction after the
+// stack it runs on.
+class StreamTrace : public TraceSink {
+public:
+  explicit StreamTrace(std::ostream &out);
+
+  void start(const Chunk &chunk, const RegisterChunk *registers) override;
+  void instruction(const Chunk &chunk, unsigned int offset, const Value *base, const Value *top,
+                   const Array<CallFrame> &frames) override;
+  void registerInstruction(const Chunk &chunk, const RegisterChunk &registers, size_t pc) override;
+
+private:
+  std::ostream &out;
+};
+
+#endif // TRACE_H
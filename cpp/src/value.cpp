@@ -1,7 +1,97 @@
 #include "value.h"
+#include "object.h"
 
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 
-void printValue(const Value value) {
-  std::cout << value;
-}
\ No newline at end of file
+// Enough for "-", 17 digits, a point and an exponent such as "e-324", or for the longest integer printed.
+#define NUMBER_BUFFER 32
+// Integers up to this magnitude convert to long long exactly.
+#define EXACT_INTEGER 9007199254740992.0
+
+bool valuesEqual(const Value a, const Value b) {
+  // Compare numbers as doubles so NaN != NaN and 0 == -0.
+  if (isNumber(a) && isNumber(b)) return asNumber(a) == asNumber(b);
+  if (a == b) return true;
+  if (isObj(a) && isObj(b)) return objectsEqual(a, b);
+  return false;
+}
+
+// Prints a number the way JavaScript converts it to a string: the fewest significant digits that read back
+// as the same double, without an exponent unless that would take more than 21 digits or 6 leading zeros.
+static void printNumber(const double number, std::ostream &out) {
+  if (std::isnan(number)) {
+    out << "NaN";
+    return;
+  }
+  if (std::isinf(number)) {
+    out << (number < 0 ? "-Infinity" : "Infinity");
+    return;
+  }
+  char buffer[NUMBER_BUFFER];
+  if (std::fabs(number) < EXACT_INTEGER && number == std::trunc(number)) {
+    // -0 stays visible, as in Node's console.
+    if (number == 0) {
+      out << (std::signbit(number) ? "-0" : "0");
+      return;
+    }
+    std::snprintf(buffer, sizeof(buffer), "%lld", static_cast<long long>(number));
+    out << buffer;
+    return;
+  }
+
+  // The shortest scientific form that round-trips, as "-d.ddde+x".
+  for (int precision = 1; precision <= 17; precision++) {
+    std::snprintf(buffer, sizeof(buffer), "%.*e", precision - 1, number);
+    if (std::strtod(buffer, nullptr) == number) break;
+  }
+  const char *mantissa = buffer;
+  if (*mantissa == '-') {
+    out << '-';
+    mantissa++;
+  }
+  char digits[NUMBER_BUFFER];
+  int count = 0;
+  const char *cursor = mantissa;
+  for (; *cursor != 'e'; cursor++) {
+    if (*cursor != '.') digits[count++] = *cursor;
+  }
+  while (count > 1 && digits[count - 1] == '0') count--;
+  // The decimal point comes after the first `point` digits.
+  const int point = std::atoi(cursor + 1) + 1;
+
+  if (count <= point && point <= 21) {
+    out.write(digits, count);
+    for (int i = count; i < point; i++) out << '0';
+  } else if (0 < point && point <= 21) {
+    out.write(digits, point);
+    out << '.';
+    out.write(digits + point, count - point);
+  } else if (-6 < point && point <= 0) {
+    out << "0.";
+    for (int i = point; i < 0; i++) out << '0';
+    out.write(digits, count);
+  } else {
+    out << digits[0];
+    if (count > 1) {
+      out << '.';
+      out.write(digits + 1, count - 1);
+    }
+    out << 'e' << (point > 0 ? "+" : "-") << std::abs(point - 1);
+  }
+}
+
+void printValue(const Value value, std::ostream &out) {
+  if (isBool(value)) {
+    out << (asBool(value) ? "true" : "false");
+  } else if (isNull(value)) {
+    out << "null";
+  } else if (isNumber(value)) {
+    printNumber(asNumber(value), out);
+  } else if (isObj(value)) {
+    printObject(value, out);
+  }
+}
@@ -5,8 +5,60 @@
 #ifndef VALUE_H
 #define VALUE_H
 
-typedef long double Value;
+#include <cstdint>
+#include <cstring>
+#include <iosfwd>
 
-void printValue(Value value);
+struct Obj;
+
+// Values are NaN-boxed into 64 bits. Any bit pattern that is not a quiet NaN with all of QNAN set is a
+// plain double. Otherwise the low bits carry a singleton tag (null, false, true) or, when the sign bit is
+// also set, a 48-bit object pointer.
+typedef uint64_t Value;
+
+#define SIGN_BIT ((uint64_t)0x8000000000000000)
+#define QNAN ((uint64_t)0x7ffc000000000000)
+
+#define TAG_NULL 1
+#define TAG_FALSE 2
+#define TAG_TRUE 3
+#define TAG_UNDEFINED 4
+
+#define NULL_VAL ((Value)(uint64_t)(QNAN | TAG_NULL))
+#define FALSE_VAL ((Value)(uint64_t)(QNAN | TAG_FALSE))
+#define TRUE_VAL ((Value)(uint64_t)(QNAN | TAG_TRUE))
+#define UNDEFINED_VAL ((Value)(uint64_t)(QNAN | TAG_UNDEFINED))
+
+inline bool isNumber(const Value value) { return (value & QNAN) != QNAN; }
+inline bool isNull(const Value value) { return value == NULL_VAL; }
+// FALSE_VAL and TRUE_VAL differ only in the lowest bit.
+inline bool isBool(const Value value) { return (value | 1) == TRUE_VAL; }
+inline bool isUndefined(const Value value) { return value == UNDEFINED_VAL; }
+inline bool isObj(const Value value) { return (value & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT); }
+
+inline double asNumber(const Value value) {
+  double number;
+  std::memcpy(&number, &value, sizeof(Value));
+  return number;
+}
+inline bool asBool(const Value value) { return value == TRUE_VAL; }
+inline Obj *asObj(const Value value) {
+  return reinterpret_cast<Obj *>(static_cast<uintptr_t>(value & ~(SIGN_BIT | QNAN)));
+}
+
+inline Value numberValue(const double number) {
+  Value value;
+  std::memcpy(&value, &number, sizeof(double));
+  return value;
+}
+inline Value boolValue(const bool boolean) { return boolean ? TRUE_VAL : FALSE_VAL; }
+inline Value objValue(const Obj *object) {
+  return SIGN_BIT | QNAN | static_cast<uint64_t>(reinterpret_cast<uintptr_t>(object));
+}
+
+inline bool isFalsey(const Value value) { return isNull(value) || value == FALSE_VAL; }
+
+bool valuesEqual(Value a, Value b);
+void printValue(Value value, std::ostream &out);
 
 #endif // VALUE_H
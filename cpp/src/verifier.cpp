@@ -0,0 +1,400 @@
+#include "verifier.h"
+#include "object.h"
+
+Verifier::Verifier(const Chunk &chunk) : chunk(chunk) {}
+
+bool Verifier::verify() {
+  if (this->chunk.count() == 0) return this->fail(0, "chunk is empty.");
+
+  this->depths.assign(this->chunk.count(), -1);
+  this->depths[0] = 0;
+  this->jumpTargets.assign(this->chunk.count(), false);
+  this->owners.assign(this->chunk.count(), -1);
+  this->worklist.assign(1, 0);
+  this->maxDepth = 0;
+
+  while (!this->worklist.empty()) {
+    const unsigned int offset = this->worklist.back();
+    this->worklist.pop_back();
+    if (!this->verifyInstruction(offset)) return false;
+  }
+  return true;
+}
+
+const std::string &Verifier::error() const { return this->message; }
+
+unsigned int Verifier::maxStackDepth() const { return this->maxDepth; }
+
+long Verifier::depthAt(const unsigned int offset) const { return this->depths[offset]; }
+
+bool Verifier::isJumpTarget(const unsigned int offset) const { return this->jumpTargets[offset]; }
+
+long Verifier::ownerAt(const unsigned int offset) const { return this->owners[offset]; }
+
+bool Verifier::verifyInstruction(const unsigned int offset) {
+  const uint8_t *code = this->chunk.code();
+  const size_t count = this->chunk.count();
+  const long depth = this->depths[offset];
+  const long owner = this->owners[offset];
+
+  // Operand bytes after the opcode, values popped and pushed, and whether execution can continue with the
+  // next instruction.
+  unsigned int operandBytes = 0;
+  long pops = 0;
+  long pushes = 0;
+  bool fallsThrough = true;
+
+  // The operand is only decoded once the instruction is known to fit in the chunk.
+  auto operand = [&]() -> uint32_t {
+    return operandBytes == 1 ? code[offset + 1] : this->chunk.readLong(offset + 1);
+  };
+
+  const auto instruction = static_cast<OpCode>(code[offset]);
+  switch (instruction) {
+    case OP_NULL:
+    case OP_TRUE:
+    case OP_FALSE:
+      pushes = 1;
+      break;
+    case OP_CONSTANT:
+    case OP_GET_LOCAL:
+    case OP_GET_BOXED_LOCAL:
+    case OP_GET_GLOBAL:
+      operandBytes = 1;
+      pushes = 1;
+      break;
+    case OP_CONSTANT_LONG:
+    case OP_GET_GLOBAL_LONG:
+      operandBytes = 3;
+      pushes = 1;
+      break;
+    case OP_SET_LOCAL:
+    case OP_SET_BOXED_LOCAL:
+    case OP_SET_GLOBAL:
+      operandBytes = 1;
+      pops = 1;
+      pushes = 1;
+      break;
+    case OP_SET_GLOBAL_LONG:
+      operandBytes = 3;
+      pops = 1;
+      pushes = 1;
+      break;
+    case OP_DEFINE_GLOBAL:
+    case OP_SET_LOCAL_POP:
+    case OP_SET_BOXED_LOCAL_POP:
+      operandBytes = 1;
+      pops = 1;
+      break;
+    case OP_DEFINE_GLOBAL_LONG:
+      operandBytes = 3;
+      pops = 1;
+      break;
+    case OP_MAP:
+    case OP_ARRAY:
+      operandBytes = 1;
+      pushes = 1;
+      break;
+    case OP_MAP_LONG:
+    case OP_ARRAY_LONG:
+      operandBytes = 3;
+      pushes = 1;
+      break;
+    case OP_POP:
+    case OP_PRINT:
+      pops = 1;
+      break;
+    case OP_NOT:
+    case OP_NEGATE:
+      pops = 1;
+      pushes = 1;
+      break;
+    case OP_GET_INDEX:
+    case OP_EQUAL:
+    case OP_GREATER:
+    case OP_LESS:
+    case OP_ADD:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+      pops = 2;
+      pushes = 1;
+      break;
+    case OP_ADD_CONST:
+    case OP_SUBTRACT_CONST:
+    case OP_MULTIPLY_CONST:
+    case OP_DIVIDE_CONST:
+    case OP_LESS_CONST:
+    case OP_GREATER_CONST:
+      operandBytes = 1;
+      pops = 1;
+      pushes = 1;
+      break;
+    case OP_SET_INDEX:
+    case OP_SLICE:
+      pops = 3;
+      pushes = 1;
+      break;
+    case OP_INVOKE:
+      // Name constant, argument count, cache.
+      operandBytes = 5;
+      pushes = 1;
+      break;
+    case OP_INVOKE_LONG:
+      operandBytes = 7;
+      pushes = 1;
+      break;
+    case OP_GET_PROPERTY:
+      // Name constant, cache.
+      operandBytes = 4;
+      pops = 1;
+      pushes = 1;
+      break;
+    case OP_GET_PROPERTY_LONG:
+      operandBytes = 6;
+      pops = 1;
+      pushes = 1;
+      break;
+    case OP_SET_PROPERTY:
+      operandBytes = 4;
+      pops = 2;
+      pushes = 1;
+      break;
+    case OP_SET_PROPERTY_LONG:
+      operandBytes = 6;
+      pops = 2;
+      pushes = 1;
+      break;
+    case OP_JUMP:
+    case OP_LOOP:
+      operandBytes = 2;
+      fallsThrough = false;
+      break;
+    case OP_JUMP_IF_FALSE:
+      // Peeks at the condition.
+      operandBytes = 2;
+      pops = 1;
+      pushes = 1;
+      break;
+    case OP_CLOSURE:
+      // Followed by the upvalue pairs, counted below.
+      operandBytes = 1;
+      pushes = 1;
+      break;
+    case OP_CLOSURE_LONG:
+      operandBytes = 3;
+      pushes = 1;
+      break;
+    case OP_GET_UPVALUE:
+    case OP_GET_BOXED_UPVALUE:
+      operandBytes = 1;
+      pushes = 1;
+      break;
+    case OP_SET_BOXED_UPVALUE:
+      operandBytes = 1;
+      pops = 1;
+      pushes = 1;
+      break;
+    case OP_CALL:
+      operandBytes = 1;
+      pushes = 1;
+      break;
+    case OP_TAIL_CALL:
+      operandBytes = 1;
+      fallsThrough = false;
+      break;
+    case OP_SPAWN:
+      operandBytes = 1;
+      pushes = 1;
+      break;
+    case OP_AWAIT:
+      pops = 1;
+      pushes = 1;
+      break;
+    case OP_RETURN_VALUE:
+      pops = 1;
+      fallsThrough = false;
+      break;
+    case OP_RETURN:
+      fallsThrough = false;
+      break;
+    default:
+      return this->fail(offset, "unknown opcode " + std::to_string(code[offset]) + ".");
+  }
+
+  if (offset + 1 + operandBytes > count) return this->fail(offset, "instruction is truncated.");
+
+  switch (instruction) {
+    case OP_CONSTANT:
+    case OP_CONSTANT_LONG:
+      if (operand() >= this->chunk.constants.size()) {
+        return this->fail(offset, "constant index out of range.");
+      }
+      break;
+    case OP_ADD_CONST:
+    case OP_SUBTRACT_CONST:
+    case OP_MULTIPLY_CONST:
+    case OP_DIVIDE_CONST:
+    case OP_LESS_CONST:
+    case OP_GREATER_CONST:
+      // The handlers skip the type check on the constant.
+      if (operand() >= this->chunk.constants.size() || !isNumber(this->chunk.constants[operand()])) {
+        return this->fail(offset, "operand is not a number constant.");
+      }
+      break;
+    case OP_GET_LOCAL:
+    case OP_SET_LOCAL:
+    case OP_SET_LOCAL_POP:
+    case OP_GET_BOXED_LOCAL:
+    case OP_SET_BOXED_LOCAL:
+    case OP_SET_BOXED_LOCAL_POP:
+      // The slot must hold a value below the operands of the instruction itself.
+      if (operand() >= depth - pops) return this->fail(offset, "local slot out of range.");
+      // A function's slot 0 holds the closure its upvalues are read from.
+      if (instruction != OP_GET_LOCAL && instruction != OP_GET_BOXED_LOCAL && owner != -1 && operand() == 0) {
+        return this->fail(offset, "store to the callee slot.");
+      }
+      break;
+    case OP_GET_GLOBAL:
+    case OP_GET_GLOBAL_LONG:
+    case OP_SET_GLOBAL:
+    case OP_SET_GLOBAL_LONG:
+    case OP_DEFINE_GLOBAL:
+    case OP_DEFINE_GLOBAL_LONG:
+      if (operand() >= this->chunk.globalNames.size()) return this->fail(offset, "global slot out of range.");
+      break;
+    case OP_MAP:
+    case OP_MAP_LONG:
+      pops = 2 * static_cast<long>(operand());
+      break;
+    case OP_ARRAY:
+    case OP_ARRAY_LONG:
+      pops = static_cast<long>(operand());
+      break;
+    case OP_INVOKE:
+    case OP_INVOKE_LONG:
+    case OP_GET_PROPERTY:
+    case OP_GET_PROPERTY_LONG:
+    case OP_SET_PROPERTY:
+    case OP_SET_PROPERTY_LONG:
+      {
+        const bool isShort = instruction == OP_INVOKE || instruction == OP_GET_PROPERTY ||
+                             instruction == OP_SET_PROPERTY;
+        const uint32_t name = isShort ? code[offset + 1] : this->chunk.readLong(offset + 1);
+        if (name >= this->chunk.constants.size() || !isString(this->chunk.constants[name])) {
+          return this->fail(offset, "property name is not a string constant.");
+        }
+        // The cache index is always the last operand.
+        if (this->chunk.readLong(offset + operandBytes - 2) >= this->chunk.cacheCount) {
+          return this->fail(offset, "inline cache index out of range.");
+        }
+        // The receiver and the arguments are replaced by the result.
+        if (instruction == OP_INVOKE || instruction == OP_INVOKE_LONG) {
+          pops = 1 + code[offset + operandBytes - 3];
+        }
+        break;
+      }
+    case OP_CLOSURE:
+    case OP_CLOSURE_LONG:
+      {
+        const uint32_t constant = operand();
+        if (constant >= this->chunk.constants.size() || !isFunction(this->chunk.constants[constant])) {
+          return this->fail(offset, "closure of a non-function constant.");
+        }
+        const ObjFunction *function = asFunction(this->chunk.constants[constant]);
+        if (offset + 1 + operandBytes + 2 * function->upvalueCount > count) {
+          return this->fail(offset, "instruction is truncated.");
+        }
+        for (uint32_t i = 0; i < function->upvalueCount; i++) {
+          const uint8_t isLocal = code[offset + 1 + operandBytes + 2 * i];
+          const uint8_t index = code[offset + 2 + operandBytes + 2 * i];
+          if (isLocal > 2) return this->fail(offset, "malformed upvalue.");
+          if (isLocal ? index >= depth : index >= this->upvalueCount(owner)) {
+            return this->fail(offset, "captured variable out of range.");
+          }
+          // Boxing the callee slot would hide the closure its upvalues are read from.
+          if (isLocal == 2 && owner != -1 && index == 0) return this->fail(offset, "box of the callee slot.");
+        }
+        operandBytes += 2 * function->upvalueCount;
+        if (!this->reach(offset, function->entry, 1 + static_cast<long>(function->arity), constant)) {
+          return false;
+        }
+        break;
+      }
+    case OP_GET_UPVALUE:
+    case OP_GET_BOXED_UPVALUE:
+    case OP_SET_BOXED_UPVALUE:
+      if (operand() >= this->upvalueCount(owner)) return this->fail(offset, "upvalue out of range.");
+      break;
+    case OP_CALL:
+    case OP_TAIL_CALL:
+    case OP_SPAWN:
+      pops = 1 + static_cast<long>(operand());
+      if (instruction == OP_TAIL_CALL && owner == -1) {
+        return this->fail(offset, "tail call outside a function.");
+      }
+      break;
+    case OP_RETURN_VALUE:
+      if (owner == -1) return this->fail(offset, "function return outside a function.");
+      break;
+    case OP_RETURN:
+      if (owner != -1) return this->fail(offset, "script return inside a function.");
+      break;
+    default:
+      break;
+  }
+
+  if (depth < pops) return this->fail(offset, "stack underflow.");
+  const long after = depth - pops + pushes;
+  if (after > static_cast<long>(this->maxDepth)) this->maxDepth = static_cast<unsigned int>(after);
+
+  const unsigned int next = offset + 1 + operandBytes;
+  switch (instruction) {
+    case OP_JUMP:
+    case OP_JUMP_IF_FALSE:
+      {
+        const size_t target = static_cast<size_t>(next) + this->chunk.readShort(offset + 1);
+        if (!this->reach(offset, target, after, owner)) return false;
+        this->jumpTargets[target] = true;
+        break;
+      }
+    case OP_LOOP:
+      {
+        const uint16_t jump = this->chunk.readShort(offset + 1);
+        if (jump > next) return this->fail(offset, "jump target out of range.");
+        if (!this->reach(offset, next - jump, after, owner)) return false;
+        this->jumpTargets[next - jump] = true;
+        break;
+      }
+    default:
+      break;
+  }
+
+  return !fallsThrough || this->reach(offset, next, after, owner);
+}
+
+bool Verifier::reach(const unsigned int from, const size_t target, const long depth, const long owner) {
+  if (target >= this->chunk.count()) return this->fail(from, "execution runs past the end of the chunk.");
+
+  long &known = this->depths[target];
+  if (known == -1) {
+    known = depth;
+    this->owners[target] = owner;
+    this->worklist.push_back(static_cast<unsigned int>(target));
+    return true;
+  }
+
+  if (known != depth) return this->fail(from, "stack depth differs between paths.");
+  if (this->owners[target] != owner) return this->fail(from, "code is shared between functions.");
+  return true;
+}
+
+uint32_t Verifier::upvalueCount(const long owner) const {
+  if (owner == -1) return 0;
+  return asFunction(this->chunk.constants[owner])->upvalueCount;
+}
+
+bool Verifier::fail(const unsigned int offset, const std::string &reason) {
+  this->message = "Invalid bytecode at offset " + std::to_string(offset) + ": " + reason;
+  return false;
+}
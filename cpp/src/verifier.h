@@ -0,0 +1,47 @@
+#ifndef VERIFIER_H
+#define VERIFIER_H
+#include "chunk.h"
+
+#include <string>
+#include <vector>
+
+// Checks a chunk once before it runs, so the VM can decode operands, index constants and globals and use its
+// stack without any bounds checks. Every reachable instruction is visited with the stack depth it runs at,
+// which must be the same along every path that reaches it. Along the way the verifier finds the deepest the
+// stack can get.
+//
+// Function bodies share the chunk with the script. Each is entered from the OP_CLOSURE that makes it, with
+// the callee and its arguments as the frame's first slots, and every instruction belongs to exactly one
+// function (or the script), whose upvalues it may read. Depths count from the base of the frame the
+// instruction runs in, so the deepest depth bounds every frame.
+class Verifier {
+public:
+  explicit Verifier(const Chunk &chunk);
+  bool verify();
+
+  const std::string &error() const;
+  unsigned int maxStackDepth() const;
+  // Stack depth on entry to the instruction at `offset`, or -1 if it is unreachable or not an instruction.
+  long depthAt(unsigned int offset) const;
+  bool isJumpTarget(unsigned int offset) const;
+  // Constant index of the function the instruction at `offset` belongs to, or -1 for the script.
+  long ownerAt(unsigned int offset) const;
+
+private:
+  const Chunk &chunk;
+  // Stack depth on entry to the instruction at each offset, or -1 if no path has reached it yet.
+  std::vector<long> depths;
+  std::vector<bool> jumpTargets;
+  // Constant index of the function each reachable instruction belongs to, or -1 for the script.
+  std::vector<long> owners;
+  std::vector<unsigned int> worklist;
+  unsigned int maxDepth = 0;
+  std::string message;
+
+  bool verifyInstruction(unsigned int offset);
+  bool reach(unsigned int from, size_t target, long depth, long owner);
+  uint32_t upvalueCount(long owner) const;
+  bool fail(unsigned int offset, const std::string &reason);
+};
+
+#endif // VERIFIER_H
@@ -1,102 +1,1809 @@
 #include "vm.h"
+#include "verifier.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <iostream>
+#include <utility>
 
-VM::VM(const Chunk &chunk)
-    : chunk(chunk)
-#ifdef DEBUG_TRACE_EXECUTION
-      ,
-      debug(chunk)
-#endif
-{
-  this->stack.reserve(STACK_MAX);
+// Where a fiber's call returns to: the end of the fiber (see finishTask()).
+static const uint8_t fiberExit[] = {OP_RETURN};
+
+VM::VM(std::shared_ptr<const Module> module, Heap &heap, const StackLimits &stackLimits)
+    : module(std::move(module)), chunk(this->module->chunk()), heap(heap), stackLimits(stackLimits),
+      stack(stackLimits), out(&std::cout), errors(&std::cerr) {
+  this->caches.assign(this->chunk.cacheCount, InlineCache());
+  this->globals.assign(this->chunk.globalNames.size(), UNDEFINED_VAL);
+  // Globals named after a native function start out bound to it; scripts may still redefine them.
+  for (size_t slot = 0; slot < this->chunk.globalNames.size(); slot++) {
+    const ObjString *name = asString(this->chunk.globalNames[slot]);
+    for (uint32_t i = 0; i < globalFunctionCount; i++) {
+      if (std::strcmp(name->chars(), globalFunctions[i].name) != 0) continue;
+      ObjNative *native = this->heap.allocateNative(i);
+      if (native != nullptr) this->globals[slot] = objValue(native);
+    }
+  }
+  this->arrayMethodTable.init();
+  this->defineNativeMethods(this->arrayMethodTable, arrayMethods, arrayMethodCount);
+  this->stringMethodTable.init();
+  this->defineNativeMethods(this->stringMethodTable, stringMethods, stringMethodCount);
+  this->heap.setRoots(this);
 }
 
-InterpretResult VM::interpret() {
-#ifdef DEBUG_TRACE_EXECUTION
-  std::cout << "== VM ==" << std::endl;
-#endif
-  // Compiler
+VM::~VM() {
+  this->heap.setRoots(nullptr);
+  this->arrayMethodTable.free();
+  this->stringMethodTable.free();
+}
+
+Heap &VM::getHeap() { return this->heap; }
 
-  // Free chunk
-  return this->run();
+void VM::defineNativeMethods(Table &table, const NativeMethodEntry *methods, const size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    const ObjString *name = this->heap.intern(methods[i].name, std::strlen(methods[i].name));
+    table.set(objValue(name), numberValue(static_cast<double>(i)));
+  }
+}
+
+void VM::visitRoots(Heap &heap) {
+  this->stack.visit(heap);
+  for (Value *slot = this->stack.top; slot < this->registersEnd; slot++) heap.visit(*slot);
+  for (Value &value : this->globals) heap.visit(value);
+  if (this->scheduler != nullptr) this->scheduler->visit(heap);
+  // The module's constants and global names live in its frozen heap, which no collection touches.
+  this->shapes.visit(heap);
+  // Method names are interned old-space strings that never move; they only need to stay marked.
+  for (Entry *entry = this->arrayMethodTable.begin(); entry != this->arrayMethodTable.end(); entry++) {
+    heap.visit(entry->key);
+  }
+  for (Entry *entry = this->stringMethodTable.begin(); entry != this->stringMethodTable.end(); entry++) {
+    heap.visit(entry->key);
+  }
 }
 
-InterpretResult VM::run() {
+// `print` leaves flushing to the stream's buffer, so whatever a run printed is flushed once it returns, as
+// well as before the run reports an error or waits for input.
+InterpretResult VM::interpret(const Engine engine) {
+  const InterpretResult result = this->start(engine);
+  this->out->flush();
+  return result;
+}
+
+InterpretResult VM::start(const Engine engine) {
+  // Everything run() skips checking is checked here, once.
+  Verifier verifier(this->chunk);
+  if (!verifier.verify()) {
+    *this->errors << verifier.error() << std::endl;
+    return INTERPRET_COMPILE_ERROR;
+  }
+
+  this->code = this->chunk.code();
+  this->constants = this->chunk.constants.data();
+  this->ip = this->code;
+
+  // A chunk whose frame does not fit the 16-bit register operands runs on the stack engine instead.
+  RegisterCompiler lowering(this->chunk, verifier);
+  if (engine == ENGINE_REGISTER && lowering.compile(this->registers)) {
+    if (!this->stack.enter(this->registers.frameSize)) {
+      this->runtimeError("Stack overflow.");
+      return INTERPRET_RUNTIME_ERROR;
+    }
+    this->slots = this->stack.top;
+
+    // The constants are registers too, below the stack slots, so operands never have to tell them apart.
+    const size_t constantCount = this->chunk.constants.size();
+    std::copy(this->constants, this->constants + constantCount, this->slots);
+    this->slots[constantCount] = NULL_VAL;
+    this->slots[constantCount + 1] = TRUE_VAL;
+    this->slots[constantCount + 2] = FALSE_VAL;
+    // Every register is a root for as long as the engine runs, so none may hold garbage. That keeps the
+    // values of dead slots alive a little longer, but the lowering never has to spill for the collector.
+    this->registersEnd = this->slots + this->registers.frameSize;
+    std::fill(this->slots + this->registers.firstSlot, this->registersEnd, NULL_VAL);
+    this->stack.top = this->slots + this->registers.firstSlot;
+
+    InterpretResult result;
+    if (this->isInstrumented()) {
+      if (this->traceSink != nullptr) this->traceSink->start(this->chunk, &this->registers);
+      this->nextTrace = 1;
+      this->scheduleHook(0);
+      result = this->runRegisters<true>();
+    } else {
+      result = this->runRegisters<false>();
+    }
+    this->registersEnd = nullptr;
+    return result;
+  }
+
+  // Set up the frame of the script. Only entering a frame can overflow the stack.
+  this->frameSize = verifier.maxStackDepth();
+  if (!this->stack.enter(this->frameSize)) {
+    this->runtimeError("Stack overflow.");
+    return INTERPRET_RUNTIME_ERROR;
+  }
+  this->slots = this->stack.top;
+
+  if (!this->isInstrumented()) return this->run<false>();
+  if (this->traceSink != nullptr) this->traceSink->start(this->chunk, nullptr);
+  this->nextTrace = 1;
+  this->scheduleHook(0);
+  return this->run<true>();
+}
+
+// With GCC and Clang every handler ends in its own indirect jump through a table of label addresses, which
+// branch predictors handle far better than the single shared jump of a switch. Define TRIPLES_SWITCH_DISPATCH
+// to build the portable switch loop instead.
+#if defined(__GNUC__) && !defined(TRIPLES_SWITCH_DISPATCH)
+#define TRIPLES_COMPUTED_GOTO
+#endif
+
+template <bool instrumented> InterpretResult VM::run() {
+  // The instruction pointer and the stack top live in locals, and so in registers, while instructions run.
+  // They are written back before anything else can look at them (helpers, natives, errors, tracing) and
+  // reloaded afterwards, as a helper may push or pop.
+  const uint8_t *ip = this->ip;
+  Value *top = this->stack.top;
+
+#define SAVE_STATE() (this->ip = ip, this->stack.top = top)
+#define LOAD_STATE() (ip = this->ip, top = this->stack.top)
+// Operands are decoded without bounds checks; the verifier has already made sure they are in range.
+#define READ_BYTE() (*ip++)
+#define READ_SHORT() (ip += 2, static_cast<uint16_t>(ip[-2] | ip[-1] << 8))
+#define READ_LONG() (ip += 3, static_cast<uint32_t>(ip[-3] | ip[-2] << 8 | ip[-1] << 16))
+#define READ_CONSTANT() (this->constants[READ_BYTE()])
+#define READ_CONSTANT_LONG() (this->constants[READ_LONG()])
+#define PUSH(value) (*top++ = (value))
+#define POP() (*--top)
+#define PEEK(distance) (top[-1 - (distance)])
+#define CALL(helper)                                                                                         \
+  do {                                                                                                       \
+    SAVE_STATE();                                                                                            \
+    const bool succeeded = (helper);                                                                         \
+    LOAD_STATE();                                                                                            \
+    if (!succeeded) return INTERPRET_RUNTIME_ERROR;                                                          \
+  } while (false)
+#define RUNTIME_ERROR(message)                                                                               \
+  do {                                                                                                       \
+    SAVE_STATE();                                                                                            \
+    this->runtimeError(message);                                                                             \
+    return INTERPRET_RUNTIME_ERROR;                                                                          \
+  } while (false)
+#define BINARY_OP(valueType, op)                                                                             \
+  do {                                                                                                       \
+    if (!isNumber(PEEK(0)) || !isNumber(PEEK(1))) RUNTIME_ERROR("Operands must be numbers.");                \
+    const double b = asNumber(POP());                                                                        \
+    const double a = asNumber(PEEK(0));                                                                      \
+    top[-1] = valueType(a op b);                                                                             \
+  } while (false)
+
+// The constant operand of the `_CONST` superinstructions is verified to be a number.
+#define CONSTANT_OP(valueType, op)                                                                           \
+  do {                                                                                                       \
+    const double b = asNumber(READ_CONSTANT());                                                              \
+    if (!isNumber(PEEK(0))) RUNTIME_ERROR("Operands must be numbers.");                                      \
+    top[-1] = valueType(asNumber(PEEK(0)) op b);                                                             \
+  } while (false)
+
+// Property accesses on a map whose shape the site's inline cache knows go straight to the property's entry.
+// Everything else, including stores that add a property, goes through the helper, which fills the cache.
+#define GET_PROPERTY(name)                                                                                   \
+  do {                                                                                                       \
+    InlineCache &cache = this->caches[READ_LONG()];                                                          \
+    const CacheEntry *hit = isMap(PEEK(0)) ? cache.find(asMap(PEEK(0))->shape) : nullptr;                    \
+    if (hit != nullptr) {                                                                                    \
+      top[-1] = asMap(PEEK(0))->table.entries[hit->index].value;                                             \
+    } else {                                                                                                 \
+      CALL(this->getProperty(name, cache));                                                                  \
+    }                                                                                                        \
+  } while (false)
+#define SET_PROPERTY(name)                                                                                   \
+  do {                                                                                                       \
+    InlineCache &cache = this->caches[READ_LONG()];                                                          \
+    const CacheEntry *hit = isMap(PEEK(1)) ? cache.find(asMap(PEEK(1))->shape) : nullptr;                    \
+    if (hit != nullptr && hit->transition == hit->key) {                                                     \
+      ObjMap *map = asMap(PEEK(1));                                                                          \
+      const Value value = POP();                                                                             \
+      map->table.entries[hit->index].value = value;                                                          \
+      this->heap.writeBarrier(map, value);                                                                   \
+      top[-1] = value;                                                                                       \
+    } else {                                                                                                 \
+      CALL(this->setProperty(name, cache));                                                                  \
+    }                                                                                                        \
+  } while (false)
+
+// `instrumented` is a constant, so the plain instantiation compiles this to nothing.
+#define INSTRUMENT()                                                                                         \
+  do {                                                                                                       \
+    if (instrumented && --this->countdown == 0) {                                                            \
+      SAVE_STATE();                                                                                          \
+      if (!this->instrument(0)) return INTERPRET_RUNTIME_ERROR;                                              \
+    }                                                                                                        \
+  } while (false)
+
+#ifdef TRIPLES_COMPUTED_GOTO
+  // One entry per opcode, in OpCode order.
+  static const void *const dispatchTable[] = {
+      &&TARGET_OP_CONSTANT,        &&TARGET_OP_CONSTANT_LONG,   &&TARGET_OP_NULL,
+      &&TARGET_OP_TRUE,            &&TARGET_OP_FALSE,           &&TARGET_OP_POP,
+      &&TARGET_OP_GET_LOCAL,       &&TARGET_OP_SET_LOCAL,       &&TARGET_OP_GET_GLOBAL,
+      &&TARGET_OP_GET_GLOBAL_LONG, &&TARGET_OP_DEFINE_GLOBAL,   &&TARGET_OP_DEFINE_GLOBAL_LONG,
+      &&TARGET_OP_SET_GLOBAL,      &&TARGET_OP_SET_GLOBAL_LONG, &&TARGET_OP_MAP,
+      &&TARGET_OP_MAP_LONG,        &&TARGET_OP_ARRAY,           &&TARGET_OP_ARRAY_LONG,
+      &&TARGET_OP_GET_INDEX,       &&TARGET_OP_SET_INDEX,       &&TARGET_OP_SLICE,
+      &&TARGET_OP_EQUAL,           &&TARGET_OP_GREATER,         &&TARGET_OP_LESS,
+      &&TARGET_OP_ADD,             &&TARGET_OP_SUBTRACT,        &&TARGET_OP_MULTIPLY,
+      &&TARGET_OP_DIVIDE,          &&TARGET_OP_NOT,             &&TARGET_OP_NEGATE,
+      &&TARGET_OP_INVOKE,          &&TARGET_OP_INVOKE_LONG,     &&TARGET_OP_GET_PROPERTY,
+      &&TARGET_OP_GET_PROPERTY_LONG, &&TARGET_OP_SET_PROPERTY,  &&TARGET_OP_SET_PROPERTY_LONG,
+      &&TARGET_OP_PRINT,           &&TARGET_OP_JUMP,            &&TARGET_OP_JUMP_IF_FALSE,
+      &&TARGET_OP_LOOP,            &&TARGET_OP_ADD_CONST,       &&TARGET_OP_SUBTRACT_CONST,
+      &&TARGET_OP_MULTIPLY_CONST,  &&TARGET_OP_DIVIDE_CONST,    &&TARGET_OP_LESS_CONST,
+      &&TARGET_OP_GREATER_CONST,   &&TARGET_OP_SET_LOCAL_POP,   &&TARGET_OP_CLOSURE,
+      &&TARGET_OP_CLOSURE_LONG,    &&TARGET_OP_GET_UPVALUE,     &&TARGET_OP_GET_BOXED_LOCAL,
+      &&TARGET_OP_SET_BOXED_LOCAL, &&TARGET_OP_SET_BOXED_LOCAL_POP, &&TARGET_OP_GET_BOXED_UPVALUE,
+      &&TARGET_OP_SET_BOXED_UPVALUE, &&TARGET_OP_CALL,          &&TARGET_OP_TAIL_CALL,
+      &&TARGET_OP_SPAWN,           &&TARGET_OP_AWAIT,           &&TARGET_OP_RETURN_VALUE,
+      &&TARGET_OP_RETURN,
+  };
+  static_assert(sizeof(dispatchTable) / sizeof(dispatchTable[0]) == OP_RETURN + 1,
+                "dispatchTable must list every opcode");
+
+#define INSTRUCTION(op) TARGET_##op
+#define DISPATCH()                                                                                           \
+  do {                                                                                                       \
+    INSTRUMENT();                                                                                            \
+    goto *dispatchTable[READ_BYTE()];                                                                        \
+  } while (false)
+
+  DISPATCH();
+#else
+#define INSTRUCTION(op) case op
+#define DISPATCH() continue
+
   for (;;) {
-#ifdef DEBUG_TRACE_EXECUTION
-    if (this->stack.size() > 0) {
-      std::cout << "\t\t";
-      for (const Value &value : this->stack) {
-        std::cout << "[ ";
-        printValue(value);
-        std::cout << " ]";
+    INSTRUMENT();
+    switch (READ_BYTE()) {
+#endif
+  INSTRUCTION(OP_CONSTANT) : {
+    PUSH(READ_CONSTANT());
+    DISPATCH();
+  }
+  INSTRUCTION(OP_CONSTANT_LONG) : {
+    PUSH(READ_CONSTANT_LONG());
+    DISPATCH();
+  }
+  INSTRUCTION(OP_NULL) : {
+    PUSH(NULL_VAL);
+    DISPATCH();
+  }
+  INSTRUCTION(OP_TRUE) : {
+    PUSH(TRUE_VAL);
+    DISPATCH();
+  }
+  INSTRUCTION(OP_FALSE) : {
+    PUSH(FALSE_VAL);
+    DISPATCH();
+  }
+  INSTRUCTION(OP_POP) : {
+    top--;
+    DISPATCH();
+  }
+  INSTRUCTION(OP_GET_LOCAL) : {
+    const uint8_t slot = READ_BYTE();
+    PUSH(this->slots[slot]);
+    DISPATCH();
+  }
+  INSTRUCTION(OP_SET_LOCAL) : {
+    const uint8_t slot = READ_BYTE();
+    this->slots[slot] = PEEK(0);
+    DISPATCH();
+  }
+  INSTRUCTION(OP_GET_GLOBAL) : {
+    const uint32_t slot = READ_BYTE();
+    CALL(this->getGlobal(slot));
+    DISPATCH();
+  }
+  INSTRUCTION(OP_GET_GLOBAL_LONG) : {
+    const uint32_t slot = READ_LONG();
+    CALL(this->getGlobal(slot));
+    DISPATCH();
+  }
+  INSTRUCTION(OP_DEFINE_GLOBAL) : {
+    const uint32_t slot = READ_BYTE();
+    this->globals[slot] = POP();
+    DISPATCH();
+  }
+  INSTRUCTION(OP_DEFINE_GLOBAL_LONG) : {
+    const uint32_t slot = READ_LONG();
+    this->globals[slot] = POP();
+    DISPATCH();
+  }
+  INSTRUCTION(OP_SET_GLOBAL) : {
+    const uint32_t slot = READ_BYTE();
+    CALL(this->setGlobal(slot));
+    DISPATCH();
+  }
+  INSTRUCTION(OP_SET_GLOBAL_LONG) : {
+    const uint32_t slot = READ_LONG();
+    CALL(this->setGlobal(slot));
+    DISPATCH();
+  }
+  INSTRUCTION(OP_MAP) : {
+    const uint32_t count = READ_BYTE();
+    CALL(this->buildMap(count));
+    DISPATCH();
+  }
+  INSTRUCTION(OP_MAP_LONG) : {
+    const uint32_t count = READ_LONG();
+    CALL(this->buildMap(count));
+    DISPATCH();
+  }
+  INSTRUCTION(OP_ARRAY) : {
+    const uint32_t count = READ_BYTE();
+    CALL(this->buildArray(count));
+    DISPATCH();
+  }
+  INSTRUCTION(OP_ARRAY_LONG) : {
+    const uint32_t count = READ_LONG();
+    CALL(this->buildArray(count));
+    DISPATCH();
+  }
+  INSTRUCTION(OP_GET_INDEX) : {
+    CALL(this->getIndex());
+    DISPATCH();
+  }
+  INSTRUCTION(OP_SET_INDEX) : {
+    CALL(this->setIndex());
+    DISPATCH();
+  }
+  INSTRUCTION(OP_SLICE) : {
+    CALL(this->slice());
+    DISPATCH();
+  }
+  INSTRUCTION(OP_EQUAL) : {
+    const Value b = POP();
+    top[-1] = boolValue(valuesEqual(PEEK(0), b));
+    DISPATCH();
+  }
+  INSTRUCTION(OP_GREATER) : {
+    BINARY_OP(boolValue, >);
+    DISPATCH();
+  }
+  INSTRUCTION(OP_LESS) : {
+    BINARY_OP(boolValue, <);
+    DISPATCH();
+  }
+  INSTRUCTION(OP_ADD) : {
+    if (isString(PEEK(0)) && isString(PEEK(1))) {
+      CALL(this->concatenate());
+      DISPATCH();
+    }
+    BINARY_OP(numberValue, +);
+    DISPATCH();
+  }
+  INSTRUCTION(OP_SUBTRACT) : {
+    BINARY_OP(numberValue, -);
+    DISPATCH();
+  }
+  INSTRUCTION(OP_MULTIPLY) : {
+    BINARY_OP(numberValue, *);
+    DISPATCH();
+  }
+  INSTRUCTION(OP_DIVIDE) : {
+    BINARY_OP(numberValue, /);
+    DISPATCH();
+  }
+  INSTRUCTION(OP_NOT) : {
+    top[-1] = boolValue(isFalsey(PEEK(0)));
+    DISPATCH();
+  }
+  INSTRUCTION(OP_NEGATE) : {
+    if (!isNumber(PEEK(0))) RUNTIME_ERROR("Operand must be a number.");
+    top[-1] = numberValue(-asNumber(PEEK(0)));
+    DISPATCH();
+  }
+  INSTRUCTION(OP_INVOKE) : {
+    const Value name = READ_CONSTANT();
+    const int argCount = READ_BYTE();
+    InlineCache &cache = this->caches[READ_LONG()];
+    CALL(this->invoke(name, argCount, cache));
+    DISPATCH();
+  }
+  INSTRUCTION(OP_INVOKE_LONG) : {
+    const Value name = READ_CONSTANT_LONG();
+    const int argCount = READ_BYTE();
+    InlineCache &cache = this->caches[READ_LONG()];
+    CALL(this->invoke(name, argCount, cache));
+    DISPATCH();
+  }
+  INSTRUCTION(OP_GET_PROPERTY) : {
+    const Value name = READ_CONSTANT();
+    GET_PROPERTY(name);
+    DISPATCH();
+  }
+  INSTRUCTION(OP_GET_PROPERTY_LONG) : {
+    const Value name = READ_CONSTANT_LONG();
+    GET_PROPERTY(name);
+    DISPATCH();
+  }
+  INSTRUCTION(OP_SET_PROPERTY) : {
+    const Value name = READ_CONSTANT();
+    SET_PROPERTY(name);
+    DISPATCH();
+  }
+  INSTRUCTION(OP_SET_PROPERTY_LONG) : {
+    const Value name = READ_CONSTANT_LONG();
+    SET_PROPERTY(name);
+    DISPATCH();
+  }
+  INSTRUCTION(OP_PRINT) : {
+    printValue(POP(), *this->out);
+    *this->out << '\n';
+    DISPATCH();
+  }
+  INSTRUCTION(OP_JUMP) : {
+    const uint16_t offset = READ_SHORT();
+    ip += offset;
+    DISPATCH();
+  }
+  INSTRUCTION(OP_JUMP_IF_FALSE) : {
+    const uint16_t offset = READ_SHORT();
+    if (isFalsey(PEEK(0))) ip += offset;
+    DISPATCH();
+  }
+  INSTRUCTION(OP_LOOP) : {
+    const uint16_t offset = READ_SHORT();
+    ip -= offset;
+#ifdef TRIPLES_JIT
+    // Once a loop is hot the rest of the script runs as machine code, entered at the loop header.
+    if (!instrumented && this->jitEnabled && ++this->backEdges >= JIT_HOT_LOOP) {
+      SAVE_STATE();
+      if (this->compileJit()) return this->runJit();
+    }
+#endif
+    DISPATCH();
+  }
+  INSTRUCTION(OP_ADD_CONST) : {
+    CONSTANT_OP(numberValue, +);
+    DISPATCH();
+  }
+  INSTRUCTION(OP_SUBTRACT_CONST) : {
+    CONSTANT_OP(numberValue, -);
+    DISPATCH();
+  }
+  INSTRUCTION(OP_MULTIPLY_CONST) : {
+    CONSTANT_OP(numberValue, *);
+    DISPATCH();
+  }
+  INSTRUCTION(OP_DIVIDE_CONST) : {
+    CONSTANT_OP(numberValue, /);
+    DISPATCH();
+  }
+  INSTRUCTION(OP_LESS_CONST) : {
+    CONSTANT_OP(boolValue, <);
+    DISPATCH();
+  }
+  INSTRUCTION(OP_GREATER_CONST) : {
+    CONSTANT_OP(boolValue, >);
+    DISPATCH();
+  }
+  INSTRUCTION(OP_SET_LOCAL_POP) : {
+    const uint8_t slot = READ_BYTE();
+    this->slots[slot] = POP();
+    DISPATCH();
+  }
+  INSTRUCTION(OP_CLOSURE) : {
+    ObjFunction *function = asFunction(READ_CONSTANT());
+    CALL(this->makeClosure(function));
+    DISPATCH();
+  }
+  INSTRUCTION(OP_CLOSURE_LONG) : {
+    ObjFunction *function = asFunction(READ_CONSTANT_LONG());
+    CALL(this->makeClosure(function));
+    DISPATCH();
+  }
+  INSTRUCTION(OP_GET_UPVALUE) : {
+    const uint8_t index = READ_BYTE();
+    PUSH(asClosure(this->slots[0])->upvalues()[index]);
+    DISPATCH();
+  }
+  INSTRUCTION(OP_GET_BOXED_LOCAL) : {
+    const Value value = this->slots[READ_BYTE()];
+    PUSH(isBox(value) ? asBox(value)->value : value);
+    DISPATCH();
+  }
+  INSTRUCTION(OP_SET_BOXED_LOCAL) : {
+    const uint8_t slot = READ_BYTE();
+    this->storeBoxed(this->slots[slot], nullptr, PEEK(0));
+    DISPATCH();
+  }
+  INSTRUCTION(OP_SET_BOXED_LOCAL_POP) : {
+    const uint8_t slot = READ_BYTE();
+    this->storeBoxed(this->slots[slot], nullptr, POP());
+    DISPATCH();
+  }
+  INSTRUCTION(OP_GET_BOXED_UPVALUE) : {
+    const Value value = asClosure(this->slots[0])->upvalues()[READ_BYTE()];
+    PUSH(isBox(value) ? asBox(value)->value : value);
+    DISPATCH();
+  }
+  INSTRUCTION(OP_SET_BOXED_UPVALUE) : {
+    ObjClosure *closure = asClosure(this->slots[0]);
+    this->storeBoxed(closure->upvalues()[READ_BYTE()], closure, PEEK(0));
+    DISPATCH();
+  }
+  INSTRUCTION(OP_CALL) : {
+    const int argCount = READ_BYTE();
+    CALL(this->call(argCount));
+    DISPATCH();
+  }
+  INSTRUCTION(OP_TAIL_CALL) : {
+    const int argCount = READ_BYTE();
+    CALL(this->tailCall(argCount));
+    DISPATCH();
+  }
+  INSTRUCTION(OP_SPAWN) : {
+    const int argCount = READ_BYTE();
+    CALL(this->spawn(argCount));
+    DISPATCH();
+  }
+  INSTRUCTION(OP_AWAIT) : {
+    SAVE_STATE();
+    InterpretResult outcome;
+    if (!this->await(&outcome)) return outcome;
+    LOAD_STATE();
+    DISPATCH();
+  }
+  INSTRUCTION(OP_RETURN_VALUE) : {
+    const Value result = POP();
+    const CallFrame &caller = this->frames.back();
+    this->stack.leave(this->slots);
+    top = this->stack.top;
+    PUSH(result);
+    ip = caller.ip;
+    this->slots = caller.slots;
+    this->frames.pop_back();
+    DISPATCH();
+  }
+  INSTRUCTION(OP_RETURN) : {
+    SAVE_STATE();
+    // Without fibers this ends the script. With them it ends the running task, and the run goes on with the
+    // tasks that are left.
+    InterpretResult outcome = INTERPRET_OK;
+    if (this->scheduler == nullptr || !this->finishTask(&outcome)) return outcome;
+    LOAD_STATE();
+    DISPATCH();
+  }
+#ifndef TRIPLES_COMPUTED_GOTO
+    }
+  }
+#endif
+
+#undef SAVE_STATE
+#undef LOAD_STATE
+#undef READ_BYTE
+#undef READ_SHORT
+#undef READ_LONG
+#undef READ_CONSTANT
+#undef READ_CONSTANT_LONG
+#undef PUSH
+#undef POP
+#undef PEEK
+#undef CALL
+#undef RUNTIME_ERROR
+#undef BINARY_OP
+#undef CONSTANT_OP
+#undef GET_PROPERTY
+#undef SET_PROPERTY
+#undef INSTRUMENT
+#undef INSTRUCTION
+#undef DISPATCH
+}
+
+bool VM::isInstrumented() const { return this->traceSink != nullptr || this->instructionLimit != 0; }
+
+// Arms the countdown for the first hook due after instruction number `current`.
+void VM::scheduleHook(const uint64_t current) {
+  uint64_t next = UINT64_MAX;
+  if (this->traceSink != nullptr) next = this->nextTrace;
+  if (this->instructionLimit != 0) next = std::min(next, this->instructionLimit + 1);
+  this->hookAt = next;
+  this->countdown = next - current;
+}
+
+// Called by the instrumented engines before instruction number `hookAt` runs: instruction `pc` of the
+// register code while the register engine runs, the one at ip otherwise. Returns false once it has stopped
+// the run.
+bool VM::instrument(const size_t pc) {
+  const bool registerEngine = this->registersEnd != nullptr;
+  const uint64_t current = this->hookAt;
+  if (this->instructionLimit != 0 && current > this->instructionLimit) {
+    // Report the line of the instruction that was not run.
+    if (registerEngine) this->ip = this->code + this->registers.origins[pc].offset;
+    this->ip++;
+    this->runtimeError("Instruction limit exceeded.");
+    return false;
+  }
+
+  if (this->traceSink != nullptr && current == this->nextTrace) {
+    if (registerEngine) {
+      this->traceSink->registerInstruction(this->chunk, this->registers, pc);
+    } else if (this->ip != fiberExit) {
+      // The end of a fiber lies outside the chunk and is not traced.
+      const unsigned int offset = static_cast<unsigned int>(this->ip - this->code);
+      this->traceSink->instruction(this->chunk, offset, this->stack.base(), this->stack.top, this->frames);
+    }
+    this->nextTrace += this->traceEvery;
+  }
+  this->scheduleHook(current);
+  return true;
+}
+
+void VM::enableJit(const bool enabled) { this->jitEnabled = enabled; }
+
+void VM::setTrace(TraceSink *sink, const uint32_t every) {
+  this->traceSink = sink;
+  this->traceEvery = every > 0 ? every : 1;
+}
+
+void VM::setInstructionLimit(const uint64_t limit) { this->instructionLimit = limit; }
+
+void VM::setOutput(std::ostream &out, std::ostream &errors) {
+  this->out = &out;
+  this->errors = &errors;
+}
+
+#ifdef TRIPLES_JIT
+// The script is compiled at most once: whether or not that works, run() stops counting back edges.
+bool VM::compileJit() {
+  this->jitEnabled = false;
+  Verifier verifier(this->chunk);
+  return verifier.verify() &&
+         this->jit.compile(this->chunk, verifier, this->globals.data(), this->caches.data(), jitSlowPath);
+}
+
+InterpretResult VM::runJit() {
+  JitFrame frame = {this->stack.top, this->slots, this->constants, this};
+  if (!this->jit.run(frame, static_cast<unsigned int>(this->ip - this->code))) return INTERPRET_RUNTIME_ERROR;
+
+  this->stack.top = frame.top;
+  return INTERPRET_OK;
+}
+
+// Runs one instruction for compiled code with the same helpers and checks as run(). Templates call this for
+// instructions they have no machine code for and when their fast path's type checks fail, so arithmetic only
+// gets here with operands that are not both numbers.
+bool VM::jitSlowPath(JitFrame *frame, const uint32_t offset) {
+  VM *vm = frame->vm;
+  vm->stack.top = frame->top;
+  // Errors are reported against the line of the byte before ip.
+  vm->ip = vm->code + offset + 1;
+
+  const Chunk &chunk = vm->chunk;
+  const uint8_t instruction = vm->code[offset];
+  const bool isLong = instruction == OP_GET_GLOBAL_LONG || instruction == OP_SET_GLOBAL_LONG ||
+                      instruction == OP_MAP_LONG || instruction == OP_ARRAY_LONG ||
+                      instruction == OP_INVOKE_LONG || instruction == OP_GET_PROPERTY_LONG ||
+                      instruction == OP_SET_PROPERTY_LONG;
+  const uint32_t operand = isLong ? chunk.readLong(offset + 1) : vm->code[offset + 1];
+  // Property accesses and method calls end in their cache index.
+  const unsigned int cacheOffset = offset + (isLong ? 4 : 2);
+
+  bool succeeded = true;
+  switch (instruction) {
+    case OP_GET_GLOBAL:
+    case OP_GET_GLOBAL_LONG:
+      succeeded = vm->getGlobal(operand);
+      break;
+    case OP_SET_GLOBAL:
+    case OP_SET_GLOBAL_LONG:
+      succeeded = vm->setGlobal(operand);
+      break;
+    case OP_MAP:
+    case OP_MAP_LONG:
+      succeeded = vm->buildMap(operand);
+      break;
+    case OP_ARRAY:
+    case OP_ARRAY_LONG:
+      succeeded = vm->buildArray(operand);
+      break;
+    case OP_GET_INDEX:
+      succeeded = vm->getIndex();
+      break;
+    case OP_SET_INDEX:
+      succeeded = vm->setIndex();
+      break;
+    case OP_SLICE:
+      succeeded = vm->slice();
+      break;
+    case OP_EQUAL: {
+      const Value b = vm->pop();
+      vm->stack.top[-1] = boolValue(valuesEqual(vm->peek(0), b));
+      break;
+    }
+    case OP_ADD:
+      if (isString(vm->peek(0)) && isString(vm->peek(1))) {
+        succeeded = vm->concatenate();
+        break;
+      }
+      vm->runtimeError("Operands must be numbers.");
+      succeeded = false;
+      break;
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+    case OP_GREATER:
+    case OP_LESS:
+    case OP_ADD_CONST:
+    case OP_SUBTRACT_CONST:
+    case OP_MULTIPLY_CONST:
+    case OP_DIVIDE_CONST:
+    case OP_LESS_CONST:
+    case OP_GREATER_CONST:
+      vm->runtimeError("Operands must be numbers.");
+      succeeded = false;
+      break;
+    case OP_NEGATE:
+      vm->runtimeError("Operand must be a number.");
+      succeeded = false;
+      break;
+    case OP_INVOKE:
+    case OP_INVOKE_LONG:
+      succeeded = vm->invoke(vm->constants[operand], vm->code[cacheOffset],
+                             vm->caches[chunk.readLong(cacheOffset + 1)]);
+      break;
+    case OP_GET_PROPERTY:
+    case OP_GET_PROPERTY_LONG: {
+      InlineCache &cache = vm->caches[chunk.readLong(cacheOffset)];
+      const Value receiver = vm->peek(0);
+      const CacheEntry *hit = isMap(receiver) ? cache.find(asMap(receiver)->shape) : nullptr;
+      if (hit != nullptr) {
+        vm->stack.top[-1] = asMap(receiver)->table.entries[hit->index].value;
+      } else {
+        succeeded = vm->getProperty(vm->constants[operand], cache);
+      }
+      break;
+    }
+    case OP_SET_PROPERTY:
+    case OP_SET_PROPERTY_LONG: {
+      InlineCache &cache = vm->caches[chunk.readLong(cacheOffset)];
+      const Value receiver = vm->peek(1);
+      const CacheEntry *hit = isMap(receiver) ? cache.find(asMap(receiver)->shape) : nullptr;
+      if (hit != nullptr && hit->transition == hit->key) {
+        const Value value = vm->pop();
+        asMap(receiver)->table.entries[hit->index].value = value;
+        vm->heap.writeBarrier(asMap(receiver), value);
+        vm->stack.top[-1] = value;
+      } else {
+        succeeded = vm->setProperty(vm->constants[operand], cache);
       }
-      std::cout << std::endl;
+      break;
+    }
+    case OP_PRINT:
+      printValue(vm->pop(), *vm->out);
+      *vm->out << '\n';
+      break;
+    default:
+      vm->runtimeError("Compiled code cannot run this instruction.");
+      succeeded = false;
+      break;
+  }
+
+  frame->top = vm->stack.top;
+  return succeeded;
+}
+#endif
+
+template <bool instrumented> InterpretResult VM::runRegisters() {
+  const RegisterInstruction *const code = this->registers.code.data();
+  const RegisterInstruction *pc = code;
+  Value *const registers = this->slots;
+  RegisterInstruction instruction;
+
+// Registers never move while the script runs, so leaving the loop only has to publish where the current
+// instruction came from (for error lines) and where the stack helpers find their operands.
+#define SAVE_STATE()                                                                                         \
+  do {                                                                                                       \
+    const RegisterOrigin &origin = this->registers.origins[static_cast<size_t>(pc - code) - 1];              \
+    this->ip = this->code + origin.offset + 1;                                                               \
+    this->stack.top = registers + this->registers.firstSlot + origin.top;                                    \
+  } while (false)
+#define REGISTER(operand) (registers[instruction.operand])
+#define CALL(helper)                                                                                         \
+  do {                                                                                                       \
+    SAVE_STATE();                                                                                            \
+    if (!(helper)) return INTERPRET_RUNTIME_ERROR;                                                           \
+  } while (false)
+#define RUNTIME_ERROR(message)                                                                               \
+  do {                                                                                                       \
+    SAVE_STATE();                                                                                            \
+    this->runtimeError(message);                                                                             \
+    return INTERPRET_RUNTIME_ERROR;                                                                          \
+  } while (false)
+#define BINARY_OP(valueType, op)                                                                             \
+  do {                                                                                                       \
+    const Value left = REGISTER(b);                                                                          \
+    const Value right = REGISTER(c);                                                                         \
+    if (!isNumber(left) || !isNumber(right)) RUNTIME_ERROR("Operands must be numbers.");                     \
+    REGISTER(a) = valueType(asNumber(left) op asNumber(right));                                              \
+  } while (false)
+
+// The hook leaves the register state alone; it reports an exceeded limit against instruction `pc` itself.
+#define INSTRUMENT()                                                                                         \
+  do {                                                                                                       \
+    if (instrumented && --this->countdown == 0 && !this->instrument(static_cast<size_t>(pc - code))) {       \
+      return INTERPRET_RUNTIME_ERROR;                                                                        \
+    }                                                                                                        \
+  } while (false)
+
+#ifdef TRIPLES_COMPUTED_GOTO
+  // One entry per register opcode, in RegisterOp order.
+  static const void *const dispatchTable[] = {
+      &&TARGET_REG_MOVE,      &&TARGET_REG_GET_GLOBAL, &&TARGET_REG_DEFINE_GLOBAL, &&TARGET_REG_SET_GLOBAL,
+      &&TARGET_REG_MAP,       &&TARGET_REG_ARRAY,      &&TARGET_REG_GET_INDEX,     &&TARGET_REG_SET_INDEX,
+      &&TARGET_REG_SLICE,     &&TARGET_REG_EQUAL,      &&TARGET_REG_GREATER,       &&TARGET_REG_LESS,
+      &&TARGET_REG_ADD,       &&TARGET_REG_SUBTRACT,   &&TARGET_REG_MULTIPLY,      &&TARGET_REG_DIVIDE,
+      &&TARGET_REG_NOT,       &&TARGET_REG_NEGATE,     &&TARGET_REG_INVOKE,        &&TARGET_REG_GET_PROPERTY,
+      &&TARGET_REG_SET_PROPERTY, &&TARGET_REG_PRINT,   &&TARGET_REG_JUMP,          &&TARGET_REG_JUMP_IF_FALSE,
+      &&TARGET_REG_RETURN,
+  };
+  static_assert(sizeof(dispatchTable) / sizeof(dispatchTable[0]) == REG_RETURN + 1,
+                "dispatchTable must list every register opcode");
+
+#define INSTRUCTION(op) TARGET_##op
+#define DISPATCH()                                                                                           \
+  do {                                                                                                       \
+    INSTRUMENT();                                                                                            \
+    instruction = *pc++;                                                                                     \
+    goto *dispatchTable[instruction.op];                                                                     \
+  } while (false)
+
+  DISPATCH();
+#else
+#define INSTRUCTION(op) case op
+#define DISPATCH() continue
+
+  for (;;) {
+    INSTRUMENT();
+    instruction = *pc++;
+    switch (instruction.op) {
+#endif
+  INSTRUCTION(REG_MOVE) : {
+    REGISTER(a) = REGISTER(b);
+    DISPATCH();
+  }
+  INSTRUCTION(REG_GET_GLOBAL) : {
+    const Value value = this->globals[instruction.wide()];
+    if (isUndefined(value)) {
+      SAVE_STATE();
+      this->undefinedVariable(instruction.wide());
+      return INTERPRET_RUNTIME_ERROR;
+    }
+    REGISTER(a) = value;
+    DISPATCH();
+  }
+  INSTRUCTION(REG_DEFINE_GLOBAL) : {
+    this->globals[instruction.wide()] = REGISTER(a);
+    DISPATCH();
+  }
+  INSTRUCTION(REG_SET_GLOBAL) : {
+    if (isUndefined(this->globals[instruction.wide()])) {
+      SAVE_STATE();
+      this->undefinedVariable(instruction.wide());
+      return INTERPRET_RUNTIME_ERROR;
+    }
+    this->globals[instruction.wide()] = REGISTER(a);
+    DISPATCH();
+  }
+  // These run on the stack engine's helpers: the lowering left their operands in consecutive slots ending at
+  // the stack top the origin records, just as the helpers expect, and the result lands in slot A.
+  INSTRUCTION(REG_MAP) : {
+    CALL(this->buildMap(instruction.b));
+    DISPATCH();
+  }
+  INSTRUCTION(REG_ARRAY) : {
+    CALL(this->buildArray(instruction.b));
+    DISPATCH();
+  }
+  INSTRUCTION(REG_SLICE) : {
+    CALL(this->slice());
+    DISPATCH();
+  }
+  // Indexing an array or a map is done in place. Anything else, errors included, copies the operands to the
+  // slots the stack engine would have had them in and runs its helper.
+  INSTRUCTION(REG_GET_INDEX) : {
+    const Value receiver = REGISTER(b);
+    const Value key = REGISTER(c);
+    uint32_t index;
+    if (isArray(receiver) && resolveIndex(key, asArray(receiver)->count, &index)) {
+      REGISTER(a) = asArray(receiver)->values[index];
+      DISPATCH();
+    }
+    if (isMap(receiver) && isHashable(key)) {
+      Value value;
+      REGISTER(a) = asMap(receiver)->table.get(key, &value) ? value : NULL_VAL;
+      DISPATCH();
+    }
+
+    SAVE_STATE();
+    this->stack.top[-2] = receiver;
+    this->stack.top[-1] = key;
+    if (!this->getIndex()) return INTERPRET_RUNTIME_ERROR;
+    REGISTER(a) = this->stack.top[-1];
+    DISPATCH();
+  }
+  INSTRUCTION(REG_SET_INDEX) : {
+    const Value receiver = REGISTER(a);
+    const Value key = REGISTER(b);
+    const Value value = REGISTER(c);
+    uint32_t index;
+    if (isArray(receiver) && resolveIndex(key, asArray(receiver)->count, &index)) {
+      asArray(receiver)->store(index, value);
+      this->heap.writeBarrier(asArray(receiver), value);
+      DISPATCH();
+    }
+
+    SAVE_STATE();
+    this->stack.top[-3] = receiver;
+    this->stack.top[-2] = key;
+    this->stack.top[-1] = value;
+    if (!this->setIndex()) return INTERPRET_RUNTIME_ERROR;
+    DISPATCH();
+  }
+  INSTRUCTION(REG_EQUAL) : {
+    REGISTER(a) = boolValue(valuesEqual(REGISTER(b), REGISTER(c)));
+    DISPATCH();
+  }
+  INSTRUCTION(REG_GREATER) : {
+    BINARY_OP(boolValue, >);
+    DISPATCH();
+  }
+  INSTRUCTION(REG_LESS) : {
+    BINARY_OP(boolValue, <);
+    DISPATCH();
+  }
+  INSTRUCTION(REG_ADD) : {
+    const Value left = REGISTER(b);
+    const Value right = REGISTER(c);
+    if (isNumber(left) && isNumber(right)) {
+      REGISTER(a) = numberValue(asNumber(left) + asNumber(right));
+      DISPATCH();
+    }
+    if (!isString(left) || !isString(right)) RUNTIME_ERROR("Operands must be numbers.");
+
+    // Concatenation allocates, so the operands go to the two stack slots the stack engine would have had them
+    // in, where the collector can see them.
+    SAVE_STATE();
+    this->stack.top[-2] = left;
+    this->stack.top[-1] = right;
+    if (!this->concatenate()) return INTERPRET_RUNTIME_ERROR;
+    REGISTER(a) = this->stack.top[-1];
+    DISPATCH();
+  }
+  INSTRUCTION(REG_SUBTRACT) : {
+    BINARY_OP(numberValue, -);
+    DISPATCH();
+  }
+  INSTRUCTION(REG_MULTIPLY) : {
+    BINARY_OP(numberValue, *);
+    DISPATCH();
+  }
+  INSTRUCTION(REG_DIVIDE) : {
+    BINARY_OP(numberValue, /);
+    DISPATCH();
+  }
+  INSTRUCTION(REG_NOT) : {
+    REGISTER(a) = boolValue(isFalsey(REGISTER(b)));
+    DISPATCH();
+  }
+  INSTRUCTION(REG_NEGATE) : {
+    if (!isNumber(REGISTER(b))) RUNTIME_ERROR("Operand must be a number.");
+    REGISTER(a) = numberValue(-asNumber(REGISTER(b)));
+    DISPATCH();
+  }
+  INSTRUCTION(REG_INVOKE) : {
+    SAVE_STATE();
+    Value name;
+    InlineCache &cache = this->currentSite(&name);
+    if (!this->invoke(REGISTER(b), instruction.c, cache)) return INTERPRET_RUNTIME_ERROR;
+    DISPATCH();
+  }
+  // The cache is checked as in run(); a miss runs the stack engine's helper on copies of the operands.
+  INSTRUCTION(REG_GET_PROPERTY) : {
+    const Value receiver = REGISTER(b);
+    InlineCache &cache = this->caches[instruction.c];
+    const CacheEntry *hit = isMap(receiver) ? cache.find(asMap(receiver)->shape) : nullptr;
+    if (hit != nullptr) {
+      REGISTER(a) = asMap(receiver)->table.entries[hit->index].value;
+      DISPATCH();
+    }
+
+    SAVE_STATE();
+    Value name;
+    this->currentSite(&name);
+    this->stack.top[-1] = receiver;
+    if (!this->getProperty(name, cache)) return INTERPRET_RUNTIME_ERROR;
+    REGISTER(a) = this->stack.top[-1];
+    DISPATCH();
+  }
+  INSTRUCTION(REG_SET_PROPERTY) : {
+    const Value receiver = REGISTER(a);
+    const Value value = REGISTER(b);
+    InlineCache &cache = this->caches[instruction.c];
+    const CacheEntry *hit = isMap(receiver) ? cache.find(asMap(receiver)->shape) : nullptr;
+    if (hit != nullptr && hit->transition == hit->key) {
+      asMap(receiver)->table.entries[hit->index].value = value;
+      this->heap.writeBarrier(asMap(receiver), value);
+      DISPATCH();
+    }
+
+    SAVE_STATE();
+    Value name;
+    this->currentSite(&name);
+    this->stack.top[-2] = receiver;
+    this->stack.top[-1] = value;
+    if (!this->setProperty(name, cache)) return INTERPRET_RUNTIME_ERROR;
+    DISPATCH();
+  }
+  INSTRUCTION(REG_PRINT) : {
+    printValue(REGISTER(a), *this->out);
+    *this->out << '\n';
+    DISPATCH();
+  }
+  INSTRUCTION(REG_JUMP) : {
+    pc = code + instruction.wide();
+    DISPATCH();
+  }
+  INSTRUCTION(REG_JUMP_IF_FALSE) : {
+    if (isFalsey(REGISTER(a))) pc = code + instruction.wide();
+    DISPATCH();
+  }
+  INSTRUCTION(REG_RETURN) : {
+    SAVE_STATE();
+    return INTERPRET_OK;
+  }
+#ifndef TRIPLES_COMPUTED_GOTO
     }
-    this->debug.disassembleInstruction(this->ip);
+  }
 #endif
 
-    switch (this->readByte()) {
-      case OP_CONSTANT:
-        {
-          const Value constant = this->readConstant();
-          stack.push_back(constant);
-          break;
-        }
-      case OP_ADD:
-        {
-          const Value b = this->pop();
-          const Value a = this->pop();
-          this->push(a + b);
-          break;
-        }
-      case OP_SUBTRACT:
-        {
-          const Value b = this->pop();
-          const Value a = this->pop();
-          this->push(a - b);
-          break;
-        }
-      case OP_MULTIPLY:
-        {
-          const Value b = this->pop();
-          const Value a = this->pop();
-          this->push(a * b);
-          break;
-        }
-      case OP_DIVIDE:
-        {
-          const Value b = this->pop();
-          const Value a = this->pop();
-          this->push(a / b);
-          break;
-        }
-      case OP_NEGATE:
-        {
-          this->push(-this->pop());
-          break;
-        }
-      case OP_RETURN:
-        {
-          printValue(this->pop());
-          std::cout << std::endl;
-          return INTERPRET_OK;
-        }
-      default:
-        return INTERPRET_RUNTIME_ERROR;
-    }
-  }
-}
-
-inline unsigned char VM::readByte() { return this->chunk.bytes.at(this->ip++); }
-
-inline Value VM::readConstant() { return this->chunk.constants.at(this->readByte()); }
-
-inline void VM::push(const Value value) { return this->stack.push_back(value); }
-
-inline Value VM::pop() {
-  const Value value = this->stack.back();
-  this->stack.pop_back();
-  return value;
+#undef SAVE_STATE
+#undef REGISTER
+#undef CALL
+#undef RUNTIME_ERROR
+#undef BINARY_OP
+#undef INSTRUMENT
+#undef INSTRUCTION
+#undef DISPATCH
+}
+
+inline void VM::push(const Value value) { *this->stack.top++ = value; }
+
+inline Value VM::pop() { return *--this->stack.top; }
+
+inline Value VM::peek(const int distance) const { return this->stack.top[-1 - distance]; }
+
+bool VM::getGlobal(const uint32_t slot) {
+  const Value value = this->globals[slot];
+  if (isUndefined(value)) {
+    this->undefinedVariable(slot);
+    return false;
+  }
+
+  this->push(value);
+  return true;
+}
+
+bool VM::setGlobal(const uint32_t slot) {
+  if (isUndefined(this->globals[slot])) {
+    this->undefinedVariable(slot);
+    return false;
+  }
+
+  this->globals[slot] = this->peek(0);
+  return true;
+}
+
+void VM::undefinedVariable(const uint32_t slot) {
+  const ObjString *name = asString(this->chunk.globalNames[slot]);
+  this->runtimeError("Undefined variable '" + std::string(name->chars(), name->length) + "'.");
+}
+
+bool VM::buildMap(const uint32_t count) {
+  // The entries stay on the stack while the map is allocated.
+  ObjMap *map = this->heap.allocateMap();
+  if (map == nullptr) {
+    this->runtimeError("Out of memory.");
+    return false;
+  }
+
+  Value *first = this->stack.top - 2 * static_cast<size_t>(count);
+  for (const Value *entry = first; entry < this->stack.top; entry += 2) {
+    if (!isHashable(entry[0])) {
+      this->runtimeError("Map keys must be strings, numbers, booleans or null.");
+      return false;
+    }
+    this->storeInMap(map, entry[0], entry[1]);
+  }
+
+  this->stack.top = first;
+  this->push(objValue(map));
+  return this->makeRoomForStorage();
+}
+
+bool VM::buildArray(const uint32_t count) {
+  // The elements stay on the stack while the array is allocated.
+  ObjArray *array = this->heap.allocateArray(count);
+  if (array == nullptr) {
+    this->runtimeError("Out of memory.");
+    return false;
+  }
+
+  Value *first = this->stack.top - count;
+  for (const Value *element = first; element < this->stack.top; element++) {
+    array->append(*element);
+    this->heap.writeBarrier(array, *element);
+  }
+
+  this->stack.top = first;
+  this->push(objValue(array));
+  return true;
+}
+
+// Enters the closure `argCount` slots below the top, which become its frame together with the arguments.
+bool VM::call(const int argCount) {
+  const Value callee = this->peek(argCount);
+  if (!isClosure(callee)) {
+    if (isNative(callee)) return this->callNative(argCount);
+    this->runtimeError("Can only call functions.");
+    return false;
+  }
+
+  const ObjFunction *function = asClosure(callee)->function;
+  if (argCount != function->arity) {
+    this->runtimeError("Expected " + std::to_string(function->arity) + " arguments but got " +
+                       std::to_string(argCount) + ".");
+    return false;
+  }
+
+  // The verifier makes sure the frame size covers the callee and its arguments.
+  const size_t carried = static_cast<size_t>(argCount) + 1;
+  if (!this->stack.enter(this->frameSize - carried, carried)) {
+    this->runtimeError("Stack overflow.");
+    return false;
+  }
+
+  this->frames.push_back({this->ip, this->slots});
+  this->slots = this->stack.top - carried;
+  this->ip = this->code + function->entry;
+  return true;
+}
+
+// Replaces the running function's frame with one for the closure `argCount` slots below the top, so a chain
+// of tail calls runs in constant space.
+bool VM::tailCall(const int argCount) {
+  const Value callee = this->peek(argCount);
+  if (isNative(callee)) {
+    // A native runs without a frame of its own, so its result is returned right away.
+    if (!this->callNative(argCount)) return false;
+    const Value result = this->pop();
+    const CallFrame caller = this->frames.back();
+    this->frames.pop_back();
+    this->stack.leave(this->slots);
+    this->push(result);
+    this->ip = caller.ip;
+    this->slots = caller.slots;
+    return true;
+  }
+  if (!isClosure(callee)) {
+    this->runtimeError("Can only call functions.");
+    return false;
+  }
+
+  const ObjFunction *function = asClosure(callee)->function;
+  if (argCount != function->arity) {
+    this->runtimeError("Expected " + std::to_string(function->arity) + " arguments but got " +
+                       std::to_string(argCount) + ".");
+    return false;
+  }
+
+  // Every frame reserves the same number of slots, so the new one fits where the old one was.
+  const size_t carried = static_cast<size_t>(argCount) + 1;
+  std::memmove(this->slots, this->stack.top - carried, carried * sizeof(Value));
+  this->stack.top = this->slots + carried;
+  this->ip = this->code + function->entry;
+  return true;
+}
+
+// Calls the native function `argCount` slots below the top, which replaces itself and its arguments with
+// its result.
+bool VM::callNative(const int argCount) {
+  Value *args = this->stack.top - 1 - argCount;
+  if (!globalFunctions[asNative(args[0])->index].method(*this, args, argCount)) return false;
+
+  this->stack.top -= argCount;
+  return true;
+}
+
+// Reads the upvalue pairs after OP_CLOSURE and pushes the closure.
+bool VM::makeClosure(ObjFunction *function) {
+  // Slots to capture by reference are boxed first; a box stored in its slot stays reachable while the
+  // closure is allocated.
+  for (uint32_t i = 0; i < function->upvalueCount; i++) {
+    const uint8_t isLocal = this->ip[2 * i];
+    Value &slot = this->slots[this->ip[2 * i + 1]];
+    if (isLocal != 2 || isBox(slot)) continue;
+
+    ObjBox *box = this->heap.allocateBox();
+    if (box == nullptr) {
+      this->runtimeError("Out of memory.");
+      return false;
+    }
+    box->value = slot;
+    slot = objValue(box);
+  }
+
+  ObjClosure *closure = this->heap.allocateClosure(function);
+  if (closure == nullptr) {
+    this->runtimeError("Out of memory.");
+    return false;
+  }
+
+  // Captured values are read only once the allocation can no longer move them.
+  for (uint32_t i = 0; i < closure->upvalueCount; i++) {
+    const uint8_t isLocal = *this->ip++;
+    const uint8_t index = *this->ip++;
+    const Value value = isLocal ? this->slots[index] : asClosure(this->slots[0])->upvalues()[index];
+    closure->upvalues()[i] = value;
+    this->heap.writeBarrier(closure, value);
+  }
+
+  this->push(objValue(closure));
+  return true;
+}
+
+// Stores into a variable that may hold a box, through the box if it does. `owner` is the object holding the
+// variable, or nullptr for a stack slot.
+void VM::storeBoxed(Value &variable, Obj *owner, const Value value) {
+  if (isBox(variable)) {
+    ObjBox *box = asBox(variable);
+    box->value = value;
+    this->heap.writeBarrier(box, value);
+    return;
+  }
+  variable = value;
+  if (owner != nullptr) this->heap.writeBarrier(owner, value);
+}
+
+// Fibers start with room for a few frames instead of a full first segment, so thousands of them stay cheap.
+#define FIBER_INITIAL_FRAMES 4
+
+// Makes the script the running task, with an empty stack to trade for the first fiber's.
+void VM::startScheduler() {
+  if (this->scheduler != nullptr) return;
+
+  StackLimits empty;
+  empty.initialSlots = 0;
+  empty.segmentSlots = 0;
+  this->scheduler.reset(new Scheduler());
+  std::unique_ptr<ValueStack> stack(new ValueStack(empty));
+  this->script = this->scheduler->add(TASK_FIBER, NULL_VAL, std::move(stack));
+  this->running = this->script;
+}
+
+// Starts the call of the closure `argCount` slots below the top on a fiber of its own and replaces the
+// closure and its arguments with the fiber. The fiber first runs once the running task waits.
+bool VM::spawn(const int argCount) {
+  const Value callee = this->peek(argCount);
+  if (!isClosure(callee)) {
+    this->runtimeError("Can only spawn functions.");
+    return false;
+  }
+  const ObjFunction *function = asClosure(callee)->function;
+  if (argCount != function->arity) {
+    this->runtimeError("Expected " + std::to_string(function->arity) + " arguments but got " +
+                       std::to_string(argCount) + ".");
+    return false;
+  }
+
+  ObjFiber *fiber = this->heap.allocateFiber();
+  if (fiber == nullptr) {
+    this->runtimeError("Out of memory.");
+    return false;
+  }
+  this->startScheduler();
+
+  StackLimits limits = this->stackLimits;
+  if (limits.segmentSlots != 0) {
+    limits.initialSlots = std::min(limits.initialSlots, FIBER_INITIAL_FRAMES * this->frameSize);
+  }
+  std::unique_ptr<ValueStack> stack(new ValueStack(limits));
+  if (!stack->enter(this->frameSize)) {
+    this->runtimeError("Stack overflow.");
+    return false;
+  }
+
+  // The callee and its arguments become the first frame of the fiber, as they would for a call.
+  const size_t carried = static_cast<size_t>(argCount) + 1;
+  Value *base = stack->top;
+  std::copy(this->stack.top - carried, this->stack.top, base);
+  stack->top = base + carried;
+
+  Task *task = this->scheduler->add(TASK_FIBER, objValue(fiber), std::move(stack));
+  task->frames.push_back({fiberExit, base});
+  task->ip = this->code + asClosure(*base)->function->entry;
+  task->slots = base;
+  fiber->task = task;
+  this->scheduler->ready(task);
+
+  this->stack.top -= carried;
+  this->push(objValue(fiber));
+  return true;
+}
+
+// Suspends the running task until the value on top of its stack is ready, then replaces the value with the
+// fiber's result, or with null after sleeping for a number of milliseconds. Other tasks run meanwhile.
+bool VM::await(InterpretResult *outcome) {
+  const Value awaited = this->peek(0);
+  if (isFiber(awaited) && asFiber(awaited)->task == nullptr) {
+    this->stack.top[-1] = asFiber(awaited)->result;
+    return true;
+  }
+
+  if (isFiber(awaited)) {
+    Task *task = asFiber(awaited)->task;
+    if (task == this->running) {
+      this->runtimeError("A fiber cannot await itself.");
+      *outcome = INTERPRET_RUNTIME_ERROR;
+      return false;
+    }
+    task->waiters.push_back(this->running);
+    // The fiber's result is pushed in its place when it finishes.
+    this->pop();
+  } else if (isNumber(awaited)) {
+    this->startScheduler();
+    this->scheduler->sleep(this->running, asNumber(awaited));
+    this->stack.top[-1] = NULL_VAL;
+  } else {
+    this->runtimeError("Can only await fibers and numbers.");
+    *outcome = INTERPRET_RUNTIME_ERROR;
+    return false;
+  }
+
+  this->saveTask(this->running);
+  this->running = nullptr;
+  return this->resume(outcome);
+}
+
+// Ends the running task at OP_RETURN: the script, or a fiber whose call has returned the value on top of its
+// stack.
+bool VM::finishTask(InterpretResult *outcome) {
+  Task *task = this->running;
+  if (task == this->script) {
+    this->script = nullptr;
+  } else {
+    this->settle(task, this->peek(0));
+  }
+
+  // Hands the task its stack back, so removing the task frees it.
+  this->saveTask(task);
+  this->running = nullptr;
+  this->scheduler->remove(task);
+  return this->resume(outcome);
+}
+
+// Switches to the next task that can run, waiting for timers and input as long as it takes. Returns false
+// once the run is over: successfully when the script has finished and no task can run any more, with a
+// runtime error when the script waits for something that never comes or the input fails.
+bool VM::resume(InterpretResult *outcome) {
+  for (;;) {
+    Task *task = this->scheduler->next(*this->out);
+    if (task == nullptr) break;
+    if (task->kind == TASK_FIBER) {
+      this->loadTask(task);
+      return true;
+    }
+    if (!this->completeRead(task)) {
+      *outcome = INTERPRET_RUNTIME_ERROR;
+      return false;
+    }
+  }
+
+  if (this->scheduler->error().empty() && this->script == nullptr) {
+    *outcome = INTERPRET_OK;
+    return false;
+  }
+  const std::string &error = this->scheduler->error();
+  this->schedulerError(error.empty() ? "Deadlock: the script awaits a fiber that never finishes." : error);
+  *outcome = INTERPRET_RUNTIME_ERROR;
+  return false;
+}
+
+// Moves the VM's execution state into the task, leaving the VM with the empty state the task held.
+void VM::saveTask(Task *task) {
+  task->ip = this->ip;
+  task->slots = this->slots;
+  task->frames.swap(this->frames);
+  task->stack->swap(this->stack);
+}
+
+void VM::loadTask(Task *task) {
+  this->running = task;
+  this->ip = task->ip;
+  this->slots = task->slots;
+  this->frames.swap(task->frames);
+  this->stack.swap(*task->stack);
+}
+
+// Records the result of a finished task and queues the tasks that awaited it, each with the result pushed
+// where its awaited value was.
+void VM::settle(Task *task, const Value result) {
+  if (isFiber(task->object)) {
+    ObjFiber *fiber = asFiber(task->object);
+    fiber->task = nullptr;
+    fiber->result = result;
+    this->heap.writeBarrier(fiber, result);
+  }
+  for (Task *waiter : task->waiters) {
+    *waiter->stack->top++ = result;
+    this->scheduler->ready(waiter);
+  }
+}
+
+// Finishes a read with the line that has arrived for it, or with null at the end of the input.
+bool VM::completeRead(Task *task) {
+  std::string line;
+  Value result = NULL_VAL;
+  if (this->scheduler->takeLine(line)) {
+    // May collect, which updates the task's fiber and the stacks of its waiters.
+    ObjString *string = this->heap.copyString(line.data(), line.length());
+    if (string == nullptr) {
+      this->schedulerError("Out of memory.");
+      return false;
+    }
+    result = objValue(string);
+  }
+
+  this->settle(task, result);
+  this->scheduler->remove(task);
+  return true;
+}
+
+bool VM::startReadLine(Value *fiber) {
+  ObjFiber *read = this->heap.allocateFiber();
+  if (read == nullptr) {
+    this->runtimeError("Out of memory.");
+    return false;
+  }
+  this->startScheduler();
+
+  Task *task = this->scheduler->add(TASK_READ_LINE, objValue(read), nullptr);
+  read->task = task;
+  this->scheduler->readLine(task);
+  *fiber = objValue(read);
+  return true;
+}
+
+// Reports an error no running task caused, at the line where the script waits unless it has finished.
+void VM::schedulerError(const std::string &message) {
+  if (this->script == nullptr) {
+    this->out->flush();
+    *this->errors << message << std::endl;
+    return;
+  }
+  this->loadTask(this->script);
+  this->runtimeError(message);
+}
+
+bool VM::invoke(const Value name, const int argCount, InlineCache &cache) {
+  Value *args = this->stack.top - 1 - argCount;
+  const Value receiver = args[0];
+
+  // The site's cache maps the receiver's type straight to the method, without looking up its name.
+  NativeMethod method = nullptr;
+  if (isObj(receiver)) {
+    const ObjType type = objType(receiver);
+    const NativeMethodEntry *methods = type == OBJ_ARRAY ? arrayMethods : stringMethods;
+    const CacheEntry *hit = cache.find(type);
+    Value index;
+    if (hit != nullptr) {
+      method = methods[hit->index].method;
+    } else if ((isArray(receiver) && this->arrayMethodTable.get(name, &index)) ||
+               (isString(receiver) && this->stringMethodTable.get(name, &index))) {
+      const auto found = static_cast<uint32_t>(asNumber(index));
+      method = methods[found].method;
+      cache.add(type, found, type);
+    }
+  }
+
+  if (method != nullptr) {
+    if (!method(*this, args, argCount)) return false;
+
+    this->stack.top -= argCount;
+    return true;
+  }
+
+  // A function stored in a map is called like a method, but without the map as an argument.
+  if (isMap(receiver)) {
+    Value property;
+    if (asMap(receiver)->table.get(name, &property) && (isClosure(property) || isNative(property))) {
+      args[0] = property;
+      return this->call(argCount);
+    }
+  }
+
+  const ObjString *methodName = asString(name);
+  this->runtimeError("Undefined method '" + std::string(methodName->chars(), methodName->length) + "'.");
+  return false;
+}
+
+// Name constant and inline cache of the property access or method call whose opcode ip has just read. Only
+// the register engine needs this; run() decodes its operands in place.
+InlineCache &VM::currentSite(Value *name) {
+  const unsigned int offset = static_cast<unsigned int>(this->ip - this->code) - 1;
+  const uint8_t instruction = this->code[offset];
+  const bool isLong = instruction == OP_INVOKE_LONG || instruction == OP_GET_PROPERTY_LONG ||
+                      instruction == OP_SET_PROPERTY_LONG;
+  *name = this->constants[isLong ? this->chunk.readLong(offset + 1) : this->code[offset + 1]];
+
+  // Method calls have the argument count before the cache index.
+  const bool isInvoke = instruction == OP_INVOKE || instruction == OP_INVOKE_LONG;
+  return this->caches[this->chunk.readLong(offset + (isLong ? 4 : 2) + (isInvoke ? 1 : 0))];
+}
+
+bool VM::getProperty(const Value name, InlineCache &cache) {
+  const Value receiver = this->peek(0);
+  if (!isMap(receiver)) {
+    this->runtimeError("Only maps have properties.");
+    return false;
+  }
+
+  const ObjMap *map = asMap(receiver);
+  const Entry *entry = map->table.find(name);
+  if (entry == nullptr) {
+    this->stack.top[-1] = NULL_VAL;
+    return true;
+  }
+
+  if (map->shape != SHAPE_DICTIONARY) {
+    cache.add(map->shape, static_cast<uint32_t>(entry - map->table.begin()), map->shape);
+  }
+  this->stack.top[-1] = entry->value;
+  return true;
+}
+
+bool VM::setProperty(const Value name, InlineCache &cache) {
+  const Value value = this->peek(0);
+  const Value receiver = this->peek(1);
+  if (!isMap(receiver)) {
+    this->runtimeError("Only maps have properties.");
+    return false;
+  }
+
+  ObjMap *map = asMap(receiver);
+  const uint32_t shape = map->shape;
+  const CacheEntry *hit = cache.find(shape);
+  if (hit != nullptr) {
+    // Stores that only replace a value are done inline, so this one adds the property along a cached
+    // transition.
+    const size_t before = Heap::storageOf(map);
+    map->table.set(name, value);
+    this->heap.storageGrew(map, before);
+    map->shape = hit->transition;
+    this->heap.writeBarrier(map, name);
+    this->heap.writeBarrier(map, value);
+  } else {
+    this->storeInMap(map, name, value);
+    if (shape != SHAPE_DICTIONARY && map->shape != SHAPE_DICTIONARY) {
+      const Entry *entry = map->table.find(name);
+      cache.add(shape, static_cast<uint32_t>(entry - map->table.begin()), map->shape);
+    }
+  }
+
+  this->stack.top -= 2;
+  this->push(value);
+  return this->makeRoomForStorage();
+}
+
+// Every store into a map goes through here, so its shape follows the keys it is given.
+void VM::storeInMap(ObjMap *map, const Value key, const Value value) {
+  const size_t before = Heap::storageOf(map);
+  if (map->table.set(key, value)) map->shape = this->shapes.transition(map->shape, key);
+  this->heap.storageGrew(map, before);
+  this->heap.writeBarrier(map, key);
+  this->heap.writeBarrier(map, value);
+}
+
+// Called where the stores that grow arrays and maps end, once nothing refers to their objects but roots.
+bool VM::makeRoomForStorage() {
+  if (this->heap.makeRoomForStorage(0)) return true;
+  this->runtimeError("Out of memory.");
+  return false;
+}
+
+bool VM::getIndex() {
+  const Value key = this->peek(0);
+  const Value receiver = this->peek(1);
+
+  if (isMap(receiver)) {
+    if (!isHashable(key)) {
+      this->runtimeError("Map keys must be strings, numbers, booleans or null.");
+      return false;
+    }
+
+    Value value;
+    if (!asMap(receiver)->table.get(key, &value)) value = NULL_VAL;
+    this->pop();
+    this->pop();
+    this->push(value);
+    return true;
+  }
+
+  if (isArray(receiver)) {
+    const ObjArray *array = asArray(receiver);
+    uint32_t index;
+    if (!resolveIndex(key, array->count, &index)) {
+      this->runtimeError("Array index out of range.");
+      return false;
+    }
+
+    this->pop();
+    this->pop();
+    this->push(array->values[index]);
+    return true;
+  }
+
+  if (isString(receiver)) {
+    uint32_t index;
+    if (!resolveIndex(key, asString(receiver)->length, &index)) {
+      this->runtimeError("String index out of range.");
+      return false;
+    }
+
+    if (!sliceString(*this, this->stack.top - 2, index, 1)) return false;
+    this->pop();
+    return true;
+  }
+
+  this->runtimeError("Only maps, arrays and strings can be indexed.");
+  return false;
+}
+
+bool VM::setIndex() {
+  const Value value = this->peek(0);
+  const Value key = this->peek(1);
+  const Value receiver = this->peek(2);
+
+  if (isMap(receiver)) {
+    if (!isHashable(key)) {
+      this->runtimeError("Map keys must be strings, numbers, booleans or null.");
+      return false;
+    }
+
+    this->storeInMap(asMap(receiver), key, value);
+    this->stack.top -= 3;
+    this->push(value);
+    return this->makeRoomForStorage();
+  }
+
+  if (isArray(receiver)) {
+    ObjArray *array = asArray(receiver);
+    uint32_t index;
+    // Assigning one past the end appends.
+    if (isNumber(key) && asNumber(key) == array->count) {
+      const size_t before = Heap::storageOf(array);
+      array->append(value);
+      this->heap.storageGrew(array, before);
+    } else if (resolveIndex(key, array->count, &index)) {
+      array->store(index, value);
+    } else {
+      this->runtimeError("Array index out of range.");
+      return false;
+    }
+
+    this->heap.writeBarrier(array, value);
+    this->stack.top -= 3;
+    this->push(value);
+    return this->makeRoomForStorage();
+  }
+
+  this->runtimeError("Only maps and arrays can be indexed.");
+  return false;
+}
+
+// Slice bounds are inclusive and may be negative to count from the end. An omitted bound (null) takes
+// `fallback`.
+static bool sliceBound(const Value bound, const double length, const double fallback, double *resolved) {
+  if (isNull(bound)) {
+    *resolved = fallback;
+    return true;
+  }
+  if (!isNumber(bound) || asNumber(bound) != std::floor(asNumber(bound))) return false;
+
+  *resolved = asNumber(bound) < 0 ? asNumber(bound) + length : asNumber(bound);
+  return true;
+}
+
+bool VM::slice() {
+  const Value end = this->peek(0);
+  const Value start = this->peek(1);
+  const Value receiver = this->peek(2);
+
+  if (!isString(receiver)) {
+    this->runtimeError("Only strings can be sliced.");
+    return false;
+  }
+
+  const double length = asString(receiver)->length;
+  double first;
+  double last;
+  if (!sliceBound(start, length, 0, &first) || !sliceBound(end, length, length - 1, &last)) {
+    this->runtimeError("Slice bounds must be integers.");
+    return false;
+  }
+
+  if (first < 0 || first > length || last < first - 1 || last >= length) {
+    this->runtimeError("String index out of range.");
+    return false;
+  }
+
+  const auto sliceLength = static_cast<uint32_t>(last - first + 1);
+  if (!sliceString(*this, this->stack.top - 3, static_cast<uint32_t>(first), sliceLength)) return false;
+  this->pop();
+  this->pop();
+  return true;
+}
+
+bool VM::concatenate() {
+  // Both operands stay on the stack, so they are rooted while the result is allocated.
+  if (!concatenateStrings(*this, this->stack.top - 2, this->stack.top - 1)) return false;
+
+  this->pop();
+  return true;
+}
+
+// Function frames listed in a runtime error before the rest are summarized.
+#define TRACE_FRAMES_MAX 16
+
+void VM::runtimeError(const std::string &message) {
+  this->out->flush();
+  *this->errors << message << std::endl;
+
+  // The instruction that failed has already been read, so ip points just past it, and every caller's saved ip
+  // points just past its call.
+  const uint8_t *ip = this->ip;
+  const Value *slots = this->slots;
+  for (size_t frame = this->frames.size();; frame--) {
+    // Deep recursion is cut short to the innermost calls and the script.
+    if (frame > 0 && this->frames.size() - frame == TRACE_FRAMES_MAX) {
+      *this->errors << "[" << frame << " more calls]" << std::endl;
+      ip = this->frames[0].ip;
+      frame = 0;
+    }
+
+    // A fiber's outermost frame returns to the end of the fiber rather than to a line of the script.
+    if (frame == 0 && this->running != this->script) {
+      *this->errors << "[spawned fiber]" << std::endl;
+      break;
+    }
+
+    const auto offset = static_cast<unsigned int>(ip - this->code);
+    *this->errors << "[line " << this->chunk.getLine(offset > 0 ? offset - 1 : 0) << "] in ";
+    if (frame == 0) {
+      *this->errors << "script" << std::endl;
+      break;
+    }
+
+    const ObjString *name = asClosure(slots[0])->function->name;
+    if (name == nullptr) {
+      *this->errors << "anonymous function" << std::endl;
+    } else {
+      *this->errors << std::string(name->chars(), name->length) << "()" << std::endl;
+    }
+    ip = this->frames[frame - 1].ip;
+    slots = this->frames[frame - 1].slots;
+  }
+  this->frames.clear();
+  this->stack.reset();
 }
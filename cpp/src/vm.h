@@ -1,30 +1,155 @@
 #ifndef VM_H
 #define VM_H
+#include "builtins/builtins.h"
 #include "chunk.h"
-#include "debug.h"
+#include "heap.h"
+#include "jit.h"
+#include "module.h"
+#include "registers.h"
+#include "scheduler.h"
+#include "shape.h"
+#include "stack.h"
+#include "table.h"
+#include "trace.h"
 
-#define STACK_MAX 256
+#include <iosfwd>
+#include <memory>
+#include <string>
 
 typedef enum { INTERPRET_OK, INTERPRET_COMPILE_ERROR, INTERPRET_RUNTIME_ERROR } InterpretResult;
 
-class VM {
+// ENGINE_REGISTER lowers the chunk to three-address code (see registers.h) before running it.
+typedef enum { ENGINE_STACK, ENGINE_REGISTER } Engine;
+
+class VM : public RootSet {
 public:
-  explicit VM(const Chunk &chunk);
-  InterpretResult interpret();
+  // Runs `module` with objects allocated in `heap`, which must not be the heap of another live VM.
+  VM(std::shared_ptr<const Module> module, Heap &heap, const StackLimits &stackLimits = StackLimits());
+  ~VM() override;
+  InterpretResult interpret(Engine engine = ENGINE_STACK);
+  // The stack engine compiles the script to machine code once a loop in it gets hot, where the JIT is built
+  // in (see jit.h). Disabling it keeps every instruction in the interpreter.
+  void enableJit(bool enabled);
+  // Hands every `every`th instruction to `sink` from the next interpret() on, or stops tracing if `sink` is
+  // nullptr. The sink must outlive the runs it traces.
+  void setTrace(TraceSink *sink, uint32_t every = 1);
+  // Stops every run with a runtime error before it would start instruction number `limit` + 1; 0 lifts the
+  // limit. Like tracing, a limit makes runs count instructions and keeps them out of the JIT.
+  void setInstructionLimit(uint64_t limit);
+  // Where `print` writes and errors are reported; std::cout and std::cerr unless redirected. Both streams
+  // must outlive the runs that use them.
+  void setOutput(std::ostream &out, std::ostream &errors);
+
+  void visitRoots(Heap &heap) override;
+
+  Heap &getHeap();
+  void runtimeError(const std::string &message);
+  // Starts reading the next line of standard input and stores the fiber that finishes with it in *fiber.
+  // Returns false after reporting a runtime error.
+  bool startReadLine(Value *fiber);
+  // Collects if growing arrays and maps made a collection due (see Heap::makeRoomForStorage). Returns false
+  // after reporting a runtime error when the heap is past its limit. Only where the heap may collect.
+  bool makeRoomForStorage();
 
 private:
-  Chunk chunk;
-#ifdef DEBUG_TRACE_EXECUTION
-  Debug debug;
+  std::shared_ptr<const Module> module;
+  const Chunk &chunk;
+  Heap &heap;
+  // Cached from the chunk by interpret(), so run() reaches code and constants without going through it.
+  const uint8_t *code = nullptr;
+  const Value *constants = nullptr;
+  // One per cache operand of the chunk; this VM's shapes are what they remember.
+  Array<InlineCache> caches;
+  const uint8_t *ip = nullptr;
+  StackLimits stackLimits;
+  ValueStack stack;
+  RegisterChunk registers;
+  // End of the register frame while the register engine runs. Registers above the stack top stay roots.
+  Value *registersEnd = nullptr;
+  // First slot of the running frame; local slot operands index from here. In a function's frame slot 0
+  // holds the closure being run.
+  Value *slots = nullptr;
+  // Frames of the functions being run, outermost first; the running frame's state is in ip and slots.
+  Array<CallFrame> frames;
+  // Slots every frame reserves: the deepest the verifier found any function, or the script, to go.
+  size_t frameSize = 0;
+  // Indexed by the slot numbers the compiler assigned; undefined until the global is defined.
+  Array<Value> globals;
+  // Interned method name -> index into arrayMethods / stringMethods.
+  Table arrayMethodTable;
+  Table stringMethodTable;
+  ShapeTree shapes;
+  // Created once the script first spawns a fiber, awaits or reads input. From then on the script is a task
+  // like the fibers: `running` is the one whose state the VM holds, and `script` is nullptr once the script
+  // has finished.
+  std::unique_ptr<Scheduler> scheduler;
+  Task *running = nullptr;
+  Task *script = nullptr;
+  bool jitEnabled = true;
+#ifdef TRIPLES_JIT
+  Jit jit;
+  // Loop back edges taken in run() so far, counting towards JIT_HOT_LOOP.
+  uint32_t backEdges = 0;
 #endif
-  unsigned int ip = 0;
-  Array<Value> stack;
+  std::ostream *out;
+  std::ostream *errors;
+  TraceSink *traceSink = nullptr;
+  uint64_t traceEvery = 1;
+  uint64_t instructionLimit = 0;
+  // Instrumented runs count down to the next call to instrument(), which is due before instruction number
+  // `hookAt` of the run; the next instruction to trace is number `nextTrace`.
+  uint64_t countdown = 0;
+  uint64_t hookAt = 0;
+  uint64_t nextTrace = 0;
 
-  InterpretResult run();
-  unsigned char readByte();
-  Value readConstant();
+  InterpretResult start(Engine engine);
+  // Instantiated with and without the per-instruction hook that tracing and the instruction limit need.
+  template <bool instrumented> InterpretResult run();
+  template <bool instrumented> InterpretResult runRegisters();
+  bool isInstrumented() const;
+#ifdef TRIPLES_JIT
+  bool compileJit();
+  InterpretResult runJit();
+  static bool jitSlowPath(JitFrame *frame, uint32_t offset);
+#endif
+  void scheduleHook(uint64_t current);
+  bool instrument(size_t pc);
   void push(Value value);
   Value pop();
+  Value peek(int distance) const;
+
+  bool call(int argCount);
+  bool tailCall(int argCount);
+  bool makeClosure(ObjFunction *function);
+  void storeBoxed(Value &variable, Obj *owner, Value value);
+  bool callNative(int argCount);
+
+  void startScheduler();
+  bool spawn(int argCount);
+  bool await(InterpretResult *outcome);
+  bool finishTask(InterpretResult *outcome);
+  bool resume(InterpretResult *outcome);
+  void saveTask(Task *task);
+  void loadTask(Task *task);
+  void settle(Task *task, Value result);
+  bool completeRead(Task *task);
+  void schedulerError(const std::string &message);
+
+  void defineNativeMethods(Table &table, const NativeMethodEntry *methods, size_t count);
+  bool invoke(Value name, int argCount, InlineCache &cache);
+  InlineCache &currentSite(Value *name);
+  bool getProperty(Value name, InlineCache &cache);
+  bool setProperty(Value name, InlineCache &cache);
+  void storeInMap(ObjMap *map, Value key, Value value);
+  bool getGlobal(uint32_t slot);
+  bool setGlobal(uint32_t slot);
+  void undefinedVariable(uint32_t slot);
+  bool buildMap(uint32_t count);
+  bool buildArray(uint32_t count);
+  bool getIndex();
+  bool setIndex();
+  bool slice();
+  bool concatenate();
 };
 
 #endif // VM_H
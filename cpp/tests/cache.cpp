@@ -0,0 +1,103 @@
+// Checks that Module::load rejects a cache file whose raw constants or header counts were tampered with, so
+// the script is compiled again rather than run with made-up values or sized by made-up counts.
+//
+// Usage: TripleS_cache_test [directory]. The cache file is written to the directory, by default the current
+// one, and removed again. The exit status is 1 if a check fails.
+#include "../src/cache.h"
+#include "../src/module.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+static const char *const source = "var point = {x: 1.5};\nprint point.x;\n";
+
+static int failures = 0;
+
+static void check(const bool passed, const char *what) {
+  if (passed) return;
+  std::cerr << "FAIL: " << what << std::endl;
+  failures++;
+}
+
+static std::vector<char> readBytes(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  return std::vector<char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+static void writeBytes(const std::string &path, const std::vector<char> &bytes) {
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  file.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+}
+
+// Writes the cache with the raw constant 1.5 replaced by `value`, and returns whether Module::load takes it.
+static bool loadsWith(const std::string &path, const uint64_t sourceHash, const std::vector<char> &original,
+                      const Value value) {
+  std::vector<char> bytes = original;
+  char tagged[1 + sizeof(Value)];
+  tagged[0] = static_cast<char>(CACHE_CONSTANT_VALUE);
+  const Value number = numberValue(1.5);
+  std::memcpy(tagged + 1, &number, sizeof(Value));
+
+  const auto found = std::search(bytes.begin(), bytes.end(), tagged, tagged + sizeof(tagged));
+  if (found == bytes.end()) {
+    check(false, "the cache holds 1.5 as a raw constant");
+    return false;
+  }
+  std::memcpy(&*(found + 1), &value, sizeof(Value));
+  writeBytes(path, bytes);
+  return Module::load(path, sourceHash) != nullptr;
+}
+
+// Writes the cache with the header field at `offset` replaced by `count`, and returns whether Module::load
+// takes it.
+static bool loadsWithCount(const std::string &path, const uint64_t sourceHash,
+                           const std::vector<char> &original, const size_t offset, const uint32_t count) {
+  std::vector<char> bytes = original;
+  std::memcpy(&bytes[offset], &count, sizeof(uint32_t));
+  writeBytes(path, bytes);
+  return Module::load(path, sourceHash) != nullptr;
+}
+
+int main(const int argc, const char *argv[]) {
+  const std::string directory = argc > 1 ? argv[1] : ".";
+  const std::string path = directory + "/cache-test" + CACHE_EXTENSION;
+  const uint64_t sourceHash = Cache::hashSource(source, std::strlen(source));
+
+  const std::shared_ptr<const Module> module = Module::compile(source);
+  check(module != nullptr, "the script compiles");
+  if (module == nullptr) return 1;
+  check(Cache::save(path, sourceHash, module->chunk()), "the cache is written");
+  check(Module::load(path, sourceHash) != nullptr, "an intact cache loads");
+
+  const std::vector<char> original = readBytes(path);
+  check(loadsWith(path, sourceHash, original, numberValue(2.5)), "another number loads");
+  check(loadsWith(path, sourceHash, original, TRUE_VAL), "a boolean loads");
+  check(loadsWith(path, sourceHash, original, NULL_VAL), "null loads");
+  const Value pointer = SIGN_BIT | QNAN | 0x4141414140;
+  check(!loadsWith(path, sourceHash, original, pointer), "an object pointer is rejected");
+  check(!loadsWith(path, sourceHash, original, UNDEFINED_VAL), "undefined is rejected");
+  check(!loadsWith(path, sourceHash, original, QNAN | 0x41), "an unknown tag is rejected");
+
+  const size_t constantCount = offsetof(CacheHeader, constantCount);
+  const size_t globalCount = offsetof(CacheHeader, globalCount);
+  const size_t cacheCount = offsetof(CacheHeader, cacheCount);
+  check(!loadsWithCount(path, sourceHash, original, constantCount, UINT32_MAX),
+        "a huge constant count is rejected");
+  check(!loadsWithCount(path, sourceHash, original, globalCount, UINT32_MAX),
+        "a huge global count is rejected");
+  check(!loadsWithCount(path, sourceHash, original, cacheCount, UINT32_MAX),
+        "a huge cache count is rejected");
+  check(!loadsWithCount(path, sourceHash, original, cacheCount, 2),
+        "more caches than property accesses are rejected");
+  check(loadsWithCount(path, sourceHash, original, cacheCount, 1), "the code's own cache count loads");
+
+  std::remove(path.c_str());
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,123 @@
+// Runs regression scripts and checks what they print against the `// expect: ` comments in them, one per
+// line of output, on every engine. A script with `// expect error: ` comments must instead fail to compile,
+// reporting errors that contain those messages, in order.
+//
+// Usage: TripleS_tests script... The exit status is 1 if any script fails.
+#include "../src/module.h"
+#include "../src/vm.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define EXPECT_OUTPUT "// expect: "
+#define EXPECT_ERROR "// expect error: "
+
+typedef struct {
+  const char *name;
+  Engine engine;
+  bool jit;
+} EngineSetup;
+
+static const EngineSetup engineSetups[] = {
+    {"stack", ENGINE_STACK, false},
+#ifdef TRIPLES_JIT
+    {"jit", ENGINE_STACK, true},
+#endif
+    {"register", ENGINE_REGISTER, false},
+};
+
+static std::vector<std::string> splitLines(const std::string &text) {
+  std::vector<std::string> lines;
+  std::istringstream stream(text);
+  std::string line;
+  while (std::getline(stream, line)) lines.push_back(line);
+  return lines;
+}
+
+// What follows `marker` on each line that has it.
+static std::vector<std::string> expectations(const std::vector<std::string> &lines, const char *marker) {
+  std::vector<std::string> expected;
+  for (const std::string &line : lines) {
+    const size_t found = line.find(marker);
+    if (found != std::string::npos) expected.push_back(line.substr(found + std::string(marker).length()));
+  }
+  return expected;
+}
+
+static bool checkErrors(const std::string &path, const std::string &source,
+                        const std::vector<std::string> &expected) {
+  // The compiler reports to std::cerr.
+  std::ostringstream errors;
+  std::streambuf *previous = std::cerr.rdbuf(errors.rdbuf());
+  const std::shared_ptr<const Module> module = Module::compile(source);
+  std::cerr.rdbuf(previous);
+
+  const std::vector<std::string> reported = splitLines(errors.str());
+  bool passed = module == nullptr && reported.size() == expected.size();
+  for (size_t i = 0; passed && i < expected.size(); i++) {
+    passed = reported[i].find(expected[i]) != std::string::npos;
+  }
+  if (!passed) {
+    std::cerr << "FAIL " << path << ": expected the compile errors" << std::endl;
+    for (const std::string &error : expected) std::cerr << "  " << error << std::endl;
+    std::cerr << "but got" << std::endl << errors.str();
+  }
+  return passed;
+}
+
+static bool checkOutput(const std::string &path, const std::string &source,
+                        const std::vector<std::string> &expected) {
+  const std::shared_ptr<const Module> module = Module::compile(source);
+  if (module == nullptr) {
+    std::cerr << "FAIL " << path << ": does not compile" << std::endl;
+    return false;
+  }
+
+  bool passed = true;
+  for (const EngineSetup &setup : engineSetups) {
+    std::ostringstream output;
+    std::ostringstream errors;
+    Heap heap;
+    VM vm(module, heap);
+    vm.setOutput(output, errors);
+    vm.enableJit(setup.jit);
+    const InterpretResult result = vm.interpret(setup.engine);
+    if (result == INTERPRET_OK && splitLines(output.str()) == expected) continue;
+
+    std::cerr << "FAIL " << path << " on the " << setup.name << " engine: expected" << std::endl;
+    for (const std::string &line : expected) std::cerr << "  " << line << std::endl;
+    std::cerr << "but got" << std::endl << output.str() << errors.str();
+    passed = false;
+  }
+  return passed;
+}
+
+int main(const int argc, const char *argv[]) {
+  if (argc < 2) {
+    std::cout << "Usage: TripleS_tests script..." << std::endl;
+    return 64;
+  }
+
+  int failures = 0;
+  for (int i = 1; i < argc; i++) {
+    const std::string path = argv[i];
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+      std::cerr << "Could not open file \"" << path << "\"." << std::endl;
+      return 74;
+    }
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    const std::string source = buffer.str();
+
+    const std::vector<std::string> lines = splitLines(source);
+    const std::vector<std::string> errors = expectations(lines, EXPECT_ERROR);
+    const bool passed = errors.empty() ? checkOutput(path, source, expectations(lines, EXPECT_OUTPUT))
+                                       : checkErrors(path, source, errors);
+    if (!passed) failures++;
+  }
+  return failures == 0 ? 0 : 1;
+}
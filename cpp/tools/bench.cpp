@@ -0,0 +1,376 @@
+// Measures the scanner, the compiler and the VM, and writes the results as JSON so they can be tracked from
+// build to build.
+//
+// Usage: TripleS_bench [--runs n] [--workloads dir] [--output path]
+//
+// The microbenchmarks time Scanner::scanToken over a corpus of scripts (MB/s and tokens/s), Compiler::compile
+// over the same scripts (MB/s) and the dispatch rate of a loop of cheap instructions on each engine. The
+// macro workloads are the scripts in bench/workloads/, modeled on definitions/*.sss, each run on every
+// engine with its output discarded. Every time is the best of the runs, with the median next to it;
+// instruction counts come from one extra traced run. Build with optimizations (CMAKE_BUILD_TYPE=Release) for
+// meaningful figures.
+#include "../src/chunk.h"
+#include "../src/compiler/compiler.h"
+#include "../src/compiler/scanner.h"
+#include "../src/heap.h"
+#include "../src/module.h"
+#include "../src/trace.h"
+#include "../src/vm.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#ifndef TRIPLES_BENCH_DIR
+#define TRIPLES_BENCH_DIR "bench"
+#endif
+
+// The scanner corpus repeats the scripts until it is at least this large.
+#define BENCH_SCANNER_BYTES (8 * 1024 * 1024)
+// Times the compiler goes over every script in one run.
+#define BENCH_COMPILER_REPEAT 1000
+
+static const char *const workloadNames[] = {"array",   "function",        "map",
+                                            "objects", "string-builtins", "unary"};
+
+// The loop dispatch is measured on: a handful of cheap instructions per iteration, all on locals.
+static const char *const dispatchScript = "{\n"
+                                          "  var total = 0;\n"
+                                          "  for (var i = 0; i < 5000000; i = i + 1) total = total + i;\n"
+                                          "  print total;\n"
+                                          "}\n";
+
+typedef struct {
+  const char *name;
+  Engine engine;
+  bool jit;
+} EngineSetup;
+
+static const EngineSetup engineSetups[] = {
+    {"stack", ENGINE_STACK, false},
+#ifdef TRIPLES_JIT
+    {"jit", ENGINE_STACK, true},
+#endif
+    {"register", ENGINE_REGISTER, false},
+};
+
+typedef struct {
+  std::string name;
+  std::string source;
+} Script;
+
+typedef struct {
+  double best;
+  double median;
+} Timing;
+
+class InstructionCounter : public TraceSink {
+public:
+  uint64_t count = 0;
+
+  void instruction(const Chunk &, unsigned int, const Value *, const Value *,
+                   const Array<CallFrame> &) override {
+    this->count++;
+  }
+  void registerInstruction(const Chunk &, const RegisterChunk &, size_t) override { this->count++; }
+};
+
+// Writes JSON objects one member at a time, taking care of commas and indentation.
+class JsonWriter {
+public:
+  explicit JsonWriter(std::ostream &out) : out(out) { this->out << std::setprecision(9); }
+
+  void begin(const char *key = nullptr) {
+    this->member(key);
+    this->out << "{";
+    this->first = true;
+    this->depth++;
+  }
+  void end() {
+    this->depth--;
+    this->out << "\n" << std::string(2 * this->depth, ' ') << "}";
+    this->first = false;
+    if (this->depth == 0) this->out << std::endl;
+  }
+  void field(const char *key, const std::string &value) {
+    this->member(key);
+    this->out << "\"";
+    for (const char c : value) {
+      if (c == '"' || c == '\\') {
+        this->out << '\\' << c;
+      } else if (static_cast<unsigned char>(c) < 0x20) {
+        this->out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c) << std::dec
+                  << std::setfill(' ');
+      } else {
+        this->out << c;
+      }
+    }
+    this->out << "\"";
+  }
+  void field(const char *key, const char *value) { this->field(key, std::string(value)); }
+  void field(const char *key, const bool value) {
+    this->member(key);
+    this->out << (value ? "true" : "false");
+  }
+  void field(const char *key, const uint64_t value) {
+    this->member(key);
+    this->out << value;
+  }
+  void field(const char *key, const double value) {
+    this->member(key);
+    this->out << value;
+  }
+
+private:
+  std::ostream &out;
+  int depth = 0;
+  bool first = true;
+
+  void member(const char *key) {
+    if (this->depth == 0) return;
+    this->out << (this->first ? "\n" : ",\n") << std::string(2 * this->depth, ' ');
+    this->first = false;
+    if (key != nullptr) this->out << "\"" << key << "\": ";
+  }
+};
+
+static bool readFile(const std::string &path, std::string &source) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) return false;
+  std::stringstream buffer;
+  buffer << file.rdbuf();
+  source = buffer.str();
+  return true;
+}
+
+// Runs `body` `runs` times. A run that returns false stops the measurement, which then returns false.
+static bool measure(const int runs, const std::function<bool()> &body, Timing *timing) {
+  std::vector<double> seconds;
+  for (int run = 0; run < runs; run++) {
+    const auto start = std::chrono::steady_clock::now();
+    if (!body()) return false;
+    seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+  }
+  std::sort(seconds.begin(), seconds.end());
+  timing->best = seconds.front();
+  timing->median = seconds[seconds.size() / 2];
+  return true;
+}
+
+static void writeTiming(JsonWriter &json, const Timing &timing) {
+  json.field("seconds", timing.best);
+  json.field("median_seconds", timing.median);
+}
+
+static double perSecond(const double amount, const Timing &timing) {
+  return timing.best > 0 ? amount / timing.best : 0;
+}
+
+// Runs `module` once in a fresh heap with its output discarded, counting its instructions if `counter` is
+// given.
+static bool runModule(const std::shared_ptr<const Module> &module, const EngineSetup &setup,
+                      InstructionCounter *counter) {
+  std::ostringstream discarded;
+  Heap heap;
+  VM vm(module, heap);
+  vm.setOutput(discarded, std::cerr);
+  vm.enableJit(setup.jit);
+  if (counter != nullptr) vm.setTrace(counter);
+  return vm.interpret(setup.engine) == INTERPRET_OK;
+}
+
+static void benchScanner(const std::vector<Script> &scripts, const int runs, JsonWriter &json) {
+  std::string corpus;
+  while (corpus.size() < BENCH_SCANNER_BYTES) {
+    for (const Script &script : scripts) corpus += script.source + "\n";
+  }
+
+  uint64_t tokens = 0;
+  Timing timing;
+  measure(runs, [&corpus, &tokens]() {
+    tokens = 0;
+    Scanner scanner(corpus);
+    while (scanner.scanToken().type != TokenType::TOKEN_EOF) tokens++;
+    return true;
+  }, &timing);
+
+  json.begin("scanner");
+  json.field("bytes", static_cast<uint64_t>(corpus.size()));
+  json.field("tokens", tokens);
+  writeTiming(json, timing);
+  json.field("mb_per_second", perSecond(static_cast<double>(corpus.size()) / 1e6, timing));
+  json.field("tokens_per_second", perSecond(static_cast<double>(tokens), timing));
+  json.end();
+}
+
+static bool benchCompiler(const std::vector<Script> &scripts, const int runs, JsonWriter &json) {
+  uint64_t bytes = 0;
+  for (const Script &script : scripts) bytes += script.source.size();
+  bytes *= BENCH_COMPILER_REPEAT;
+
+  Timing timing;
+  const bool compiled = measure(runs, [&scripts]() {
+    Heap heap;
+    for (int repeat = 0; repeat < BENCH_COMPILER_REPEAT; repeat++) {
+      for (const Script &script : scripts) {
+        Chunk chunk;
+        if (!Compiler(script.source, chunk, heap).compile()) return false;
+        chunk.free();
+      }
+    }
+    return true;
+  }, &timing);
+  if (!compiled) {
+    std::cerr << "The compiler benchmark's scripts did not compile." << std::endl;
+    return false;
+  }
+
+  json.begin("compiler");
+  json.field("bytes", bytes);
+  writeTiming(json, timing);
+  json.field("mb_per_second", perSecond(static_cast<double>(bytes) / 1e6, timing));
+  json.end();
+  return true;
+}
+
+static bool benchDispatch(const int runs, JsonWriter &json) {
+  const std::shared_ptr<const Module> module = Module::compile(dispatchScript);
+  if (module == nullptr) return false;
+
+  json.begin("dispatch");
+  for (const EngineSetup &setup : engineSetups) {
+    // The JIT runs no dispatch loop at all.
+    if (setup.jit) continue;
+    InstructionCounter counter;
+    Timing timing;
+    if (!runModule(module, setup, &counter) ||
+        !measure(runs, [&module, &setup]() { return runModule(module, setup, nullptr); }, &timing)) {
+      std::cerr << "The dispatch benchmark did not run on the " << setup.name << " engine." << std::endl;
+      return false;
+    }
+
+    json.begin(setup.name);
+    json.field("instructions", counter.count);
+    writeTiming(json, timing);
+    json.field("instructions_per_second", perSecond(static_cast<double>(counter.count), timing));
+    json.end();
+  }
+  json.end();
+  return true;
+}
+
+static bool benchWorkload(const Script &script, const int runs, JsonWriter &json) {
+  const std::shared_ptr<const Module> module = Module::compile(script.source);
+  InstructionCounter counter;
+  if (module == nullptr || !runModule(module, engineSetups[0], &counter)) {
+    std::cerr << "\"" << script.name << "\" did not run to completion." << std::endl;
+    return false;
+  }
+
+  json.begin(script.name.c_str());
+  json.field("bytes", static_cast<uint64_t>(script.source.size()));
+  json.field("instructions", counter.count);
+  for (const EngineSetup &setup : engineSetups) {
+    Timing timing;
+    if (!measure(runs, [&module, &setup]() { return runModule(module, setup, nullptr); }, &timing)) {
+      std::cerr << "\"" << script.name << "\" did not run to completion on the " << setup.name << " engine."
+                << std::endl;
+      return false;
+    }
+    json.begin(setup.name);
+    writeTiming(json, timing);
+    json.end();
+  }
+  json.end();
+  return true;
+}
+
+int main(const int argc, const char *argv[]) {
+  int runs = 5;
+  std::string directory = std::string(TRIPLES_BENCH_DIR) + "/workloads";
+  std::string outputPath;
+  for (int i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+      runs = std::atoi(argv[++i]);
+    } else if (std::strcmp(argv[i], "--workloads") == 0 && i + 1 < argc) {
+      directory = argv[++i];
+    } else if (std::strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+      outputPath = argv[++i];
+    } else {
+      runs = 0;
+      break;
+    }
+  }
+  if (runs < 1) {
+    std::cout << "Usage: TripleS_bench [--runs n] [--workloads dir] [--output path]" << std::endl;
+    return 64;
+  }
+
+  std::vector<Script> scripts;
+  for (const char *name : workloadNames) {
+    const std::string path = directory + "/" + name + ".sss";
+    Script script = {name, ""};
+    if (!readFile(path, script.source)) {
+      std::cerr << "Could not open file \"" << path << "\"." << std::endl;
+      return 74;
+    }
+    scripts.push_back(script);
+  }
+
+  std::ofstream file;
+  if (!outputPath.empty()) {
+    file.open(outputPath);
+    if (!file) {
+      std::cerr << "Could not write \"" << outputPath << "\"." << std::endl;
+      return 74;
+    }
+  }
+  // Written to a buffer first, so a failed benchmark leaves no half-written report behind.
+  std::ostringstream report;
+  JsonWriter json(report);
+
+  json.begin();
+  json.field("runs", static_cast<uint64_t>(runs));
+  json.begin("build");
+#ifdef __VERSION__
+  json.field("compiler", __VERSION__);
+#endif
+#ifdef __OPTIMIZE__
+  json.field("optimized", true);
+#else
+  json.field("optimized", false);
+#endif
+#ifdef TRIPLES_SWITCH_DISPATCH
+  json.field("dispatch", "switch");
+#else
+  json.field("dispatch", "computed goto");
+#endif
+#ifdef TRIPLES_JIT
+  json.field("jit", true);
+#else
+  json.field("jit", false);
+#endif
+  json.end();
+
+  json.begin("micro");
+  benchScanner(scripts, runs, json);
+  if (!benchCompiler(scripts, runs, json) || !benchDispatch(runs, json)) return 70;
+  json.end();
+
+  json.begin("macro");
+  for (const Script &script : scripts) {
+    if (!benchWorkload(script, runs, json)) return 70;
+  }
+  json.end();
+  json.end();
+
+  (outputPath.empty() ? std::cout : file) << report.str();
+  return 0;
+}
@@ -0,0 +1,232 @@
+// Runs the same scripts on the Node.js interpreter (nodejs/) and on TripleS, checks that they print the same
+// thing, and compares what each run cost.
+//
+// Usage: TripleS_compare [--runs n] [--node command] [--node-cli path] [--triples path] script...
+//
+// Each script runs as a child process of either engine, with no input and its errors discarded. TripleS runs
+// with --no-cache, so both engines compile the script on every run. The best wall-clock time over the runs
+// is reported for each engine, together with that run's peak resident set size and, where the kernel lets
+// perf events count them, the instructions it retired in user space. Both figures cover the whole process,
+// start-up and compilation included. The Node.js interpreter must be built first (`npm run build` in
+// nodejs/). The exit status is 1 if the outputs of any script differ or TripleS is slower than Node.js on
+// one, so the harness can gate a deployment.
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#define COMPARE_HAS_PERF
+#endif
+
+#ifndef TRIPLES_BINARY
+#define TRIPLES_BINARY "TripleS"
+#endif
+#ifndef TRIPLES_NODE_CLI
+#define TRIPLES_NODE_CLI "../nodejs/bin/index.js"
+#endif
+
+// An instruction count the kernel would not provide.
+#define COMPARE_NO_COUNT UINT64_MAX
+
+typedef struct {
+  bool succeeded;
+  int status;
+  std::string output;
+  double seconds;
+  // Kilobytes.
+  long peakResident;
+  uint64_t instructions;
+} Run;
+
+#ifdef COMPARE_HAS_PERF
+// Counts the user-space instructions `pid` and the threads and processes it starts go on to retire, from its
+// exec on. Returns -1 if perf events are not available.
+static int countInstructions(const pid_t pid) {
+  perf_event_attr attributes;
+  std::memset(&attributes, 0, sizeof(attributes));
+  attributes.size = sizeof(attributes);
+  attributes.type = PERF_TYPE_HARDWARE;
+  attributes.config = PERF_COUNT_HW_INSTRUCTIONS;
+  attributes.disabled = 1;
+  attributes.enable_on_exec = 1;
+  attributes.inherit = 1;
+  attributes.exclude_kernel = 1;
+  attributes.exclude_hv = 1;
+  return static_cast<int>(syscall(SYS_perf_event_open, &attributes, pid, -1, -1, PERF_FLAG_FD_CLOEXEC));
+}
+#endif
+
+// Runs `arguments` with its standard output captured and waits for it to exit.
+static Run runProcess(const std::vector<std::string> &arguments) {
+  Run run = {false, -1, "", 0, 0, COMPARE_NO_COUNT};
+  std::vector<char *> argv;
+  for (const std::string &argument : arguments) argv.push_back(const_cast<char *>(argument.c_str()));
+  argv.push_back(nullptr);
+
+  int output[2];
+  int release[2];
+  if (pipe(output) != 0) return run;
+  if (pipe(release) != 0) {
+    close(output[0]);
+    close(output[1]);
+    return run;
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  const pid_t pid = fork();
+  if (pid < 0) {
+    for (const int end : {output[0], output[1], release[0], release[1]}) close(end);
+    return run;
+  }
+  if (pid == 0) {
+    // Held back until the parent has attached the counter, so it sees the exec.
+    char go;
+    close(release[1]);
+    if (read(release[0], &go, 1) != 1) _exit(127);
+    const int nothing = open("/dev/null", O_RDWR);
+    dup2(nothing, STDIN_FILENO);
+    dup2(nothing, STDERR_FILENO);
+    dup2(output[1], STDOUT_FILENO);
+    execvp(argv[0], argv.data());
+    _exit(127);
+  }
+
+  close(output[1]);
+  close(release[0]);
+  int counter = -1;
+#ifdef COMPARE_HAS_PERF
+  counter = countInstructions(pid);
+#endif
+  const char go = 1;
+  const bool released = write(release[1], &go, 1) == 1;
+  close(release[1]);
+
+  char buffer[4096];
+  ssize_t count;
+  while ((count = read(output[0], buffer, sizeof(buffer))) != 0) {
+    if (count > 0) run.output.append(buffer, static_cast<size_t>(count));
+    if (count < 0 && errno != EINTR) break;
+  }
+  close(output[0]);
+
+  int status;
+  rusage usage;
+  while (wait4(pid, &status, 0, &usage) < 0 && errno == EINTR) {
+  }
+  run.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  run.peakResident = usage.ru_maxrss;
+  run.status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+  run.succeeded = released && run.status != 127;
+
+  if (counter >= 0) {
+    uint64_t instructions;
+    if (read(counter, &instructions, sizeof(instructions)) == sizeof(instructions)) {
+      run.instructions = instructions;
+    }
+    close(counter);
+  }
+  return run;
+}
+
+// The fastest of `runs` runs. False if one could not start or printed something different from the others.
+static bool measure(const std::vector<std::string> &arguments, const int runs, Run *best) {
+  for (int i = 0; i < runs; i++) {
+    const Run run = runProcess(arguments);
+    if (!run.succeeded || (i > 0 && run.output != best->output)) return false;
+    if (i == 0 || run.seconds < best->seconds) *best = run;
+  }
+  return true;
+}
+
+static std::string formatCount(const uint64_t instructions) {
+  if (instructions == COMPARE_NO_COUNT) return "-";
+  std::ostringstream text;
+  text << std::fixed << std::setprecision(1) << static_cast<double>(instructions) / 1e6 << "M";
+  return text.str();
+}
+
+int main(const int argc, const char *argv[]) {
+  int runs = 3;
+  std::string node = "node";
+  std::string nodeCli = TRIPLES_NODE_CLI;
+  std::string triples = TRIPLES_BINARY;
+  std::vector<std::string> scripts;
+  for (int i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+      runs = std::atoi(argv[++i]);
+    } else if (std::strcmp(argv[i], "--node") == 0 && i + 1 < argc) {
+      node = argv[++i];
+    } else if (std::strcmp(argv[i], "--node-cli") == 0 && i + 1 < argc) {
+      nodeCli = argv[++i];
+    } else if (std::strcmp(argv[i], "--triples") == 0 && i + 1 < argc) {
+      triples = argv[++i];
+    } else {
+      scripts.emplace_back(argv[i]);
+    }
+  }
+
+  if (scripts.empty() || runs < 1) {
+    std::cout << "Usage: TripleS_compare [--runs n] [--node command] [--node-cli path] [--triples path]"
+                 " script..."
+              << std::endl;
+    return 64;
+  }
+
+  std::cout << std::left << std::setw(32) << "script " << std::setw(8) << "output" << std::right
+            << std::setw(10) << "node ms" << std::setw(10) << "c++ ms" << std::setw(9) << "speedup"
+            << std::setw(10) << "node MB" << std::setw(10) << "c++ MB" << std::setw(12) << "node instrs"
+            << std::setw(12) << "c++ instrs" << std::endl;
+
+  int exitCode = 0;
+  for (const std::string &script : scripts) {
+    Run nodeRun;
+    Run triplesRun;
+    if (!measure({node, nodeCli, "-p", script}, runs, &nodeRun)) {
+      std::cerr << "\"" << script << "\" did not run, or printed something different each time, on Node.js"
+                << " (is nodejs/ built?)." << std::endl;
+      exitCode = 70;
+      continue;
+    }
+    // Without its cache TripleS compiles the script on every run, as Node.js parses it on every run, and
+    // leaves no .sssc file next to it.
+    if (!measure({triples, "--no-cache", script}, runs, &triplesRun)) {
+      std::cerr << "\"" << script << "\" did not run, or printed something different each time, on TripleS."
+                << std::endl;
+      exitCode = 70;
+      continue;
+    }
+
+    const bool agree = nodeRun.output == triplesRun.output;
+    if (nodeRun.status != 0 || triplesRun.status != 0) {
+      std::cerr << "\"" << script << "\" exited with status " << nodeRun.status << " on Node.js and "
+                << triplesRun.status << " on TripleS." << std::endl;
+    }
+    const double speedup = nodeRun.seconds / triplesRun.seconds;
+    if ((!agree || speedup < 1) && exitCode == 0) exitCode = 1;
+
+    std::cout << std::left << std::setw(32) << script + " " << std::setw(8) << (agree ? "same" : "DIFFERS")
+              << std::right << std::fixed << std::setprecision(1) << std::setw(10) << nodeRun.seconds * 1000
+              << std::setw(10) << triplesRun.seconds * 1000 << std::setw(8) << speedup << "x" << std::setw(10)
+              << static_cast<double>(nodeRun.peakResident) / 1024 << std::setw(10)
+              << static_cast<double>(triplesRun.peakResident) / 1024 << std::setw(12)
+              << formatCount(nodeRun.instructions) << std::setw(12) << formatCount(triplesRun.instructions)
+              << std::endl;
+  }
+  return exitCode;
+}
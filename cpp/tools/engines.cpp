@@ -0,0 +1,135 @@
+// Compares the stack VM with the register engine on the same scripts.
+//
+// Usage: TripleS_engines [--runs n] [--count] script...
+//
+// Every script is compiled once and run on both engines with its output discarded. The best wall-clock time
+// of each engine over the runs is reported, or with --count the instructions each engine executed, counted by
+// a trace sink; traced runs are slower and never use the JIT, so they are not timed. Scripts to try are in
+// bench/.
+#include "../src/chunk.h"
+#include "../src/heap.h"
+#include "../src/module.h"
+#include "../src/trace.h"
+#include "../src/vm.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+typedef struct {
+  double seconds;
+  uint64_t instructions;
+} Measurement;
+
+class InstructionCounter : public TraceSink {
+public:
+  uint64_t count = 0;
+
+  void instruction(const Chunk &, unsigned int, const Value *, const Value *,
+                   const Array<CallFrame> &) override {
+    this->count++;
+  }
+  void registerInstruction(const Chunk &, const RegisterChunk &, size_t) override { this->count++; }
+};
+
+static bool runScript(const std::shared_ptr<const Module> &module, const Engine engine, const bool count,
+                      Measurement *measurement) {
+  // Keep the script's own output out of the report.
+  std::ostringstream discarded;
+  std::streambuf *output = std::cout.rdbuf(discarded.rdbuf());
+
+  Heap heap;
+  VM vm(module, heap);
+  InstructionCounter counter;
+  if (count) vm.setTrace(&counter);
+  const auto start = std::chrono::steady_clock::now();
+  const bool succeeded = vm.interpret(engine) == INTERPRET_OK;
+  measurement->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  measurement->instructions = counter.count;
+
+  std::cout.rdbuf(output);
+  return succeeded;
+}
+
+// The engines take turns, so neither always runs on the allocator state the other one left behind.
+static bool measure(const std::string &source, const int runs, const bool count, Measurement *stack,
+                    Measurement *registers) {
+  const std::shared_ptr<const Module> module = Module::compile(source);
+  if (module == nullptr) return false;
+
+  for (int run = 0; run < runs; run++) {
+    Measurement measurement;
+    if (!runScript(module, ENGINE_STACK, count, &measurement)) return false;
+    if (run == 0 || measurement.seconds < stack->seconds) *stack = measurement;
+    if (!runScript(module, ENGINE_REGISTER, count, &measurement)) return false;
+    if (run == 0 || measurement.seconds < registers->seconds) *registers = measurement;
+  }
+  return true;
+}
+
+int main(const int argc, const char *argv[]) {
+  int runs = 5;
+  bool count = false;
+  std::vector<std::string> scripts;
+  for (int i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+      runs = std::atoi(argv[++i]);
+    } else if (std::strcmp(argv[i], "--count") == 0) {
+      count = true;
+    } else {
+      scripts.emplace_back(argv[i]);
+    }
+  }
+
+  if (scripts.empty() || runs < 1) {
+    std::cout << "Usage: TripleS_engines [--runs n] [--count] script..." << std::endl;
+    return 64;
+  }
+
+  if (count) {
+    std::cout << std::left << std::setw(32) << "script" << std::right << std::setw(16) << "stack instrs"
+              << std::setw(16) << "register instrs" << std::setw(10) << "change" << std::endl;
+  } else {
+    std::cout << std::left << std::setw(32) << "script" << std::right << std::setw(14) << "stack ms"
+              << std::setw(14) << "register ms" << std::setw(10) << "change" << std::endl;
+  }
+
+  int exitCode = 0;
+  for (const std::string &script : scripts) {
+    std::ifstream file(script, std::ios::binary);
+    if (!file) {
+      std::cerr << "Could not open file \"" << script << "\"." << std::endl;
+      exitCode = 74;
+      continue;
+    }
+    std::stringstream source;
+    source << file.rdbuf();
+
+    Measurement stack;
+    Measurement registers;
+    if (!measure(source.str(), runs, count, &stack, &registers)) {
+      std::cerr << "\"" << script << "\" did not run to completion." << std::endl;
+      exitCode = 70;
+      continue;
+    }
+
+    double change;
+    if (count) {
+      change = 100.0 * (static_cast<double>(registers.instructions) / stack.instructions - 1);
+      std::cout << std::left << std::setw(32) << script << std::right << std::setw(16) << stack.instructions
+                << std::setw(16) << registers.instructions;
+    } else {
+      change = 100.0 * (registers.seconds / stack.seconds - 1);
+      std::cout << std::left << std::setw(32) << script << std::right << std::fixed << std::setprecision(1)
+                << std::setw(14) << stack.seconds * 1000 << std::setw(14) << registers.seconds * 1000;
+    }
+    std::cout << std::fixed << std::setprecision(1) << std::setw(9) << change << "%" << std::endl;
+  }
+  return exitCode;
+}
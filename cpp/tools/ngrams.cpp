@@ -0,0 +1,146 @@
+// Mines the opcode sequences scripts actually execute, to decide which superinstructions are worth adding.
+//
+// Usage: TripleS_ngrams [--length n] [--top count] script...
+//
+// Every script is compiled and run to completion with its output discarded. The most frequent executed
+// sequences of 2 to n opcodes are then listed with their share of all executed instructions. Sequences that
+// cross a jump are counted too, although they cannot be fused; check the compiled code before adding one.
+#include "../src/chunk.h"
+#include "../src/debug.h"
+#include "../src/heap.h"
+#include "../src/module.h"
+#include "../src/trace.h"
+#include "../src/vm.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+
+#define NGRAM_MAX_LENGTH 4
+
+class NgramCounter : public TraceSink {
+public:
+  explicit NgramCounter(const unsigned int maxLength) : maxLength(maxLength) {}
+
+  void instruction(const Chunk &chunk, const unsigned int offset, const Value *, const Value *,
+                   const Array<CallFrame> &) override {
+    this->record(chunk.at(offset));
+  }
+  void registerInstruction(const Chunk &, const RegisterChunk &registers, const size_t pc) override {
+    this->record(registers.code[pc].op);
+  }
+
+  void record(const uint8_t opcode) {
+    this->executed++;
+    std::memmove(this->history + 1, this->history, NGRAM_MAX_LENGTH - 1);
+    this->history[0] = opcode;
+    if (this->filled < NGRAM_MAX_LENGTH) this->filled++;
+
+    // Key: length in the top byte, then the opcodes, oldest first, in the low bytes.
+    for (unsigned int length = 2; length <= this->maxLength && length <= this->filled; length++) {
+      uint64_t key = static_cast<uint64_t>(length) << 56;
+      for (unsigned int i = 0; i < length; i++) {
+        key |= static_cast<uint64_t>(this->history[length - 1 - i]) << (8 * i);
+      }
+      this->counts[key]++;
+    }
+  }
+
+  // Sequences never continue from one script into the next.
+  void endScript() { this->filled = 0; }
+
+  void print(const size_t top) const {
+    for (unsigned int length = 2; length <= this->maxLength; length++) {
+      std::vector<std::pair<uint64_t, uint64_t>> ranked;
+      for (const auto &entry : this->counts) {
+        if (entry.first >> 56 == length) ranked.emplace_back(entry);
+      }
+      std::sort(ranked.begin(), ranked.end(),
+                [](const std::pair<uint64_t, uint64_t> &a, const std::pair<uint64_t, uint64_t> &b) {
+                  return a.second > b.second;
+                });
+
+      std::cout << "== " << length << "-grams ==" << std::endl;
+      for (size_t i = 0; i < ranked.size() && i < top; i++) {
+        const double share =
+            100.0 * static_cast<double>(ranked[i].second) / static_cast<double>(this->executed);
+        std::cout << std::setw(12) << ranked[i].second << std::setw(8) << std::fixed << std::setprecision(2)
+                  << share << "%  ";
+        for (unsigned int op = 0; op < length; op++) {
+          const char *name = opcodeName(static_cast<uint8_t>(ranked[i].first >> (8 * op)));
+          std::cout << (op > 0 ? ", " : "") << (name != nullptr ? name : "?");
+        }
+        std::cout << std::endl;
+      }
+    }
+    std::cout << executed << " instructions executed." << std::endl;
+  }
+
+private:
+  unsigned int maxLength;
+  uint8_t history[NGRAM_MAX_LENGTH] = {};
+  unsigned int filled = 0;
+  uint64_t executed = 0;
+  std::unordered_map<uint64_t, uint64_t> counts;
+};
+
+static bool runScript(const std::string &path, NgramCounter &counter) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    std::cerr << "Could not open file \"" << path << "\"." << std::endl;
+    return false;
+  }
+  std::stringstream source;
+  source << file.rdbuf();
+
+  const std::shared_ptr<const Module> module = Module::compile(source.str());
+  if (module == nullptr) return false;
+
+  // Keep the script's own output out of the report.
+  std::ostringstream discarded;
+  std::streambuf *output = std::cout.rdbuf(discarded.rdbuf());
+  Heap heap;
+  VM vm(module, heap);
+  vm.setTrace(&counter);
+  const InterpretResult result = vm.interpret();
+  std::cout.rdbuf(output);
+
+  counter.endScript();
+  return result == INTERPRET_OK;
+}
+
+int main(const int argc, const char *argv[]) {
+  unsigned int length = 3;
+  size_t top = 15;
+  std::vector<std::string> scripts;
+  for (int i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], "--length") == 0 && i + 1 < argc) {
+      length = static_cast<unsigned int>(std::atoi(argv[++i]));
+    } else if (std::strcmp(argv[i], "--top") == 0 && i + 1 < argc) {
+      top = static_cast<size_t>(std::atoi(argv[++i]));
+    } else {
+      scripts.emplace_back(argv[i]);
+    }
+  }
+
+  if (scripts.empty() || length < 2 || length > NGRAM_MAX_LENGTH) {
+    std::cout << "Usage: TripleS_ngrams [--length 2-" << NGRAM_MAX_LENGTH << "] [--top count] script..."
+              << std::endl;
+    return 64;
+  }
+
+  NgramCounter counter(length);
+  for (const std::string &script : scripts) {
+    if (!runScript(script, counter)) {
+      std::cerr << "\"" << script << "\" did not run to completion." << std::endl;
+    }
+  }
+  counter.print(top);
+  return 0;
+}